@@ -0,0 +1,431 @@
+#ifndef BLOOM_H
+#define BLOOM_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <learnopengl/gl_ext.h>
+#include <learnopengl/gl_state.h>
+#include <learnopengl/gpu_timer.h>
+#include <learnopengl/render_targets.h>
+#include <learnopengl/shader.h>
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <vector>
+
+namespace uniforms {
+constexpr Uniform<glm::vec2> sourceTexelSize("sourceTexelSize");
+constexpr Uniform<glm::vec4> prefilterCurve("prefilterCurve");
+constexpr Uniform<bool> prefilter("prefilter");
+constexpr Uniform<bool> horizontal("horizontal");
+constexpr Uniform<float> filterRadius("filterRadius");
+constexpr Uniform<int> blurTaps("blurTaps");
+constexpr Uniform<float> blurOffsets("blurOffsets");   // arrays of BlurKernel::MAX_TAPS
+constexpr Uniform<float> blurWeights("blurWeights");
+}
+
+// One side of a Gaussian cut off at radius texels, as the linear sampling taps of the blur passes: the center texel,
+// then each pair of neighbours merged into one bilinear fetch placed between them by their weights. The 2 * radius + 1
+// texels take 1 + 2 * ceil(radius / 2) fetches, 5 for the 9 texels at radius 4.
+struct BlurKernel {
+    static const int MAX_RADIUS = 16;
+    static const int MAX_TAPS = 1 + MAX_RADIUS / 2;   // as in blurrShader.fs and blur.comp
+
+    int taps = 0;   // taps[0] is the center, the others are taken on both sides
+    float offsets[MAX_TAPS] = {};
+    float weights[MAX_TAPS] = {};
+
+    static BlurKernel Gaussian(float sigma, int radius)
+    {
+        radius = std::max(1, std::min(radius, MAX_RADIUS));
+        sigma = std::max(sigma, 0.1f);
+        // radius + 2 so an odd radius pairs its last texel with a zero
+        float texels[MAX_RADIUS + 2] = {};
+        float sum = 0.0f;
+        for (int i = 0; i <= radius; i++)
+        {
+            texels[i] = std::exp(-0.5f * i * i / (sigma * sigma));
+            sum += i == 0 ? texels[i] : 2.0f * texels[i];
+        }
+        BlurKernel kernel;
+        kernel.offsets[0] = 0.0f;
+        kernel.weights[0] = texels[0] / sum;
+        kernel.taps = 1;
+        for (int i = 1; i <= radius; i += 2)
+        {
+            float weight = texels[i] + texels[i + 1];
+            kernel.offsets[kernel.taps] = (i * texels[i] + (i + 1) * texels[i + 1]) / weight;
+            kernel.weights[kernel.taps] = weight / sum;
+            kernel.taps++;
+        }
+        return kernel;
+    }
+
+    void upload(const Shader &shader) const
+    {
+        shader.set(uniforms::blurTaps, taps);
+        glUniform1fv(shader.location(uniforms::blurOffsets), taps, offsets);
+        glUniform1fv(shader.location(uniforms::blurWeights), taps, weights);
+    }
+};
+
+struct BloomSettings {
+    float threshold = 1.0f;   // scene brightness (max of r, g, b) where the bloom starts
+    float knee = 0.5f;        // how far below the threshold it fades in, as a fraction of the threshold
+    float radius = 1.0f;      // tent filter footprint of the upsample, in texels of the level it reads
+    float intensity = 0.3f;   // scale of the bloom added to the scene when tone mapping
+    // Method::Gaussian
+    float blurSigma = 2.0f;
+    int blurRadius = 4;       // texels on each side, up to BlurKernel::MAX_RADIUS
+    bool computeBlur = true;  // through blur.comp where compute shaders are available
+};
+
+// Two ways of blurring the bright parts of the scene, both in two steps: brightPass() takes what is above the
+// threshold out of the scene into a target of BrightTarget(), which the caller owns (a transient of the frame graph),
+// and blur() blurs that target in place. The tone mapping then adds the target to the scene.
+// Method::MipChain, progressive bloom through a chain of half resolution levels (level 0, the bright target, is half
+// the scene size):
+//   bright pass: scene -> 0, the 13 tap downsample filter (bloom_downsample.fs) applying the soft threshold
+//   downsample:  0 -> 1 -> ... -> n-1, the same filter
+//   upsample:    n-1 -> n-2 -> ... -> 0, each a 3x3 tent filter (bloom_upsample.fs) added onto the level above
+// Level 0 ends up holding the bloom of every level. All passes are full screen triangles over levels of a quarter the
+// pixels or less, and the blur grows with the number of levels rather than with taps, so a wider radius costs nothing
+// extra. Levels 1 and down are transient targets of the pool, taken and given back within blur().
+// Method::Gaussian, the original bloom: GAUSSIAN_PASSES alternating horizontal and vertical Gaussian blurs at the full
+// scene size over the thresholded scene, ping-ponging with a second target from the pool. The passes run as full
+// screen triangles (blurrShader.fs) or, given a compute program (blur.comp, GL 4.3), as work groups that share one
+// load of their texels; the GPU time of a pass is kept for each.
+// The targets are RGBA16F or, set with setFormat(), GL_R11F_G11F_B10F for half the bandwidth (hdr_formats.h).
+class Bloom
+{
+public:
+    enum class Method {
+        MipChain,
+        Gaussian
+    };
+    static const int MAX_LEVELS = 6;
+    static const int GAUSSIAN_PASSES = 10;
+
+    // the scene's color is a full scale target of the pool
+    Bloom(RenderTargetPool &targets, Shader &downsampleShader, Shader &upsampleShader, Shader &blurShader,
+          int levels = MAX_LEVELS)
+        : targets(targets), downsampleShader(downsampleShader), upsampleShader(upsampleShader), blurShader(blurShader),
+          maxLevels(std::min(levels, MAX_LEVELS))
+    {
+        GLint previousFramebuffer = 0;
+        glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previousFramebuffer);
+        glGenFramebuffers(1, &framebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        GLuint level = targets.acquire(LevelTarget(1));
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, level, 0);
+        complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+        targets.release(level);
+        glBindFramebuffer(GL_FRAMEBUFFER, previousFramebuffer);
+        if (!complete)
+            std::cout << "WARNING::BLOOM::mip chain framebuffer not complete, no bloom" << std::endl;
+
+        downsampleShader.use();
+        downsampleShader.setInt("source", 0);
+        upsampleShader.use();
+        upsampleShader.setInt("source", 0);
+        blurShader.use();
+        blurShader.setInt("image", 0);
+        glGenVertexArrays(1, &emptyVAO);
+        GLState().invalidate();
+    }
+
+    ~Bloom()
+    {
+        glDeleteFramebuffers(1, &framebuffer);
+        glDeleteVertexArrays(1, &emptyVAO);
+    }
+
+    // level n of the chain, 1 / 2^(n + 1) of the scene size; linear filtered, the filters place their taps between
+    // texels
+    static RenderTargetDesc LevelTarget(int level, GLenum format = GL_RGBA16F)
+    {
+        return RenderTargetDesc{ format, 1.0f / float(2 << level), GL_LINEAR };
+    }
+
+    static RenderTargetDesc GaussianTarget(GLenum format = GL_RGBA16F)
+    {
+        return RenderTargetDesc{ format, 1.0f, GL_LINEAR };
+    }
+
+    // what brightPass() writes and blur() blurs: level 0 of the chain, or a full size target for the Gaussian blur;
+    // sampled with the scene's texture coordinates
+    static RenderTargetDesc BrightTarget(Method method, GLenum format = GL_RGBA16F)
+    {
+        return method == Method::Gaussian ? GaussianTarget(format) : LevelTarget(0, format);
+    }
+
+    // GL_RGBA16F or GL_R11F_G11F_B10F, for the targets of the following passes
+    void setFormat(GLenum internalFormat)
+    {
+        targetFormat = internalFormat;
+    }
+
+    GLenum format() const
+    {
+        return targetFormat;
+    }
+
+    Bloom(const Bloom &) = delete;
+    Bloom &operator=(const Bloom &) = delete;
+
+    bool available() const
+    {
+        return complete;
+    }
+
+    // blur.comp writing RGBA16F and, with PACKED_FLOAT_TARGET defined, R11F_G11F_B10F images; null (or not linked) to
+    // keep the Gaussian blur of that format on the fragment path
+    void setComputeBlur(Shader *rgba16f, Shader *packedFloat)
+    {
+        Shader *shaders[2] = { rgba16f, packedFloat };
+        for (int i = 0; i < 2; i++)
+        {
+            GLint linked = GL_FALSE;
+            if (shaders[i])
+                glGetProgramiv(shaders[i]->ID, GL_LINK_STATUS, &linked);
+            computeBlurShaders[i] = linked ? shaders[i] : nullptr;
+            if (shaders[i] && !linked)
+                std::cout << "WARNING::BLOOM::compute blur not linked, blurring with the fragment shader" << std::endl;
+            if (computeBlurShaders[i])
+            {
+                computeBlurShaders[i]->use();
+                computeBlurShaders[i]->setInt("source", 0);
+            }
+        }
+        GLState().invalidate();
+    }
+
+    bool computeBlurAvailable() const
+    {
+        return computeBlurShader() != nullptr;
+    }
+
+    // GPU time of one Gaussian blur pass through the compute shader and through the fragment shader, each as of the
+    // last frames it ran
+    double computeBlurPassMs() const
+    {
+        return computePassTimer.milliseconds();
+    }
+
+    double fragmentBlurPassMs() const
+    {
+        return fragmentPassTimer.milliseconds();
+    }
+
+    // levels of the chain at the current size: down to a few texels, at most the constructor's count
+    int levels() const
+    {
+        int count = 0;
+        // nothing left to blur below a few texels
+        while (count < maxLevels && glm::all(glm::greaterThanEqual(targets.size(LevelTarget(count)), glm::ivec2(2))))
+            count++;
+        return count;
+    }
+
+    // the soft threshold of sceneTexture (full scale, linear filtered) into target, a target of BrightTarget(method).
+    // Like blur(), leaves framebuffer 0 bound with the viewport as it was.
+    void brightPass(GLuint sceneTexture, GLuint target, const BloomSettings &settings, Method method = Method::MipChain)
+    {
+        if (!complete)
+            return;
+        begin();
+        GLStateCache &state = GLState();
+        if (method == Method::Gaussian)
+        {
+            // a one tap kernel: only the threshold, blur() does all the blurring
+            BlurKernel threshold;
+            threshold.taps = 1;
+            threshold.weights[0] = 1.0f;
+            bool compute = settings.computeBlur && computeBlurShader();
+            Shader &shader = compute ? *computeBlurShader() : blurShader;
+            state.useProgram(shader.ID);
+            shader.set(uniforms::prefilterCurve, prefilterCurve(settings));
+            shader.set(uniforms::prefilter, true);
+            shader.set(uniforms::horizontal, true);
+            threshold.upload(shader);
+            state.bindTexture(0, sceneTexture);
+            if (compute)
+                dispatchBlur(target, true);
+            else
+                drawInto(target, sceneSize);
+        }
+        else
+        {
+            state.useProgram(downsampleShader.ID);
+            downsampleShader.set(uniforms::prefilterCurve, prefilterCurve(settings));
+            downsampleShader.set(uniforms::prefilter, true);
+            downsampleShader.set(uniforms::sourceTexelSize, 1.0f / glm::vec2(sceneSize));
+            state.bindTexture(0, sceneTexture);
+            drawInto(target, targets.size(LevelTarget(0)));
+        }
+        end();
+    }
+
+    // blurs target, written by brightPass() with the same method, in place
+    void blur(GLuint target, const BloomSettings &settings, Method method = Method::MipChain)
+    {
+        if (!complete)
+            return;
+        begin();
+        if (method == Method::Gaussian)
+            gaussian(target, settings);
+        else
+            mipChain(target, settings);
+        end();
+    }
+
+private:
+    RenderTargetPool &targets;
+    Shader &downsampleShader, &upsampleShader, &blurShader;
+    int maxLevels;
+    GLenum targetFormat = GL_RGBA16F;
+    glm::ivec2 sceneSize;
+    GLint savedViewport[4] = {};
+    // targets of the running blur()
+    std::vector<glm::ivec2> levelSizes;
+    std::vector<GLuint> levelTextures;
+    GLuint gaussianTextures[2] = {};
+    Shader *computeBlurShaders[2] = {};   // by image format: RGBA16F, R11F_G11F_B10F
+    GpuPassTimer computePassTimer, fragmentPassTimer;
+    BlurKernel kernel;
+    float kernelSigma = 0.0f;
+    int kernelRadius = 0;
+    GLuint framebuffer = 0;
+    GLuint emptyVAO = 0;   // the passes generate their triangle from gl_VertexID
+    bool complete = false;
+
+    Shader *computeBlurShader() const
+    {
+        return computeBlurShaders[targetFormat == GL_R11F_G11F_B10F];
+    }
+
+    // the soft knee of the threshold as a quadratic curve, see bloom_downsample.fs
+    static glm::vec4 prefilterCurve(const BloomSettings &settings)
+    {
+        float knee = std::max(settings.threshold * settings.knee, 1e-4f);
+        return glm::vec4(settings.threshold, settings.threshold - knee, 2.0f * knee, 0.25f / knee);
+    }
+
+    void begin()
+    {
+        sceneSize = targets.size(GaussianTarget());
+        glGetIntegerv(GL_VIEWPORT, savedViewport);
+        // the tone mapping and the UI of the last frame bound their programs and textures directly
+        GLStateCache &state = GLState();
+        state.invalidate();
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glDisable(GL_DEPTH_TEST);
+        state.bindVertexArray(emptyVAO);
+        state.setBlend(false);
+        state.setCullFace(false);
+    }
+
+    void end()
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glViewport(savedViewport[0], savedViewport[1], savedViewport[2], savedViewport[3]);
+        glEnable(GL_DEPTH_TEST);
+    }
+
+    // level 0 is the bright target
+    void mipChain(GLuint brightTexture, const BloomSettings &settings)
+    {
+        levelSizes.clear();
+        levelTextures.clear();
+        int count = levels();
+        for (int level = 0; level < count; level++)
+        {
+            levelSizes.push_back(targets.size(LevelTarget(level)));
+            levelTextures.push_back(level == 0 ? brightTexture : targets.acquire(LevelTarget(level, targetFormat)));
+        }
+        if (levelTextures.size() < 2)
+            return;
+        GLStateCache &state = GLState();
+        state.useProgram(downsampleShader.ID);
+        downsampleShader.set(uniforms::prefilter, false);
+        for (size_t level = 1; level < levelTextures.size(); level++)
+        {
+            state.bindTexture(0, levelTextures[level - 1]);
+            downsampleShader.set(uniforms::sourceTexelSize, 1.0f / glm::vec2(levelSizes[level - 1]));
+            drawInto(levelTextures[level], levelSizes[level]);
+        }
+
+        // every level gets the (already accumulated) level below added on top
+        state.useProgram(upsampleShader.ID);
+        upsampleShader.set(uniforms::filterRadius, settings.radius);
+        state.setBlend(true);
+        glBlendFunc(GL_ONE, GL_ONE);
+        for (size_t level = levelTextures.size() - 1; level > 0; level--)
+        {
+            state.bindTexture(0, levelTextures[level]);
+            upsampleShader.set(uniforms::sourceTexelSize, 1.0f / glm::vec2(levelSizes[level]));
+            drawInto(levelTextures[level - 1], levelSizes[level - 1]);
+        }
+        // back to the blend function the scene's transparent passes expect
+        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        state.setBlend(false);
+        for (size_t level = 1; level < levelTextures.size(); level++)
+            targets.release(levelTextures[level]);
+    }
+
+    // an even number of passes, so the last one writes back into the bright target
+    void gaussian(GLuint brightTexture, const BloomSettings &settings)
+    {
+        gaussianTextures[0] = brightTexture;
+        gaussianTextures[1] = targets.acquire(GaussianTarget(targetFormat));
+        if (settings.blurSigma != kernelSigma || settings.blurRadius != kernelRadius)
+        {
+            kernel = BlurKernel::Gaussian(settings.blurSigma, settings.blurRadius);
+            kernelSigma = settings.blurSigma;
+            kernelRadius = settings.blurRadius;
+        }
+        bool compute = settings.computeBlur && computeBlurShader();
+        Shader &shader = compute ? *computeBlurShader() : blurShader;
+        GpuPassTimer &timer = compute ? computePassTimer : fragmentPassTimer;
+        GLStateCache &state = GLState();
+        state.useProgram(shader.ID);
+        shader.set(uniforms::prefilter, false);
+        kernel.upload(shader);
+        timer.begin();
+        bool horizontal = true;
+        for (int pass = 0; pass < GAUSSIAN_PASSES; pass++)
+        {
+            state.bindTexture(0, gaussianTextures[!horizontal]);
+            shader.set(uniforms::horizontal, horizontal);
+            if (compute)
+                dispatchBlur(gaussianTextures[horizontal], horizontal);
+            else
+                drawInto(gaussianTextures[horizontal], sceneSize);
+            horizontal = !horizontal;
+        }
+        timer.end(GAUSSIAN_PASSES);
+        targets.release(gaussianTextures[1]);
+    }
+
+    // a work group per TILE_SIZE texels of a row (column), as blur.comp is laid out
+    void dispatchBlur(GLuint target, bool horizontal)
+    {
+        const int TILE_SIZE = 128;
+        GLExtFunctions &ext = GLExt();
+        ext.BindImageTexture(0, target, 0, GL_FALSE, 0, GL_WRITE_ONLY, targetFormat);
+        int along = horizontal ? sceneSize.x : sceneSize.y, lines = horizontal ? sceneSize.y : sceneSize.x;
+        ext.DispatchCompute((GLuint)((along + TILE_SIZE - 1) / TILE_SIZE), (GLuint)lines, 1);
+        // the next pass and the tone mapping sample what this one wrote
+        ext.MemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+    }
+
+    void drawInto(GLuint texture, glm::ivec2 size)
+    {
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, 0);
+        glViewport(0, 0, size.x, size.y);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+    }
+};
+#endif
@@ -0,0 +1,512 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include <glm/glm.hpp>
+
+#include <learnopengl/frustum_culling.h>
+
+#include <algorithm>
+#include <cfloat>
+#include <cstdint>
+#include <vector>
+
+// axis aligned box, empty (min > max) by default
+struct Aabb {
+    glm::vec3 min = glm::vec3(FLT_MAX);
+    glm::vec3 max = glm::vec3(-FLT_MAX);
+
+    Aabb() {}
+    Aabb(const glm::vec3 &minimum, const glm::vec3 &maximum) : min(minimum), max(maximum) {}
+
+    // the box around (minimum, maximum) moved by transform
+    static Aabb Transformed(const glm::vec3 &minimum, const glm::vec3 &maximum, const glm::mat4 &transform)
+    {
+        glm::vec3 center = glm::vec3(transform * glm::vec4((minimum + maximum) * 0.5f, 1.0f));
+        glm::vec3 extent = (maximum - minimum) * 0.5f;
+        glm::vec3 worldExtent(0.0f);
+        for (int column = 0; column < 3; column++)
+            worldExtent += glm::abs(glm::vec3(transform[column])) * extent[column];
+        return Aabb(center - worldExtent, center + worldExtent);
+    }
+
+    void grow(const Aabb &box)
+    {
+        min = glm::min(min, box.min);
+        max = glm::max(max, box.max);
+    }
+
+    void grow(const glm::vec3 &point)
+    {
+        min = glm::min(min, point);
+        max = glm::max(max, point);
+    }
+
+    glm::vec3 center() const
+    {
+        return (min + max) * 0.5f;
+    }
+
+    // half the surface area, all the SAH needs
+    float halfArea() const
+    {
+        glm::vec3 size = glm::max(max - min, glm::vec3(0.0f));
+        return size.x * size.y + size.y * size.z + size.z * size.x;
+    }
+
+    bool overlaps(const Aabb &box) const
+    {
+        return glm::all(glm::lessThanEqual(min, box.max)) && glm::all(glm::lessThanEqual(box.min, max));
+    }
+
+    bool operator==(const Aabb &box) const
+    {
+        return min == box.min && max == box.max;
+    }
+};
+
+// Bounding volume hierarchy over the boxes of scene objects, for culling and spatial queries in logarithmic time.
+// Objects are inserted with a value of the caller's choosing (usually an index into its own object list) that the
+// queries report back. The tree is built top-down with the binned surface area heuristic; objects that move are
+// refitted in place (update()), which keeps the queries correct but slowly loosens the tree, so maintain() rebuilds it
+// once its SAH cost has grown by a third, and whenever objects were added or removed.
+class Bvh
+{
+public:
+    // nearest box hit by a ray
+    struct RayHit {
+        uint32_t value;
+        float distance;
+    };
+
+    // boxes visited by the last query, for statistics
+    unsigned int nodesVisited = 0;
+
+    // returns the object's handle for update() and remove()
+    uint32_t insert(const Aabb &box, uint32_t value)
+    {
+        Object object = { box, value, true };
+        uint32_t handle;
+        if (!freeHandles.empty())
+        {
+            handle = freeHandles.back();
+            freeHandles.pop_back();
+            objects[handle] = object;
+        }
+        else
+        {
+            handle = (uint32_t)objects.size();
+            objects.push_back(object);
+        }
+        dirty = true;
+        return handle;
+    }
+
+    void remove(uint32_t handle)
+    {
+        objects[handle].alive = false;
+        freeHandles.push_back(handle);
+        dirty = true;
+    }
+
+    // moves an object: its leaf and the nodes above it are refitted
+    void update(uint32_t handle, const Aabb &box)
+    {
+        if (objects[handle].box == box)
+            return;
+        objects[handle].box = box;
+        if (dirty)
+            return;
+        uint32_t node = objectLeaf[handle];
+        Aabb leafBox;
+        for (uint32_t i = 0; i < nodes[node].count; i++)
+            leafBox.grow(objects[order[nodes[node].first + i]].box);
+        nodes[node].box = leafBox;
+        while (node != 0)
+        {
+            node = nodes[node].parent;
+            Aabb box = nodes[nodes[node].first].box;
+            box.grow(nodes[nodes[node].first + 1].box);
+            if (nodes[node].box == box)
+                break;
+            nodes[node].box = box;
+        }
+        refitted = true;
+    }
+
+    // rebuilds the tree if objects were added or removed, or if refitting made it too loose. Call before querying.
+    void maintain()
+    {
+        if (dirty || (refitted && cost() > builtCost * 1.33f))
+            build();
+        refitted = false;
+    }
+
+    size_t size() const
+    {
+        return objects.size() - freeHandles.size();
+    }
+
+    // the objects whose box intersects the frustum
+    void queryFrustum(const Frustum &frustum, std::vector<uint32_t> &result)
+    {
+        nodesVisited = 0;
+        if (nodes.empty())
+            return;
+        // every entry remembers the planes its box still straddles; a box inside all of them takes its subtree along untested
+        struct Entry {
+            uint32_t node;
+            uint32_t planes;
+        } stack[STACK_SIZE];
+        int top = 0;
+        stack[top++] = { 0, 0x3F };
+        while (top > 0)
+        {
+            Entry entry = stack[--top];
+            const Node &node = nodes[entry.node];
+            nodesVisited++;
+            uint32_t planes = entry.planes;
+            bool outside = false;
+            for (int i = 0; i < 6 && !outside; i++)
+            {
+                if (!(planes & (1u << i)))
+                    continue;
+                const glm::vec4 &plane = frustum.planes[i];
+                glm::vec3 center = node.box.center(), extent = (node.box.max - node.box.min) * 0.5f;
+                float distance = glm::dot(glm::vec3(plane), center) + plane.w;
+                float radius = glm::dot(glm::abs(glm::vec3(plane)), extent);
+                if (distance + radius < 0.0f)
+                    outside = true;
+                else if (distance - radius >= 0.0f)
+                    planes &= ~(1u << i);
+            }
+            if (outside)
+                continue;
+            if (planes == 0)
+                collect(entry.node, result);
+            else if (node.count > 0)
+            {
+                for (uint32_t i = 0; i < node.count; i++)
+                {
+                    const Object &object = objects[order[node.first + i]];
+                    if (intersects(frustum, planes, object.box))
+                        result.push_back(object.value);
+                }
+            }
+            else
+            {
+                stack[top++] = { node.first, planes };
+                stack[top++] = { node.first + 1, planes };
+            }
+        }
+    }
+
+    // the objects whose box overlaps box
+    void queryAabb(const Aabb &box, std::vector<uint32_t> &result)
+    {
+        traverse([&box](const Aabb &nodeBox) { return box.overlaps(nodeBox); }, result);
+    }
+
+    // the objects whose box comes within radius of center
+    void querySphere(const glm::vec3 &center, float radius, std::vector<uint32_t> &result)
+    {
+        traverse([&center, radius](const Aabb &nodeBox) {
+                     glm::vec3 closest = glm::clamp(center, nodeBox.min, nodeBox.max);
+                     glm::vec3 offset = closest - center;
+                     return glm::dot(offset, offset) <= radius * radius;
+                 }, result);
+    }
+
+    // the nearest object box hit by the ray within maxDistance (direction doesn't have to be normalized, distances
+    // are in units of its length)
+    bool raycast(const glm::vec3 &origin, const glm::vec3 &direction, float maxDistance, RayHit &hit)
+    {
+        nodesVisited = 0;
+        if (nodes.empty())
+            return false;
+        glm::vec3 inverse = 1.0f / direction;
+        float nearest = maxDistance;
+        bool found = false;
+        uint32_t stack[STACK_SIZE];
+        int top = 0;
+        stack[top++] = 0;
+        while (top > 0)
+        {
+            const Node &node = nodes[stack[--top]];
+            nodesVisited++;
+            float entry;
+            if (!rayHits(origin, inverse, node.box, nearest, entry))
+                continue;
+            if (node.count > 0)
+            {
+                for (uint32_t i = 0; i < node.count; i++)
+                {
+                    const Object &object = objects[order[node.first + i]];
+                    if (rayHits(origin, inverse, object.box, nearest, entry))
+                    {
+                        nearest = entry;
+                        hit.value = object.value;
+                        hit.distance = entry;
+                        found = true;
+                    }
+                }
+                continue;
+            }
+            // the nearer child goes on top so it is searched first and shortens the ray for the other
+            float leftEntry, rightEntry;
+            bool left = rayHits(origin, inverse, nodes[node.first].box, nearest, leftEntry);
+            bool right = rayHits(origin, inverse, nodes[node.first + 1].box, nearest, rightEntry);
+            if (left && right)
+            {
+                bool leftFirst = leftEntry <= rightEntry;
+                stack[top++] = leftFirst ? node.first + 1 : node.first;
+                stack[top++] = leftFirst ? node.first : node.first + 1;
+            }
+            else if (left)
+                stack[top++] = node.first;
+            else if (right)
+                stack[top++] = node.first + 1;
+        }
+        return found;
+    }
+
+private:
+    // interior nodes have count 0 and their two children at first and first + 1,
+    // leaves hold count objects starting at order[first]
+    struct Node {
+        Aabb box;
+        uint32_t first;
+        uint32_t count;
+        uint32_t parent;
+    };
+
+    struct Object {
+        Aabb box;
+        uint32_t value;
+        bool alive;
+    };
+
+    static const int STACK_SIZE = 64;
+    static const uint32_t MAX_LEAF_OBJECTS = 4;
+    static const int BINS = 16;
+
+    std::vector<Object> objects;
+    std::vector<uint32_t> freeHandles;
+    std::vector<uint32_t> order;      // object handles, leaves reference ranges of it
+    std::vector<uint32_t> objectLeaf; // leaf of every object, for refitting
+    std::vector<Node> nodes;
+    bool dirty = false;
+    bool refitted = false;
+    float builtCost = 0.0f;
+
+    void build()
+    {
+        order.clear();
+        for (uint32_t i = 0; i < objects.size(); i++)
+            if (objects[i].alive)
+                order.push_back(i);
+        nodes.clear();
+        objectLeaf.assign(objects.size(), 0);
+        dirty = false;
+        if (order.empty())
+            return;
+        nodes.reserve(2 * order.size());
+        Node root;
+        root.first = 0;
+        root.count = (uint32_t)order.size();
+        root.parent = 0;
+        nodes.push_back(root);
+        uint32_t stack[STACK_SIZE];
+        int top = 0;
+        stack[top++] = 0;
+        while (top > 0)
+        {
+            uint32_t index = stack[--top];
+            Aabb box, centroids;
+            for (uint32_t i = 0; i < nodes[index].count; i++)
+            {
+                const Aabb &objectBox = objects[order[nodes[index].first + i]].box;
+                box.grow(objectBox);
+                centroids.grow(objectBox.center());
+            }
+            nodes[index].box = box;
+            uint32_t split;
+            if (top + 2 > STACK_SIZE || !findSplit(nodes[index], centroids, split))
+            {
+                for (uint32_t i = 0; i < nodes[index].count; i++)
+                    objectLeaf[order[nodes[index].first + i]] = index;
+                continue;
+            }
+            Node left, right;
+            left.first = nodes[index].first;
+            left.count = split - nodes[index].first;
+            right.first = split;
+            right.count = nodes[index].count - left.count;
+            left.parent = right.parent = index;
+            uint32_t children = (uint32_t)nodes.size();
+            nodes.push_back(left);
+            nodes.push_back(right);
+            nodes[index].first = children;
+            nodes[index].count = 0;
+            stack[top++] = children;
+            stack[top++] = children + 1;
+        }
+        builtCost = cost();
+    }
+
+    // partitions the node's objects at the cheapest of the binned candidate planes on its longest centroid axis,
+    // false if keeping them in one leaf is cheaper
+    bool findSplit(const Node &node, const Aabb &centroids, uint32_t &split)
+    {
+        if (node.count <= MAX_LEAF_OBJECTS)
+            return false;
+        glm::vec3 size = centroids.max - centroids.min;
+        int axis = size.x > size.y ? (size.x > size.z ? 0 : 2) : (size.y > size.z ? 1 : 2);
+        if (size[axis] <= 0.0f)
+            return false;
+
+        struct Bin {
+            Aabb box;
+            uint32_t count = 0;
+        } bins[BINS];
+        float scale = BINS / size[axis];
+        auto binOf = [&](const Object &object) {
+            return std::min(BINS - 1, (int)((object.box.center()[axis] - centroids.min[axis]) * scale));
+        };
+        for (uint32_t i = 0; i < node.count; i++)
+        {
+            const Object &object = objects[order[node.first + i]];
+            Bin &bin = bins[binOf(object)];
+            bin.box.grow(object.box);
+            bin.count++;
+        }
+        // cost of splitting after every bin: areas and counts swept from both sides
+        float rightArea[BINS];
+        uint32_t rightCount[BINS];
+        Aabb sweep;
+        uint32_t count = 0;
+        for (int i = BINS - 1; i > 0; i--)
+        {
+            sweep.grow(bins[i].box);
+            count += bins[i].count;
+            rightArea[i] = sweep.halfArea();
+            rightCount[i] = count;
+        }
+        sweep = Aabb();
+        count = 0;
+        float bestCost = FLT_MAX;
+        int bestBin = -1;
+        for (int i = 0; i < BINS - 1; i++)
+        {
+            sweep.grow(bins[i].box);
+            count += bins[i].count;
+            if (count == 0 || rightCount[i + 1] == 0)
+                continue;
+            float splitCost = sweep.halfArea() * count + rightArea[i + 1] * rightCount[i + 1];
+            if (splitCost < bestCost)
+            {
+                bestCost = splitCost;
+                bestBin = i;
+            }
+        }
+        // a leaf costs one box test per object, an interior node one traversal step plus its children
+        if (bestBin < 0 || bestCost >= node.box.halfArea() * (node.count - 1.0f))
+            return false;
+        uint32_t *begin = order.data() + node.first;
+        uint32_t *middle = std::partition(begin, begin + node.count,
+                                          [&](uint32_t handle) { return binOf(objects[handle]) <= bestBin; });
+        split = node.first + (uint32_t)(middle - begin);
+        return true;
+    }
+
+    // SAH cost of the tree relative to its root
+    float cost() const
+    {
+        if (nodes.empty())
+            return 0.0f;
+        float total = 0.0f;
+        for (const Node &node : nodes)
+            total += node.box.halfArea() * (node.count > 0 ? node.count : 1.0f);
+        return total / std::max(nodes[0].box.halfArea(), FLT_MIN);
+    }
+
+    void collect(uint32_t index, std::vector<uint32_t> &result)
+    {
+        uint32_t stack[STACK_SIZE];
+        int top = 0;
+        stack[top++] = index;
+        while (top > 0)
+        {
+            const Node &node = nodes[stack[--top]];
+            if (node.count > 0)
+            {
+                for (uint32_t i = 0; i < node.count; i++)
+                    result.push_back(objects[order[node.first + i]].value);
+            }
+            else
+            {
+                stack[top++] = node.first;
+                stack[top++] = node.first + 1;
+            }
+        }
+    }
+
+    template <typename Test>
+    void traverse(const Test &test, std::vector<uint32_t> &result)
+    {
+        nodesVisited = 0;
+        if (nodes.empty())
+            return;
+        uint32_t stack[STACK_SIZE];
+        int top = 0;
+        stack[top++] = 0;
+        while (top > 0)
+        {
+            const Node &node = nodes[stack[--top]];
+            nodesVisited++;
+            if (!test(node.box))
+                continue;
+            if (node.count > 0)
+            {
+                for (uint32_t i = 0; i < node.count; i++)
+                {
+                    const Object &object = objects[order[node.first + i]];
+                    if (test(object.box))
+                        result.push_back(object.value);
+                }
+            }
+            else
+            {
+                stack[top++] = node.first;
+                stack[top++] = node.first + 1;
+            }
+        }
+    }
+
+    static bool intersects(const Frustum &frustum, uint32_t planes, const Aabb &box)
+    {
+        glm::vec3 center = box.center(), extent = (box.max - box.min) * 0.5f;
+        for (int i = 0; i < 6; i++)
+        {
+            if (!(planes & (1u << i)))
+                continue;
+            const glm::vec4 &plane = frustum.planes[i];
+            if (glm::dot(glm::vec3(plane), center) + plane.w + glm::dot(glm::abs(glm::vec3(plane)), extent) < 0.0f)
+                return false;
+        }
+        return true;
+    }
+
+    // slab test, entry is where the ray enters the box (0 if it starts inside)
+    static bool rayHits(const glm::vec3 &origin, const glm::vec3 &inverseDirection, const Aabb &box, float maxDistance,
+                        float &entry)
+    {
+        glm::vec3 t0 = (box.min - origin) * inverseDirection;
+        glm::vec3 t1 = (box.max - origin) * inverseDirection;
+        glm::vec3 nearest = glm::min(t0, t1), farthest = glm::max(t0, t1);
+        float enter = std::max(std::max(nearest.x, nearest.y), std::max(nearest.z, 0.0f));
+        float exit = std::min(std::min(farthest.x, farthest.y), std::min(farthest.z, maxDistance));
+        entry = enter;
+        return enter <= exit;
+    }
+};
+#endif
@@ -0,0 +1,419 @@
+#ifndef CLUSTERED_LIGHTING_H
+#define CLUSTERED_LIGHTING_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <learnopengl/gl_state.h>
+#include <learnopengl/thread_pool.h>
+#include <learnopengl/uniform_blocks.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <future>
+#include <limits>
+#include <vector>
+
+// sphere tests run 8 lights at a time with AVX, 4 with SSE and one at a time elsewhere (as in frustum_culling.h)
+#if defined(__AVX__)
+#include <immintrin.h>
+#define CLUSTERED_LIGHTING_AVX
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define CLUSTERED_LIGHTING_SSE
+#endif
+
+// One point light as the shaders fetch it: four RGBA32F texels of the light buffer texture.
+//
+//   struct PointLight {
+//       vec3 position; float range;
+//       vec3 ambient;  float constant;
+//       vec3 diffuse;  float linear;
+//       vec3 specular; float quadratic;
+//   };
+struct PointLightData {
+    glm::vec3 position;
+    float range;
+    glm::vec3 ambient;
+    float constant;
+    glm::vec3 diffuse;
+    float linear;
+    glm::vec3 specular;
+    float quadratic;
+};
+static_assert(sizeof(PointLightData) == 64, "a light is four vec4 texels");
+
+// distance at which the light's brightest channel has fallen below cutoff (infinity when it doesn't fall off)
+inline float PointLightRange(const PointLightData &light, float cutoff = 1.0f / 64.0f)
+{
+    float brightest = glm::max(glm::max(light.diffuse.r, light.diffuse.g), glm::max(light.diffuse.b, light.specular.r));
+    brightest = glm::max(brightest, glm::max(light.specular.g, light.specular.b));
+    brightest = glm::max(brightest, glm::max(glm::max(light.ambient.r, light.ambient.g), light.ambient.b));
+    // solve quadratic * d^2 + linear * d + constant = brightest / cutoff
+    float c = light.constant - brightest / cutoff;
+    if (c >= 0.0f)
+        return 0.0f;
+    if (light.quadratic > 0.0f)
+        return (-light.linear + std::sqrt(light.linear * light.linear - 4.0f * light.quadratic * c)) / (2.0f * light.quadratic);
+    if (light.linear > 0.0f)
+        return -c / light.linear;
+    return std::numeric_limits<float>::infinity();
+}
+
+// lights and cluster references of the last update, shown in the settings window
+struct ClusterStats {
+    unsigned int lights = 0;
+    unsigned int references = 0;     // light indices over all clusters
+    unsigned int maxPerCluster = 0;
+    double cpuMs = 0.0;
+};
+
+// Clustered forward shading. The view frustum is cut into CLUSTERS_X x CLUSTERS_Y screen tiles and CLUSTERS_Z depth
+// slices (the first one up to CLUSTER_NEAR, the others exponentially spaced from there to the far plane), and every
+// frame each cluster gets the list of lights whose sphere of influence touches it. The slices are assigned in parallel
+// on the thread pool, narrowing the lights down per slice, per row of tiles and then per cluster. The shaders find a
+// fragment's cluster from its clip position and only loop over that cluster's lights:
+//
+//   uniform samplerBuffer pointLightData;   // LIGHT_UNIT, four texels per light
+//   uniform usamplerBuffer lightClusters;   // CLUSTER_UNIT, (first index, count) of cluster x + X * (y + Y * z)
+//   uniform usamplerBuffer lightIndices;    // INDEX_UNIT
+//
+// with the grid size and slice mapping in the LightData block (uniform_blocks.h).
+class LightClusters
+{
+public:
+    static const int CLUSTERS_X = 16, CLUSTERS_Y = 9, CLUSTERS_Z = 24;
+    static const int CLUSTER_COUNT = CLUSTERS_X * CLUSTERS_Y * CLUSTERS_Z;
+    // above the material texture units (MaterialTextureUnit)
+    static const GLuint LIGHT_UNIT = 16, CLUSTER_UNIT = 17, INDEX_UNIT = 18;
+
+    explicit LightClusters(ThreadPool &pool) : pool(pool)
+    {
+        slices.resize(CLUSTERS_Z);
+        createTexture(lightBuffer, lightTexture, GL_RGBA32F, LIGHT_UNIT);
+        createTexture(clusterBuffer, clusterTexture, GL_RG32UI, CLUSTER_UNIT);
+        createTexture(indexBuffer, indexTexture, GL_R32UI, INDEX_UNIT);
+        glActiveTexture(GL_TEXTURE0);
+        GLState().invalidate();
+    }
+
+    ~LightClusters()
+    {
+        // update() collects its slice tasks, but none may run on a destroyed object should one be left behind
+        for (std::future<void> &task : pendingSlices)
+            if (task.valid())
+                task.wait();
+        GLuint textures[] = { lightTexture, clusterTexture, indexTexture };
+        GLuint buffers[] = { lightBuffer, clusterBuffer, indexBuffer };
+        glDeleteTextures(3, textures);
+        glDeleteBuffers(3, buffers);
+    }
+
+    LightClusters(const LightClusters &) = delete;
+    LightClusters &operator=(const LightClusters &) = delete;
+
+    // the projection the clusters follow (as passed to glm::perspective); the cluster boxes are rebuilt when it changes
+    void setProjection(float fovY, float aspect, float nearPlane, float farPlane)
+    {
+        if (fovY == projection[0] && aspect == projection[1] && nearPlane == projection[2] && farPlane == projection[3])
+            return;
+        projection[0] = fovY;
+        projection[1] = aspect;
+        projection[2] = nearPlane;
+        projection[3] = farPlane;
+        float clusterNear = std::min((float)CLUSTER_NEAR, farPlane * 0.5f);
+        sliceScale = (CLUSTERS_Z - 1) / std::log(farPlane / clusterNear);
+        sliceBias = std::log(clusterNear) * sliceScale;
+
+        // view space boxes around the clusters (the camera looks down -z)
+        float tanY = std::tan(fovY * 0.5f), tanX = tanY * aspect;
+        for (int z = 0; z < CLUSTERS_Z; z++)
+        {
+            float depthNear = z == 0 ? nearPlane : clusterNear * std::pow(farPlane / clusterNear, (z - 1) / float(CLUSTERS_Z - 1));
+            float depthFar = clusterNear * std::pow(farPlane / clusterNear, z / float(CLUSTERS_Z - 1));
+            Slice &slice = slices[z];
+            slice.bounds = Box::Empty();
+            for (int y = 0; y < CLUSTERS_Y; y++)
+            {
+                Box &row = slice.rows[y];
+                row = Box::Empty();
+                for (int x = 0; x < CLUSTERS_X; x++)
+                {
+                    glm::vec2 ndcMin(-1.0f + 2.0f * x / CLUSTERS_X, -1.0f + 2.0f * y / CLUSTERS_Y);
+                    glm::vec2 ndcMax(-1.0f + 2.0f * (x + 1) / CLUSTERS_X, -1.0f + 2.0f * (y + 1) / CLUSTERS_Y);
+                    Box &cluster = slice.clusters[y * CLUSTERS_X + x];
+                    cluster = Box::Empty();
+                    for (float depth : { depthNear, depthFar })
+                        for (const glm::vec2 &ndc : { ndcMin, ndcMax })
+                        {
+                            glm::vec3 corner(ndc.x * tanX * depth, ndc.y * tanY * depth, -depth);
+                            cluster.min = glm::min(cluster.min, corner);
+                            cluster.max = glm::max(cluster.max, corner);
+                        }
+                    row.min = glm::min(row.min, cluster.min);
+                    row.max = glm::max(row.max, cluster.max);
+                }
+                slice.bounds.min = glm::min(slice.bounds.min, row.min);
+                slice.bounds.max = glm::max(slice.bounds.max, row.max);
+            }
+        }
+    }
+
+    // assigns the lights (world space, range filled in) to the clusters as seen through view and uploads the result
+    void update(const std::vector<PointLightData> &lights, const glm::mat4 &view)
+    {
+        auto start = std::chrono::steady_clock::now();
+        viewLights.clear();
+        for (size_t i = 0; i < lights.size(); i++)
+        {
+            glm::vec3 position = glm::vec3(view * glm::vec4(lights[i].position, 1.0f));
+            viewLights.push(position, lights[i].range, (uint32_t)i);
+        }
+
+        // slices are independent, so each is a task; a handful of lights isn't worth the hand-off
+        if (lights.size() >= PARALLEL_LIGHTS && pool.size() > 1)
+        {
+            std::vector<std::future<void>> &tasks = pendingSlices;
+            tasks.clear();
+            for (int z = 0; z < CLUSTERS_Z; z++)
+                tasks.push_back(pool.submit([this, z]() { assignSlice(slices[z]); }));
+            for (std::future<void> &task : tasks)
+                task.get();
+        }
+        else
+        {
+            for (Slice &slice : slices)
+                assignSlice(slice);
+        }
+
+        // the slices' index lists one after another
+        clusterData.resize(CLUSTER_COUNT * 2);
+        indices.clear();
+        stats.maxPerCluster = 0;
+        for (int z = 0; z < CLUSTERS_Z; z++)
+        {
+            const Slice &slice = slices[z];
+            uint32_t base = (uint32_t)indices.size();
+            indices.insert(indices.end(), slice.indices.begin(), slice.indices.end());
+            for (int cluster = 0; cluster < CLUSTERS_X * CLUSTERS_Y; cluster++)
+            {
+                size_t i = (size_t)z * CLUSTERS_X * CLUSTERS_Y + cluster;
+                clusterData[i * 2] = base + slice.first[cluster];
+                clusterData[i * 2 + 1] = slice.count[cluster];
+                stats.maxPerCluster = glm::max(stats.maxPerCluster, slice.count[cluster]);
+            }
+        }
+        stats.lights = (unsigned int)lights.size();
+        stats.references = (unsigned int)indices.size();
+
+        upload(lightBuffer, lights.data(), lights.size() * sizeof(PointLightData));
+        upload(clusterBuffer, clusterData.data(), clusterData.size() * sizeof(uint32_t));
+        upload(indexBuffer, indices.data(), indices.size() * sizeof(uint32_t));
+        stats.cpuMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    // grid size and slice mapping for the LightData block
+    LightUniforms uniforms() const
+    {
+        LightUniforms data = {};
+        data.clusterCount = glm::ivec3(CLUSTERS_X, CLUSTERS_Y, CLUSTERS_Z);
+        data.pointLightCount = (int32_t)stats.lights;
+        data.sliceScale = sliceScale;
+        data.sliceBias = sliceBias;
+        return data;
+    }
+
+    const ClusterStats &lastStats() const
+    {
+        return stats;
+    }
+
+private:
+    // the first slice ends here, so the exponential spacing isn't spent on the few centimeters in front of the camera
+    static constexpr float CLUSTER_NEAR = 1.0f;
+    static const size_t PARALLEL_LIGHTS = 64;
+
+    struct Box {
+        glm::vec3 min, max;
+
+        static Box Empty()
+        {
+            return Box{ glm::vec3(std::numeric_limits<float>::max()), glm::vec3(-std::numeric_limits<float>::max()) };
+        }
+    };
+
+    // light spheres in view space, structure of arrays for the SIMD test
+    struct SphereList {
+        std::vector<float> x, y, z, radius;
+        std::vector<uint32_t> id;
+
+        size_t size() const
+        {
+            return id.size();
+        }
+
+        void clear()
+        {
+            x.clear();
+            y.clear();
+            z.clear();
+            radius.clear();
+            id.clear();
+        }
+
+        void push(const glm::vec3 &center, float r, uint32_t lightId)
+        {
+            x.push_back(center.x);
+            y.push_back(center.y);
+            z.push_back(center.z);
+            radius.push_back(r);
+            id.push_back(lightId);
+        }
+
+        void push(const SphereList &other, size_t i)
+        {
+            x.push_back(other.x[i]);
+            y.push_back(other.y[i]);
+            z.push_back(other.z[i]);
+            radius.push_back(other.radius[i]);
+            id.push_back(other.id[i]);
+        }
+    };
+
+    struct Slice {
+        Box bounds;
+        Box rows[CLUSTERS_Y];
+        Box clusters[CLUSTERS_X * CLUSTERS_Y];
+        // written by the slice's task
+        SphereList sliceLights, rowLights;
+        std::vector<uint32_t> indices;
+        uint32_t first[CLUSTERS_X * CLUSTERS_Y];
+        uint32_t count[CLUSTERS_X * CLUSTERS_Y];
+    };
+
+    ThreadPool &pool;
+    std::vector<Slice> slices;
+    SphereList viewLights;
+    std::vector<std::future<void>> pendingSlices;
+    std::vector<uint32_t> clusterData, indices;
+    float projection[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    float sliceScale = 0.0f, sliceBias = 0.0f;
+    ClusterStats stats;
+
+    GLuint lightBuffer = 0, lightTexture = 0;
+    GLuint clusterBuffer = 0, clusterTexture = 0;
+    GLuint indexBuffer = 0, indexTexture = 0;
+
+    static void createTexture(GLuint &buffer, GLuint &texture, GLenum format, GLuint unit)
+    {
+        glGenBuffers(1, &buffer);
+        glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+        glBufferData(GL_TEXTURE_BUFFER, 16, nullptr, GL_STREAM_DRAW);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+        glGenTextures(1, &texture);
+        // the units are only used for these, so the textures stay bound for good
+        glActiveTexture(GL_TEXTURE0 + unit);
+        glBindTexture(GL_TEXTURE_BUFFER, texture);
+        glTexBuffer(GL_TEXTURE_BUFFER, format, buffer);
+    }
+
+    // orphans the storage, last frame's draws may still read it
+    static void upload(GLuint buffer, const void *data, size_t size)
+    {
+        glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+        glBufferData(GL_TEXTURE_BUFFER, glm::max(size, (size_t)16), nullptr, GL_STREAM_DRAW);
+        if (size > 0)
+            glBufferSubData(GL_TEXTURE_BUFFER, 0, size, data);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    }
+
+    void assignSlice(Slice &slice) const
+    {
+        slice.indices.clear();
+        slice.sliceLights.clear();
+        SpheresTouchingBox(viewLights, slice.bounds, slice.sliceLights);
+        for (int y = 0; y < CLUSTERS_Y; y++)
+        {
+            slice.rowLights.clear();
+            SpheresTouchingBox(slice.sliceLights, slice.rows[y], slice.rowLights);
+            for (int x = 0; x < CLUSTERS_X; x++)
+            {
+                int cluster = y * CLUSTERS_X + x;
+                slice.first[cluster] = (uint32_t)slice.indices.size();
+                SpheresTouchingBox(slice.rowLights, slice.clusters[cluster], slice.indices);
+                slice.count[cluster] = (uint32_t)slice.indices.size() - slice.first[cluster];
+            }
+        }
+    }
+
+    // the spheres that reach into the box: squared distance from the center to the box at most radius^2
+    template <typename Output>
+    static void SpheresTouchingBox(const SphereList &spheres, const Box &box, Output &output)
+    {
+        size_t count = spheres.size(), i = 0;
+        const float *sx = spheres.x.data(), *sy = spheres.y.data(), *sz = spheres.z.data(), *sr = spheres.radius.data();
+#if defined(CLUSTERED_LIGHTING_AVX)
+        const __m256 zero = _mm256_setzero_ps();
+        const __m256 minX = _mm256_set1_ps(box.min.x), minY = _mm256_set1_ps(box.min.y), minZ = _mm256_set1_ps(box.min.z);
+        const __m256 maxX = _mm256_set1_ps(box.max.x), maxY = _mm256_set1_ps(box.max.y), maxZ = _mm256_set1_ps(box.max.z);
+        for (; i + 8 <= count; i += 8)
+        {
+            __m256 x = _mm256_loadu_ps(sx + i), y = _mm256_loadu_ps(sy + i), z = _mm256_loadu_ps(sz + i);
+            __m256 dx = _mm256_add_ps(_mm256_max_ps(_mm256_sub_ps(minX, x), zero), _mm256_max_ps(_mm256_sub_ps(x, maxX), zero));
+            __m256 dy = _mm256_add_ps(_mm256_max_ps(_mm256_sub_ps(minY, y), zero), _mm256_max_ps(_mm256_sub_ps(y, maxY), zero));
+            __m256 dz = _mm256_add_ps(_mm256_max_ps(_mm256_sub_ps(minZ, z), zero), _mm256_max_ps(_mm256_sub_ps(z, maxZ), zero));
+            __m256 distance = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)), _mm256_mul_ps(dz, dz));
+            __m256 radius = _mm256_loadu_ps(sr + i);
+            int mask = _mm256_movemask_ps(_mm256_cmp_ps(distance, _mm256_mul_ps(radius, radius), _CMP_LE_OQ));
+            for (; mask; mask &= mask - 1)
+                Append(output, spheres, i + Lowest(mask));
+        }
+#elif defined(CLUSTERED_LIGHTING_SSE)
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 minX = _mm_set1_ps(box.min.x), minY = _mm_set1_ps(box.min.y), minZ = _mm_set1_ps(box.min.z);
+        const __m128 maxX = _mm_set1_ps(box.max.x), maxY = _mm_set1_ps(box.max.y), maxZ = _mm_set1_ps(box.max.z);
+        for (; i + 4 <= count; i += 4)
+        {
+            __m128 x = _mm_loadu_ps(sx + i), y = _mm_loadu_ps(sy + i), z = _mm_loadu_ps(sz + i);
+            __m128 dx = _mm_add_ps(_mm_max_ps(_mm_sub_ps(minX, x), zero), _mm_max_ps(_mm_sub_ps(x, maxX), zero));
+            __m128 dy = _mm_add_ps(_mm_max_ps(_mm_sub_ps(minY, y), zero), _mm_max_ps(_mm_sub_ps(y, maxY), zero));
+            __m128 dz = _mm_add_ps(_mm_max_ps(_mm_sub_ps(minZ, z), zero), _mm_max_ps(_mm_sub_ps(z, maxZ), zero));
+            __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+            __m128 radius = _mm_loadu_ps(sr + i);
+            int mask = _mm_movemask_ps(_mm_cmple_ps(distance, _mm_mul_ps(radius, radius)));
+            for (; mask; mask &= mask - 1)
+                Append(output, spheres, i + Lowest(mask));
+        }
+#endif
+        // the rest (or everything without SIMD)
+        for (; i < count; i++)
+        {
+            float dx = glm::max(box.min.x - sx[i], 0.0f) + glm::max(sx[i] - box.max.x, 0.0f);
+            float dy = glm::max(box.min.y - sy[i], 0.0f) + glm::max(sy[i] - box.max.y, 0.0f);
+            float dz = glm::max(box.min.z - sz[i], 0.0f) + glm::max(sz[i] - box.max.z, 0.0f);
+            if (dx * dx + dy * dy + dz * dz <= sr[i] * sr[i])
+                Append(output, spheres, i);
+        }
+    }
+
+    static int Lowest(int mask)
+    {
+        int bit = 0;
+        while (!(mask & (1 << bit)))
+            bit++;
+        return bit;
+    }
+
+    static void Append(SphereList &output, const SphereList &spheres, size_t i)
+    {
+        output.push(spheres, i);
+    }
+
+    static void Append(std::vector<uint32_t> &output, const SphereList &spheres, size_t i)
+    {
+        output.push_back(spheres.id[i]);
+    }
+};
+#endif
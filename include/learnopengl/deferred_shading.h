@@ -0,0 +1,159 @@
+#ifndef DEFERRED_SHADING_H
+#define DEFERRED_SHADING_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <learnopengl/gl_state.h>
+#include <learnopengl/render_targets.h>
+#include <learnopengl/shader.h>
+
+#include <iostream>
+
+namespace uniforms {
+constexpr Uniform<glm::mat4> inverseViewProjection("inverseViewProjection");
+}
+
+// defines that turn 2.model_lighting.fs (and instancing.fs) into the deferred passes
+inline const char *GBufferDefines()
+{
+    return "#define GBUFFER\n";
+}
+
+inline const char *DeferredLightingDefines()
+{
+    return "#define DEFERRED_LIGHTING\n";
+}
+
+// The G-buffer of the deferred path, 8 bytes a pixel besides the depth:
+//   0: RGBA8     albedo, specular mask
+//   1: RGB10_A2  octahedral normal (xy), shininess / 256 (z), lit (a: 1) or unlit (a: 0)
+// The depth attachment is the scene's depth texture, so the forward passes after the lighting (the windows) and the
+// occlusion culling see the same depth as in the forward path. The lighting pass reads it all back in one full screen
+// triangle and shades every pixel once, through the same light clusters as the forward shader.
+// The two color targets are transient (RenderTargetPool): taken in beginGeometry() and given back once light() has
+// read them, so the forward path doesn't keep them.
+class GBuffer
+{
+public:
+    // the texture units the lighting pass reads the G-buffer from
+    static const GLuint ALBEDO_UNIT = 0, NORMAL_UNIT = 1, DEPTH_UNIT = 2;
+
+    static RenderTargetDesc AlbedoTarget()
+    {
+        return RenderTargetDesc{ GL_RGBA8, 1.0f, GL_NEAREST };
+    }
+
+    static RenderTargetDesc NormalTarget()
+    {
+        return RenderTargetDesc{ GL_RGB10_A2, 1.0f, GL_NEAREST };
+    }
+
+    // depthTexture is a persistent target of the pool at full scale
+    GBuffer(RenderTargetPool &targets, GLuint depthTexture) : targets(targets), depthTexture(depthTexture)
+    {
+        GLint previousFramebuffer = 0;
+        glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previousFramebuffer);
+        glGenFramebuffers(1, &framebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        attachTargets();
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthTexture, 0);
+        GLenum attachments[2] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+        glDrawBuffers(2, attachments);
+        complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+        if (!complete)
+            std::cout << "WARNING::DEFERRED::G-buffer framebuffer not complete, only forward rendering is available" << std::endl;
+        releaseTargets();
+        glBindFramebuffer(GL_FRAMEBUFFER, previousFramebuffer);
+
+        glGenVertexArrays(1, &emptyVAO);
+        GLState().invalidate();
+    }
+
+    ~GBuffer()
+    {
+        glDeleteFramebuffers(1, &framebuffer);
+        glDeleteVertexArrays(1, &emptyVAO);
+    }
+
+    GBuffer(const GBuffer &) = delete;
+    GBuffer &operator=(const GBuffer &) = delete;
+
+    bool available() const
+    {
+        return complete;
+    }
+
+    // the G-buffer's framebuffer, its targets at color attachments 0 and 1
+    GLuint framebufferObject() const
+    {
+        return framebuffer;
+    }
+
+    // takes the G-buffer targets and binds them for the geometry pass; the depth was cleared with the scene framebuffer
+    void beginGeometry()
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        attachTargets();
+        const GLfloat zero[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+        glClearBufferfv(GL_COLOR, 0, zero);
+        glClearBufferfv(GL_COLOR, 1, zero);
+    }
+
+    // shades every covered pixel of the G-buffer into sceneFramebuffer with lightingShader (2.model_lighting.fs with
+    // DeferredLightingDefines()), leaving sceneFramebuffer bound with the depth test on for the forward passes. The
+    // G-buffer targets go back to the pool.
+    void light(Shader &lightingShader, GLuint sceneFramebuffer, const glm::mat4 &viewProjection)
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, sceneFramebuffer);
+        GLStateCache &state = GLState();
+        state.useProgram(lightingShader.ID);
+        state.bindVertexArray(emptyVAO);
+        state.bindTexture(ALBEDO_UNIT, albedoSpecular);
+        state.bindTexture(NORMAL_UNIT, normalGloss);
+        state.bindTexture(DEPTH_UNIT, depthTexture);
+        state.setBlend(false);
+        state.setCullFace(false);
+        lightingShader.set(uniforms::inverseViewProjection, glm::inverse(viewProjection));
+        // sampling a texture attached to the bound framebuffer is a feedback loop even without depth writes
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, 0, 0);
+        glDisable(GL_DEPTH_TEST);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        glEnable(GL_DEPTH_TEST);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthTexture, 0);
+        releaseTargets();
+    }
+
+    // points the lighting program's G-buffer samplers at their units
+    static void setupLightingShader(Shader &lightingShader)
+    {
+        lightingShader.use();
+        lightingShader.setInt("gAlbedoSpecular", ALBEDO_UNIT);
+        lightingShader.setInt("gNormalGloss", NORMAL_UNIT);
+        lightingShader.setInt("gDepth", DEPTH_UNIT);
+    }
+
+private:
+    RenderTargetPool &targets;
+    GLuint framebuffer = 0;
+    GLuint albedoSpecular = 0, normalGloss = 0;   // while taken from the pool
+    GLuint depthTexture;
+    GLuint emptyVAO = 0;
+    bool complete = false;
+
+    // attached every time: a texture trimmed from the pool may come back under the same name as a new object
+    void attachTargets()
+    {
+        albedoSpecular = targets.acquire(AlbedoTarget());
+        normalGloss = targets.acquire(NormalTarget());
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, albedoSpecular, 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, normalGloss, 0);
+    }
+
+    void releaseTargets()
+    {
+        targets.release(albedoSpecular);
+        targets.release(normalGloss);
+    }
+};
+#endif
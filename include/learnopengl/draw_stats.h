@@ -0,0 +1,16 @@
+#ifndef DRAW_STATS_H
+#define DRAW_STATS_H
+
+// Scene geometry submitted this frame: every glDraw*/glMultiDraw* call counts once, meshes counts the meshes those
+// calls drew. Reset by the application at the start of a frame, shown in the settings window.
+struct DrawStats {
+    unsigned int drawCalls = 0;
+    unsigned int meshes = 0;
+};
+
+inline DrawStats &FrameDrawStats()
+{
+    static DrawStats stats;
+    return stats;
+}
+#endif
@@ -0,0 +1,92 @@
+#ifndef FRAGMENT_COUNTER_H
+#define FRAGMENT_COUNTER_H
+
+#include <glad/glad.h>
+
+#include <learnopengl/gl_ext.h>
+
+#include <vector>
+
+// Counts the fragments shaded by the passes between begin() and end(), summed over a frame. Where the driver has
+// ARB_pipeline_statistics_query (core in 4.6) it counts fragment shader invocations; elsewhere it falls back to
+// GL_SAMPLES_PASSED, the fragments that passed the depth test, which is what gets shaded with early depth testing.
+// The fallback is an occlusion query, so no occlusion query may be active between begin() and end().
+// Like GpuTimer the results are read a few frames late from a ring so counting never stalls the pipeline.
+class FragmentCounter
+{
+public:
+    FragmentCounter() : target(GLCaps().pipelineStatisticsQuery ? GL_FRAGMENT_SHADER_INVOCATIONS_ARB : GL_SAMPLES_PASSED)
+    {
+    }
+
+    ~FragmentCounter()
+    {
+        for (std::vector<GLuint> &queries : frames)
+            if (!queries.empty())
+                glDeleteQueries((GLsizei)queries.size(), queries.data());
+    }
+
+    FragmentCounter(const FragmentCounter &) = delete;
+    FragmentCounter &operator=(const FragmentCounter &) = delete;
+
+    // collects the oldest frame before its queries are reused
+    void beginFrame()
+    {
+        if (issued[current])
+        {
+            GLuint64 total = 0;
+            for (int i = 0; i < used[current]; i++)
+            {
+                GLuint64 count = 0;
+                glGetQueryObjectui64v(frames[current][i], GL_QUERY_RESULT, &count);
+                total += count;
+            }
+            lastCount = total;
+        }
+        used[current] = 0;
+    }
+
+    void begin()
+    {
+        std::vector<GLuint> &queries = frames[current];
+        if (used[current] == (int)queries.size())
+        {
+            queries.push_back(0);
+            glGenQueries(1, &queries.back());
+        }
+        glBeginQuery(target, queries[used[current]++]);
+    }
+
+    void end()
+    {
+        glEndQuery(target);
+    }
+
+    void endFrame()
+    {
+        issued[current] = true;
+        current = (current + 1) % FRAME_COUNT;
+    }
+
+    // fragments of the latest collected frame
+    GLuint64 fragments() const
+    {
+        return lastCount;
+    }
+
+    // false when fragments() counts the samples passing the depth test instead
+    bool countsInvocations() const
+    {
+        return target == GL_FRAGMENT_SHADER_INVOCATIONS_ARB;
+    }
+
+private:
+    static const int FRAME_COUNT = 4;
+    const GLenum target;
+    std::vector<GLuint> frames[FRAME_COUNT];
+    int used[FRAME_COUNT] = {};
+    bool issued[FRAME_COUNT] = {};
+    int current = 0;
+    GLuint64 lastCount = 0;
+};
+#endif
@@ -0,0 +1,361 @@
+#ifndef FRAME_GRAPH_H
+#define FRAME_GRAPH_H
+
+#include <glad/glad.h>
+
+#include <learnopengl/gl_ext.h>
+#include <learnopengl/render_targets.h>
+
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// The passes of a frame, declared anew every frame with what each of them reads and writes, run by execute():
+//   - every write makes a new version of its resource, and a read sees the version its handle names. The passes run
+//     in the order these dependencies give: after the writer of each version they read, and before the writer of the
+//     next version of anything they read (the declaration order breaks ties).
+//   - a pass runs only if something needs it: it has side effects, or it writes the final version of an output
+//     resource, or a needed pass reads what it wrote. A write with Load::Preserve (blending, or read-modify-write)
+//     needs the version it builds on, one with Load::Discard (a clear, or every texel overwritten) doesn't.
+//   - transient resources are targets of the pool, taken right before the first pass using them and given back
+//     after the last, so resources whose lifetimes don't overlap share memory. Their textures are only valid inside
+//     those passes (texture()).
+//   - resources attached to a framebuffer (attach()) have the attachment invalidated after the last pass using them,
+//     unless they are outputs, and before a Load::Discard write, so their contents are never kept nor loaded for
+//     nothing (glInvalidateFramebuffer, where GL 4.3 or ARB_invalidate_subdata is there).
+// Each pass binds the framebuffer it draws into itself.
+class FrameGraph
+{
+public:
+    // a version of a resource, as the declaring functions return them
+    typedef uint32_t Resource;
+
+    enum class Load {
+        Preserve,
+        Discard
+    };
+
+    static const int MAX_ATTACHMENTS = 4;
+
+    class PassBuilder
+    {
+    public:
+        PassBuilder(FrameGraph &graph, size_t pass) : graph(graph), pass(pass)
+        {
+        }
+
+        Resource read(Resource resource)
+        {
+            graph.passes[pass].accesses.push_back({ resource, NONE, Load::Preserve });
+            return resource;
+        }
+
+        // the new version of the resource, for the passes after this one to read or write
+        Resource write(Resource resource, Load load = Load::Preserve)
+        {
+            uint32_t written = (uint32_t)graph.versions.size();
+            graph.versions.push_back({ graph.versions[resource].resource, (int)pass });
+            ResourceInfo &info = graph.resources[graph.versions[resource].resource];
+            if (info.latest != resource)
+                std::cout << "ERROR::FRAME_GRAPH::" << graph.passes[pass].name << " writes an old version of "
+                          << info.name << std::endl;
+            info.latest = written;
+            graph.passes[pass].accesses.push_back({ resource, written, load });
+            return written;
+        }
+
+        // never culled, e.g. a pass keeping results for the next frames
+        PassBuilder &sideEffects()
+        {
+            graph.passes[pass].sideEffects = true;
+            return *this;
+        }
+
+    private:
+        FrameGraph &graph;
+        size_t pass;
+    };
+
+    explicit FrameGraph(RenderTargetPool &targets) : targets(targets)
+    {
+    }
+
+    FrameGraph(const FrameGraph &) = delete;
+    FrameGraph &operator=(const FrameGraph &) = delete;
+
+    // forgets the last frame's passes and resources
+    void reset()
+    {
+        passes.clear();
+        resources.clear();
+        versions.clear();
+        order.clear();
+    }
+
+    // a texture (or nothing, 0, for a resource that only orders passes) the graph doesn't own
+    Resource import(const char *name, GLuint texture = 0)
+    {
+        ResourceInfo info;
+        info.name = name;
+        info.texture = texture;
+        return addResource(info);
+    }
+
+    // a target of the pool that lives only as long as the passes using it
+    Resource create(const char *name, const RenderTargetDesc &desc)
+    {
+        ResourceInfo info;
+        info.name = name;
+        info.desc = desc;
+        info.transient = true;
+        return addResource(info);
+    }
+
+    // the resource is (part of) framebuffer's attachment, e.g. GL_COLOR_ATTACHMENT0 or, of framebuffer 0, GL_COLOR
+    void attach(Resource resource, GLuint framebuffer, GLenum attachment)
+    {
+        ResourceInfo &info = resources[versions[resource].resource];
+        if (info.attachmentCount == MAX_ATTACHMENTS)
+        {
+            std::cout << "ERROR::FRAME_GRAPH::too many attachments for " << info.name << std::endl;
+            return;
+        }
+        info.framebuffer = framebuffer;
+        info.attachments[info.attachmentCount++] = attachment;
+    }
+
+    // what the frame is for: the passes writing its final version are never culled, nor is it invalidated
+    void markOutput(Resource resource)
+    {
+        resources[versions[resource].resource].output = true;
+    }
+
+    PassBuilder addPass(const char *name, std::function<void()> execute)
+    {
+        Pass pass;
+        pass.name = name;
+        pass.execute = std::move(execute);
+        passes.push_back(std::move(pass));
+        return PassBuilder(*this, passes.size() - 1);
+    }
+
+    // the texture of any version of the resource; transient ones only inside the passes using them
+    GLuint texture(Resource resource) const
+    {
+        return resources[versions[resource].resource].texture;
+    }
+
+    // orders and culls the declared passes, then runs them
+    void execute()
+    {
+        compile();
+        lastInvalidated = 0;
+        for (size_t position = 0; position < order.size(); position++)
+        {
+            Pass &pass = passes[order[position]];
+            for (ResourceInfo &info : resources)
+                if (info.transient && info.firstUse == (int)position)
+                    info.texture = targets.acquire(info.desc);
+            for (const Access &access : pass.accesses)
+                if (access.written != NONE && access.load == Load::Discard)
+                    invalidate(resources[versions[access.version].resource]);
+            pass.execute();
+            for (ResourceInfo &info : resources)
+            {
+                if (info.lastUse != (int)position)
+                    continue;
+                if (info.transient)
+                {
+                    targets.release(info.texture);
+                    info.texture = 0;
+                }
+                if (!info.output)
+                    invalidate(info);
+            }
+        }
+    }
+
+    // the passes of the last execute(), in order, then the culled ones
+    std::string summary() const
+    {
+        std::string text;
+        for (size_t i = 0; i < order.size(); i++)
+            text += (i ? " > " : "") + std::string(passes[order[i]].name);
+        std::string culled;
+        for (const Pass &pass : passes)
+            if (!pass.alive)
+                culled += (culled.empty() ? "" : ", ") + std::string(pass.name);
+        if (!culled.empty())
+            text += " (culled: " + culled + ")";
+        return text;
+    }
+
+    // attachments invalidated by the last execute()
+    unsigned int invalidatedAttachments() const
+    {
+        return lastInvalidated;
+    }
+
+private:
+    static const uint32_t NONE = ~0u;
+
+    struct Access {
+        Resource version;   // read, or built on by the write
+        Resource written;   // the version written, NONE for a read
+        Load load;
+    };
+
+    struct Pass {
+        const char *name = "";
+        std::function<void()> execute;
+        std::vector<Access> accesses;
+        bool sideEffects = false;
+        bool alive = false;
+    };
+
+    struct ResourceInfo {
+        const char *name = "";
+        GLuint texture = 0;
+        RenderTargetDesc desc;
+        bool transient = false;
+        bool output = false;
+        GLuint framebuffer = 0;
+        GLenum attachments[MAX_ATTACHMENTS] = {};
+        int attachmentCount = 0;
+        Resource latest = 0;
+        int firstUse = -1, lastUse = -1;   // positions in order
+    };
+
+    struct Version {
+        uint32_t resource;
+        int writer;   // -1 for the version a resource starts with
+    };
+
+    RenderTargetPool &targets;
+    std::vector<Pass> passes;
+    std::vector<ResourceInfo> resources;
+    std::vector<Version> versions;
+    std::vector<size_t> order;   // the passes run, in order
+    unsigned int lastInvalidated = 0;
+    // compile() scratch
+    std::vector<std::vector<size_t>> successors;
+    std::vector<int> predecessors;
+
+    Resource addResource(ResourceInfo &info)
+    {
+        Resource version = (Resource)versions.size();
+        info.latest = version;
+        versions.push_back({ (uint32_t)resources.size(), -1 });
+        resources.push_back(info);
+        return version;
+    }
+
+    void compile()
+    {
+        size_t count = passes.size();
+        successors.assign(count, std::vector<size_t>());
+        predecessors.assign(count, 0);
+        auto addEdge = [this](int from, size_t to) {
+            if (from < 0 || (size_t)from == to)
+                return;
+            successors[from].push_back(to);
+            predecessors[to]++;
+        };
+        for (size_t i = 0; i < count; i++)
+            for (const Access &access : passes[i].accesses)
+            {
+                addEdge(versions[access.version].writer, i);
+                if (access.written == NONE)
+                    continue;
+                // whoever uses the version this write replaces goes first
+                for (size_t j = 0; j < count; j++)
+                    for (const Access &other : passes[j].accesses)
+                        if (other.version == access.version && j != i)
+                            addEdge((int)j, i);
+            }
+
+        // the first ready pass in declaration order, every time
+        order.clear();
+        std::vector<bool> done(count, false);
+        while (order.size() < count)
+        {
+            size_t next = count;
+            for (size_t i = 0; i < count && next == count; i++)
+                if (!done[i] && predecessors[i] == 0)
+                    next = i;
+            if (next == count)
+            {
+                std::cout << "ERROR::FRAME_GRAPH::cyclic dependencies, running the passes as declared" << std::endl;
+                order.clear();
+                for (size_t i = 0; i < count; i++)
+                    order.push_back(i);
+                break;
+            }
+            done[next] = true;
+            order.push_back(next);
+            for (size_t successor : successors[next])
+                predecessors[successor]--;
+        }
+
+        // culling, walking back from what is needed
+        std::vector<size_t> needed;
+        for (size_t i = 0; i < count; i++)
+        {
+            Pass &pass = passes[i];
+            pass.alive = pass.sideEffects;
+            for (const Access &access : pass.accesses)
+                if (access.written != NONE && resources[versions[access.written].resource].output &&
+                    resources[versions[access.written].resource].latest == access.written)
+                    pass.alive = true;
+            if (pass.alive)
+                needed.push_back(i);
+        }
+        while (!needed.empty())
+        {
+            size_t i = needed.back();
+            needed.pop_back();
+            for (const Access &access : passes[i].accesses)
+            {
+                if (access.written != NONE && access.load == Load::Discard)
+                    continue;
+                int writer = versions[access.version].writer;
+                if (writer >= 0 && !passes[writer].alive)
+                {
+                    passes[writer].alive = true;
+                    needed.push_back(writer);
+                }
+            }
+        }
+        size_t alive = 0;
+        for (size_t i : order)
+            if (passes[i].alive)
+                order[alive++] = i;
+        order.resize(alive);
+
+        for (ResourceInfo &info : resources)
+            info.firstUse = info.lastUse = -1;
+        for (size_t position = 0; position < order.size(); position++)
+            for (const Access &access : passes[order[position]].accesses)
+            {
+                ResourceInfo &info = resources[versions[access.version].resource];
+                if (info.firstUse < 0)
+                    info.firstUse = (int)position;
+                info.lastUse = (int)position;
+            }
+    }
+
+    void invalidate(const ResourceInfo &info)
+    {
+        if (info.attachmentCount == 0 || !GLCaps().invalidateFramebuffer)
+            return;
+        GLint previousFramebuffer = 0;
+        glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previousFramebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, info.framebuffer);
+        GLExt().InvalidateFramebuffer(GL_FRAMEBUFFER, info.attachmentCount, info.attachments);
+        glBindFramebuffer(GL_FRAMEBUFFER, previousFramebuffer);
+        lastInvalidated += info.attachmentCount;
+    }
+};
+#endif
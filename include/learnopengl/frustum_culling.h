@@ -0,0 +1,171 @@
+#ifndef FRUSTUM_CULLING_H
+#define FRUSTUM_CULLING_H
+
+#include <glm/glm.hpp>
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// the kernel tests 8 boxes per iteration with AVX (when the build enables it, e.g. -mavx or -march=native),
+// 4 with SSE (every x86-64 target) and falls back to one at a time elsewhere
+#if defined(__AVX__)
+#include <immintrin.h>
+#define FRUSTUM_CULLING_AVX
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define FRUSTUM_CULLING_SSE
+#endif
+
+// the six planes (normals pointing inwards, normalized) of a view-projection matrix
+struct Frustum {
+    glm::vec4 planes[6];
+
+    static Frustum FromViewProjection(const glm::mat4 &m)
+    {
+        // rows of the matrix, glm is column major
+        glm::vec4 row[4];
+        for (int i = 0; i < 4; i++)
+            row[i] = glm::vec4(m[0][i], m[1][i], m[2][i], m[3][i]);
+        Frustum frustum;
+        frustum.planes[0] = row[3] + row[0]; // left
+        frustum.planes[1] = row[3] - row[0]; // right
+        frustum.planes[2] = row[3] + row[1]; // bottom
+        frustum.planes[3] = row[3] - row[1]; // top
+        frustum.planes[4] = row[3] + row[2]; // near
+        frustum.planes[5] = row[3] - row[2]; // far
+        for (glm::vec4 &plane : frustum.planes)
+            plane /= glm::length(glm::vec3(plane));
+        return frustum;
+    }
+};
+
+// world space boxes as center and half extent, stored as structure of arrays so the kernel loads several at once
+struct AabbArray {
+    std::vector<float> centerX, centerY, centerZ;
+    std::vector<float> extentX, extentY, extentZ;
+
+    size_t size() const
+    {
+        return centerX.size();
+    }
+
+    void resize(size_t count)
+    {
+        centerX.resize(count);
+        centerY.resize(count);
+        centerZ.resize(count);
+        extentX.resize(count);
+        extentY.resize(count);
+        extentZ.resize(count);
+    }
+
+    // the box (minimum, maximum) moved by transform, as the box around the transformed one
+    void setTransformed(size_t i, const glm::vec3 &minimum, const glm::vec3 &maximum, const glm::mat4 &transform)
+    {
+        glm::vec3 center = glm::vec3(transform * glm::vec4((minimum + maximum) * 0.5f, 1.0f));
+        glm::vec3 extent = (maximum - minimum) * 0.5f;
+        glm::vec3 worldExtent(0.0f);
+        for (int column = 0; column < 3; column++)
+            worldExtent += glm::abs(glm::vec3(transform[column])) * extent[column];
+        centerX[i] = center.x;
+        centerY[i] = center.y;
+        centerZ[i] = center.z;
+        extentX[i] = worldExtent.x;
+        extentY[i] = worldExtent.y;
+        extentZ[i] = worldExtent.z;
+    }
+};
+
+// boxes tested and found visible this frame, reset by the application
+struct CullingStats {
+    unsigned int tested = 0;
+    unsigned int visible = 0;
+};
+
+inline CullingStats &FrameCullingStats()
+{
+    static CullingStats stats;
+    return stats;
+}
+
+// writes 1 to visible[i] for every box that intersects the frustum and 0 for the others, returns the number visible.
+// A box is outside once it lies entirely behind one plane: dot(n, center) + w + dot(|n|, extent) < 0.
+inline size_t CullAabbs(const Frustum &frustum, const AabbArray &boxes, uint8_t *visible)
+{
+    size_t count = boxes.size();
+    const float *cx = boxes.centerX.data(), *cy = boxes.centerY.data(), *cz = boxes.centerZ.data();
+    const float *ex = boxes.extentX.data(), *ey = boxes.extentY.data(), *ez = boxes.extentZ.data();
+    size_t i = 0, visibleCount = 0;
+
+#if defined(FRUSTUM_CULLING_AVX)
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256 centerX = _mm256_loadu_ps(cx + i), centerY = _mm256_loadu_ps(cy + i), centerZ = _mm256_loadu_ps(cz + i);
+        __m256 extentX = _mm256_loadu_ps(ex + i), extentY = _mm256_loadu_ps(ey + i), extentZ = _mm256_loadu_ps(ez + i);
+        __m256 outside = _mm256_setzero_ps();
+        for (const glm::vec4 &plane : frustum.planes)
+        {
+            __m256 distance = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(centerX, _mm256_set1_ps(plane.x)),
+                                                          _mm256_mul_ps(centerY, _mm256_set1_ps(plane.y))),
+                                            _mm256_add_ps(_mm256_mul_ps(centerZ, _mm256_set1_ps(plane.z)), _mm256_set1_ps(plane.w)));
+            __m256 radius = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(extentX, _mm256_set1_ps(std::fabs(plane.x))),
+                                                        _mm256_mul_ps(extentY, _mm256_set1_ps(std::fabs(plane.y)))),
+                                          _mm256_mul_ps(extentZ, _mm256_set1_ps(std::fabs(plane.z))));
+            outside = _mm256_or_ps(outside, _mm256_cmp_ps(_mm256_add_ps(distance, radius), _mm256_setzero_ps(), _CMP_LT_OQ));
+        }
+        int outsideMask = _mm256_movemask_ps(outside);
+        for (int lane = 0; lane < 8; lane++)
+        {
+            visible[i + lane] = !((outsideMask >> lane) & 1);
+            visibleCount += visible[i + lane];
+        }
+    }
+#elif defined(FRUSTUM_CULLING_SSE)
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128 centerX = _mm_loadu_ps(cx + i), centerY = _mm_loadu_ps(cy + i), centerZ = _mm_loadu_ps(cz + i);
+        __m128 extentX = _mm_loadu_ps(ex + i), extentY = _mm_loadu_ps(ey + i), extentZ = _mm_loadu_ps(ez + i);
+        __m128 outside = _mm_setzero_ps();
+        for (const glm::vec4 &plane : frustum.planes)
+        {
+            __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(centerX, _mm_set1_ps(plane.x)), _mm_mul_ps(centerY, _mm_set1_ps(plane.y))),
+                                         _mm_add_ps(_mm_mul_ps(centerZ, _mm_set1_ps(plane.z)), _mm_set1_ps(plane.w)));
+            __m128 radius = _mm_add_ps(_mm_add_ps(_mm_mul_ps(extentX, _mm_set1_ps(std::fabs(plane.x))),
+                                                  _mm_mul_ps(extentY, _mm_set1_ps(std::fabs(plane.y)))),
+                                       _mm_mul_ps(extentZ, _mm_set1_ps(std::fabs(plane.z))));
+            outside = _mm_or_ps(outside, _mm_cmplt_ps(_mm_add_ps(distance, radius), _mm_setzero_ps()));
+        }
+        int outsideMask = _mm_movemask_ps(outside);
+        for (int lane = 0; lane < 4; lane++)
+        {
+            visible[i + lane] = !((outsideMask >> lane) & 1);
+            visibleCount += visible[i + lane];
+        }
+    }
+#endif
+    // the rest (or everything without SIMD)
+    for (; i < count; i++)
+    {
+        bool inside = true;
+        for (const glm::vec4 &plane : frustum.planes)
+        {
+            float distance = plane.x * cx[i] + plane.y * cy[i] + plane.z * cz[i] + plane.w;
+            float radius = std::fabs(plane.x) * ex[i] + std::fabs(plane.y) * ey[i] + std::fabs(plane.z) * ez[i];
+            if (distance + radius < 0.0f)
+            {
+                inside = false;
+                break;
+            }
+        }
+        visible[i] = inside;
+        visibleCount += inside;
+    }
+
+    CullingStats &stats = FrameCullingStats();
+    stats.tested += (unsigned int)count;
+    stats.visible += (unsigned int)visibleCount;
+    return visibleCount;
+}
+#endif
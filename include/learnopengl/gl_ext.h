@@ -0,0 +1,150 @@
+#ifndef GL_EXT_H
+#define GL_EXT_H
+
+#include <glad/glad.h>
+
+#include <cstring>
+
+// The bundled glad loader only knows core OpenGL 3.3. Newer features are used when the driver offers them, so their
+// enums are declared here and the capabilities are probed once at startup with LoadGLExtensions().
+
+// EXT_texture_compression_s3tc
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT  0x83F0
+#define GL_COMPRESSED_RGBA_S3TC_DXT1_EXT 0x83F1
+#define GL_COMPRESSED_RGBA_S3TC_DXT3_EXT 0x83F2
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+// ARB_texture_compression_bptc (core in 4.2)
+#ifndef GL_COMPRESSED_RGBA_BPTC_UNORM
+#define GL_COMPRESSED_RGBA_BPTC_UNORM 0x8E8C
+#endif
+// ARB_draw_indirect (core in 4.0)
+#ifndef GL_DRAW_INDIRECT_BUFFER
+#define GL_DRAW_INDIRECT_BUFFER 0x8F3F
+#endif
+// ARB_compute_shader, ARB_shader_image_load_store (core in 4.3 and 4.2)
+#ifndef GL_COMPUTE_SHADER
+#define GL_COMPUTE_SHADER 0x91B9
+#endif
+#ifndef GL_TEXTURE_FETCH_BARRIER_BIT
+#define GL_TEXTURE_FETCH_BARRIER_BIT 0x00000008
+#define GL_SHADER_IMAGE_ACCESS_BARRIER_BIT 0x00000020
+#endif
+// ARB_pipeline_statistics_query (core in 4.6)
+#ifndef GL_FRAGMENT_SHADER_INVOCATIONS_ARB
+#define GL_FRAGMENT_SHADER_INVOCATIONS_ARB 0x82F4
+#endif
+
+// entry points newer than 3.3, null when the driver doesn't provide them
+typedef void (APIENTRYP GLEXT_PFNTEXSTORAGE2D)(GLenum target, GLsizei levels, GLenum internalformat, GLsizei width, GLsizei height);
+typedef void (APIENTRYP GLEXT_PFNMULTIDRAWELEMENTSINDIRECT)(GLenum mode, GLenum type, const void *indirect, GLsizei drawcount, GLsizei stride);
+typedef void (APIENTRYP GLEXT_PFNDISPATCHCOMPUTE)(GLuint numGroupsX, GLuint numGroupsY, GLuint numGroupsZ);
+typedef void (APIENTRYP GLEXT_PFNBINDIMAGETEXTURE)(GLuint unit, GLuint texture, GLint level, GLboolean layered, GLint layer, GLenum access, GLenum format);
+typedef void (APIENTRYP GLEXT_PFNMEMORYBARRIER)(GLbitfield barriers);
+typedef void (APIENTRYP GLEXT_PFNINVALIDATEFRAMEBUFFER)(GLenum target, GLsizei numAttachments, const GLenum *attachments);
+
+struct GLExtFunctions {
+    GLEXT_PFNTEXSTORAGE2D TexStorage2D = nullptr;   // 4.2, ARB_texture_storage
+    GLEXT_PFNMULTIDRAWELEMENTSINDIRECT MultiDrawElementsIndirect = nullptr; // 4.3, ARB_multi_draw_indirect
+    GLEXT_PFNDISPATCHCOMPUTE DispatchCompute = nullptr;   // 4.3, ARB_compute_shader
+    GLEXT_PFNBINDIMAGETEXTURE BindImageTexture = nullptr; // 4.2, ARB_shader_image_load_store
+    GLEXT_PFNMEMORYBARRIER MemoryBarrier = nullptr;       // 4.2, ARB_shader_image_load_store
+    GLEXT_PFNINVALIDATEFRAMEBUFFER InvalidateFramebuffer = nullptr; // 4.3, ARB_invalidate_subdata
+};
+
+inline GLExtFunctions &GLExt()
+{
+    static GLExtFunctions functions;
+    return functions;
+}
+
+struct GLCapabilities {
+    int majorVersion = 3;
+    int minorVersion = 3;
+    bool textureCompressionS3TC = false;
+    bool textureCompressionRGTC = false;
+    bool textureCompressionBPTC = false;
+    bool textureStorage = false;
+    bool multiDrawIndirect = false;
+    bool pipelineStatisticsQuery = false;
+    bool computeShader = false;   // compute programs writing images, with the 4.3 shading language
+    bool invalidateFramebuffer = false;
+
+    bool atLeast(int major, int minor) const
+    {
+        return majorVersion > major || (majorVersion == major && minorVersion >= minor);
+    }
+};
+
+// filled by LoadGLExtensions() on the GL thread, read-only afterwards so loader threads may query it
+inline GLCapabilities &GLCaps()
+{
+    static GLCapabilities capabilities;
+    return capabilities;
+}
+
+inline bool HasGLExtension(const char *name)
+{
+    GLint count = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+    for (GLint i = 0; i < count; i++)
+    {
+        const char *extension = (const char *)glGetStringi(GL_EXTENSIONS, i);
+        if (extension && strcmp(extension, name) == 0)
+            return true;
+    }
+    return false;
+}
+
+// call once after gladLoadGLLoader with the same loader function
+inline void LoadGLExtensions(GLADloadproc load)
+{
+    GLCapabilities &caps = GLCaps();
+    glGetIntegerv(GL_MAJOR_VERSION, &caps.majorVersion);
+    glGetIntegerv(GL_MINOR_VERSION, &caps.minorVersion);
+
+    caps.textureCompressionS3TC = HasGLExtension("GL_EXT_texture_compression_s3tc");
+    caps.textureCompressionRGTC = true; // core since 3.0
+    caps.textureCompressionBPTC = caps.atLeast(4, 2) || HasGLExtension("GL_ARB_texture_compression_bptc");
+
+    GLExtFunctions &ext = GLExt();
+    if (caps.atLeast(4, 2) || HasGLExtension("GL_ARB_texture_storage"))
+        ext.TexStorage2D = (GLEXT_PFNTEXSTORAGE2D)load("glTexStorage2D");
+    caps.textureStorage = ext.TexStorage2D != nullptr;
+    if (caps.atLeast(4, 3) || HasGLExtension("GL_ARB_multi_draw_indirect"))
+        ext.MultiDrawElementsIndirect = (GLEXT_PFNMULTIDRAWELEMENTSINDIRECT)load("glMultiDrawElementsIndirect");
+    caps.multiDrawIndirect = ext.MultiDrawElementsIndirect != nullptr;
+    // the compute shaders are #version 430, so the extensions alone on an older context are not enough
+    if (caps.atLeast(4, 3))
+    {
+        ext.DispatchCompute = (GLEXT_PFNDISPATCHCOMPUTE)load("glDispatchCompute");
+        ext.BindImageTexture = (GLEXT_PFNBINDIMAGETEXTURE)load("glBindImageTexture");
+        ext.MemoryBarrier = (GLEXT_PFNMEMORYBARRIER)load("glMemoryBarrier");
+    }
+    caps.computeShader = ext.DispatchCompute && ext.BindImageTexture && ext.MemoryBarrier;
+    if (caps.atLeast(4, 3) || HasGLExtension("GL_ARB_invalidate_subdata"))
+        ext.InvalidateFramebuffer = (GLEXT_PFNINVALIDATEFRAMEBUFFER)load("glInvalidateFramebuffer");
+    caps.invalidateFramebuffer = ext.InvalidateFramebuffer != nullptr;
+    // only new query targets, no entry points
+    caps.pipelineStatisticsQuery = caps.atLeast(4, 6) || HasGLExtension("GL_ARB_pipeline_statistics_query");
+}
+
+// whether textures of the given compressed internal format can be uploaded with glCompressedTexImage2D
+inline bool IsCompressedFormatSupported(GLenum internalFormat)
+{
+    const GLCapabilities &caps = GLCaps();
+    switch (internalFormat)
+    {
+        case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+        case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+            return caps.textureCompressionS3TC;
+        case GL_COMPRESSED_RED_RGTC1:
+        case GL_COMPRESSED_RG_RGTC2:
+            return caps.textureCompressionRGTC;
+        case GL_COMPRESSED_RGBA_BPTC_UNORM:
+            return caps.textureCompressionBPTC;
+    }
+    return false;
+}
+#endif
@@ -0,0 +1,133 @@
+#ifndef GL_STATE_H
+#define GL_STATE_H
+
+#include <glad/glad.h>
+
+// Counts of the state changes that actually reached GL, reset by the application every frame
+struct GLStateStats {
+    unsigned int programs = 0;
+    unsigned int vertexArrays = 0;
+    unsigned int textures = 0;
+    unsigned int renderStates = 0; // face culling and blending
+};
+
+// Shadow copy of the bindings the scene draws change, so redundant binds are skipped. It only knows what went through
+// it: code that binds programs, vertex arrays or textures directly has to call invalidate() before drawing through it
+// again (RenderQueue::execute() does so at the start).
+class GLStateCache
+{
+public:
+    GLStateStats stats;
+
+    void invalidate()
+    {
+        program = UNKNOWN;
+        vertexArray = UNKNOWN;
+        activeUnit = UNKNOWN;
+        for (GLuint &texture : textures)
+            texture = UNKNOWN;
+        for (GLuint &texture : textureBuffers)
+            texture = UNKNOWN;
+        cullFace = -1;
+        blend = -1;
+    }
+
+    // true if the program changed
+    bool useProgram(GLuint id)
+    {
+        if (program == id)
+            return false;
+        glUseProgram(id);
+        program = id;
+        stats.programs++;
+        return true;
+    }
+
+    void bindVertexArray(GLuint id)
+    {
+        if (vertexArray == id)
+            return;
+        glBindVertexArray(id);
+        vertexArray = id;
+        stats.vertexArrays++;
+    }
+
+    void bindTexture(unsigned int unit, GLuint id)
+    {
+        if (unit < MAX_UNITS && textures[unit] == id)
+            return;
+        if (activeUnit != unit)
+        {
+            glActiveTexture(GL_TEXTURE0 + unit);
+            activeUnit = unit;
+        }
+        glBindTexture(GL_TEXTURE_2D, id);
+        if (unit < MAX_UNITS)
+            textures[unit] = id;
+        stats.textures++;
+    }
+
+    // buffer textures (GL_TEXTURE_BUFFER) go on units of their own, the GL_TEXTURE_2D shadow doesn't cover them
+    void bindTextureBuffer(unsigned int unit, GLuint id)
+    {
+        if (unit < MAX_UNITS && textureBuffers[unit] == id)
+            return;
+        if (activeUnit != unit)
+        {
+            glActiveTexture(GL_TEXTURE0 + unit);
+            activeUnit = unit;
+        }
+        glBindTexture(GL_TEXTURE_BUFFER, id);
+        if (unit < MAX_UNITS)
+            textureBuffers[unit] = id;
+        stats.textures++;
+    }
+
+    void setCullFace(bool enabled)
+    {
+        if (cullFace == (int)enabled)
+            return;
+        if (enabled)
+            glEnable(GL_CULL_FACE);
+        else
+            glDisable(GL_CULL_FACE);
+        cullFace = enabled;
+        stats.renderStates++;
+    }
+
+    void setBlend(bool enabled)
+    {
+        if (blend == (int)enabled)
+            return;
+        if (enabled)
+            glEnable(GL_BLEND);
+        else
+            glDisable(GL_BLEND);
+        blend = enabled;
+        stats.renderStates++;
+    }
+
+private:
+    static const GLuint UNKNOWN = ~0u;
+    static const unsigned int MAX_UNITS = 32;
+    GLuint program = UNKNOWN;
+    GLuint vertexArray = UNKNOWN;
+    GLuint activeUnit = UNKNOWN;
+    GLuint textures[MAX_UNITS] = { UNKNOWN, UNKNOWN, UNKNOWN, UNKNOWN, UNKNOWN, UNKNOWN, UNKNOWN, UNKNOWN,
+                                   UNKNOWN, UNKNOWN, UNKNOWN, UNKNOWN, UNKNOWN, UNKNOWN, UNKNOWN, UNKNOWN,
+                                   UNKNOWN, UNKNOWN, UNKNOWN, UNKNOWN, UNKNOWN, UNKNOWN, UNKNOWN, UNKNOWN,
+                                   UNKNOWN, UNKNOWN, UNKNOWN, UNKNOWN, UNKNOWN, UNKNOWN, UNKNOWN, UNKNOWN };
+    GLuint textureBuffers[MAX_UNITS] = { UNKNOWN, UNKNOWN, UNKNOWN, UNKNOWN, UNKNOWN, UNKNOWN, UNKNOWN, UNKNOWN,
+                                         UNKNOWN, UNKNOWN, UNKNOWN, UNKNOWN, UNKNOWN, UNKNOWN, UNKNOWN, UNKNOWN,
+                                         UNKNOWN, UNKNOWN, UNKNOWN, UNKNOWN, UNKNOWN, UNKNOWN, UNKNOWN, UNKNOWN,
+                                         UNKNOWN, UNKNOWN, UNKNOWN, UNKNOWN, UNKNOWN, UNKNOWN, UNKNOWN, UNKNOWN };
+    int cullFace = -1;
+    int blend = -1;
+};
+
+inline GLStateCache &GLState()
+{
+    static GLStateCache state;
+    return state;
+}
+#endif
@@ -0,0 +1,111 @@
+#ifndef GPU_TIMER_H
+#define GPU_TIMER_H
+
+#include <glad/glad.h>
+
+// Measures how long the GPU spends on the commands between begin() and end() (GL_TIME_ELAPSED, core since 3.3).
+// Results are read a few frames late from a small ring of queries so measuring never stalls the pipeline;
+// milliseconds() returns an exponentially smoothed value of the latest results.
+class GpuTimer
+{
+public:
+    GpuTimer()
+    {
+        glGenQueries(QUERY_COUNT, queries);
+    }
+
+    ~GpuTimer()
+    {
+        glDeleteQueries(QUERY_COUNT, queries);
+    }
+
+    GpuTimer(const GpuTimer &) = delete;
+    GpuTimer &operator=(const GpuTimer &) = delete;
+
+    void begin()
+    {
+        // collect the oldest query before reusing it
+        if (issued[current])
+        {
+            GLuint64 nanoseconds;
+            glGetQueryObjectui64v(queries[current], GL_QUERY_RESULT, &nanoseconds);
+            double ms = nanoseconds / 1e6;
+            smoothedMs = smoothedMs == 0.0 ? ms : smoothedMs * 0.95 + ms * 0.05;
+        }
+        glBeginQuery(GL_TIME_ELAPSED, queries[current]);
+    }
+
+    void end()
+    {
+        glEndQuery(GL_TIME_ELAPSED);
+        issued[current] = true;
+        current = (current + 1) % QUERY_COUNT;
+    }
+
+    double milliseconds() const
+    {
+        return smoothedMs;
+    }
+
+private:
+    static const int QUERY_COUNT = 4;
+    GLuint queries[QUERY_COUNT];
+    bool issued[QUERY_COUNT] = {};
+    int current = 0;
+    double smoothedMs = 0.0;
+};
+
+// Average GPU time of each of a run of passes, from a timestamp before the first and one after the last
+// (glQueryCounter, core since 3.3). Unlike GL_TIME_ELAPSED these may be taken while a GpuTimer is measuring the
+// commands around them. Read back late from a ring like GpuTimer.
+class GpuPassTimer
+{
+public:
+    GpuPassTimer()
+    {
+        glGenQueries(2 * QUERY_COUNT, queries);
+    }
+
+    ~GpuPassTimer()
+    {
+        glDeleteQueries(2 * QUERY_COUNT, queries);
+    }
+
+    GpuPassTimer(const GpuPassTimer &) = delete;
+    GpuPassTimer &operator=(const GpuPassTimer &) = delete;
+
+    void begin()
+    {
+        if (passes[current] > 0)
+        {
+            GLuint64 first, last;
+            glGetQueryObjectui64v(queries[2 * current], GL_QUERY_RESULT, &first);
+            glGetQueryObjectui64v(queries[2 * current + 1], GL_QUERY_RESULT, &last);
+            double ms = (last - first) / 1e6 / passes[current];
+            smoothedMs = smoothedMs == 0.0 ? ms : smoothedMs * 0.95 + ms * 0.05;
+        }
+        glQueryCounter(queries[2 * current], GL_TIMESTAMP);
+    }
+
+    // passCount passes were issued since begin()
+    void end(int passCount)
+    {
+        glQueryCounter(queries[2 * current + 1], GL_TIMESTAMP);
+        passes[current] = passCount;
+        current = (current + 1) % QUERY_COUNT;
+    }
+
+    // per pass
+    double milliseconds() const
+    {
+        return smoothedMs;
+    }
+
+private:
+    static const int QUERY_COUNT = 4;
+    GLuint queries[2 * QUERY_COUNT];
+    int passes[QUERY_COUNT] = {};
+    int current = 0;
+    double smoothedMs = 0.0;
+};
+#endif
@@ -0,0 +1,130 @@
+#ifndef HDR_FORMATS_H
+#define HDR_FORMATS_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <learnopengl/gl_state.h>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+// Storage of the HDR targets: the scene color and the bloom chain. GL_R11F_G11F_B10F packs the three color channels as
+// unsigned floats of 6, 6 and 5 mantissa bits into 4 bytes, half of GL_RGBA16F, so every pass writing or sampling those
+// targets moves half the bytes. No pass needs what it gives up: the alpha (the windows blend with their own alpha, the
+// tone mapping reads rgb) and negative values. What it costs is precision: up to a mantissa step, 2^-6 of the value for
+// red and green and 2^-5 for blue against 2^-10, as HdrFormatValidation measures.
+enum class HdrQuality {
+    High,          // RGBA16F everywhere
+    Balanced,      // packed bloom: blurred and added at a fraction, its error hardly shows
+    Performance    // packed scene color and bloom
+};
+
+struct HdrFormats {
+    GLenum sceneColor = GL_RGBA16F;
+    GLenum bloom = GL_RGBA16F;
+
+    bool operator==(const HdrFormats &other) const
+    {
+        return sceneColor == other.sceneColor && bloom == other.bloom;
+    }
+
+    bool operator!=(const HdrFormats &other) const
+    {
+        return !(*this == other);
+    }
+};
+
+inline HdrFormats HdrFormatsFor(HdrQuality quality)
+{
+    HdrFormats formats;
+    if (quality != HdrQuality::High)
+        formats.bloom = GL_R11F_G11F_B10F;
+    if (quality == HdrQuality::Performance)
+        formats.sceneColor = GL_R11F_G11F_B10F;
+    return formats;
+}
+
+struct HdrFormatError {
+    bool measured = false;
+    float maxOutput = 0.0f;     // largest difference of a tone mapped channel, in steps of the 8 bit backbuffer
+    float meanOutput = 0.0f;
+    float maxScene = 0.0f;      // largest relative difference of a scene color channel (HDR, before the bloom)
+};
+
+// Compares the frames of the packed formats with RGBA16F ones. While enabled, every other frame is rendered as the
+// reference with RGBA16F targets, and capture() takes the scene color and the tone mapped frame of both. A pair
+// rendered from the same view gives the error of the formats alone, so the camera should stay still.
+class HdrFormatValidation
+{
+public:
+    bool enabled = false;
+
+    // the formats to render this frame with
+    HdrFormats frameFormats(const HdrFormats &formats)
+    {
+        if (!enabled)
+            referenceFrame = true;
+        return enabled && referenceFrame ? HdrFormats() : formats;
+    }
+
+    // reads the scene color texture and the tone mapped frame from the bound framebuffer, both width x height; the
+    // second frame of a pair is compared with the first
+    void capture(GLuint sceneTexture, int width, int height)
+    {
+        Capture &frame = referenceFrame ? reference : tested;
+        frame.width = width;
+        frame.height = height;
+        frame.scene.resize((size_t)width * height * 3);
+        frame.output.resize((size_t)width * height * 4);
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        glBindTexture(GL_TEXTURE_2D, sceneTexture);
+        glGetTexImage(GL_TEXTURE_2D, 0, GL_RGB, GL_FLOAT, frame.scene.data());
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, frame.output.data());
+        glPixelStorei(GL_PACK_ALIGNMENT, 4);
+        GLState().invalidate();
+        if (!referenceFrame && tested.width == reference.width && tested.height == reference.height)
+            compare();
+        referenceFrame = !referenceFrame;
+    }
+
+    const HdrFormatError &error() const
+    {
+        return lastError;
+    }
+
+private:
+    struct Capture {
+        int width = 0, height = 0;
+        std::vector<float> scene;
+        std::vector<unsigned char> output;
+    };
+
+    bool referenceFrame = true;
+    Capture reference, tested;
+    HdrFormatError lastError;
+
+    void compare()
+    {
+        HdrFormatError error;
+        error.measured = true;
+        double sum = 0.0;
+        size_t pixels = (size_t)reference.width * reference.height;
+        for (size_t i = 0; i < pixels; i++)
+            for (size_t channel = 0; channel < 3; channel++)
+            {
+                float difference = std::abs((float)tested.output[i * 4 + channel] - (float)reference.output[i * 4 + channel]);
+                error.maxOutput = std::max(error.maxOutput, difference);
+                sum += difference;
+                // relative to the reference, down to the darkest shades anyone could tell apart
+                float expected = reference.scene[i * 3 + channel];
+                float relative = std::abs(tested.scene[i * 3 + channel] - expected) / std::max(std::abs(expected), 1.0f / 256.0f);
+                error.maxScene = std::max(error.maxScene, relative);
+            }
+        error.meanOutput = pixels ? (float)(sum / (pixels * 3)) : 0.0f;
+        lastError = error;
+    }
+};
+#endif
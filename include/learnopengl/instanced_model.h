@@ -0,0 +1,283 @@
+#ifndef INSTANCED_MODEL_H
+#define INSTANCED_MODEL_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <learnopengl/bvh.h>
+#include <learnopengl/draw_stats.h>
+#include <learnopengl/gl_state.h>
+#include <learnopengl/mesh_lod.h>
+#include <learnopengl/model.h>
+#include <learnopengl/shader.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+// Any number of copies of a Model, each with its own transform, drawn with one instanced call per mesh and level of
+// detail.
+// The transforms live in slots of a growable buffer read by the vertex shader as a buffer texture (four RGBA32F texels
+// per slot). add() takes a slot off the free list or appends one and remove() puts it back, both O(1); the slots
+// changed since the last upload() are marked dirty and only those ranges are re-uploaded.
+// A draw gets the slots to draw (e.g. those left by culling). They are grouped by the LOD each instance picks per
+// mesh and streamed as one 32 bit slot index per instance to the instanced attribute at INSTANCE_LOCATION, so a frame
+// uploads 4 bytes per drawn instance instead of its matrix. Vertex shader side (instancing.vs):
+//   layout (location = 8) in uint aInstance;      // INSTANCE_LOCATION
+//   uniform samplerBuffer instanceTransforms;     // TRANSFORM_UNIT, four texels (columns) per slot
+class InstancedModel
+{
+public:
+    // per-instance attributes take locations 8-11, past everything the vertex layouts use (mesh.h)
+    static const GLuint FIRST_INSTANCE_LOCATION = 8, INSTANCE_LOCATION_COUNT = 4;
+    static const GLuint INSTANCE_LOCATION = FIRST_INSTANCE_LOCATION;
+    static const GLuint TRANSFORM_UNIT = 19;
+    // what add() returns when the buffer texture can't hold another slot
+    static const uint32_t INVALID_INSTANCE = ~0u;
+
+    // the model has to be finished loading; its meshes' vertex arrays get the instance attribute
+    explicit InstancedModel(Model &model) : model(model), instanceLods(model.meshes.size())
+    {
+        model.GetBounds(modelMin, modelMax);
+        GLint maxTexels = 0;
+        glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxTexels);
+        maxInstances = (size_t)maxTexels / 4;
+
+        glGenBuffers(1, &transformBuffer);
+        glGenTextures(1, &transformTexture);
+        glBindBuffer(GL_TEXTURE_BUFFER, transformBuffer);
+        glBufferData(GL_TEXTURE_BUFFER, sizeof(glm::mat4), nullptr, GL_DYNAMIC_DRAW);
+        glBindTexture(GL_TEXTURE_BUFFER, transformTexture);
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, transformBuffer);
+        glBindTexture(GL_TEXTURE_BUFFER, 0);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+        // the attribute always points into the stream buffer, so a plain draw through these vertex arrays stays valid
+        glGenBuffers(1, &streamBuffer);
+        glBindBuffer(GL_ARRAY_BUFFER, streamBuffer);
+        glBufferData(GL_ARRAY_BUFFER, streamCapacity, nullptr, GL_STREAM_DRAW);
+        for (Mesh &mesh : model.meshes)
+        {
+            glBindVertexArray(mesh.VAO);
+            glEnableVertexAttribArray(INSTANCE_LOCATION);
+            glVertexAttribIPointer(INSTANCE_LOCATION, 1, GL_UNSIGNED_INT, sizeof(uint32_t), (void*)0);
+            glVertexAttribDivisor(INSTANCE_LOCATION, 1);
+        }
+        glBindVertexArray(0);
+        GLState().invalidate();
+    }
+
+    ~InstancedModel()
+    {
+        glDeleteTextures(1, &transformTexture);
+        glDeleteBuffers(1, &transformBuffer);
+        glDeleteBuffers(1, &streamBuffer);
+    }
+
+    InstancedModel(const InstancedModel &) = delete;
+    InstancedModel &operator=(const InstancedModel &) = delete;
+
+    // returns the new instance's slot, INVALID_INSTANCE when the buffer texture is full
+    uint32_t add(const glm::mat4 &transform)
+    {
+        uint32_t slot;
+        if (!freeSlots.empty())
+        {
+            slot = freeSlots.back();
+            freeSlots.pop_back();
+        }
+        else
+        {
+            if (transforms.size() >= maxInstances)
+            {
+                std::cout << "WARNING::INSTANCING::buffer texture full at " << maxInstances << " instances" << std::endl;
+                return INVALID_INSTANCE;
+            }
+            slot = (uint32_t)transforms.size();
+            transforms.push_back(transform);
+            dirty.push_back(0);
+            for (vector<int> &lods : instanceLods)
+                lods.push_back(0);
+        }
+        for (vector<int> &lods : instanceLods)
+            lods[slot] = 0;
+        liveCount++;
+        setTransform(slot, transform);
+        return slot;
+    }
+
+    // the slot is reused by a later add(); nothing is uploaded, it is simply never drawn again
+    void remove(uint32_t instance)
+    {
+        freeSlots.push_back(instance);
+        liveCount--;
+    }
+
+    void setTransform(uint32_t instance, const glm::mat4 &transform)
+    {
+        transforms[instance] = transform;
+        dirty[instance] = 1;
+        dirtyBegin = std::min(dirtyBegin, (size_t)instance);
+        dirtyEnd = std::max(dirtyEnd, (size_t)instance + 1);
+    }
+
+    const glm::mat4 &transform(uint32_t instance) const
+    {
+        return transforms[instance];
+    }
+
+    // world space box of an instance
+    Aabb bounds(uint32_t instance) const
+    {
+        return Aabb::Transformed(modelMin, modelMax, transforms[instance]);
+    }
+
+    size_t size() const
+    {
+        return liveCount;
+    }
+
+    // most instances the buffer texture holds, GL_MAX_TEXTURE_BUFFER_SIZE / 4: only 16384 at the 65536 texels GL 3.3
+    // guarantees, though desktop drivers give millions
+    size_t capacity() const
+    {
+        return maxInstances;
+    }
+
+    // bytes the last upload() sent
+    size_t uploadedBytes() const
+    {
+        return lastUploadBytes;
+    }
+
+    // sends the transforms changed since the last call; call once a frame before drawing. Runs of dirty slots closer
+    // than MERGE_GAP are sent as one range.
+    void upload()
+    {
+        lastUploadBytes = 0;
+        glBindBuffer(GL_TEXTURE_BUFFER, transformBuffer);
+        if (allocatedSlots < transforms.size())
+        {
+            // grown: a new store of twice the size, everything goes up again
+            allocatedSlots = std::max(transforms.size(), allocatedSlots * 2);
+            glBufferData(GL_TEXTURE_BUFFER, allocatedSlots * sizeof(glm::mat4), nullptr, GL_DYNAMIC_DRAW);
+            dirtyBegin = 0;
+            dirtyEnd = transforms.size();
+            std::fill(dirty.begin(), dirty.end(), 1);
+        }
+        size_t slot = dirtyBegin;
+        while (slot < dirtyEnd)
+        {
+            if (!dirty[slot])
+            {
+                slot++;
+                continue;
+            }
+            size_t last = slot;
+            for (size_t next = slot + 1; next < dirtyEnd && next - last <= MERGE_GAP; next++)
+                if (dirty[next])
+                    last = next;
+            std::fill(dirty.begin() + slot, dirty.begin() + last + 1, 0);
+            size_t bytes = (last + 1 - slot) * sizeof(glm::mat4);
+            glBufferSubData(GL_TEXTURE_BUFFER, slot * sizeof(glm::mat4), bytes, &transforms[slot]);
+            lastUploadBytes += bytes;
+            slot = last + 1;
+        }
+        dirtyBegin = transforms.size();
+        dirtyEnd = 0;
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    }
+
+    // draws the given instances (slots), each at its own LOD per mesh; the material textures are left to the caller
+    void draw(Shader &shader, const uint32_t *instances, size_t count, const LodView &lodView)
+    {
+        if (count == 0)
+            return;
+        GLStateCache &state = GLState();
+        state.bindTextureBuffer(TRANSFORM_UNIT, transformTexture);
+
+        // slot indices of every mesh grouped by LOD, all in one upload
+        grouped.resize(model.meshes.size() * count);
+        groupStarts.clear();
+        for (size_t i = 0; i < model.meshes.size(); i++)
+        {
+            Mesh &mesh = model.meshes[i];
+            vector<int> &lods = instanceLods[i];
+            size_t meshStart = i * count;
+            size_t start = groupStarts.size();
+            groupStarts.resize(start + mesh.lods.size() + 1, meshStart);
+            for (size_t j = 0; j < count; j++)
+            {
+                uint32_t instance = instances[j];
+                lods[instance] = SelectLod(mesh, transforms[instance], lodView, lods[instance]);
+                groupStarts[start + lods[instance] + 1]++;
+            }
+            for (size_t lod = 0; lod < mesh.lods.size(); lod++)
+                groupStarts[start + lod + 1] += groupStarts[start + lod] - meshStart;
+            fillPositions.assign(groupStarts.begin() + start, groupStarts.end() - 1);
+            for (size_t j = 0; j < count; j++)
+                grouped[fillPositions[lods[instances[j]]]++] = instances[j];
+        }
+
+        size_t bytes = grouped.size() * sizeof(uint32_t);
+        glBindBuffer(GL_ARRAY_BUFFER, streamBuffer);
+        if (streamCursor + bytes > streamCapacity)
+        {
+            // orphaned once full, the draws still reading the old store keep it
+            streamCapacity = std::max(streamCapacity, bytes * 2);
+            glBufferData(GL_ARRAY_BUFFER, streamCapacity, nullptr, GL_STREAM_DRAW);
+            streamCursor = 0;
+        }
+        glBufferSubData(GL_ARRAY_BUFFER, streamCursor, bytes, grouped.data());
+
+        size_t start = 0;
+        for (Mesh &mesh : model.meshes)
+        {
+            shader.set(uniforms::dequantization, mesh.dequantization);
+            state.bindVertexArray(mesh.VAO);
+            size_t indexSize = mesh.indexType == GL_UNSIGNED_SHORT ? sizeof(uint16_t) : sizeof(unsigned int);
+            for (size_t lod = 0; lod < mesh.lods.size(); lod++)
+            {
+                size_t first = groupStarts[start + lod], instancesInGroup = groupStarts[start + lod + 1] - first;
+                if (instancesInGroup == 0)
+                    continue;
+                glVertexAttribIPointer(INSTANCE_LOCATION, 1, GL_UNSIGNED_INT, sizeof(uint32_t),
+                                       (void*)(streamCursor + first * sizeof(uint32_t)));
+                const MeshLod &range = mesh.lods[lod];
+                glDrawElementsInstancedBaseVertex(GL_TRIANGLES, range.indexCount, mesh.indexType,
+                                                  (void*)((mesh.firstIndex + range.indexOffset) * indexSize),
+                                                  (GLsizei)instancesInGroup, mesh.baseVertex);
+                FrameDrawStats().drawCalls++;
+                FrameDrawStats().meshes++;
+            }
+            start += mesh.lods.size() + 1;
+        }
+        streamCursor += bytes;
+    }
+
+private:
+    static const size_t MERGE_GAP = 16;
+
+    Model &model;
+    glm::vec3 modelMin, modelMax;
+    size_t maxInstances = 0;
+    // CPU copy of every slot, what upload() sends from
+    vector<glm::mat4> transforms;
+    vector<uint8_t> dirty;
+    vector<uint32_t> freeSlots;
+    size_t liveCount = 0;
+    size_t dirtyBegin = 0, dirtyEnd = 0;   // every dirty slot is in [dirtyBegin, dirtyEnd)
+    size_t allocatedSlots = 0;
+    size_t lastUploadBytes = 0;
+    // LOD each slot was drawn with last, per mesh (hysteresis of SelectLod)
+    vector<vector<int>> instanceLods;
+
+    GLuint transformBuffer = 0, transformTexture = 0;
+    GLuint streamBuffer = 0;
+    size_t streamCapacity = 64 * 1024, streamCursor = 0;
+    // per draw scratch
+    vector<uint32_t> grouped;
+    vector<size_t> groupStarts, fillPositions;
+};
+#endif
@@ -0,0 +1,165 @@
+#ifndef KTX_H
+#define KTX_H
+
+#include <glad/glad.h>
+
+#include <learnopengl/gl_ext.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+using namespace std;
+
+// Minimal reader/writer for KTX 1.1 files (https://registry.khronos.org/KTX/specs/1.0/ktxspec.v1.html) holding a
+// single 2D compressed texture with its full mip chain. That is all the texture transcoder writes and all the
+// loader needs, cube maps, arrays and uncompressed payloads are rejected.
+const unsigned char KTX_IDENTIFIER[12] = { 0xAB, 0x4B, 0x54, 0x58, 0x20, 0x31, 0x31, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A };
+const uint32_t KTX_ENDIANNESS = 0x04030201;
+
+struct KtxHeader {
+    unsigned char identifier[12];
+    uint32_t endianness;
+    uint32_t glType;
+    uint32_t glTypeSize;
+    uint32_t glFormat;
+    uint32_t glInternalFormat;
+    uint32_t glBaseInternalFormat;
+    uint32_t pixelWidth;
+    uint32_t pixelHeight;
+    uint32_t pixelDepth;
+    uint32_t numberOfArrayElements;
+    uint32_t numberOfFaces;
+    uint32_t numberOfMipmapLevels;
+    uint32_t bytesOfKeyValueData;
+};
+
+struct KtxLevel {
+    size_t offset; // into KtxTexture::data
+    size_t size;
+};
+
+struct KtxTexture {
+    GLenum internalFormat = 0;     // e.g. GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+    GLenum baseInternalFormat = 0; // GL_RED, GL_RG, GL_RGB or GL_RGBA
+    int width = 0;
+    int height = 0;
+    vector<unsigned char> data;   // all mip levels back to back, level 0 first
+    vector<KtxLevel> levels;
+
+    bool empty() const
+    {
+        return levels.empty();
+    }
+
+    size_t byteSize() const
+    {
+        return data.size();
+    }
+};
+
+// bytes per 4x4 block of the compressed formats the transcoder writes, 0 for any other format
+inline size_t KtxBlockBytes(GLenum internalFormat)
+{
+    switch (internalFormat)
+    {
+        case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+        case GL_COMPRESSED_RED_RGTC1:
+            return 8;
+        case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+        case GL_COMPRESSED_RG_RGTC2:
+        case GL_COMPRESSED_RGBA_BPTC_UNORM:
+            return 16;
+    }
+    return 0;
+}
+
+// Everything read from the file is checked before it is used: the format, the level count against the full mip chain
+// and every level's size against what its blocks take, so a corrupt or truncated file is rejected (and the loader
+// falls back to the source image) instead of allocating whatever a size field says.
+inline bool ReadKtx(const string &filename, KtxTexture &texture)
+{
+    ifstream in(filename, ios::binary | ios::ate);
+    if (!in)
+        return false;
+    size_t fileSize = (size_t)in.tellg();
+    in.seekg(0);
+    KtxHeader header;
+    if (!in.read((char *)&header, sizeof(header)))
+        return false;
+    if (memcmp(header.identifier, KTX_IDENTIFIER, sizeof(KTX_IDENTIFIER)) != 0 || header.endianness != KTX_ENDIANNESS ||
+        header.glType != 0 || header.pixelDepth > 1 || header.numberOfArrayElements > 1 || header.numberOfFaces != 1 ||
+        header.pixelWidth == 0 || header.pixelHeight == 0)
+        return false;
+    size_t blockBytes = KtxBlockBytes(header.glInternalFormat);
+    uint32_t fullChain = 1;
+    for (uint32_t size = max(header.pixelWidth, header.pixelHeight); size > 1; size /= 2)
+        fullChain++;
+    if (blockBytes == 0 || header.numberOfMipmapLevels > fullChain)
+        return false;
+    in.seekg(header.bytesOfKeyValueData, ios::cur);
+
+    texture.internalFormat = header.glInternalFormat;
+    texture.baseInternalFormat = header.glBaseInternalFormat;
+    texture.width = (int)header.pixelWidth;
+    texture.height = (int)header.pixelHeight;
+    texture.data.clear();
+    texture.levels.clear();
+    uint32_t numLevels = header.numberOfMipmapLevels ? header.numberOfMipmapLevels : 1;
+    for (uint32_t level = 0; level < numLevels; level++)
+    {
+        uint32_t imageSize;
+        if (!in.read((char *)&imageSize, sizeof(imageSize)))
+            return false;
+        size_t blocksX = (max(header.pixelWidth >> level, 1u) + 3) / 4;
+        size_t blocksY = (max(header.pixelHeight >> level, 1u) + 3) / 4;
+        if (imageSize != blocksX * blocksY * blockBytes || (size_t)in.tellg() + imageSize > fileSize)
+            return false;
+        KtxLevel entry = { texture.data.size(), imageSize };
+        texture.data.resize(entry.offset + imageSize);
+        if (!in.read((char *)texture.data.data() + entry.offset, imageSize))
+            return false;
+        texture.levels.push_back(entry);
+        in.seekg((4 - imageSize % 4) % 4, ios::cur); // mipPadding
+    }
+    return true;
+}
+
+inline bool WriteKtx(const string &filename, const KtxTexture &texture)
+{
+    KtxHeader header = {};
+    memcpy(header.identifier, KTX_IDENTIFIER, sizeof(KTX_IDENTIFIER));
+    header.endianness = KTX_ENDIANNESS;
+    header.glTypeSize = 1;
+    header.glInternalFormat = texture.internalFormat;
+    header.glBaseInternalFormat = texture.baseInternalFormat;
+    header.pixelWidth = (uint32_t)texture.width;
+    header.pixelHeight = (uint32_t)texture.height;
+    header.numberOfFaces = 1;
+    header.numberOfMipmapLevels = (uint32_t)texture.levels.size();
+
+    // written under a temporary name and renamed into place, so an interrupted write never leaves a partial file that
+    // looks up to date next to the image
+    string tmpFilename = filename + ".tmp";
+    ofstream out(tmpFilename, ios::binary | ios::trunc);
+    out.write((const char *)&header, sizeof(header));
+    for (const KtxLevel &level : texture.levels)
+    {
+        uint32_t imageSize = (uint32_t)level.size;
+        static const char padding[4] = {};
+        out.write((const char *)&imageSize, sizeof(imageSize));
+        out.write((const char *)texture.data.data() + level.offset, level.size);
+        out.write(padding, (4 - imageSize % 4) % 4);
+    }
+    out.close();
+    if (!out || rename(tmpFilename.c_str(), filename.c_str()) != 0)
+    {
+        remove(tmpFilename.c_str());
+        return false;
+    }
+    return true;
+}
+#endif
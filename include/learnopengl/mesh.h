@@ -5,9 +5,13 @@
 
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/packing.hpp>
 
+#include <learnopengl/draw_stats.h>
+#include <learnopengl/gl_state.h>
 #include <learnopengl/shader.h>
 
+#include <cstdint>
 #include <string>
 #include <vector>
 using namespace std;
@@ -25,7 +29,218 @@ struct Vertex {
     glm::vec3 Bitangent;
 };
 
+// Compact vertex as it is stored on the GPU (20 bytes instead of the 56 of Vertex):
+//   position   unsigned normalized 16 bit, relative to the bounds of the mesh (see Mesh::dequantization)
+//   normal     octahedral encoding, signed normalized 16 bit
+//   tangent    octahedral encoding, the bitangent is cross(normal, tangent) * handedness
+//   texCoords  half floats
+// The fourth position component holds the handedness, 0 for -1 and 1 for +1.
+struct PackedVertex {
+    uint16_t Position[4];
+    int16_t Normal[2];
+    int16_t Tangent[2];
+    uint16_t TexCoords[2];
+};
+
+// Position-only copy of a PackedVertex for the depth pre-pass, 8 bytes: the same quantized position (w unused),
+// padded so every vertex stays 4 byte aligned
+struct PackedPosition {
+    uint16_t Position[4];
+};
+
+// Octahedral encoding of a unit vector into [-1, 1]^2
+inline glm::vec2 OctahedralEncode(glm::vec3 n)
+{
+    float length = glm::abs(n.x) + glm::abs(n.y) + glm::abs(n.z);
+    if (length == 0.0f)
+        return glm::vec2(0.0f);
+    n /= length;
+    glm::vec2 encoded(n.x, n.y);
+    if (n.z < 0.0f)
+    {
+        glm::vec2 signs(encoded.x >= 0.0f ? 1.0f : -1.0f, encoded.y >= 0.0f ? 1.0f : -1.0f);
+        encoded = (1.0f - glm::abs(glm::vec2(encoded.y, encoded.x))) * signs;
+    }
+    return encoded;
+}
+
+inline int16_t PackSnorm16(float value)
+{
+    return (int16_t)glm::round(glm::clamp(value, -1.0f, 1.0f) * 32767.0f);
+}
+
+// Per vertex type: how Mesh converts the loaded vertices before the upload and which attribute pointers it sets.
+// Attribute locations stay 0 position, 1 normal, 2 texCoords, 3 tangent (4 bitangent where stored) for every layout;
+// shaders are compiled with shaderDefines() to read the matching types. Locations 8-11 are reserved for per-instance
+// attributes (instanced_model.h).
+template <typename V>
+struct VertexLayout;
+
+template <>
+struct VertexLayout<Vertex> {
+    static const char *shaderDefines()
+    {
+        return "";
+    }
+
+    // uploaded as is
+    static const Vertex *pack(const Vertex *vertices, size_t, vector<Vertex> &, glm::mat4 &dequantization)
+    {
+        dequantization = glm::mat4(1.0f);
+        return vertices;
+    }
+
+    static void setAttributes()
+    {
+        // vertex Positions
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
+        // vertex normals
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Normal));
+        // vertex texture coords
+        glEnableVertexAttribArray(2);
+        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords));
+        // vertex tangent
+        glEnableVertexAttribArray(3);
+        glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Tangent));
+        // vertex bitangent
+        glEnableVertexAttribArray(4);
+        glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Bitangent));
+    }
+
+    // position-only stream of the depth pre-pass, 12 bytes a vertex
+    typedef glm::vec3 Position;
+
+    static Position position(const Vertex &vertex)
+    {
+        return vertex.Position;
+    }
+
+    static void setPositionAttributes()
+    {
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Position), (void*)0);
+    }
+};
+
+template <>
+struct VertexLayout<PackedVertex> {
+    static const char *shaderDefines()
+    {
+        return "#define PACKED_VERTICES\n";
+    }
+
+    // quantizes the vertices into packed, dequantization maps the [0, 1] positions back into model space
+    static const PackedVertex *pack(const Vertex *vertices, size_t numVertices, vector<PackedVertex> &packed,
+                                    glm::mat4 &dequantization)
+    {
+        glm::vec3 minimum(0.0f), maximum(0.0f);
+        if (numVertices)
+            minimum = maximum = vertices[0].Position;
+        for (size_t i = 1; i < numVertices; i++)
+        {
+            minimum = glm::min(minimum, vertices[i].Position);
+            maximum = glm::max(maximum, vertices[i].Position);
+        }
+        glm::vec3 extent = maximum - minimum;
+        for (int axis = 0; axis < 3; axis++)
+            if (extent[axis] <= 0.0f)
+                extent[axis] = 1.0f; // flat along this axis, every vertex quantizes to 0
+        dequantization = glm::scale(glm::translate(glm::mat4(1.0f), minimum), extent);
+
+        packed.resize(numVertices);
+        for (size_t i = 0; i < numVertices; i++)
+        {
+            const Vertex &vertex = vertices[i];
+            PackedVertex &out = packed[i];
+            glm::vec3 position = (vertex.Position - minimum) / extent;
+            for (int axis = 0; axis < 3; axis++)
+                out.Position[axis] = (uint16_t)glm::round(glm::clamp(position[axis], 0.0f, 1.0f) * 65535.0f);
+            bool rightHanded = glm::dot(glm::cross(vertex.Normal, vertex.Tangent), vertex.Bitangent) >= 0.0f;
+            out.Position[3] = rightHanded ? 65535 : 0;
+
+            glm::vec2 normal = OctahedralEncode(vertex.Normal);
+            glm::vec2 tangent = OctahedralEncode(vertex.Tangent);
+            out.Normal[0] = PackSnorm16(normal.x);
+            out.Normal[1] = PackSnorm16(normal.y);
+            out.Tangent[0] = PackSnorm16(tangent.x);
+            out.Tangent[1] = PackSnorm16(tangent.y);
+            out.TexCoords[0] = glm::packHalf1x16(vertex.TexCoords.x);
+            out.TexCoords[1] = glm::packHalf1x16(vertex.TexCoords.y);
+        }
+        return packed.data();
+    }
+
+    static void setAttributes()
+    {
+        // quantized position + tangent handedness
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 4, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(PackedVertex), (void*)offsetof(PackedVertex, Position));
+        // octahedral normal
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 2, GL_SHORT, GL_TRUE, sizeof(PackedVertex), (void*)offsetof(PackedVertex, Normal));
+        // half float texture coords
+        glEnableVertexAttribArray(2);
+        glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, sizeof(PackedVertex), (void*)offsetof(PackedVertex, TexCoords));
+        // octahedral tangent
+        glEnableVertexAttribArray(3);
+        glVertexAttribPointer(3, 2, GL_SHORT, GL_TRUE, sizeof(PackedVertex), (void*)offsetof(PackedVertex, Tangent));
+    }
+
+    // position-only stream of the depth pre-pass, the quantized values as they are so both passes compute the same
+    // clip space position
+    typedef PackedPosition Position;
+
+    static Position position(const PackedVertex &vertex)
+    {
+        Position position = { { vertex.Position[0], vertex.Position[1], vertex.Position[2], 0 } };
+        return position;
+    }
+
+    static void setPositionAttributes()
+    {
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 4, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(Position), (void*)0);
+    }
+};
+
+// the layout meshes are uploaded with, build with -DMESH_FULL_PRECISION_VERTICES to compare against plain floats
+#ifdef MESH_FULL_PRECISION_VERTICES
+typedef Vertex GpuVertex;
+#else
+typedef PackedVertex GpuVertex;
+#endif
+
+// prepend to the vertex shaders that draw meshes
+inline const char *MeshShaderDefines()
+{
+    return VertexLayout<GpuVertex>::shaderDefines();
+}
+
+// Uploads the positions of the given vertices on their own into buffer, behind a vertex array that shares
+// indexBuffer with the full one. The depth pre-pass (render_queue.h) draws through it and only fetches the positions.
+inline void SetupPositionStream(const GpuVertex *vertices, size_t numVertices, GLuint indexBuffer, GLuint &vertexArray,
+                                GLuint &buffer)
+{
+    typedef VertexLayout<GpuVertex>::Position Position;
+    vector<Position> positions(numVertices);
+    for (size_t i = 0; i < numVertices; i++)
+        positions[i] = VertexLayout<GpuVertex>::position(vertices[i]);
+
+    glGenVertexArrays(1, &vertexArray);
+    glGenBuffers(1, &buffer);
+    glBindVertexArray(vertexArray);
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    glBufferData(GL_ARRAY_BUFFER, numVertices * sizeof(Position), positions.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+    VertexLayout<GpuVertex>::setPositionAttributes();
+    glBindVertexArray(0);
+}
 
+namespace uniforms {
+constexpr Uniform<glm::mat4> dequantization("dequantization");
+}
 
 struct Texture {
     unsigned int id;
@@ -33,72 +248,176 @@ struct Texture {
     string path;
 };
 
+// one level of detail: a range of the mesh's index buffer and how far (in mesh units) it deviates from LOD 0
+struct MeshLod {
+    uint32_t indexOffset;
+    uint32_t indexCount;
+    float error;
+};
+
+// what a mesh keeps in system memory once it is on the GPU. Static geometry only needs the counts and bounds;
+// keep the arrays for code that reads them back later (e.g. CPU picking or re-batching).
+enum class MeshResidency {
+    GpuOnly,
+    KeepCpuCopy
+};
+
 class Mesh {
 public:
-    // mesh Data
+    // mesh Data, the vertex and index arrays are released by setupMesh() unless asked to keep them
     vector<Vertex>       vertices;
     vector<unsigned int> indices;
     vector<Texture>      textures;
+    unsigned int numIndices; // of LOD 0
+    // index ranges of LOD 0 and the simplified levels (see mesh_lod.h), all in the one index buffer
+    vector<MeshLod> lods;
+    // bounding sphere in model space, for LOD selection, and the box around the vertices, for frustum culling
+    glm::vec3 boundsCenter = glm::vec3(0.0f);
+    float boundsRadius = 0.0f;
+    glm::vec3 boundsMin = glm::vec3(0.0f);
+    glm::vec3 boundsMax = glm::vec3(0.0f);
+
+    unsigned int VAO = 0;
+    // positions only, over the same indices (see SetupPositionStream)
+    unsigned int depthVAO = 0;
+    // maps the positions stored in the vertex buffer back to model space (identity unless they are quantized)
+    glm::mat4 dequantization = glm::mat4(1.0f);
+    size_t numVertices = 0;
+    // GL_UNSIGNED_SHORT for meshes with at most 65536 vertices, GL_UNSIGNED_INT otherwise
+    GLenum indexType = GL_UNSIGNED_INT;
+    // where the mesh starts in its buffers, non-zero when it is part of a StaticBatch (static_batch.h)
+    GLint baseVertex = 0;
+    size_t firstIndex = 0;
+    // constructor, only stores the data so meshes can be built on a loader thread. setupMesh() has to be called on
+    // the GL thread before the mesh is drawn.
+    // indices may hold further LODs after LOD 0, lods describes them (empty: all indices are LOD 0)
+    // the arrays are taken over, pass them with std::move to avoid copying the geometry
+    Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures, vector<MeshLod> lods = vector<MeshLod>())
+        : vertices(std::move(vertices)), indices(std::move(indices)), textures(std::move(textures))
+    {
+        setLods(std::move(lods), this->indices.size());
+        resolveTextureUnits();
+    }
 
-    unsigned int VAO;
-    std::string glslIdentifierPrefix;
-    // constructor
-    Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures)
+    // constructor for data that already lives somewhere else (e.g. a memory mapped model cache): the arrays are
+    // uploaded straight from the given pointers and no CPU-side copy is kept. They have to stay valid until setupMesh().
+    Mesh(const Vertex *vertexData, size_t numVertices, const unsigned int *indexData, size_t numIndices, vector<Texture> textures,
+         vector<MeshLod> lods = vector<MeshLod>())
+        : textures(std::move(textures))
     {
-        this->vertices = vertices;
-        this->indices = indices;
-        this->textures = textures;
+        setLods(std::move(lods), numIndices);
+        resolveTextureUnits();
+        this->externalVertices = vertexData;
+        this->numExternalVertices = numVertices;
+        this->externalIndices = indexData;
+    }
 
-        // now that we have all the required data, set the vertex buffers and its attribute pointers.
-        setupMesh();
+    // the vertex array, buffers and mapped arrays are not shared, so meshes are moved and never copied
+    Mesh(const Mesh &) = delete;
+    Mesh &operator=(const Mesh &) = delete;
+    Mesh(Mesh &&) = default;
+    Mesh &operator=(Mesh &&) = default;
+
+    // now that we have all the required data, set the vertex buffers and its attribute pointers.
+    // Afterwards only the counts, LOD ranges and bounds are kept on the CPU unless residency says otherwise.
+    void setupMesh(MeshResidency residency = MeshResidency::GpuOnly)
+    {
+        if (!vertices.empty())
+            setupMesh(vertices.data(), vertices.size(), indices.data());
+        else
+            setupMesh(externalVertices, numExternalVertices, externalIndices);
+        releaseGeometry(residency);
     }
 
-    // render the mesh
-    void Draw(Shader &shader)
+    // system memory held by the vertex and index arrays
+    size_t cpuGeometryBytes() const
     {
-        // bind appropriate textures
+        return vertices.capacity() * sizeof(Vertex) + indices.capacity() * sizeof(unsigned int);
+    }
+
+    // render the mesh at the given level of detail
+    // (vertex array and textures are bound through GLState() and left bound for the next draw)
+    void Draw(Shader &shader, int lod = 0)
+    {
+        bindTextures();
+        shader.set(uniforms::dequantization, dequantization);
+
+        // draw mesh
+        GLState().bindVertexArray(VAO);
+        drawElements(lod);
+    }
+
+    // render only the depth of the mesh from its position stream, for the depth pre-pass
+    // (the program needs nothing but the positions, "model" and "dequantization")
+    void DrawDepth(Shader &shader, int lod = 0)
+    {
+        shader.set(uniforms::dequantization, dequantization);
+        GLState().bindVertexArray(depthVAO);
+        drawElements(lod);
+    }
+
+    // binds the textures to their material units (MaterialTextureUnit), skipping the ones already bound
+    void bindTextures()
+    {
+        for(unsigned int i = 0; i < textures.size(); i++)
+            if (textureUnits[i] >= 0)
+                GLState().bindTexture(textureUnits[i], textures[i].id);
+    }
+
+    // identifies the set of textures for sorting draws by material
+    unsigned int materialKey() const
+    {
+        return textures.empty() ? 0 : textures[0].id;
+    }
+
+private:
+    friend class StaticBatch;
+
+    // unit of every texture (MaterialTextureUnit), the samplers were pointed at them when the shader was linked
+    vector<int> textureUnits;
+
+    void resolveTextureUnits()
+    {
+        // the N in texture_diffuseN counts the textures of a type
         unsigned int diffuseNr  = 1;
         unsigned int specularNr = 1;
         unsigned int normalNr   = 1;
         unsigned int heightNr   = 1;
-        for(unsigned int i = 0; i < textures.size(); i++)
+        textureUnits.clear();
+        for (const Texture &texture : textures)
         {
-            glActiveTexture(GL_TEXTURE0 + i); // active proper texture unit before binding
-            // retrieve texture number (the N in diffuse_textureN)
-            string number;
-            string name = textures[i].type;
-            if(name == "texture_diffuse")
-                number = std::to_string(diffuseNr++);
-            else if(name == "texture_specular")
-                number = std::to_string(specularNr++); // transfer unsigned int to stream
-            else if(name == "texture_normal")
-                number = std::to_string(normalNr++); // transfer unsigned int to stream
-            else if(name == "texture_height")
-                number = std::to_string(heightNr++); // transfer unsigned int to stream
-
-            // now set the sampler to the correct texture unit
-            glUniform1i(glGetUniformLocation(shader.ID, (glslIdentifierPrefix + name + number).c_str()), i);
-            // and finally bind the texture
-            glBindTexture(GL_TEXTURE_2D, textures[i].id);
+            unsigned int number = 0;
+            if(texture.type == "texture_diffuse")
+                number = diffuseNr++;
+            else if(texture.type == "texture_specular")
+                number = specularNr++;
+            else if(texture.type == "texture_normal")
+                number = normalNr++;
+            else if(texture.type == "texture_height")
+                number = heightNr++;
+            textureUnits.push_back(MaterialTextureUnit(texture.type, number));
         }
+    }
 
+    // render data (0 when the mesh lives in a StaticBatch's buffers)
+    unsigned int VBO = 0, EBO = 0, positionVBO = 0;
+    // arrays owned by someone else, only valid until setupMesh()
+    const Vertex *externalVertices = nullptr;
+    size_t numExternalVertices = 0;
+    const unsigned int *externalIndices = nullptr;
+    size_t totalIndices = 0; // all LODs
 
-
-        // draw mesh
-        glBindVertexArray(VAO);
-        glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
-        glBindVertexArray(0);
-
-        // always good practice to set everything back to defaults once configured.
-        glActiveTexture(GL_TEXTURE0);
+    void setLods(vector<MeshLod> levels, size_t indexCount)
+    {
+        lods = std::move(levels);
+        if (lods.empty())
+            lods.push_back({ 0, (uint32_t)indexCount, 0.0f });
+        numIndices = lods[0].indexCount;
+        totalIndices = indexCount;
     }
 
-private:
-    // render data
-    unsigned int VBO, EBO;
-
     // initializes all the buffer objects/arrays
-    void setupMesh()
+    void setupMesh(const Vertex *vertexData, size_t numVertices, const unsigned int *indexData)
     {
         // create buffers/arrays
         glGenVertexArrays(1, &VAO);
@@ -106,34 +425,74 @@ private:
         glGenBuffers(1, &EBO);
 
         glBindVertexArray(VAO);
-        // load data into vertex buffers
+        // convert into the GPU vertex layout (a no-op for the full precision one) and load it into the vertex buffer
+        vector<GpuVertex> converted;
+        const GpuVertex *gpuVertices = VertexLayout<GpuVertex>::pack(vertexData, numVertices, converted, dequantization);
+        this->numVertices = numVertices;
+        computeBounds(vertexData, numVertices);
         glBindBuffer(GL_ARRAY_BUFFER, VBO);
-        // A great thing about structs is that their memory layout is sequential for all its items.
-        // The effect is that we can simply pass a pointer to the struct and it translates perfectly to a glm::vec3/2 array which
-        // again translates to 3/2 floats which translates to a byte array.
-        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);
+        glBufferData(GL_ARRAY_BUFFER, numVertices * sizeof(GpuVertex), gpuVertices, GL_STATIC_DRAW);
 
+        // small meshes get 16 bit indices, half the index buffer
         glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
+        if (numVertices <= 65536)
+        {
+            vector<uint16_t> shortIndices(indexData, indexData + totalIndices);
+            indexType = GL_UNSIGNED_SHORT;
+            glBufferData(GL_ELEMENT_ARRAY_BUFFER, totalIndices * sizeof(uint16_t), shortIndices.data(), GL_STATIC_DRAW);
+        }
+        else
+        {
+            indexType = GL_UNSIGNED_INT;
+            glBufferData(GL_ELEMENT_ARRAY_BUFFER, totalIndices * sizeof(unsigned int), indexData, GL_STATIC_DRAW);
+        }
 
         // set the vertex attribute pointers
-        // vertex Positions
-        glEnableVertexAttribArray(0);
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
-        // vertex normals
-        glEnableVertexAttribArray(1);
-        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Normal));
-        // vertex texture coords
-        glEnableVertexAttribArray(2);
-        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords));
-        // vertex tangent
-        glEnableVertexAttribArray(3);
-        glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Tangent));
-        // vertex bitangent
-        glEnableVertexAttribArray(4);
-        glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Bitangent));
+        VertexLayout<GpuVertex>::setAttributes();
 
         glBindVertexArray(0);
+        SetupPositionStream(gpuVertices, numVertices, EBO, depthVAO, positionVBO);
+    }
+
+    // draws the index range of a level of detail from the bound vertex array
+    void drawElements(int lod)
+    {
+        const MeshLod &range = lods[lod];
+        size_t indexSize = indexType == GL_UNSIGNED_SHORT ? sizeof(uint16_t) : sizeof(unsigned int);
+        glDrawElementsBaseVertex(GL_TRIANGLES, range.indexCount, indexType, (void*)((firstIndex + range.indexOffset) * indexSize),
+                                 baseVertex);
+        FrameDrawStats().drawCalls++;
+        FrameDrawStats().meshes++;
+    }
+
+    // drops the CPU-side arrays once they are on the GPU
+    void releaseGeometry(MeshResidency residency)
+    {
+        externalVertices = nullptr;
+        externalIndices = nullptr;
+        if (residency == MeshResidency::GpuOnly)
+        {
+            // swap with empty vectors, clear() would keep the capacity
+            vector<Vertex>().swap(vertices);
+            vector<unsigned int>().swap(indices);
+        }
+    }
+
+    // sphere around the bounding box, loose but cheap
+    void computeBounds(const Vertex *vertexData, size_t numVertices)
+    {
+        if (numVertices == 0)
+            return;
+        glm::vec3 minimum = vertexData[0].Position, maximum = minimum;
+        for (size_t i = 1; i < numVertices; i++)
+        {
+            minimum = glm::min(minimum, vertexData[i].Position);
+            maximum = glm::max(maximum, vertexData[i].Position);
+        }
+        boundsMin = minimum;
+        boundsMax = maximum;
+        boundsCenter = (minimum + maximum) * 0.5f;
+        boundsRadius = glm::length(maximum - minimum) * 0.5f;
     }
 };
 #endif
\ No newline at end of file
@@ -0,0 +1,307 @@
+#ifndef MESH_LOD_H
+#define MESH_LOD_H
+
+#include <learnopengl/mesh.h>
+#include <learnopengl/mesh_optimizer.h>
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+using namespace std;
+
+// Level of detail chains. Each LOD is an index range into the mesh's single index buffer over the shared vertex buffer,
+// produced at import by a quadric error metric simplifier (Garland & Heckbert, "Surface Simplification Using Quadric
+// Error Metrics", 1997) that collapses vertices onto neighbouring ones, so no new vertices are created. Vertices on
+// open borders and UV/normal seams are kept in place, which preserves silhouettes and texture mapping.
+// At draw time the coarsest LOD whose geometric error projects to at most LodView::maxPixelError pixels is used.
+
+// a symmetric 4x4 matrix accumulating squared distances to planes, weighted by triangle area
+struct Quadric {
+    double a00 = 0, a01 = 0, a02 = 0, a03 = 0, a11 = 0, a12 = 0, a13 = 0, a22 = 0, a23 = 0, a33 = 0;
+    double weight = 0;
+
+    void addPlane(const glm::dvec3 &n, double d, double w)
+    {
+        a00 += w * n.x * n.x; a01 += w * n.x * n.y; a02 += w * n.x * n.z; a03 += w * n.x * d;
+        a11 += w * n.y * n.y; a12 += w * n.y * n.z; a13 += w * n.y * d;
+        a22 += w * n.z * n.z; a23 += w * n.z * d;
+        a33 += w * d * d;
+        weight += w;
+    }
+
+    Quadric &operator+=(const Quadric &q)
+    {
+        a00 += q.a00; a01 += q.a01; a02 += q.a02; a03 += q.a03;
+        a11 += q.a11; a12 += q.a12; a13 += q.a13;
+        a22 += q.a22; a23 += q.a23;
+        a33 += q.a33;
+        weight += q.weight;
+        return *this;
+    }
+
+    // mean squared distance of p to the accumulated planes
+    double error(const glm::vec3 &p) const
+    {
+        double x = p.x, y = p.y, z = p.z;
+        double e = a00 * x * x + 2 * a01 * x * y + 2 * a02 * x * z + 2 * a03 * x
+                 + a11 * y * y + 2 * a12 * y * z + 2 * a13 * y
+                 + a22 * z * z + 2 * a23 * z
+                 + a33;
+        return weight > 0 ? fabs(e) / weight : 0.0;
+    }
+};
+
+// Simplifies an indexed triangle list towards targetIndexCount indices without exceeding maxError (in mesh units).
+// Returns the new index list; error receives the largest error of the collapses made.
+inline vector<unsigned int> SimplifyMesh(const vector<Vertex> &vertices, const vector<unsigned int> &indices,
+                                         size_t targetIndexCount, float maxError, float &error)
+{
+    const size_t numVertices = vertices.size();
+    error = 0.0f;
+
+    // vertices sharing a position are seams (different normals or texture coordinates), they stay where they are
+    vector<unsigned int> positionId(numVertices);
+    vector<bool> locked(numVertices, false);
+    {
+        struct PositionHash {
+            size_t operator()(const glm::vec3 &p) const
+            {
+                uint32_t bits[3];
+                memcpy(bits, &p, sizeof(bits));
+                return (size_t)bits[0] * 73856093u ^ (size_t)bits[1] * 19349663u ^ (size_t)bits[2] * 83492791u;
+            }
+        };
+        unordered_map<glm::vec3, unsigned int, PositionHash> firstWithPosition;
+        firstWithPosition.reserve(numVertices);
+        for (unsigned int v = 0; v < numVertices; v++)
+        {
+            auto inserted = firstWithPosition.emplace(vertices[v].Position, v);
+            positionId[v] = inserted.first->second;
+            if (!inserted.second)
+                locked[v] = locked[inserted.first->second] = true;
+        }
+    }
+    // so are vertices on open (or non-manifold) edges
+    {
+        unordered_map<uint64_t, int> edgeUses;
+        edgeUses.reserve(indices.size());
+        for (size_t i = 0; i < indices.size(); i += 3)
+            for (int k = 0; k < 3; k++)
+            {
+                uint64_t a = indices[i + k], b = indices[i + (k + 1) % 3];
+                edgeUses[min(a, b) << 32 | max(a, b)]++;
+            }
+        for (auto &edge : edgeUses)
+            if (edge.second != 2)
+                locked[edge.first >> 32] = locked[edge.first & 0xffffffffu] = true;
+    }
+
+    // quadrics per position, so seam vertices see the planes of all triangles around them
+    vector<Quadric> quadrics(numVertices);
+    for (size_t i = 0; i < indices.size(); i += 3)
+    {
+        glm::dvec3 p0 = vertices[indices[i]].Position, p1 = vertices[indices[i + 1]].Position, p2 = vertices[indices[i + 2]].Position;
+        glm::dvec3 normal = glm::cross(p1 - p0, p2 - p0);
+        double doubleArea = glm::length(normal);
+        if (doubleArea == 0.0)
+            continue;
+        normal /= doubleArea;
+        double d = -glm::dot(normal, p0);
+        for (int k = 0; k < 3; k++)
+            quadrics[positionId[indices[i + k]]].addPlane(normal, d, doubleArea * 0.5);
+    }
+
+    struct Collapse {
+        unsigned int from, to;
+        double cost;
+    };
+
+    vector<unsigned int> result = indices;
+    vector<unsigned int> triangleOffsets, adjacency, remap(numVertices);
+    vector<bool> passLocked(numVertices);
+    vector<Collapse> collapses;
+    while (result.size() > targetIndexCount)
+    {
+        // vertex -> triangle adjacency of the current triangles
+        triangleOffsets.assign(numVertices + 1, 0);
+        for (unsigned int index : result)
+            triangleOffsets[index + 1]++;
+        for (size_t v = 0; v < numVertices; v++)
+            triangleOffsets[v + 1] += triangleOffsets[v];
+        adjacency.resize(result.size());
+        {
+            vector<unsigned int> fill(triangleOffsets.begin(), triangleOffsets.end() - 1);
+            for (size_t i = 0; i < result.size(); i++)
+                adjacency[fill[result[i]]++] = (unsigned int)(i / 3);
+        }
+
+        // every edge can collapse either way unless the moving vertex is locked
+        collapses.clear();
+        for (size_t i = 0; i < result.size(); i += 3)
+            for (int k = 0; k < 3; k++)
+            {
+                unsigned int a = result[i + k], b = result[i + (k + 1) % 3];
+                Quadric sum = quadrics[positionId[a]];
+                sum += quadrics[positionId[b]];
+                if (!locked[a])
+                    collapses.push_back({ a, b, sum.error(vertices[b].Position) });
+                if (!locked[b])
+                    collapses.push_back({ b, a, sum.error(vertices[a].Position) });
+            }
+        sort(collapses.begin(), collapses.end(), [](const Collapse &x, const Collapse &y) { return x.cost < y.cost; });
+
+        // collapse the cheapest edges whose neighbourhoods don't overlap, until the target is reached
+        for (size_t v = 0; v < numVertices; v++)
+            remap[v] = (unsigned int)v;
+        passLocked.assign(numVertices, false);
+        size_t removedIndices = 0;
+        size_t applied = 0;
+        for (const Collapse &collapse : collapses)
+        {
+            if (result.size() - removedIndices <= targetIndexCount || sqrt(collapse.cost) > maxError)
+                break;
+            unsigned int u = collapse.from, v = collapse.to;
+            if (passLocked[u] || passLocked[v])
+                continue;
+
+            // moving u onto v must not flip (or nearly flip) any triangle that survives the collapse
+            bool flips = false;
+            size_t degenerate = 0;
+            for (unsigned int j = triangleOffsets[u]; j < triangleOffsets[u + 1] && !flips; j++)
+            {
+                const unsigned int *triangle = &result[adjacency[j] * 3];
+                if (triangle[0] == v || triangle[1] == v || triangle[2] == v)
+                {
+                    degenerate++;
+                    continue;
+                }
+                glm::vec3 p[3], q[3];
+                for (int k = 0; k < 3; k++)
+                {
+                    p[k] = vertices[triangle[k]].Position;
+                    q[k] = triangle[k] == u ? vertices[v].Position : p[k];
+                }
+                glm::vec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+                glm::vec3 after = glm::cross(q[1] - q[0], q[2] - q[0]);
+                // also reject turning a triangle by more than ~75 degrees, which folds thin triangles over each other
+                flips = glm::dot(before, after) <= 0.25f * glm::length(before) * glm::length(after);
+            }
+            if (flips)
+                continue;
+
+            remap[u] = v;
+            quadrics[positionId[v]] += quadrics[positionId[u]];
+            removedIndices += degenerate * 3;
+            applied++;
+            error = max(error, (float)sqrt(collapse.cost));
+            // the rest of this pass must not touch the triangles around u
+            for (unsigned int j = triangleOffsets[u]; j < triangleOffsets[u + 1]; j++)
+                for (int k = 0; k < 3; k++)
+                    passLocked[result[adjacency[j] * 3 + k]] = true;
+        }
+        if (applied == 0)
+            break;
+
+        size_t kept = 0;
+        for (size_t i = 0; i < result.size(); i += 3)
+        {
+            unsigned int a = remap[result[i]], b = remap[result[i + 1]], c = remap[result[i + 2]];
+            if (a == b || b == c || a == c)
+                continue;
+            result[kept++] = a;
+            result[kept++] = b;
+            result[kept++] = c;
+        }
+        result.resize(kept);
+    }
+    return result;
+}
+
+// Appends up to maxLevels simplified versions of the mesh (each about half the triangles of the previous one) to
+// indices, which holds LOD 0 on entry. Stops early once the simplifier can't remove at least a fifth of the
+// triangles anymore, e.g. because everything left lies on borders or seams.
+inline vector<MeshLod> BuildLodChain(const vector<Vertex> &vertices, vector<unsigned int> &indices, int maxLevels = 3)
+{
+    vector<MeshLod> lods;
+    lods.push_back({ 0, (uint32_t)indices.size(), 0.0f });
+    if (indices.empty())
+        return lods;
+
+    glm::vec3 minimum = vertices[indices[0]].Position, maximum = minimum;
+    for (const Vertex &vertex : vertices)
+    {
+        minimum = glm::min(minimum, vertex.Position);
+        maximum = glm::max(maximum, vertex.Position);
+    }
+    // no level may deviate by more than 5% of the bounding box diagonal, LOD selection decides when that is invisible
+    float maxError = glm::length(maximum - minimum) * 0.05f;
+
+    vector<unsigned int> current(indices);
+    float error = 0.0f;
+    for (int level = 1; level <= maxLevels; level++)
+    {
+        size_t target = current.size() / 6 * 3;
+        float levelError;
+        vector<unsigned int> simplified = SimplifyMesh(vertices, current, target, maxError, levelError);
+        if (simplified.size() > current.size() * 4 / 5)
+            break;
+        OptimizeVertexCache(simplified, vertices.size());
+        error = max(error, levelError);
+        lods.push_back({ (uint32_t)indices.size(), (uint32_t)simplified.size(), error });
+        indices.insert(indices.end(), simplified.begin(), simplified.end());
+        current.swap(simplified);
+    }
+    return lods;
+}
+
+// what the LOD selection needs to know about the camera
+struct LodView {
+    glm::vec3 cameraPosition = glm::vec3(0.0f);
+    float pixelsPerUnitAtOne = 1.0f; // screen pixels covered by one world unit at distance 1
+    float maxPixelError = 1.0f;
+    // a coarser LOD is only picked once its error is this much below the limit, so objects near a switching
+    // distance don't flicker between two levels
+    float hysteresis = 0.25f;
+    bool enabled = true;
+
+    static LodView Perspective(const glm::vec3 &cameraPosition, float fovyRadians, float viewportHeight, float maxPixelError = 1.0f)
+    {
+        LodView view;
+        view.cameraPosition = cameraPosition;
+        view.pixelsPerUnitAtOne = viewportHeight / (2.0f * tanf(fovyRadians * 0.5f));
+        view.maxPixelError = maxPixelError;
+        return view;
+    }
+
+    // pixels per mesh unit for a mesh drawn with the given transform (scale taken from its largest axis)
+    float pixelsPerUnit(const Mesh &mesh, const glm::mat4 &transform) const
+    {
+        float scale = sqrtf(max(glm::dot(glm::vec3(transform[0]), glm::vec3(transform[0])),
+                            max(glm::dot(glm::vec3(transform[1]), glm::vec3(transform[1])),
+                                glm::dot(glm::vec3(transform[2]), glm::vec3(transform[2])))));
+        glm::vec3 center = glm::vec3(transform * glm::vec4(mesh.boundsCenter, 1.0f));
+        float distance = max(glm::length(center - cameraPosition) - mesh.boundsRadius * scale, 1e-3f);
+        return pixelsPerUnitAtOne * scale / distance;
+    }
+};
+
+// picks the LOD for a mesh drawn with transform, current is the LOD it was drawn with last time
+inline int SelectLod(const Mesh &mesh, const glm::mat4 &transform, const LodView &view, int current)
+{
+    if (!view.enabled || mesh.lods.size() < 2)
+        return 0;
+    float pixelsPerUnit = view.pixelsPerUnit(mesh, transform);
+    for (int lod = (int)mesh.lods.size() - 1; lod > 0; lod--)
+    {
+        float limit = view.maxPixelError * (lod > current ? 1.0f - view.hysteresis : 1.0f);
+        if (mesh.lods[lod].error * pixelsPerUnit <= limit)
+            return lod;
+    }
+    return 0;
+}
+#endif
@@ -0,0 +1,318 @@
+#ifndef MESH_OPTIMIZER_H
+#define MESH_OPTIMIZER_H
+
+#include <learnopengl/mesh.h>
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+using namespace std;
+
+// Import time optimization of indexed triangle lists, run once per mesh before the model cache is written:
+//   1. WeldVertices          merges bitwise identical vertices
+//   2. OptimizeVertexCache   orders triangles for the post-transform vertex cache (Forsyth's linear speed algorithm)
+//   3. OptimizeOverdraw      orders cache friendly clusters of triangles front to back (outward facing first)
+//   4. OptimizeVertexFetch   orders vertices by first use so the vertex fetch walks memory linearly
+// ACMR (average cache miss ratio: transformed vertices per triangle, 0.5 is ideal for a regular grid, 3 the worst)
+// is measured with a FIFO cache, like the one most GPUs approximate.
+
+const int MESH_OPT_FIFO_CACHE_SIZE = 16;
+
+inline double ComputeACMR(const unsigned int *indices, size_t numIndices, size_t numVertices,
+                          int cacheSize = MESH_OPT_FIFO_CACHE_SIZE)
+{
+    if (numIndices < 3)
+        return 0.0;
+    // a vertex is in the cache if fewer than cacheSize misses happened since it was last loaded
+    vector<size_t> loadedAt(numVertices, 0);
+    size_t misses = 0;
+    for (size_t i = 0; i < numIndices; i++)
+    {
+        unsigned int vertex = indices[i];
+        if (loadedAt[vertex] == 0 || misses - loadedAt[vertex] >= (size_t)cacheSize)
+        {
+            misses++;
+            loadedAt[vertex] = misses;
+        }
+    }
+    return (double)misses / (numIndices / 3);
+}
+
+struct VertexHash {
+    size_t operator()(const Vertex &vertex) const
+    {
+        // FNV-1a over the raw bytes, Vertex is all floats without padding
+        const unsigned char *bytes = (const unsigned char *)&vertex;
+        size_t hash = 14695981039346656037ull;
+        for (size_t i = 0; i < sizeof(Vertex); i++)
+            hash = (hash ^ bytes[i]) * 1099511628211ull;
+        return hash;
+    }
+};
+
+struct VertexBitwiseEqual {
+    bool operator()(const Vertex &a, const Vertex &b) const
+    {
+        return memcmp(&a, &b, sizeof(Vertex)) == 0;
+    }
+};
+
+// merges identical vertices and drops unreferenced ones
+inline void WeldVertices(vector<Vertex> &vertices, vector<unsigned int> &indices)
+{
+    unordered_map<Vertex, unsigned int, VertexHash, VertexBitwiseEqual> unique;
+    unique.reserve(vertices.size());
+    vector<Vertex> welded;
+    welded.reserve(vertices.size());
+    vector<unsigned int> remap(vertices.size(), ~0u);
+    for (unsigned int &index : indices)
+    {
+        if (remap[index] == ~0u)
+        {
+            auto inserted = unique.emplace(vertices[index], (unsigned int)welded.size());
+            if (inserted.second)
+                welded.push_back(vertices[index]);
+            remap[index] = inserted.first->second;
+        }
+        index = remap[index];
+    }
+    vertices.swap(welded);
+}
+
+// Tom Forsyth, "Linear-Speed Vertex Cache Optimisation" (2006). Greedily emits the triangle with the best score, where
+// vertices score high if they are recently used and have few remaining triangles.
+inline void OptimizeVertexCache(vector<unsigned int> &indices, size_t numVertices)
+{
+    const int cacheSize = 32;
+    const size_t numTriangles = indices.size() / 3;
+    if (numTriangles == 0)
+        return;
+
+    auto vertexScore = [](int cachePosition, unsigned int remainingTriangles) {
+        if (remainingTriangles == 0)
+            return -1.0f;
+        float score = 0.0f;
+        if (cachePosition >= 0)
+        {
+            if (cachePosition < 3)
+                score = 0.75f; // the last triangle's vertices, slightly penalized so strips don't just turn around
+            else
+                score = powf(1.0f - (float)(cachePosition - 3) / (cacheSize - 3), 1.5f);
+        }
+        return score + 2.0f / sqrtf((float)remainingTriangles);
+    };
+
+    // vertex -> triangle adjacency
+    vector<unsigned int> triangleOffsets(numVertices + 1, 0);
+    for (unsigned int index : indices)
+        triangleOffsets[index + 1]++;
+    for (size_t v = 0; v < numVertices; v++)
+        triangleOffsets[v + 1] += triangleOffsets[v];
+    vector<unsigned int> remaining(numVertices);
+    for (size_t v = 0; v < numVertices; v++)
+        remaining[v] = triangleOffsets[v + 1] - triangleOffsets[v];
+    vector<unsigned int> adjacency(indices.size());
+    {
+        vector<unsigned int> fill(triangleOffsets.begin(), triangleOffsets.end() - 1);
+        for (size_t t = 0; t < numTriangles; t++)
+            for (int k = 0; k < 3; k++)
+                adjacency[fill[indices[t * 3 + k]]++] = (unsigned int)t;
+    }
+
+    vector<float> score(numVertices);
+    for (size_t v = 0; v < numVertices; v++)
+        score[v] = vertexScore(-1, remaining[v]);
+    vector<float> triangleScore(numTriangles);
+    for (size_t t = 0; t < numTriangles; t++)
+        triangleScore[t] = score[indices[t * 3]] + score[indices[t * 3 + 1]] + score[indices[t * 3 + 2]];
+    vector<bool> emitted(numTriangles, false);
+
+    vector<unsigned int> output;
+    output.reserve(indices.size());
+    vector<unsigned int> cache, nextCache;
+    cache.reserve(cacheSize + 3);
+    nextCache.reserve(cacheSize + 3);
+    size_t scanFrom = 0; // for picking a new start when the cache yields nothing
+
+    long best = 0;
+    while (best >= 0)
+    {
+        // emit the triangle and move its vertices to the front of the cache
+        unsigned int triangle[3] = { indices[best * 3], indices[best * 3 + 1], indices[best * 3 + 2] };
+        emitted[best] = true;
+        nextCache.assign(triangle, triangle + 3);
+        for (unsigned int vertex : triangle)
+        {
+            output.push_back(vertex);
+            // remove the triangle from the vertex's list of remaining ones
+            unsigned int *begin = &adjacency[triangleOffsets[vertex]];
+            unsigned int *end = begin + remaining[vertex];
+            *find(begin, end, (unsigned int)best) = *(end - 1);
+            remaining[vertex]--;
+        }
+        for (unsigned int vertex : cache)
+            if (vertex != triangle[0] && vertex != triangle[1] && vertex != triangle[2])
+                nextCache.push_back(vertex);
+        cache.swap(nextCache);
+
+        // rescore the cached vertices (and the ones that just fell out) and their remaining triangles
+        for (size_t position = 0; position < cache.size(); position++)
+        {
+            unsigned int vertex = cache[position];
+            float newScore = vertexScore(position < (size_t)cacheSize ? (int)position : -1, remaining[vertex]);
+            float delta = newScore - score[vertex];
+            score[vertex] = newScore;
+            for (unsigned int i = 0; i < remaining[vertex]; i++)
+                triangleScore[adjacency[triangleOffsets[vertex] + i]] += delta;
+        }
+        if (cache.size() > (size_t)cacheSize)
+            cache.resize(cacheSize);
+
+        // the next triangle is the best one touching the cache
+        best = -1;
+        float bestScore = -1.0f;
+        for (unsigned int vertex : cache)
+            for (unsigned int i = 0; i < remaining[vertex]; i++)
+            {
+                unsigned int t = adjacency[triangleOffsets[vertex] + i];
+                if (triangleScore[t] > bestScore)
+                {
+                    bestScore = triangleScore[t];
+                    best = t;
+                }
+            }
+
+        // nothing adjacent to the cache is left, continue with the next triangle not yet emitted
+        if (best < 0)
+        {
+            while (scanFrom < numTriangles && emitted[scanFrom])
+                scanFrom++;
+            if (scanFrom < numTriangles)
+                best = (long)scanFrom;
+        }
+    }
+    indices.swap(output);
+}
+
+// Splits the (cache optimized) triangle order into clusters wherever the simulated cache starts over and sorts the
+// clusters so that those facing away from the mesh center come first: from most viewpoints they occlude the rest, which
+// then fails the depth test instead of being shaded. Keeps the order if it would raise ACMR above threshold * before.
+inline void OptimizeOverdraw(vector<unsigned int> &indices, const vector<Vertex> &vertices, float threshold = 1.05f)
+{
+    const size_t numTriangles = indices.size() / 3;
+    if (numTriangles < 2)
+        return;
+    double acmrBefore = ComputeACMR(indices.data(), indices.size(), vertices.size());
+
+    // cluster boundaries: a triangle whose three vertices all miss the cache
+    vector<size_t> clusterStarts;
+    {
+        vector<size_t> loadedAt(vertices.size(), 0);
+        size_t misses = 0;
+        for (size_t t = 0; t < numTriangles; t++)
+        {
+            int triangleMisses = 0;
+            for (int k = 0; k < 3; k++)
+            {
+                unsigned int vertex = indices[t * 3 + k];
+                if (loadedAt[vertex] == 0 || misses - loadedAt[vertex] >= (size_t)MESH_OPT_FIFO_CACHE_SIZE)
+                {
+                    misses++;
+                    loadedAt[vertex] = misses;
+                    triangleMisses++;
+                }
+            }
+            if (t == 0 || triangleMisses == 3)
+                clusterStarts.push_back(t);
+        }
+    }
+    if (clusterStarts.size() < 2)
+        return;
+    clusterStarts.push_back(numTriangles);
+
+    glm::vec3 meshCenter(0.0f);
+    for (unsigned int index : indices)
+        meshCenter += vertices[index].Position;
+    meshCenter /= (float)indices.size();
+
+    size_t numClusters = clusterStarts.size() - 1;
+    vector<float> sortKey(numClusters);
+    for (size_t c = 0; c < numClusters; c++)
+    {
+        glm::vec3 centroid(0.0f), normal(0.0f);
+        float area = 0.0f;
+        for (size_t t = clusterStarts[c]; t < clusterStarts[c + 1]; t++)
+        {
+            const glm::vec3 &a = vertices[indices[t * 3]].Position;
+            const glm::vec3 &b = vertices[indices[t * 3 + 1]].Position;
+            const glm::vec3 &d = vertices[indices[t * 3 + 2]].Position;
+            glm::vec3 weightedNormal = glm::cross(b - a, d - a); // length is twice the area
+            float triangleArea = glm::length(weightedNormal);
+            centroid += (a + b + d) * (triangleArea / 3.0f);
+            normal += weightedNormal;
+            area += triangleArea;
+        }
+        centroid = area > 0.0f ? centroid / area : vertices[indices[clusterStarts[c] * 3]].Position;
+        float normalLength = glm::length(normal);
+        sortKey[c] = normalLength > 0.0f ? glm::dot(centroid - meshCenter, normal / normalLength) : 0.0f;
+    }
+
+    vector<size_t> order(numClusters);
+    for (size_t c = 0; c < numClusters; c++)
+        order[c] = c;
+    stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return sortKey[a] > sortKey[b]; });
+
+    vector<unsigned int> sorted;
+    sorted.reserve(indices.size());
+    for (size_t c : order)
+        sorted.insert(sorted.end(), indices.begin() + clusterStarts[c] * 3, indices.begin() + clusterStarts[c + 1] * 3);
+
+    if (ComputeACMR(sorted.data(), sorted.size(), vertices.size()) <= acmrBefore * threshold)
+        indices.swap(sorted);
+}
+
+// renumbers the vertices in the order the index buffer first references them
+inline void OptimizeVertexFetch(vector<Vertex> &vertices, vector<unsigned int> &indices)
+{
+    vector<unsigned int> remap(vertices.size(), ~0u);
+    vector<Vertex> reordered;
+    reordered.reserve(vertices.size());
+    for (unsigned int &index : indices)
+    {
+        if (remap[index] == ~0u)
+        {
+            remap[index] = (unsigned int)reordered.size();
+            reordered.push_back(vertices[index]);
+        }
+        index = remap[index];
+    }
+    vertices.swap(reordered);
+}
+
+struct MeshOptimizationStats {
+    size_t verticesBefore = 0, verticesAfter = 0;
+    size_t triangles = 0;
+    double acmrBefore = 0.0, acmrAfter = 0.0;
+};
+
+inline MeshOptimizationStats OptimizeMesh(vector<Vertex> &vertices, vector<unsigned int> &indices)
+{
+    MeshOptimizationStats stats;
+    stats.verticesBefore = vertices.size();
+    stats.triangles = indices.size() / 3;
+    stats.acmrBefore = ComputeACMR(indices.data(), indices.size(), vertices.size());
+
+    WeldVertices(vertices, indices);
+    OptimizeVertexCache(indices, vertices.size());
+    OptimizeOverdraw(indices, vertices);
+    OptimizeVertexFetch(vertices, indices);
+
+    stats.verticesAfter = vertices.size();
+    stats.acmrAfter = ComputeACMR(indices.data(), indices.size(), vertices.size());
+    return stats;
+}
+#endif
@@ -5,26 +5,35 @@
 
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
-#include <stb_image.h>
 #include <assimp/Importer.hpp>
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
 
+#include <learnopengl/frustum_culling.h>
 #include <learnopengl/mesh.h>
+#include <learnopengl/mesh_lod.h>
+#include <learnopengl/mesh_optimizer.h>
+#include <learnopengl/model_cache.h>
+#include <learnopengl/render_queue.h>
 #include <learnopengl/shader.h>
+#include <learnopengl/static_batch.h>
+#include <learnopengl/texture.h>
+#include <learnopengl/texture_registry.h>
+#include <learnopengl/thread_pool.h>
+
+#include <chrono>
+#include <future>
+#include <memory>
 
 #include <string>
 #include <fstream>
 #include <sstream>
 #include <iostream>
 #include <map>
+#include <unordered_map>
 #include <vector>
 using namespace std;
 
-unsigned int TextureFromFile(const char *path, const string &directory, bool gamma = false);
-
-
-
 class Model
 {
 public:
@@ -32,12 +41,132 @@ public:
     vector<Texture> textures_loaded;	// stores all the textures loaded so far, optimization to make sure textures aren't loaded more than once.
     vector<Mesh>    meshes;
     string directory;
+    string path;
     bool gammaCorrection;
+    // load statistics: whether the binary cache was used, how long the geometry import, the image decoding and the GPU
+    // upload took, and how long the Assimp import (cold load) took - measured now or recorded in the cache when it was written.
+    bool loadedFromCache = false;
+    double importTimeMs = 0.0;
+    double decodeTimeMs = 0.0;
+    double uploadTimeMs = 0.0;
+    double coldLoadTimeMs = 0.0;
+    // GPU memory of the model's textures and what they would take uncompressed
+    size_t textureBytes = 0;
+    size_t uncompressedTextureBytes = 0;
+    // vertex cache miss ratio (FIFO, triangle weighted over all meshes) as imported and after the mesh optimization
+    double acmrBefore = 0.0;
+    double acmrAfter = 0.0;
+    // what the meshes keep in system memory after the upload, and how much geometry that released
+    MeshResidency residency = MeshResidency::GpuOnly;
+    size_t releasedGeometryBytes = 0;
+    // upload all meshes into one StaticBatch instead of a VAO per mesh, set before finishLoading()
+    bool staticBatching = false;
+    StaticBatch batch;
+
+    // post-processing steps every model is imported with, part of the cache key
+    static const unsigned int importFlags = aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_FlipUVs |
+                                            aiProcess_CalcTangentSpace | aiProcess_JoinIdenticalVertices;
 
     // constructor, expects a filepath to a 3D model.
-    Model(string const &path, bool gamma = false) : gammaCorrection(gamma)
+    Model(string const &path, bool gamma = false, MeshResidency residency = MeshResidency::GpuOnly)
+        : gammaCorrection(gamma), residency(residency)
     {
-        loadModel(path);
+        loadModel(path, nullptr);
+        finishLoading();
+    }
+
+    // asynchronous constructor: the import and the image decoding run on the pool and the constructor returns
+    // immediately. finishLoading() has to be called on the GL thread before the model is used.
+    Model(string const &path, ThreadPool &pool, bool gamma = false, MeshResidency residency = MeshResidency::GpuOnly)
+        : path(path), gammaCorrection(gamma), residency(residency)
+    {
+        ThreadPool *workers = &pool;
+        pendingLoad = pool.submit([path, gamma, workers]() {
+            unique_ptr<Model> model(new Model(gamma));
+            model->loadModel(path, workers);
+            return model;
+        });
+    }
+
+    Model(Model &&) = default;
+    Model &operator=(Model &&) = default;
+
+    // waits for the CPU side of the load and uploads meshes and textures. Must run on the thread owning the GL context.
+    void finishLoading()
+    {
+        if (pendingLoad.valid())
+        {
+            MeshResidency requested = residency;
+            bool batched = staticBatching;
+            *this = std::move(*pendingLoad.get());
+            residency = requested;
+            staticBatching = batched;
+        }
+
+        auto start = chrono::steady_clock::now();
+        TextureRegistry &registry = TextureRegistry::Instance();
+        for (unsigned int i = 0; i < textureHandles.size(); i++)
+        {
+            // images shared with other models are decoded and uploaded only once, by whoever gets here first
+            registry.FinishLoading(textureHandles[i]);
+            const TextureEntry &entry = *textureHandles[i].get();
+            textures_loaded[i].id = entry.id;
+            decodeTimeMs += entry.decodeTimeMs;
+            textureBytes += entry.vramBytes;
+            uncompressedTextureBytes += entry.uncompressedBytes;
+        }
+        size_t geometryBytes = 0;
+        for (Mesh &mesh : meshes)
+        {
+            // meshes were built before the texture ids existed
+            for (Texture &texture : mesh.textures)
+                for (const Texture &loaded : textures_loaded)
+                    if (loaded.path == texture.path)
+                        texture.id = loaded.id;
+            geometryBytes += mesh.cpuGeometryBytes();
+        }
+        if (staticBatching)
+            batch.build(meshes, residency);
+        else
+            for (Mesh &mesh : meshes)
+                mesh.setupMesh(residency);
+        for (const Mesh &mesh : meshes)
+            geometryBytes -= mesh.cpuGeometryBytes();
+        releasedGeometryBytes = geometryBytes;
+        cache.reset(); // the mapped arrays are on the GPU now
+        uploadTimeMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+        if (loadedFromCache)
+            cout << "MODEL::LOAD:: " << path << " warm (cache) " << importTimeMs << " ms, cold (assimp) " << coldLoadTimeMs << " ms";
+        else
+            cout << "MODEL::LOAD:: " << path << " cold (assimp) " << importTimeMs << " ms";
+        cout << ", image decode " << decodeTimeMs << " ms, upload " << uploadTimeMs << " ms" << endl;
+        cout << "MODEL::TEXTURES:: " << path << " " << textureBytes / (1024.0 * 1024.0) << " MB VRAM, "
+             << (uncompressedTextureBytes - textureBytes) / (1024.0 * 1024.0) << " MB saved by block compression" << endl;
+        size_t numVertices = 0;
+        for (const Mesh &mesh : meshes)
+            numVertices += mesh.numVertices;
+        cout << "MODEL::MESH_OPT:: " << path << " ACMR " << acmrBefore << " -> " << acmrAfter << endl;
+        vector<size_t> lodTriangles;
+        for (const Mesh &mesh : meshes)
+            for (size_t lod = 0; lod < mesh.lods.size(); lod++)
+            {
+                if (lodTriangles.size() <= lod)
+                    lodTriangles.resize(lod + 1, 0);
+                lodTriangles[lod] += mesh.lods[lod].indexCount / 3;
+            }
+        cout << "MODEL::LOD:: " << path << " triangles per level:";
+        for (size_t triangles : lodTriangles)
+            cout << " " << triangles;
+        cout << endl;
+        meshLods.assign(meshes.size(), 0);
+        cout << "MODEL::VERTICES:: " << path << " " << numVertices << " vertices x " << sizeof(GpuVertex) << " B = "
+             << numVertices * sizeof(GpuVertex) / 1024.0 << " KB (" << numVertices * sizeof(Vertex) / 1024.0
+             << " KB as full precision floats)" << endl;
+        if (batch.built())
+            cout << "MODEL::BATCH:: " << path << " " << meshes.size() << " meshes in " << batch.groupCount()
+                 << " multi-draws" << endl;
+        cout << "MODEL::MEMORY:: " << path << " " << releasedGeometryBytes / 1024.0 << " KB of CPU geometry released after upload" << endl;
     }
 
     // draws the model, and thus all its meshes
@@ -47,29 +176,134 @@ public:
             meshes[i].Draw(shader);
     }
 
-    void SetShaderTextureNamePrefix(std::string prefix) {
-        for (Mesh& mesh: meshes) {
-            mesh.glslIdentifierPrefix = prefix;
+    // queues every mesh (or every material group of the static batch) at the level of detail its projected size calls
+    // for, leaving out the meshes whose box lies outside frustum (if one is given). The LOD choices are kept here, so
+    // the model must outlive the queue's execute().
+    void Submit(RenderQueue &queue, Shader &shader, const glm::mat4 &model, const LodView &view, const Frustum *frustum,
+                RenderPass pass = RenderPass::Opaque)
+    {
+        meshLods.resize(meshes.size(), 0);
+        meshVisible.assign(meshes.size(), 1);
+        if (frustum)
+        {
+            updateWorldBounds(model);
+            CullAabbs(*frustum, worldBounds, meshVisible.data());
+        }
+        for(unsigned int i = 0; i < meshes.size(); i++)
+            meshLods[i] = meshVisible[i] ? SelectLod(meshes[i], model, view, meshLods[i]) : -1;
+        uint32_t transform = queue.addTransform(model);
+        if (batch.built() && StaticBatch::Enabled())
+        {
+            for (size_t group = 0; group < batch.groupCount(); group++)
+                if (batch.groupVisible(meshLods, group))
+                    queue.submitBatchGroup(shader, pass, transform, batch, meshes, meshLods, group,
+                                           glm::vec3(model * glm::vec4(batch.groupCenter(group), 1.0f)));
+        }
+        else
+        {
+            for(unsigned int i = 0; i < meshes.size(); i++)
+                if (meshLods[i] >= 0)
+                    queue.submitMesh(shader, pass, transform, meshes[i], meshLods[i],
+                                     glm::vec3(model * glm::vec4(meshes[i].boundsCenter, 1.0f)));
         }
     }
-private:
-    // loads a model with supported ASSIMP extensions from file and stores the resulting meshes in the meshes vector.
-    void loadModel(string const &path)
+
+    // the box around all meshes in model space
+    void GetBounds(glm::vec3 &minimum, glm::vec3 &maximum) const
     {
-        // read file via ASSIMP
-        Assimp::Importer importer;
-        const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_FlipUVs | aiProcess_CalcTangentSpace);
-        // check for errors
-        if(!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) // if is Not Zero
+        minimum = glm::vec3(0.0f);
+        maximum = glm::vec3(0.0f);
+        for (size_t i = 0; i < meshes.size(); i++)
         {
-            cout << "ERROR::ASSIMP:: " << importer.GetErrorString() << endl;
-            return;
+            minimum = i ? glm::min(minimum, meshes[i].boundsMin) : meshes[i].boundsMin;
+            maximum = i ? glm::max(maximum, meshes[i].boundsMax) : meshes[i].boundsMax;
         }
+    }
+
+private:
+    // state of a load that hasn't been finished yet
+    future<unique_ptr<Model>> pendingLoad;
+    vector<TextureHandle> textureHandles;       // one per textures_loaded entry, keeps the registry textures alive
+    unordered_map<string, unsigned int> textureIndices; // path -> index into textures_loaded
+    unique_ptr<ModelCacheFile> cache;            // keeps the cached arrays mapped until they are uploaded
+    ThreadPool *pool = nullptr;                  // only set while loadModel() runs
+    vector<int> meshLods;                        // LOD each mesh was drawn with last (-1 if culled), for the selection's hysteresis
+    vector<uint8_t> meshVisible;                 // frustum test result per mesh
+    AabbArray worldBounds;                       // the meshes' boxes moved by worldBoundsTransform
+    glm::mat4 worldBoundsTransform = glm::mat4(1.0f);
+
+    explicit Model(bool gamma) : gammaCorrection(gamma)
+    {
+    }
+
+    // the world space boxes are only recomputed when the model matrix changes
+    void updateWorldBounds(const glm::mat4 &model)
+    {
+        if (worldBounds.size() == meshes.size() && worldBoundsTransform == model)
+            return;
+        worldBounds.resize(meshes.size());
+        for (size_t i = 0; i < meshes.size(); i++)
+            worldBounds.setTransformed(i, meshes[i].boundsMin, meshes[i].boundsMax, model);
+        worldBoundsTransform = model;
+    }
+
+    // loads a model from its binary cache if it is up to date, otherwise with ASSIMP (and writes the cache for the next run).
+    // Only touches the CPU side: images are decoded on the pool (if given) and nothing is uploaded yet.
+    void loadModel(string const &path, ThreadPool *pool)
+    {
+        auto start = chrono::steady_clock::now();
+        this->path = path;
+        this->pool = pool;
         // retrieve the directory path of the filepath
         directory = path.substr(0, path.find_last_of('/'));
 
-        // process ASSIMP's root node recursively
-        processNode(scene->mRootNode, scene);
+        cache.reset(new ModelCacheFile);
+        if (cache->open(path, importFlags))
+        {
+            // warm load: the mapped arrays go straight to the GPU
+            for (const CachedMesh &cached : cache->meshes)
+            {
+                vector<Texture> textures;
+                textures.reserve(cached.textures.size());
+                for (const Texture &texture : cached.textures)
+                    textures.push_back(loadModelTexture(texture.path, texture.type));
+                meshes.emplace_back(cached.vertices, cached.numVertices, cached.indices, cached.numIndices, std::move(textures), cached.lods);
+            }
+            loadedFromCache = true;
+            coldLoadTimeMs = cache->coldLoadTimeMs;
+            acmrBefore = cache->acmrBefore;
+            acmrAfter = cache->acmrAfter;
+        }
+        else
+        {
+            cache.reset();
+            // read file via ASSIMP
+            Assimp::Importer importer;
+            const aiScene* scene = importer.ReadFile(path, importFlags);
+            // check for errors
+            if(!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) // if is Not Zero
+            {
+                cout << "ERROR::ASSIMP:: " << importer.GetErrorString() << endl;
+                return;
+            }
+
+            // process ASSIMP's root node recursively
+            processNode(scene->mRootNode, scene);
+            size_t triangles = 0;
+            for (const Mesh &mesh : meshes)
+                triangles += mesh.numIndices / 3;
+            if (triangles)
+            {
+                acmrBefore /= triangles;
+                acmrAfter /= triangles;
+            }
+
+            coldLoadTimeMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+            if (!writeModelCache(path, importFlags, meshes, coldLoadTimeMs, acmrBefore, acmrAfter))
+                cout << "WARNING::MODEL_CACHE:: could not write cache for " << path << endl;
+        }
+        importTimeMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+        this->pool = nullptr;
     }
 
     // processes a node in a recursive fashion. Processes each individual mesh located at the node and repeats this process on its children nodes (if any).
@@ -81,7 +315,7 @@ private:
             // the node object only contains indices to index the actual objects in the scene.
             // the scene contains all the data, node is just to keep stuff organized (like relations between nodes).
             aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
-            meshes.push_back(processMesh(mesh, scene));
+            meshes.emplace_back(processMesh(mesh, scene));
         }
         // after we've processed all of the meshes (if any) we then recursively process each of the children nodes
         for(unsigned int i = 0; i < node->mNumChildren; i++)
@@ -94,14 +328,15 @@ private:
     Mesh processMesh(aiMesh *mesh, const aiScene *scene)
     {
         // data to fill
-        vector<Vertex> vertices;
-        vector<unsigned int> indices;
+        // (sized exactly up front and written in place, the mesh is triangulated so every face has three indices)
+        vector<Vertex> vertices(mesh->mNumVertices);
+        vector<unsigned int> indices(mesh->mNumFaces * 3);
         vector<Texture> textures;
 
         // walk through each of the mesh's vertices
         for(unsigned int i = 0; i < mesh->mNumVertices; i++)
         {
-            Vertex vertex;
+            Vertex &vertex = vertices[i];
             glm::vec3 vector; // we declare a placeholder vector since assimp_ uses its own vector class that doesn't directly convert to glm's vec3 class so we transfer the data to this placeholder glm::vec3 first.
             // positions
             vector.x = mesh->mVertices[i].x;
@@ -138,19 +373,27 @@ private:
             }
             else
                 vertex.TexCoords = glm::vec2(0.0f, 0.0f);
-
-            vertices.push_back(vertex);
-
-
         }
         // now wak through each of the mesh's faces (a face is a mesh its triangle) and retrieve the corresponding vertex indices.
+        size_t numIndices = 0;
         for(unsigned int i = 0; i < mesh->mNumFaces; i++)
         {
-            aiFace face = mesh->mFaces[i];
-            // retrieve all indices of the face and store them in the indices vector
-            for(unsigned int j = 0; j < face.mNumIndices; j++)
-                indices.push_back(face.mIndices[j]);
+            const aiFace &face = mesh->mFaces[i];
+            // retrieve all indices of the face and store them in the indices vector (points and lines,
+            // which triangulation leaves alone, are dropped)
+            if (face.mNumIndices != 3)
+                continue;
+            for(unsigned int j = 0; j < 3; j++)
+                indices[numIndices++] = face.mIndices[j];
         }
+        indices.resize(numIndices);
+        // weld, reorder for the vertex cache and overdraw, then reorder the vertices for fetch locality
+        // (acmr sums are triangle weighted here and divided by loadModel)
+        MeshOptimizationStats optimization = OptimizeMesh(vertices, indices);
+        acmrBefore += optimization.acmrBefore * optimization.triangles;
+        acmrAfter += optimization.acmrAfter * optimization.triangles;
+        // simplified levels of detail are appended to the index list
+        vector<MeshLod> lods = BuildLodChain(vertices, indices);
         // process materials
         aiMaterial* material = scene->mMaterials[mesh->mMaterialIndex];
         // we assume a convention for sampler names in the shaders. Each diffuse texture should be named
@@ -179,7 +422,7 @@ private:
 
 
         // return a mesh object created from the extracted mesh data
-        return Mesh(vertices, indices, textures);
+        return Mesh(std::move(vertices), std::move(indices), std::move(textures), std::move(lods));
     }
 
     // checks all material textures of a given type and loads the textures if they're not loaded yet.
@@ -191,69 +434,31 @@ private:
         {
             aiString str;
             mat->GetTexture(type, i, &str);
-            // check if texture was loaded before and if so, continue to next iteration: skip loading a new texture
-            bool skip = false;
-            for(unsigned int j = 0; j < textures_loaded.size(); j++)
-            {
-                if(std::strcmp(textures_loaded[j].path.data(), str.C_Str()) == 0)
-                {
-                    textures.push_back(textures_loaded[j]);
-                    skip = true; // a texture with the same filepath has already been loaded, continue to next one. (optimization)
-                    break;
-                }
-            }
-            if(!skip)
-            {   // if texture hasn't been loaded already, load it
-                Texture texture;
-                texture.id = TextureFromFile(str.C_Str(), this->directory);
-                texture.type = typeName;
-                texture.path = str.C_Str();
-                textures.push_back(texture);
-                textures_loaded.push_back(texture);  // store it as texture loaded for entire model, to ensure we won't unnecesery load duplicate textures.
-            }
+            textures.push_back(loadModelTexture(str.C_Str(), typeName));
         }
         return textures;
     }
-};
 
-
-unsigned int TextureFromFile(const char *path, const string &directory, bool gamma)
-{
-    string filename = string(path);
-    filename = directory + '/' + filename;
-
-    unsigned int textureID;
-    glGenTextures(1, &textureID);
-
-    int width, height, nrComponents;
-    unsigned char *data = stbi_load(filename.c_str(), &width, &height, &nrComponents, 0);
-    if (data)
-    {
-        GLenum format;
-        if (nrComponents == 1)
-            format = GL_RED;
-        else if (nrComponents == 3)
-            format = GL_RGB;
-        else if (nrComponents == 4)
-            format = GL_RGBA;
-
-        glBindTexture(GL_TEXTURE_2D, textureID);
-        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
-
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-        stbi_image_free(data);
-    }
-    else
+    // returns the texture at the given path (relative to the model directory). The image itself comes from the global
+    // TextureRegistry, so it is decoded only once even if other models use it too. The id is filled in by finishLoading().
+    Texture loadModelTexture(const string &path, const string &typeName)
     {
-        std::cout << "Texture failed to load at path: " << path << std::endl;
-        stbi_image_free(data);
+        auto found = textureIndices.find(path);
+        if (found != textureIndices.end())
+        {
+            Texture texture = textures_loaded[found->second];
+            texture.type = typeName;
+            return texture;
+        }
+        Texture texture;
+        texture.id = 0;
+        texture.type = typeName;
+        texture.path = path;
+        textureIndices[path] = textures_loaded.size();
+        textures_loaded.push_back(texture);
+        // decoded on the pool so large images of all models decode concurrently
+        textureHandles.push_back(TextureRegistry::Instance().Acquire(this->directory + '/' + path, pool));
+        return texture;
     }
-
-    return textureID;
-}
+};
 #endif
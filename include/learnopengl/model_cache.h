@@ -0,0 +1,289 @@
+#ifndef MODEL_CACHE_H
+#define MODEL_CACHE_H
+
+#include <learnopengl/mesh.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+using namespace std;
+
+// Binary cache of an imported model. One cache file sits next to each source model (scene.gltf -> scene.gltf.rgmc)
+// and stores the final interleaved vertex/index arrays and the texture references of every mesh, so a warm start
+// can skip Assimp entirely and hand the mapped arrays straight to glBufferData.
+//
+// File layout (native endianness, every section 8 byte aligned):
+//   ModelCacheHeader
+//   source path (header.pathLength chars)
+//   per mesh: ModelCacheMeshRecord, numLods MeshLod records, then per texture: ModelCacheTextureRecord + type chars + path chars
+//   per mesh: vertex array (numVertices * sizeof(Vertex)), index array of all LODs (numIndices * sizeof(unsigned int))
+const char MODEL_CACHE_MAGIC[4] = { 'R', 'G', 'M', 'C' };
+// bump whenever the layout of the file or of Vertex changes (or the import produces different data), old caches are
+// then rebuilt. 2: meshes are optimized (mesh_optimizer.h) before they are written, 3: LOD chains
+const uint32_t MODEL_CACHE_VERSION = 3;
+
+struct ModelCacheHeader {
+    char     magic[4];
+    uint32_t version;
+    uint32_t importFlags;   // aiPostProcessSteps the cached data was imported with
+    uint32_t vertexSize;    // sizeof(Vertex) when the cache was written
+    int64_t  sourceMTime;   // modification time of the source file
+    uint64_t sourceSize;
+    double   coldLoadTimeMs; // how long the Assimp import took when the cache was written
+    double   acmrBefore;     // vertex cache miss ratio of the imported meshes before and after the optimization
+    double   acmrAfter;
+    uint32_t numMeshes;
+    uint32_t pathLength;
+};
+
+struct ModelCacheMeshRecord {
+    uint32_t numVertices;
+    uint32_t numIndices;
+    uint32_t numTextures;
+    uint32_t numLods;
+};
+
+struct ModelCacheTextureRecord {
+    uint32_t typeLength;
+    uint32_t pathLength;
+};
+
+// mesh data as seen through the mapping, pointers stay valid while the owning ModelCacheFile is alive
+struct CachedMesh {
+    const Vertex       *vertices;
+    uint32_t            numVertices;
+    const unsigned int *indices;
+    uint32_t            numIndices; // of all LODs
+    vector<MeshLod>     lods;
+    vector<Texture>     textures; // only type and path are filled, ids are resolved by the model
+};
+
+inline size_t modelCacheAlign(size_t offset)
+{
+    return (offset + 7) & ~size_t(7);
+}
+
+inline string modelCachePath(const string &sourcePath)
+{
+    return sourcePath + ".rgmc";
+}
+
+// reads modification time and size of the source file, returns false if it doesn't exist
+inline bool modelCacheSourceStamp(const string &sourcePath, int64_t &mtime, uint64_t &size)
+{
+    struct stat st;
+    if (stat(sourcePath.c_str(), &st) != 0)
+        return false;
+    mtime = (int64_t)st.st_mtime;
+    size = (uint64_t)st.st_size;
+    return true;
+}
+
+// A read-only memory mapping of a cache file. open() fails (returns false) if the cache is missing, corrupt or stale
+// with respect to the source file and the import flags, the caller then falls back to Assimp.
+class ModelCacheFile
+{
+public:
+    vector<CachedMesh> meshes;
+    double coldLoadTimeMs = 0.0;
+    double acmrBefore = 0.0, acmrAfter = 0.0;
+
+    ModelCacheFile() = default;
+    ModelCacheFile(const ModelCacheFile &) = delete;
+    ModelCacheFile &operator=(const ModelCacheFile &) = delete;
+
+    ~ModelCacheFile()
+    {
+        close();
+    }
+
+    bool open(const string &sourcePath, uint32_t importFlags)
+    {
+        close();
+        int64_t mtime;
+        uint64_t size;
+        if (!modelCacheSourceStamp(sourcePath, mtime, size))
+            return false;
+
+        int fd = ::open(modelCachePath(sourcePath).c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(ModelCacheHeader))
+        {
+            ::close(fd);
+            return false;
+        }
+        mappedSize = (size_t)st.st_size;
+        void *mapping = mmap(nullptr, mappedSize, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd); // the mapping keeps the file alive
+        if (mapping == MAP_FAILED)
+        {
+            mappedSize = 0;
+            return false;
+        }
+        data = (const char *)mapping;
+
+        if (!parse(sourcePath, importFlags, mtime, size))
+        {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    void close()
+    {
+        if (data)
+            munmap((void *)data, mappedSize);
+        data = nullptr;
+        mappedSize = 0;
+        meshes.clear();
+    }
+
+private:
+    const char *data = nullptr;
+    size_t mappedSize = 0;
+
+    bool parse(const string &sourcePath, uint32_t importFlags, int64_t mtime, uint64_t size)
+    {
+        const ModelCacheHeader &header = *(const ModelCacheHeader *)data;
+        if (memcmp(header.magic, MODEL_CACHE_MAGIC, 4) != 0 || header.version != MODEL_CACHE_VERSION ||
+            header.importFlags != importFlags || header.vertexSize != sizeof(Vertex) ||
+            header.sourceMTime != mtime || header.sourceSize != size)
+            return false;
+
+        size_t offset = sizeof(ModelCacheHeader);
+        if (offset + header.pathLength > mappedSize || sourcePath.compare(0, string::npos, data + offset, header.pathLength) != 0)
+            return false;
+        offset = modelCacheAlign(offset + header.pathLength);
+        coldLoadTimeMs = header.coldLoadTimeMs;
+        acmrBefore = header.acmrBefore;
+        acmrAfter = header.acmrAfter;
+
+        meshes.resize(header.numMeshes);
+        for (CachedMesh &mesh : meshes)
+        {
+            if (offset + sizeof(ModelCacheMeshRecord) > mappedSize)
+                return false;
+            const ModelCacheMeshRecord &record = *(const ModelCacheMeshRecord *)(data + offset);
+            offset += sizeof(ModelCacheMeshRecord);
+            mesh.numVertices = record.numVertices;
+            mesh.numIndices = record.numIndices;
+            if (offset + record.numLods * sizeof(MeshLod) > mappedSize)
+                return false;
+            const MeshLod *lods = (const MeshLod *)(data + offset);
+            mesh.lods.assign(lods, lods + record.numLods);
+            for (const MeshLod &lod : mesh.lods)
+                if ((uint64_t)lod.indexOffset + lod.indexCount > record.numIndices)
+                    return false;
+            offset = modelCacheAlign(offset + record.numLods * sizeof(MeshLod));
+            mesh.textures.resize(record.numTextures);
+            for (Texture &texture : mesh.textures)
+            {
+                if (offset + sizeof(ModelCacheTextureRecord) > mappedSize)
+                    return false;
+                const ModelCacheTextureRecord &textureRecord = *(const ModelCacheTextureRecord *)(data + offset);
+                offset += sizeof(ModelCacheTextureRecord);
+                if (offset + textureRecord.typeLength + textureRecord.pathLength > mappedSize)
+                    return false;
+                texture.id = 0;
+                texture.type.assign(data + offset, textureRecord.typeLength);
+                texture.path.assign(data + offset + textureRecord.typeLength, textureRecord.pathLength);
+                offset = modelCacheAlign(offset + textureRecord.typeLength + textureRecord.pathLength);
+            }
+        }
+        for (CachedMesh &mesh : meshes)
+        {
+            size_t vertexBytes = (size_t)mesh.numVertices * sizeof(Vertex);
+            size_t indexBytes = (size_t)mesh.numIndices * sizeof(unsigned int);
+            if (offset + vertexBytes > mappedSize)
+                return false;
+            mesh.vertices = (const Vertex *)(data + offset);
+            offset = modelCacheAlign(offset + vertexBytes);
+            if (offset + indexBytes > mappedSize)
+                return false;
+            mesh.indices = (const unsigned int *)(data + offset);
+            offset = modelCacheAlign(offset + indexBytes);
+        }
+        return true;
+    }
+};
+
+// Writes the cache for a freshly imported model. The file is written under a temporary name and renamed into place
+// so a crash (or a concurrent reader) never sees a half written cache.
+inline bool writeModelCache(const string &sourcePath, uint32_t importFlags, const vector<Mesh> &meshes, double coldLoadTimeMs,
+                            double acmrBefore, double acmrAfter)
+{
+    ModelCacheHeader header;
+    memcpy(header.magic, MODEL_CACHE_MAGIC, 4);
+    header.version = MODEL_CACHE_VERSION;
+    header.importFlags = importFlags;
+    header.vertexSize = sizeof(Vertex);
+    if (!modelCacheSourceStamp(sourcePath, header.sourceMTime, header.sourceSize))
+        return false;
+    header.coldLoadTimeMs = coldLoadTimeMs;
+    header.acmrBefore = acmrBefore;
+    header.acmrAfter = acmrAfter;
+    header.numMeshes = (uint32_t)meshes.size();
+    header.pathLength = (uint32_t)sourcePath.size();
+
+    string cachePath = modelCachePath(sourcePath);
+    string tmpPath = cachePath + ".tmp";
+    ofstream out(tmpPath, ios::binary | ios::trunc);
+    if (!out)
+        return false;
+
+    size_t offset = 0;
+    auto write = [&](const void *bytes, size_t count) {
+        out.write((const char *)bytes, count);
+        offset += count;
+    };
+    auto pad = [&]() {
+        static const char zeros[8] = {};
+        write(zeros, modelCacheAlign(offset) - offset);
+    };
+
+    write(&header, sizeof(header));
+    write(sourcePath.data(), sourcePath.size());
+    pad();
+    for (const Mesh &mesh : meshes)
+    {
+        ModelCacheMeshRecord record = { (uint32_t)mesh.vertices.size(), (uint32_t)mesh.indices.size(), (uint32_t)mesh.textures.size(),
+                                        (uint32_t)mesh.lods.size() };
+        write(&record, sizeof(record));
+        write(mesh.lods.data(), mesh.lods.size() * sizeof(MeshLod));
+        pad();
+        for (const Texture &texture : mesh.textures)
+        {
+            ModelCacheTextureRecord textureRecord = { (uint32_t)texture.type.size(), (uint32_t)texture.path.size() };
+            write(&textureRecord, sizeof(textureRecord));
+            write(texture.type.data(), texture.type.size());
+            write(texture.path.data(), texture.path.size());
+            pad();
+        }
+    }
+    for (const Mesh &mesh : meshes)
+    {
+        write(mesh.vertices.data(), mesh.vertices.size() * sizeof(Vertex));
+        pad();
+        write(mesh.indices.data(), mesh.indices.size() * sizeof(unsigned int));
+        pad();
+    }
+    out.close();
+    if (!out || rename(tmpPath.c_str(), cachePath.c_str()) != 0)
+    {
+        remove(tmpPath.c_str());
+        return false;
+    }
+    return true;
+}
+#endif
@@ -0,0 +1,423 @@
+#ifndef OCCLUSION_CULLING_H
+#define OCCLUSION_CULLING_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <learnopengl/bvh.h>
+#include <learnopengl/gl_state.h>
+#include <learnopengl/render_targets.h>
+#include <learnopengl/shader.h>
+
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+namespace uniforms {
+constexpr Uniform<glm::vec3> boxMin("boxMin");
+constexpr Uniform<glm::vec3> boxMax("boxMax");
+constexpr Uniform<glm::ivec2> sourceSize("sourceSize");
+constexpr Uniform<glm::vec2> depthSize("depthSize");
+constexpr Uniform<int> levels("levels");
+}
+
+struct OcclusionStats {
+    unsigned int tested = 0;      // objects in the last test that came back
+    unsigned int occluded = 0;    // of those, the hidden ones
+    unsigned int conditional = 0; // objects drawn under conditional rendering this frame
+};
+
+// Occlusion culling of scene objects by their world space boxes, in two phases per frame:
+//   1. the objects found visible last time are drawn as they are, they are the occluders
+//   2. every other candidate gets its box drawn into a GL_ANY_SAMPLES_PASSED query against that depth and is drawn
+//      under conditional rendering on it, so an object that just came into view shows up this frame instead of popping
+//      in later; the GPU skips the draws of those still hidden
+// Once all opaque draws are done, endFrame() tests every candidate against the finished depth buffer to decide the
+// next frames' phase 1 set: with a hierarchical-Z pyramid (the farthest depth per texel, every level half the previous
+// one) and one transform feedback draw testing a box per point, or, where the pyramid targets can't be made, with
+// one more occlusion query per phase 1 object. Results are read back two frames later so the CPU never waits on them.
+class OcclusionCuller
+{
+public:
+    enum class Method {
+        HiZ,
+        Queries
+    };
+
+    OcclusionStats stats;
+
+    // the pyramid, half the depth buffer's size
+    static RenderTargetDesc PyramidTarget()
+    {
+        return RenderTargetDesc{ GL_R32F, 0.5f, GL_NEAREST, true };
+    }
+
+    // depthTexture is the depth attachment (a full scale target of the pool) of sceneFramebuffer, which the scene is
+    // drawn into
+    OcclusionCuller(Shader &boxShader, Shader &downsampleShader, Shader &testShader, RenderTargetPool &targets,
+                    GLuint sceneFramebuffer, GLuint depthTexture)
+        : boxShader(boxShader), downsampleShader(downsampleShader), testShader(testShader), targets(targets),
+          sceneFramebuffer(sceneFramebuffer), depthTexture(depthTexture)
+    {
+        createBoxMesh();
+        hiZSupported = linked(downsampleShader) && linked(testShader) && createPyramid();
+        if (!hiZSupported)
+            std::cout << "WARNING::OCCLUSION:: no depth pyramid, falling back to occlusion queries" << std::endl;
+        currentMethod = hiZSupported ? Method::HiZ : Method::Queries;
+        for (FrameSlot &slot : slots)
+            glGenBuffers(1, &slot.feedbackBuffer);
+    }
+
+    ~OcclusionCuller()
+    {
+        for (FrameSlot &slot : slots)
+        {
+            if (slot.fence)
+                glDeleteSync(slot.fence);
+            glDeleteBuffers(1, &slot.feedbackBuffer);
+            if (!slot.queries.empty())
+                glDeleteQueries((GLsizei)slot.queries.size(), slot.queries.data());
+        }
+        glDeleteVertexArrays(1, &cubeVAO);
+        glDeleteBuffers(1, &cubeVBO);
+        glDeleteBuffers(1, &cubeEBO);
+        glDeleteVertexArrays(1, &emptyVAO);
+        glDeleteVertexArrays(1, &testVAO);
+        glDeleteBuffers(1, &boxBuffer);
+        glDeleteFramebuffers(1, &pyramidFramebuffer);
+        if (pyramid)
+            targets.release(pyramid);
+    }
+
+    OcclusionCuller(const OcclusionCuller &) = delete;
+    OcclusionCuller &operator=(const OcclusionCuller &) = delete;
+
+    bool hiZAvailable() const
+    {
+        return hiZSupported;
+    }
+
+    Method method() const
+    {
+        return currentMethod;
+    }
+
+    void setMethod(Method method)
+    {
+        currentMethod = method == Method::HiZ && !hiZSupported ? Method::Queries : method;
+    }
+
+    // starts a frame over objectCount objects (the caller's indices) and takes in the results of two frames ago
+    void beginFrame(size_t objectCount, const glm::vec3 &cameraPosition, float nearPlane)
+    {
+        frame++;
+        visible.resize(objectCount, 0);
+        camera = cameraPosition;
+        closeMargin = nearPlane * 2.0f;
+        stats.conditional = 0;
+        resolve(slots[(frame + 1) % FRAMES_IN_FLIGHT]);
+        queriedFrame.resize(objectCount, 0);
+    }
+
+    // found visible by the last test that came back; these are drawn first, as occluders
+    bool visibleLastFrame(uint32_t object) const
+    {
+        return visible[object] != 0;
+    }
+
+    // the phase 2 box queries go between beginQueries() and endQueries(), which set up and restore the render state
+    void beginQueries()
+    {
+        GLStateCache &state = GLState();
+        state.useProgram(boxShader.ID);
+        state.bindVertexArray(cubeVAO);
+        state.setCullFace(false); // the back faces count too, the camera may look into the box
+        state.setBlend(false);
+        glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+        glDepthMask(GL_FALSE);
+        glDepthFunc(GL_LEQUAL); // a box face may lie exactly on the object drawn earlier in the frame
+    }
+
+    void endQueries()
+    {
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+        glDepthMask(GL_TRUE);
+        glDepthFunc(GL_LESS);
+    }
+
+    // draws the object's box into an occlusion query against the depth so far, for drawing the object under
+    // conditional rendering on the returned query. 0 when the camera is so close that the near plane could clip the
+    // box away: the object is drawn unconditionally then.
+    GLuint queryBox(uint32_t object, const Aabb &box)
+    {
+        if (glm::all(glm::greaterThanEqual(camera, box.min - closeMargin)) &&
+            glm::all(glm::lessThanEqual(camera, box.max + closeMargin)))
+        {
+            visible[object] = 1;
+            return 0;
+        }
+        FrameSlot &slot = currentSlot();
+        if (slot.queryCount == slot.queries.size())
+        {
+            GLuint query;
+            glGenQueries(1, &query);
+            slot.queries.push_back(query);
+        }
+        GLuint query = slot.queries[slot.queryCount++];
+        slot.queryObjects.push_back(object);
+        queriedFrame[object] = frame;
+        boxShader.set(uniforms::boxMin, box.min);
+        boxShader.set(uniforms::boxMax, box.max);
+        glBeginQuery(GL_ANY_SAMPLES_PASSED, query);
+        glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_BYTE, nullptr);
+        glEndQuery(GL_ANY_SAMPLES_PASSED);
+        stats.conditional++;
+        return query;
+    }
+
+    // after the last opaque draw: tests the candidates (objects, with their boxes) against the finished depth buffer.
+    // Leaves sceneFramebuffer bound.
+    void endFrame(const std::vector<uint32_t> &objects, const std::vector<Aabb> &boxes)
+    {
+        FrameSlot &slot = currentSlot();
+        slot.readQueries = currentMethod == Method::Queries;
+        if (currentMethod == Method::HiZ)
+        {
+            buildPyramid();
+            testPyramid(slot, objects, boxes);
+            return;
+        }
+        // the phase 1 objects haven't been queried yet (and aren't drawn conditionally, so they don't count as such)
+        unsigned int conditional = stats.conditional;
+        beginQueries();
+        for (size_t i = 0; i < objects.size(); i++)
+            if (queriedFrame[objects[i]] != frame)
+                queryBox(objects[i], boxes[i]);
+        endQueries();
+        stats.conditional = conditional;
+    }
+
+private:
+    struct FrameSlot {
+        std::vector<GLuint> queries;        // pool, the first queryCount are in use
+        size_t queryCount = 0;
+        std::vector<uint32_t> queryObjects; // object of every query in use
+        bool readQueries = false;           // the queries decide visibility (Method::Queries)
+        GLuint feedbackBuffer = 0;          // one float per tested object (Method::HiZ)
+        size_t feedbackCapacity = 0;
+        std::vector<uint32_t> testedObjects;
+        GLsync fence = 0;
+    };
+
+    static const unsigned int FRAMES_IN_FLIGHT = 3;
+
+    Shader &boxShader, &downsampleShader, &testShader;
+    RenderTargetPool &targets;
+    GLuint sceneFramebuffer, depthTexture;
+    int width = 0, height = 0;          // of the depth buffer, as of levelsGeneration of the pool
+    unsigned int levelsGeneration = 0;
+    bool hiZSupported = false;
+    Method currentMethod = Method::Queries;
+
+    FrameSlot slots[FRAMES_IN_FLIGHT];
+    uint64_t frame = 0;
+    std::vector<uint8_t> visible;
+    std::vector<uint64_t> queriedFrame;
+    std::vector<float> results;
+    glm::vec3 camera = glm::vec3(0.0f);
+    float closeMargin = 0.0f;
+
+    GLuint cubeVAO = 0, cubeVBO = 0, cubeEBO = 0;
+    GLuint emptyVAO = 0;                    // the pyramid passes generate their triangle from gl_VertexID
+    GLuint testVAO = 0, boxBuffer = 0;
+    GLuint pyramid = 0, pyramidFramebuffer = 0;
+    std::vector<glm::ivec2> levelSizes;
+
+    FrameSlot &currentSlot()
+    {
+        return slots[frame % FRAMES_IN_FLIGHT];
+    }
+
+    static bool linked(const Shader &shader)
+    {
+        GLint status = 0;
+        glGetProgramiv(shader.ID, GL_LINK_STATUS, &status);
+        return status != 0;
+    }
+
+    void createBoxMesh()
+    {
+        const float corners[] = { 0, 0, 0,  1, 0, 0,  0, 1, 0,  1, 1, 0,  0, 0, 1,  1, 0, 1,  0, 1, 1,  1, 1, 1 };
+        const uint8_t indices[] = { 0, 2, 1, 1, 2, 3,  4, 5, 6, 5, 7, 6,  0, 1, 4, 1, 5, 4,
+                                    2, 6, 3, 3, 6, 7,  0, 4, 2, 2, 4, 6,  1, 3, 5, 3, 7, 5 };
+        glGenVertexArrays(1, &cubeVAO);
+        glGenBuffers(1, &cubeVBO);
+        glGenBuffers(1, &cubeEBO);
+        glBindVertexArray(cubeVAO);
+        glBindBuffer(GL_ARRAY_BUFFER, cubeVBO);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, cubeEBO);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
+        glBindVertexArray(0);
+        GLState().invalidate();
+    }
+
+    // an R32F texture with a full mip chain, level 0 half the size of the depth buffer. Sizes round down like any
+    // mip chain would (the texture is incomplete otherwise), the downsample folds odd edges into the last texel.
+    bool createPyramid()
+    {
+        pyramid = targets.createPersistent(PyramidTarget());
+        updateSizes();
+
+        glGenFramebuffers(1, &pyramidFramebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, pyramidFramebuffer);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, pyramid, 0);
+        bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+        glBindFramebuffer(GL_FRAMEBUFFER, sceneFramebuffer);
+
+        glGenVertexArrays(1, &emptyVAO);
+        glGenVertexArrays(1, &testVAO);
+        glGenBuffers(1, &boxBuffer);
+        glBindVertexArray(testVAO);
+        glBindBuffer(GL_ARRAY_BUFFER, boxBuffer);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Aabb), (void*)0);
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Aabb), (void*)sizeof(glm::vec3));
+        glBindVertexArray(0);
+        GLState().invalidate();
+        return complete;
+    }
+
+    // the pool re-specifies the pyramid when the window is resized, its levels are taken from there
+    void updateSizes()
+    {
+        width = targets.width();
+        height = targets.height();
+        levelsGeneration = targets.generation();
+        levelSizes.clear();
+        glm::ivec2 size = targets.size(PyramidTarget());
+        levelSizes.push_back(size);
+        while (size.x > 1 || size.y > 1)
+        {
+            size = glm::max(size / 2, glm::ivec2(1));
+            levelSizes.push_back(size);
+        }
+    }
+
+    // every level is the farthest depth of the 2x2 texels under it in the level before (the depth buffer for level 0)
+    void buildPyramid()
+    {
+        if (levelsGeneration != targets.generation())
+            updateSizes();
+        GLStateCache &state = GLState();
+        glDisable(GL_DEPTH_TEST);
+        glBindFramebuffer(GL_FRAMEBUFFER, pyramidFramebuffer);
+        state.useProgram(downsampleShader.ID);
+        state.bindVertexArray(emptyVAO);
+        state.setBlend(false);
+        state.setCullFace(false);
+        for (size_t level = 0; level < levelSizes.size(); level++)
+        {
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, pyramid, (GLint)level);
+            glViewport(0, 0, levelSizes[level].x, levelSizes[level].y);
+            if (level == 0)
+            {
+                state.bindTexture(0, depthTexture);
+                downsampleShader.set(uniforms::sourceSize, glm::ivec2(width, height));
+            }
+            else
+            {
+                // only the previous level is visible to the shader, so writing this one is not a feedback loop
+                state.bindTexture(0, pyramid);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, (GLint)level - 1);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)level - 1);
+                downsampleShader.set(uniforms::sourceSize, levelSizes[level - 1]);
+            }
+            glDrawArrays(GL_TRIANGLES, 0, 3);
+        }
+        state.bindTexture(0, pyramid);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)levelSizes.size() - 1);
+        glBindFramebuffer(GL_FRAMEBUFFER, sceneFramebuffer);
+        glViewport(0, 0, width, height);
+        glEnable(GL_DEPTH_TEST);
+    }
+
+    // one point per box, the visibility of each is captured into the slot's feedback buffer
+    void testPyramid(FrameSlot &slot, const std::vector<uint32_t> &objects, const std::vector<Aabb> &boxes)
+    {
+        slot.testedObjects = objects;
+        if (objects.empty())
+            return;
+        glBindBuffer(GL_ARRAY_BUFFER, boxBuffer);
+        glBufferData(GL_ARRAY_BUFFER, boxes.size() * sizeof(Aabb), boxes.data(), GL_STREAM_DRAW);
+        if (slot.feedbackCapacity < objects.size())
+        {
+            slot.feedbackCapacity = objects.size() * 2;
+            glBindBuffer(GL_TRANSFORM_FEEDBACK_BUFFER, slot.feedbackBuffer);
+            glBufferData(GL_TRANSFORM_FEEDBACK_BUFFER, slot.feedbackCapacity * sizeof(float), nullptr, GL_STREAM_READ);
+            glBindBuffer(GL_TRANSFORM_FEEDBACK_BUFFER, 0);
+        }
+
+        GLStateCache &state = GLState();
+        state.useProgram(testShader.ID);
+        state.bindVertexArray(testVAO);
+        state.bindTexture(0, pyramid);
+        testShader.set(uniforms::depthSize, glm::vec2(width, height));
+        testShader.set(uniforms::levels, (int)levelSizes.size());
+        glEnable(GL_RASTERIZER_DISCARD);
+        glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, slot.feedbackBuffer);
+        glBeginTransformFeedback(GL_POINTS);
+        glDrawArrays(GL_POINTS, 0, (GLsizei)objects.size());
+        glEndTransformFeedback();
+        glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+        glDisable(GL_RASTERIZER_DISCARD);
+        slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+
+    // takes in a finished frame's results; the frame is two behind, so this rarely has to wait
+    void resolve(FrameSlot &slot)
+    {
+        if (slot.fence)
+        {
+            glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 100000000); // 100 ms at most
+            glDeleteSync(slot.fence);
+            slot.fence = 0;
+            results.resize(slot.testedObjects.size());
+            glBindBuffer(GL_TRANSFORM_FEEDBACK_BUFFER, slot.feedbackBuffer);
+            glGetBufferSubData(GL_TRANSFORM_FEEDBACK_BUFFER, 0, results.size() * sizeof(float), results.data());
+            glBindBuffer(GL_TRANSFORM_FEEDBACK_BUFFER, 0);
+            stats.tested = (unsigned int)results.size();
+            stats.occluded = 0;
+            for (size_t i = 0; i < results.size(); i++)
+            {
+                uint32_t object = slot.testedObjects[i];
+                if (object < visible.size())
+                    visible[object] = results[i] > 0.5f;
+                stats.occluded += results[i] <= 0.5f;
+            }
+        }
+        else if (slot.readQueries && slot.queryCount > 0)
+        {
+            stats.tested = (unsigned int)slot.queryCount;
+            stats.occluded = 0;
+            for (size_t i = 0; i < slot.queryCount; i++)
+            {
+                GLuint passed = 0;
+                glGetQueryObjectuiv(slot.queries[i], GL_QUERY_RESULT, &passed);
+                uint32_t object = slot.queryObjects[i];
+                if (object < visible.size())
+                    visible[object] = passed != 0;
+                stats.occluded += passed == 0;
+            }
+        }
+        slot.queryCount = 0;
+        slot.queryObjects.clear();
+        slot.testedObjects.clear();
+        slot.readQueries = false;
+    }
+};
+#endif
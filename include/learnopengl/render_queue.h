@@ -0,0 +1,316 @@
+#ifndef RENDER_QUEUE_H
+#define RENDER_QUEUE_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <learnopengl/gl_state.h>
+#include <learnopengl/mesh.h>
+#include <learnopengl/shader.h>
+#include <learnopengl/static_batch.h>
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace uniforms {
+constexpr Uniform<glm::mat4> model("model");
+}
+
+// passes in execution order, each with its own fixed render state
+enum class RenderPass : uint8_t {
+    Opaque = 0,            // back faces culled, no blending
+    OpaqueDoubleSided = 1, // no culling
+    Transparent = 2        // alpha blended, back to front
+};
+
+// Per-frame list of draws. Every item gets a 64 bit sort key:
+//   opaque:      pass (4) | program (8) | material (16) | vertex array (16) | depth (20)
+//   transparent: pass (4) | inverted depth (20) | program (8) | material (16) | vertex array (16)
+// so opaque draws are grouped by state and go front to back within a state (early depth rejection), and transparent
+// ones strictly back to front. The keys are radix sorted and the draws executed through GLState(), which drops the
+// binds that are already in place.
+// Opaque meshes can also go through a depth pre-pass (setDepthPrepass, executeDepth): their depth is laid down first
+// from the position streams, then execute() shades them with GL_EQUAL and without depth writes, so the lighting runs
+// once per covered pixel whatever the overdraw.
+class RenderQueue
+{
+public:
+    // draws anything that isn't a mesh, with the item's program bound and its transform in the "model" uniform
+    typedef void (*DrawCallback)(void *context, GLStateCache &state);
+
+    // starts a frame; depth is measured from the camera and quantized over [0, farPlane]
+    void begin(const glm::vec3 &cameraPosition, float farPlane)
+    {
+        camera = cameraPosition;
+        depthScale = ((1u << DEPTH_BITS) - 1) / farPlane;
+        items.clear();
+        transforms.clear();
+        condition = 0;
+        depthShader = nullptr;
+        prepassed = 0;
+    }
+
+    // the items submitted from now on are drawn under conditional rendering on this occlusion query (0: unconditionally)
+    void setCondition(GLuint query)
+    {
+        condition = query;
+    }
+
+    // opaque meshes and batch groups submitted from now on also get their depth drawn by executeDepth() with this
+    // program (depth_prepass.vs/.fs), nullptr leaves them out of the pre-pass. Callbacks are never pre-passed.
+    void setDepthPrepass(Shader *shader)
+    {
+        depthShader = shader;
+    }
+
+    // model matrix shared by the items submitted with the returned index
+    uint32_t addTransform(const glm::mat4 &transform)
+    {
+        transforms.push_back(transform);
+        return (uint32_t)transforms.size() - 1;
+    }
+
+    void submitMesh(Shader &shader, RenderPass pass, uint32_t transform, Mesh &mesh, int lod, const glm::vec3 &worldCenter)
+    {
+        RenderItem item = makeItem(shader, pass, transform, mesh.materialKey(), mesh.VAO, worldCenter);
+        item.kind = RenderItem::MESH;
+        item.depthShader = prepassShader(pass);
+        item.mesh = &mesh;
+        item.lod = lod;
+        items.push_back(item);
+    }
+
+    void submitBatchGroup(Shader &shader, RenderPass pass, uint32_t transform, StaticBatch &batch, vector<Mesh> &meshes,
+                          const vector<int> &lods, size_t group, const glm::vec3 &worldCenter)
+    {
+        RenderItem item = makeItem(shader, pass, transform, meshes[batch.groupMesh(group)].materialKey(), batch.vertexArray(),
+                                   worldCenter);
+        item.kind = RenderItem::BATCH_GROUP;
+        item.depthShader = prepassShader(pass);
+        item.batch = &batch;
+        item.meshes = &meshes;
+        item.lods = &lods;
+        item.group = group;
+        items.push_back(item);
+    }
+
+    // material and vertexArray only steer the sorting, the callback binds what it needs through the given state cache
+    void submitCallback(Shader &shader, RenderPass pass, uint32_t transform, unsigned int material, unsigned int vertexArray,
+                        const glm::vec3 &worldCenter, DrawCallback draw, void *context)
+    {
+        RenderItem item = makeItem(shader, pass, transform, material, vertexArray, worldCenter);
+        item.kind = RenderItem::CALLBACK;
+        item.callback = draw;
+        item.context = context;
+        items.push_back(item);
+    }
+
+    // draws the depth of the pre-passed items submitted since begin() or the last executeDepth(), with color writes off
+    // and front to back per vertex array. The depth test is left at GL_LESS.
+    void executeDepth()
+    {
+        sort(prepassed, true);
+        GLStateCache &state = GLState();
+        state.invalidate();
+        glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+        const Shader *currentShader = nullptr;
+        uint32_t currentTransform = NO_TRANSFORM;
+        for (const SortEntry &entry : entries)
+        {
+            const RenderItem &item = items[entry.index];
+            applyPass(state, item.pass);
+            bindProgram(state, *item.depthShader, item.transform, currentShader, currentTransform);
+            if (item.condition)
+                glBeginConditionalRender(item.condition, GL_QUERY_WAIT);
+            if (item.kind == RenderItem::MESH)
+                item.mesh->DrawDepth(*item.depthShader, item.lod);
+            else
+                item.batch->drawGroupDepth(*item.depthShader, *item.meshes, *item.lods, item.group);
+            if (item.condition)
+                glEndConditionalRender();
+        }
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+        prepassed = items.size();
+    }
+
+    // sorts and draws everything submitted since begin(); the items whose depth executeDepth() drew are only shaded
+    // where they are the nearest surface (GL_EQUAL)
+    void execute()
+    {
+        sort(0, false);
+        GLStateCache &state = GLState();
+        state.invalidate();
+        const Shader *currentShader = nullptr;
+        uint32_t currentTransform = NO_TRANSFORM;
+        bool depthEqual = false;
+        for (const SortEntry &entry : entries)
+        {
+            const RenderItem &item = items[entry.index];
+            applyPass(state, item.pass);
+            bool prepassedItem = item.depthShader && entry.index < prepassed;
+            if (prepassedItem != depthEqual)
+            {
+                glDepthFunc(prepassedItem ? GL_EQUAL : GL_LESS);
+                glDepthMask(prepassedItem ? GL_FALSE : GL_TRUE);
+                depthEqual = prepassedItem;
+            }
+            bindProgram(state, *item.shader, item.transform, currentShader, currentTransform);
+            if (item.condition)
+                glBeginConditionalRender(item.condition, GL_QUERY_WAIT);
+            switch (item.kind)
+            {
+                case RenderItem::MESH:
+                    item.mesh->Draw(*item.shader, item.lod);
+                    break;
+                case RenderItem::BATCH_GROUP:
+                    item.batch->drawGroup(*item.shader, *item.meshes, *item.lods, item.group);
+                    break;
+                case RenderItem::CALLBACK:
+                    item.callback(item.context, state);
+                    break;
+            }
+            if (item.condition)
+                glEndConditionalRender();
+        }
+        // what the rest of the frame (post-processing, UI) was written against
+        if (depthEqual)
+        {
+            glDepthFunc(GL_LESS);
+            glDepthMask(GL_TRUE);
+        }
+        state.setCullFace(false);
+        state.setBlend(true);
+    }
+
+    size_t size() const
+    {
+        return items.size();
+    }
+
+    static const uint32_t NO_TRANSFORM = ~0u;
+
+private:
+    struct RenderItem {
+        enum Kind { MESH, BATCH_GROUP, CALLBACK } kind;
+        uint64_t key;
+        uint64_t depthKey;     // order in the depth pre-pass
+        Shader *shader;
+        Shader *depthShader;   // program of the depth pre-pass, nullptr when not pre-passed
+        RenderPass pass;
+        uint32_t transform;
+        GLuint condition;
+        // MESH
+        Mesh *mesh;
+        int lod;
+        // BATCH_GROUP
+        StaticBatch *batch;
+        vector<Mesh> *meshes;
+        const vector<int> *lods;
+        size_t group;
+        // CALLBACK
+        DrawCallback callback;
+        void *context;
+    };
+
+    struct SortEntry {
+        uint64_t key;
+        uint32_t index;
+    };
+
+    static const unsigned int DEPTH_BITS = 20;
+    vector<RenderItem> items;
+    vector<glm::mat4> transforms;
+    vector<SortEntry> entries, scratch;
+    glm::vec3 camera = glm::vec3(0.0f);
+    float depthScale = 1.0f;
+    GLuint condition = 0;
+    Shader *depthShader = nullptr;
+    size_t prepassed = 0;  // items [0, prepassed) went through executeDepth()
+
+    RenderItem makeItem(Shader &shader, RenderPass pass, uint32_t transform, unsigned int material, unsigned int vertexArray,
+                        const glm::vec3 &worldCenter) const
+    {
+        RenderItem item;
+        memset(&item, 0, sizeof(item));
+        item.shader = &shader;
+        item.pass = pass;
+        item.transform = transform;
+        item.condition = condition;
+
+        uint64_t depth = (uint64_t)glm::min(glm::length(worldCenter - camera) * depthScale, (float)((1u << DEPTH_BITS) - 1));
+        uint64_t program = shader.ID & 0xFF, materialBits = material & 0xFFFF, vertexArrayBits = vertexArray & 0xFFFF;
+        uint64_t key = (uint64_t)pass << 60;
+        if (pass == RenderPass::Transparent)
+            key |= ((((1u << DEPTH_BITS) - 1) - depth) << 40) | (program << 32) | (materialBits << 16) | vertexArrayBits;
+        else
+            key |= (program << 52) | (materialBits << 36) | (vertexArrayBits << DEPTH_BITS) | depth;
+        item.key = key;
+        // pass (4) | vertex array (16) | depth (20): the pre-pass has a single program and no materials
+        item.depthKey = ((uint64_t)pass << 60) | (vertexArrayBits << DEPTH_BITS) | depth;
+        return item;
+    }
+
+    Shader *prepassShader(RenderPass pass) const
+    {
+        return pass == RenderPass::Transparent ? nullptr : depthShader;
+    }
+
+    void bindProgram(GLStateCache &state, Shader &shader, uint32_t transform, const Shader *&currentShader,
+                     uint32_t &currentTransform)
+    {
+        if (state.useProgram(shader.ID) || &shader != currentShader)
+        {
+            currentShader = &shader;
+            currentTransform = NO_TRANSFORM; // uniforms are per program
+        }
+        if (transform != NO_TRANSFORM && transform != currentTransform)
+        {
+            shader.set(uniforms::model, transforms[transform]);
+            currentTransform = transform;
+        }
+    }
+
+    static void applyPass(GLStateCache &state, RenderPass pass)
+    {
+        state.setCullFace(pass == RenderPass::Opaque);
+        state.setBlend(pass == RenderPass::Transparent);
+    }
+
+    // LSD radix sort of the keys of the items from first on (for the depth pass only the pre-passed ones, by their
+    // depth keys), 8 bits per pass; passes where every key has the same digit are skipped
+    void sort(size_t first, bool depthPass)
+    {
+        entries.clear();
+        uint32_t histograms[8][256];
+        memset(histograms, 0, sizeof(histograms));
+        for (size_t i = first; i < items.size(); i++)
+        {
+            if (depthPass && !items[i].depthShader)
+                continue;
+            SortEntry entry = { depthPass ? items[i].depthKey : items[i].key, (uint32_t)i };
+            entries.push_back(entry);
+            for (int digit = 0; digit < 8; digit++)
+                histograms[digit][(entry.key >> (digit * 8)) & 0xFF]++;
+        }
+        size_t count = entries.size();
+        scratch.resize(count);
+        for (int digit = 0; digit < 8; digit++)
+        {
+            uint32_t *histogram = histograms[digit];
+            if (count == 0 || histogram[(entries[0].key >> (digit * 8)) & 0xFF] == count)
+                continue;
+            uint32_t offset = 0;
+            for (int bucket = 0; bucket < 256; bucket++)
+            {
+                uint32_t bucketCount = histogram[bucket];
+                histogram[bucket] = offset;
+                offset += bucketCount;
+            }
+            for (size_t i = 0; i < count; i++)
+                scratch[histogram[(entries[i].key >> (digit * 8)) & 0xFF]++] = entries[i];
+            entries.swap(scratch);
+        }
+    }
+};
+#endif
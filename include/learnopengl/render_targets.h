@@ -0,0 +1,290 @@
+#ifndef RENDER_TARGETS_H
+#define RENDER_TARGETS_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <learnopengl/gl_state.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+// How an offscreen target is made: its format and its size as a fraction of the backbuffer's. Targets with equal
+// descriptors are interchangeable, which is what the pool recycles them by.
+struct RenderTargetDesc {
+    GLenum internalFormat = GL_RGBA16F;
+    float scale = 1.0f;           // of the backbuffer width and height, rounded down, at least one texel
+    GLenum filter = GL_LINEAR;
+    bool mipmapped = false;       // a full mip chain below the scaled size, levels rounded down
+
+    bool operator==(const RenderTargetDesc &other) const
+    {
+        return internalFormat == other.internalFormat && scale == other.scale && filter == other.filter &&
+               mipmapped == other.mipmapped;
+    }
+};
+
+// Every offscreen texture the renderer draws into, sized from the backbuffer:
+//  - persistent targets (createPersistent) belong to their user until release(). A resize re-specifies them in
+//    place, so their names, and the framebuffers they are attached to, stay valid.
+//  - transient targets (acquire) live from the first pass writing them to the last reading them, then go back with
+//    release(). A later acquire() of the same descriptor, even in the same frame, gets the texture back, so passes
+//    whose targets are never alive at the same time share the memory. Free ones left unused for TRIM_FRAMES frames
+//    are deleted.
+// resize() only records the size, which can change many times a frame while a window edge is dragged; the targets
+// follow at the next beginFrame().
+class RenderTargetPool
+{
+public:
+    static const uint64_t TRIM_FRAMES = 60;
+
+    RenderTargetPool(int width, int height) : backbuffer(std::max(width, 1), std::max(height, 1)), pending(backbuffer)
+    {
+    }
+
+    ~RenderTargetPool()
+    {
+        for (const Target &target : targets)
+            glDeleteTextures(1, &target.texture);
+    }
+
+    RenderTargetPool(const RenderTargetPool &) = delete;
+    RenderTargetPool &operator=(const RenderTargetPool &) = delete;
+
+    // the new backbuffer size; a minimized window (0 x 0) keeps the targets as they are
+    void resize(int width, int height)
+    {
+        if (width > 0 && height > 0)
+            pending = glm::ivec2(width, height);
+    }
+
+    // once a frame before the targets are used: applies a pending resize and trims the free targets. True when the
+    // size changed, in which case generation() has moved on as well.
+    bool beginFrame()
+    {
+        frame++;
+        for (size_t i = 0; i < targets.size();)
+        {
+            if (!targets[i].persistent && !targets[i].inUse && frame - targets[i].lastUsed > TRIM_FRAMES)
+            {
+                glDeleteTextures(1, &targets[i].texture);
+                targets.erase(targets.begin() + i);
+            }
+            else
+                i++;
+        }
+        if (pending == backbuffer)
+            return false;
+        backbuffer = pending;
+        sizeGeneration++;
+        for (Target &target : targets)
+            allocate(target);
+        GLState().invalidate();
+        return true;
+    }
+
+    int width() const
+    {
+        return backbuffer.x;
+    }
+
+    int height() const
+    {
+        return backbuffer.y;
+    }
+
+    // changes with every applied resize, for users keeping sizes derived from the targets
+    unsigned int generation() const
+    {
+        return sizeGeneration;
+    }
+
+    // level 0 size of a target of the descriptor at the current backbuffer size
+    glm::ivec2 size(const RenderTargetDesc &desc) const
+    {
+        return ScaledSize(desc, backbuffer);
+    }
+
+    GLuint createPersistent(const RenderTargetDesc &desc)
+    {
+        Target target = create(desc);
+        target.persistent = true;
+        targets.push_back(target);
+        return target.texture;
+    }
+
+    // a persistent target in another internal format, re-specified in place like on a resize; its contents are lost
+    void setFormat(GLuint texture, GLenum internalFormat)
+    {
+        for (Target &target : targets)
+            if (target.texture == texture && target.persistent)
+            {
+                if (target.desc.internalFormat == internalFormat)
+                    return;
+                target.desc.internalFormat = internalFormat;
+                allocate(target);
+                glBindTexture(GL_TEXTURE_2D, 0);
+                GLState().invalidate();
+                return;
+            }
+        std::cout << "ERROR::RENDER_TARGETS::texture " << texture << " is not a persistent render target" << std::endl;
+    }
+
+    GLuint acquire(const RenderTargetDesc &desc)
+    {
+        for (Target &target : targets)
+            if (!target.persistent && !target.inUse && target.desc == desc)
+            {
+                target.inUse = true;
+                target.lastUsed = frame;
+                return target.texture;
+            }
+        Target target = create(desc);
+        target.inUse = true;
+        targets.push_back(target);
+        return target.texture;
+    }
+
+    // a transient target goes back to the pool; a persistent one is deleted
+    void release(GLuint texture)
+    {
+        for (size_t i = 0; i < targets.size(); i++)
+        {
+            if (targets[i].texture != texture)
+                continue;
+            if (targets[i].persistent)
+            {
+                glDeleteTextures(1, &texture);
+                targets.erase(targets.begin() + i);
+            }
+            else
+            {
+                targets[i].inUse = false;
+                targets[i].lastUsed = frame;
+            }
+            return;
+        }
+        std::cout << "ERROR::RENDER_TARGETS::released texture " << texture << " is not a render target" << std::endl;
+    }
+
+    // memory of the allocated targets of a format as they would be with a width x height backbuffer
+    size_t bytes(GLenum internalFormat, int width, int height) const
+    {
+        size_t total = 0;
+        for (const Target &target : targets)
+            if (target.desc.internalFormat == internalFormat)
+                total += Bytes(target.desc, glm::ivec2(width, height));
+        return total;
+    }
+
+    size_t count() const
+    {
+        return targets.size();
+    }
+
+    static glm::ivec2 ScaledSize(const RenderTargetDesc &desc, glm::ivec2 backbuffer)
+    {
+        return glm::max(glm::ivec2(glm::vec2(backbuffer) * desc.scale), glm::ivec2(1));
+    }
+
+    static size_t BytesPerTexel(GLenum internalFormat)
+    {
+        switch (internalFormat)
+        {
+            case GL_RGBA16F:
+                return 8;
+            case GL_RGBA8:
+            case GL_RGB10_A2:
+            case GL_R11F_G11F_B10F:
+            case GL_R32F:
+            case GL_DEPTH_COMPONENT24:   // padded to 32 bits
+                return 4;
+        }
+        return 4;
+    }
+
+    // of one target, mip chain included
+    static size_t Bytes(const RenderTargetDesc &desc, glm::ivec2 backbuffer)
+    {
+        glm::ivec2 size = ScaledSize(desc, backbuffer);
+        size_t texels = (size_t)size.x * size.y;
+        while (desc.mipmapped && (size.x > 1 || size.y > 1))
+        {
+            size = glm::max(size / 2, glm::ivec2(1));
+            texels += (size_t)size.x * size.y;
+        }
+        return texels * BytesPerTexel(desc.internalFormat);
+    }
+
+private:
+    struct Target {
+        RenderTargetDesc desc;
+        GLuint texture = 0;
+        bool persistent = false;
+        bool inUse = false;
+        uint64_t lastUsed = 0;
+    };
+
+    glm::ivec2 backbuffer, pending;
+    unsigned int sizeGeneration = 0;
+    uint64_t frame = 0;
+    std::vector<Target> targets;
+
+    Target create(const RenderTargetDesc &desc)
+    {
+        Target target;
+        target.desc = desc;
+        target.lastUsed = frame;
+        glGenTextures(1, &target.texture);
+        allocate(target);
+        GLenum minFilter = desc.filter;
+        if (desc.mipmapped)
+            minFilter = desc.filter == GL_NEAREST ? GL_NEAREST_MIPMAP_NEAREST : GL_LINEAR_MIPMAP_NEAREST;
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, minFilter);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, desc.filter);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        GLState().invalidate();
+        return target;
+    }
+
+    // (re)specifies every level at the current size, leaving the texture bound
+    void allocate(const Target &target)
+    {
+        GLenum format = GL_RGBA, type = GL_FLOAT;
+        switch (target.desc.internalFormat)
+        {
+            case GL_RGBA8:
+                type = GL_UNSIGNED_BYTE;
+                break;
+            case GL_RGB10_A2:
+                type = GL_UNSIGNED_INT_2_10_10_10_REV;
+                break;
+            case GL_R11F_G11F_B10F:
+                format = GL_RGB;
+                break;
+            case GL_R32F:
+                format = GL_RED;
+                break;
+            case GL_DEPTH_COMPONENT24:
+                format = GL_DEPTH_COMPONENT;
+                type = GL_UNSIGNED_INT;
+                break;
+        }
+        glBindTexture(GL_TEXTURE_2D, target.texture);
+        glm::ivec2 size = this->size(target.desc);
+        GLint level = 0;
+        glTexImage2D(GL_TEXTURE_2D, level, target.desc.internalFormat, size.x, size.y, 0, format, type, nullptr);
+        while (target.desc.mipmapped && (size.x > 1 || size.y > 1))
+        {
+            size = glm::max(size / 2, glm::ivec2(1));
+            glTexImage2D(GL_TEXTURE_2D, ++level, target.desc.internalFormat, size.x, size.y, 0, format, type, nullptr);
+        }
+        // levels left from a larger size would make the texture incomplete
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, level);
+    }
+};
+#endif
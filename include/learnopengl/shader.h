@@ -4,18 +4,74 @@
 #include <glad/glad.h>
 #include <glm/glm.hpp>
 
+#include <algorithm>
+#include <cstdint>
 #include <string>
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <vector>
 #include <common.h>
+#include <learnopengl/gl_ext.h>
+#include <learnopengl/uniform_blocks.h>
+
+// FNV-1a hash of a uniform name, the key of Shader's location table
+constexpr uint32_t HashUniformName(const char *name)
+{
+    uint32_t hash = 2166136261u;
+    while (*name)
+    {
+        hash ^= (uint8_t)*name++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// a uniform name reduced to its hash; constexpr from a literal, so handles declared constexpr never hash at runtime
+struct UniformName {
+    uint32_t hash;
+
+    constexpr UniformName(const char *name) : hash(HashUniformName(name))
+    {
+    }
+    UniformName(const std::string &name) : hash(HashUniformName(name.c_str()))
+    {
+    }
+};
+
+// typed handle, e.g. constexpr Uniform<glm::mat4> ModelMatrix("model"); used with Shader::set()
+template <typename T>
+struct Uniform : UniformName {
+    constexpr Uniform(const char *name) : UniformName(name)
+    {
+    }
+};
+
+// Texture unit of the n-th (1-based) material texture of a type, as Mesh binds them: diffuse, specular, normal and
+// height maps take units 0-3 for the first texture of each type, 4-7 for the second and so on. -1 for other textures.
+// Shaders point their texture_<type><n> samplers (with any struct prefix, e.g. material.) at these units when linked.
+inline int MaterialTextureUnit(const std::string &type, unsigned int number)
+{
+    static const char *const types[] = { "texture_diffuse", "texture_specular", "texture_normal", "texture_height" };
+    const unsigned int maxPerType = 4; // 16 units, the minimum GL 3.3 guarantees per stage
+    if (number < 1 || number > maxPerType)
+        return -1;
+    for (int i = 0; i < 4; i++)
+        if (type == types[i])
+            return i + 4 * (number - 1);
+    return -1;
+}
+
 class Shader
 {
 public:
     unsigned int ID;
     // constructor generates the shader on the fly
+    // defines (e.g. "#define PACKED_VERTICES\n") are inserted into every stage right after its #version line,
+    // feedbackVaryings are the outputs captured (interleaved) when the program runs under transform feedback
     // ------------------------------------------------------------------------
-    Shader(const char* vertexPath, const char* fragmentPath, const char* geometryPath = nullptr)
+    Shader(const char* vertexPath, const char* fragmentPath, const char* geometryPath = nullptr, const std::string &defines = "",
+           const std::vector<const char*> &feedbackVaryings = std::vector<const char*>())
     {
         std::string vertexPathString(vertexPath);
         std::string fragmentPathString(fragmentPath);
@@ -65,6 +121,12 @@ public:
         {
             std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
         }
+        if (!defines.empty())
+        {
+            insertDefines(vertexCode, defines);
+            insertDefines(fragmentCode, defines);
+            insertDefines(geometryCode, defines);
+        }
         const char* vShaderCode = vertexCode.c_str();
         const char * fShaderCode = fragmentCode.c_str();
         // 2. compile shaders
@@ -95,6 +157,8 @@ public:
         glAttachShader(ID, fragment);
         if(geometryPath != nullptr)
             glAttachShader(ID, geometry);
+        if (!feedbackVaryings.empty())
+            glTransformFeedbackVaryings(ID, (GLsizei)feedbackVaryings.size(), feedbackVaryings.data(), GL_INTERLEAVED_ATTRIBS);
         glLinkProgram(ID);
         checkCompileErrors(ID, "PROGRAM");
         // delete the shaders as they're linked into our program now and no longer necessery
@@ -103,6 +167,44 @@ public:
         if(geometryPath != nullptr)
             glDeleteShader(geometry);
 
+        reflectUniforms();
+        bindUniformBlocks();
+    }
+    // a compute program; only where GLCaps().computeShader is set. defines as above, passed as a std::string: a string
+    // literal would pick the vertex and fragment constructor
+    // ------------------------------------------------------------------------
+    explicit Shader(const char* computePath, const std::string &defines = "")
+    {
+        std::string computeCode;
+        std::ifstream cShaderFile;
+        cShaderFile.exceptions (std::ifstream::failbit | std::ifstream::badbit);
+        try
+        {
+            cShaderFile.open(computePath);
+            std::stringstream cShaderStream;
+            cShaderStream << cShaderFile.rdbuf();
+            cShaderFile.close();
+            computeCode = cShaderStream.str();
+        }
+        catch (std::ifstream::failure& e)
+        {
+            std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
+        }
+        if (!defines.empty())
+            insertDefines(computeCode, defines);
+        const char *cShaderCode = computeCode.c_str();
+        unsigned int compute = glCreateShader(GL_COMPUTE_SHADER);
+        glShaderSource(compute, 1, &cShaderCode, NULL);
+        glCompileShader(compute);
+        checkCompileErrors(compute, "COMPUTE");
+        ID = glCreateProgram();
+        glAttachShader(ID, compute);
+        glLinkProgram(ID);
+        checkCompileErrors(ID, "PROGRAM");
+        glDeleteShader(compute);
+
+        reflectUniforms();
+        bindUniformBlocks();
     }
     // activate the shader
     // ------------------------------------------------------------------------
@@ -110,66 +212,193 @@ public:
     { 
         glUseProgram(ID); 
     }
+    // location of a uniform, from the table built at link time (-1 if the program has no such active uniform)
+    GLint location(UniformName name) const
+    {
+        auto found = std::lower_bound(locations.begin(), locations.end(), UniformLocation{ name.hash, -1 });
+        return found != locations.end() && found->hash == name.hash ? found->location : -1;
+    }
+    // typed handles
+    // ------------------------------------------------------------------------
+    template <typename T, typename V>
+    void set(Uniform<T> uniform, const V &value) const
+    {
+        upload(location(uniform), T(value));
+    }
     // utility uniform functions
     // ------------------------------------------------------------------------
-    void setBool(const std::string &name, bool value) const
+    void setBool(UniformName name, bool value) const
     {         
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value); 
+        glUniform1i(location(name), (int)value); 
     }
     // ------------------------------------------------------------------------
-    void setInt(const std::string &name, int value) const
+    void setInt(UniformName name, int value) const
     { 
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), value); 
+        glUniform1i(location(name), value); 
     }
     // ------------------------------------------------------------------------
-    void setFloat(const std::string &name, float value) const
+    void setFloat(UniformName name, float value) const
     { 
-        glUniform1f(glGetUniformLocation(ID, name.c_str()), value); 
+        glUniform1f(location(name), value); 
     }
     // ------------------------------------------------------------------------
-    void setVec2(const std::string &name, const glm::vec2 &value) const
+    void setVec2(UniformName name, const glm::vec2 &value) const
     { 
-        glUniform2fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]); 
+        glUniform2fv(location(name), 1, &value[0]); 
     }
-    void setVec2(const std::string &name, float x, float y) const
+    void setVec2(UniformName name, float x, float y) const
     { 
-        glUniform2f(glGetUniformLocation(ID, name.c_str()), x, y); 
+        glUniform2f(location(name), x, y); 
     }
     // ------------------------------------------------------------------------
-    void setVec3(const std::string &name, const glm::vec3 &value) const
+    void setVec3(UniformName name, const glm::vec3 &value) const
     { 
-        glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]); 
+        glUniform3fv(location(name), 1, &value[0]); 
     }
-    void setVec3(const std::string &name, float x, float y, float z) const
+    void setVec3(UniformName name, float x, float y, float z) const
     { 
-        glUniform3f(glGetUniformLocation(ID, name.c_str()), x, y, z); 
+        glUniform3f(location(name), x, y, z); 
     }
     // ------------------------------------------------------------------------
-    void setVec4(const std::string &name, const glm::vec4 &value) const
+    void setVec4(UniformName name, const glm::vec4 &value) const
     { 
-        glUniform4fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]); 
+        glUniform4fv(location(name), 1, &value[0]); 
     }
-    void setVec4(const std::string &name, float x, float y, float z, float w) 
+    void setVec4(UniformName name, float x, float y, float z, float w) 
     { 
-        glUniform4f(glGetUniformLocation(ID, name.c_str()), x, y, z, w); 
+        glUniform4f(location(name), x, y, z, w); 
     }
     // ------------------------------------------------------------------------
-    void setMat2(const std::string &name, const glm::mat2 &mat) const
+    void setMat2(UniformName name, const glm::mat2 &mat) const
     {
-        glUniformMatrix2fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        glUniformMatrix2fv(location(name), 1, GL_FALSE, &mat[0][0]);
     }
     // ------------------------------------------------------------------------
-    void setMat3(const std::string &name, const glm::mat3 &mat) const
+    void setMat3(UniformName name, const glm::mat3 &mat) const
     {
-        glUniformMatrix3fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        glUniformMatrix3fv(location(name), 1, GL_FALSE, &mat[0][0]);
     }
     // ------------------------------------------------------------------------
-    void setMat4(const std::string &name, const glm::mat4 &mat) const
+    void setMat4(UniformName name, const glm::mat4 &mat) const
     {
-        glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        glUniformMatrix4fv(location(name), 1, GL_FALSE, &mat[0][0]);
     }
 
 private:
+    struct UniformLocation {
+        uint32_t hash;
+        GLint location;
+
+        bool operator<(const UniformLocation &other) const
+        {
+            return hash < other.hash;
+        }
+    };
+    // active uniforms sorted by name hash
+    std::vector<UniformLocation> locations;
+
+    static void upload(GLint location, bool value) { glUniform1i(location, (int)value); }
+    static void upload(GLint location, int value) { glUniform1i(location, value); }
+    static void upload(GLint location, float value) { glUniform1f(location, value); }
+    static void upload(GLint location, const glm::vec2 &value) { glUniform2fv(location, 1, &value[0]); }
+    static void upload(GLint location, const glm::ivec2 &value) { glUniform2iv(location, 1, &value[0]); }
+    static void upload(GLint location, const glm::vec3 &value) { glUniform3fv(location, 1, &value[0]); }
+    static void upload(GLint location, const glm::vec4 &value) { glUniform4fv(location, 1, &value[0]); }
+    static void upload(GLint location, const glm::mat2 &mat) { glUniformMatrix2fv(location, 1, GL_FALSE, &mat[0][0]); }
+    static void upload(GLint location, const glm::mat3 &mat) { glUniformMatrix3fv(location, 1, GL_FALSE, &mat[0][0]); }
+    static void upload(GLint location, const glm::mat4 &mat) { glUniformMatrix4fv(location, 1, GL_FALSE, &mat[0][0]); }
+
+    // queries every active uniform once after linking, so setting one later is a table lookup instead of a
+    // glGetUniformLocation with a string. Material samplers get their fixed texture units (MaterialTextureUnit) here.
+    void reflectUniforms()
+    {
+        GLint count = 0, maxLength = 0;
+        glGetProgramiv(ID, GL_ACTIVE_UNIFORMS, &count);
+        glGetProgramiv(ID, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+        std::vector<GLchar> buffer(maxLength + 1);
+        GLint previousProgram = 0;
+        glGetIntegerv(GL_CURRENT_PROGRAM, &previousProgram);
+        glUseProgram(ID);
+        for (GLint i = 0; i < count; i++)
+        {
+            GLint size = 0;
+            GLenum type;
+            glGetActiveUniform(ID, i, maxLength + 1, nullptr, &size, &type, buffer.data());
+            std::string name(buffer.data());
+            GLint location = glGetUniformLocation(ID, name.c_str());
+            if (location < 0)
+                continue; // in a uniform block
+            addLocation(name, location);
+            // arrays are reported as name[0]: register the plain name and the other elements too
+            if (name.size() > 3 && name.compare(name.size() - 3, 3, "[0]") == 0)
+            {
+                std::string base = name.substr(0, name.size() - 3);
+                addLocation(base, location);
+                for (GLint element = 1; element < size; element++)
+                {
+                    std::string elementName = base + "[" + std::to_string(element) + "]";
+                    addLocation(elementName, glGetUniformLocation(ID, elementName.c_str()));
+                }
+            }
+            if (type == GL_SAMPLER_2D)
+            {
+                // [prefix.]texture_<type><n>
+                size_t start = name.find_last_of('.') == std::string::npos ? 0 : name.find_last_of('.') + 1;
+                size_t digits = name.find_last_not_of("0123456789") + 1;
+                if (digits > start && digits < name.size())
+                {
+                    int unit = MaterialTextureUnit(name.substr(start, digits - start), std::stoi(name.substr(digits)));
+                    if (unit >= 0)
+                        glUniform1i(location, unit);
+                }
+            }
+        }
+        glUseProgram(previousProgram);
+        std::sort(locations.begin(), locations.end());
+        for (size_t i = 1; i < locations.size(); i++)
+            if (locations[i].hash == locations[i - 1].hash && locations[i].location != locations[i - 1].location)
+                std::cout << "ERROR::SHADER::UNIFORM_HASH_COLLISION in program " << ID << std::endl;
+    }
+
+    // connects the program's shared uniform blocks (uniform_blocks.h) to their fixed binding points
+    void bindUniformBlocks()
+    {
+        GLint count = 0;
+        glGetProgramiv(ID, GL_ACTIVE_UNIFORM_BLOCKS, &count);
+        for (GLint i = 0; i < count; i++)
+        {
+            GLchar name[256];
+            glGetActiveUniformBlockName(ID, i, sizeof(name), nullptr, name);
+            const SharedUniformBlock *block = FindSharedUniformBlock(name);
+            if (!block)
+            {
+                std::cout << "ERROR::SHADER::UNKNOWN_UNIFORM_BLOCK " << name << std::endl;
+                continue;
+            }
+            GLint size = 0;
+            glGetActiveUniformBlockiv(ID, i, GL_UNIFORM_BLOCK_DATA_SIZE, &size);
+            if ((size_t)size != block->size)
+                std::cout << "ERROR::SHADER::UNIFORM_BLOCK_SIZE " << name << " is " << size << " bytes, expected "
+                          << block->size << std::endl;
+            glUniformBlockBinding(ID, i, block->binding);
+        }
+    }
+
+    void addLocation(const std::string &name, GLint location)
+    {
+        locations.push_back(UniformLocation{ HashUniformName(name.c_str()), location });
+    }
+
+    static void insertDefines(std::string &code, const std::string &defines)
+    {
+        // #version has to stay the first statement
+        size_t lineEnd = code.compare(0, 8, "#version") == 0 ? code.find('\n') : std::string::npos;
+        if (lineEnd == std::string::npos)
+            code.insert(0, defines);
+        else
+            code.insert(lineEnd + 1, defines);
+    }
+
     // utility function for checking shader compilation/linking errors.
     // ------------------------------------------------------------------------
     void checkCompileErrors(GLuint shader, std::string type)
@@ -0,0 +1,267 @@
+#ifndef STATIC_BATCH_H
+#define STATIC_BATCH_H
+
+#include <glad/glad.h>
+
+#include <learnopengl/draw_stats.h>
+#include <learnopengl/gl_state.h>
+#include <learnopengl/gl_ext.h>
+#include <learnopengl/mesh.h>
+#include <learnopengl/shader.h>
+
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Static batching: the meshes of a model are suballocated into one vertex and one index buffer behind a single VAO.
+// Meshes sharing a material (the same textures) are drawn together with one glMultiDrawElementsIndirect where the
+// driver has it (4.3, ARB_multi_draw_indirect) or one glMultiDrawElementsBaseVertex (core 3.2) otherwise, instead of
+// a VAO bind, texture binds and a draw per mesh.
+// Positions are quantized against the bounds of the whole batch so one dequantization matrix serves every mesh.
+class StaticBatch
+{
+public:
+    // global switch, lets the per-mesh draws be compared against the batched ones at runtime
+    static bool &Enabled()
+    {
+        static bool enabled = true;
+        return enabled;
+    }
+
+    bool built() const
+    {
+        return VAO != 0;
+    }
+
+    // uploads all meshes into the shared buffers and points them at their ranges (they can still be drawn one by one
+    // with Mesh::Draw). Replaces Mesh::setupMesh(), has to run on the GL thread while the meshes' arrays are valid.
+    void build(vector<Mesh> &meshes, MeshResidency residency)
+    {
+        size_t totalVertices = 0, totalIndices = 0;
+        for (const Mesh &mesh : meshes)
+        {
+            totalVertices += sourceVertexCount(mesh);
+            totalIndices += mesh.totalIndices;
+        }
+        if (totalVertices == 0)
+            return;
+
+        // gather everything first, the quantization needs the bounds of all meshes
+        vector<Vertex> vertices;
+        vector<unsigned int> indices;
+        vertices.reserve(totalVertices);
+        indices.reserve(totalIndices);
+        bool shortIndices = true;
+        for (Mesh &mesh : meshes)
+        {
+            const Vertex *vertexData = mesh.vertices.empty() ? mesh.externalVertices : mesh.vertices.data();
+            const unsigned int *indexData = mesh.vertices.empty() ? mesh.externalIndices : mesh.indices.data();
+            size_t numVertices = sourceVertexCount(mesh);
+
+            // indices stay local to the mesh, the base vertex offsets them into the shared buffer
+            mesh.baseVertex = (GLint)vertices.size();
+            mesh.firstIndex = indices.size();
+            mesh.numVertices = numVertices;
+            mesh.computeBounds(vertexData, numVertices);
+            vertices.insert(vertices.end(), vertexData, vertexData + numVertices);
+            indices.insert(indices.end(), indexData, indexData + mesh.totalIndices);
+            shortIndices = shortIndices && numVertices <= 65536;
+            mesh.releaseGeometry(residency);
+        }
+
+        glGenVertexArrays(1, &VAO);
+        glGenBuffers(1, &VBO);
+        glGenBuffers(1, &EBO);
+        glBindVertexArray(VAO);
+
+        vector<GpuVertex> converted;
+        const GpuVertex *gpuVertices = VertexLayout<GpuVertex>::pack(vertices.data(), vertices.size(), converted, dequantization);
+        glBindBuffer(GL_ARRAY_BUFFER, VBO);
+        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(GpuVertex), gpuVertices, GL_STATIC_DRAW);
+
+        // 16 bit indices as long as no single mesh needs more
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+        indexType = shortIndices ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+        if (shortIndices)
+        {
+            vector<uint16_t> packedIndices(indices.begin(), indices.end());
+            glBufferData(GL_ELEMENT_ARRAY_BUFFER, packedIndices.size() * sizeof(uint16_t), packedIndices.data(), GL_STATIC_DRAW);
+        }
+        else
+            glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), indices.data(), GL_STATIC_DRAW);
+
+        VertexLayout<GpuVertex>::setAttributes();
+        glBindVertexArray(0);
+        SetupPositionStream(gpuVertices, vertices.size(), EBO, depthVAO, positionVBO);
+
+        for (Mesh &mesh : meshes)
+        {
+            mesh.VAO = VAO;
+            mesh.depthVAO = depthVAO;
+            mesh.indexType = indexType;
+            mesh.dequantization = dequantization;
+        }
+
+        // one group per distinct set of textures, in the order the materials first appear
+        map<vector<pair<string, unsigned int>>, size_t> groupOfMaterial;
+        for (unsigned int i = 0; i < meshes.size(); i++)
+        {
+            vector<pair<string, unsigned int>> material;
+            for (const Texture &texture : meshes[i].textures)
+                material.push_back(make_pair(texture.type, texture.id));
+            auto found = groupOfMaterial.find(material);
+            if (found == groupOfMaterial.end())
+            {
+                found = groupOfMaterial.insert(make_pair(material, groups.size())).first;
+                groups.push_back(vector<unsigned int>());
+            }
+            groups[found->second].push_back(i);
+        }
+        for (const vector<unsigned int> &group : groups)
+        {
+            glm::vec3 center(0.0f);
+            for (unsigned int i : group)
+                center += meshes[i].boundsCenter;
+            groupCenters.push_back(center / (float)group.size());
+        }
+
+        if (GLCaps().multiDrawIndirect)
+            glGenBuffers(1, &indirectBuffer);
+    }
+
+    // draws every mesh at the given level of detail, one multi-draw per material. Meshes with a negative level
+    // (culled) are left out.
+    void draw(Shader &shader, vector<Mesh> &meshes, const vector<int> &lods)
+    {
+        for (size_t group = 0; group < groups.size(); group++)
+            drawGroup(shader, meshes, lods, group);
+    }
+
+    // draws the meshes of one material with a single multi-draw
+    void drawGroup(Shader &shader, vector<Mesh> &meshes, const vector<int> &lods, size_t groupIndex)
+    {
+        if (!groupVisible(lods, groupIndex))
+            return;
+        shader.set(uniforms::dequantization, dequantization);
+        GLState().bindVertexArray(VAO);
+        meshes[groups[groupIndex][0]].bindTextures();
+        multiDraw(meshes, lods, groupIndex);
+    }
+
+    // the same meshes from the position stream, for the depth pre-pass
+    void drawGroupDepth(Shader &shader, vector<Mesh> &meshes, const vector<int> &lods, size_t groupIndex)
+    {
+        if (!groupVisible(lods, groupIndex))
+            return;
+        shader.set(uniforms::dequantization, dequantization);
+        GLState().bindVertexArray(depthVAO);
+        multiDraw(meshes, lods, groupIndex);
+    }
+
+    // whether any mesh of the group is left after culling
+    bool groupVisible(const vector<int> &lods, size_t group) const
+    {
+        for (unsigned int i : groups[group])
+            if (lods[i] >= 0)
+                return true;
+        return false;
+    }
+
+    size_t groupCount() const
+    {
+        return groups.size();
+    }
+
+    // first mesh of a material group, it stands for the group's textures
+    unsigned int groupMesh(size_t group) const
+    {
+        return groups[group][0];
+    }
+
+    // model space center of a group's meshes, for depth sorting
+    glm::vec3 groupCenter(size_t group) const
+    {
+        return groupCenters[group];
+    }
+
+    unsigned int vertexArray() const
+    {
+        return VAO;
+    }
+
+
+private:
+    // layout glMultiDrawElementsIndirect reads
+    struct DrawElementsIndirectCommand {
+        GLuint count;
+        GLuint instanceCount;
+        GLuint firstIndex;
+        GLint  baseVertex;
+        GLuint baseInstance;
+    };
+
+    unsigned int VAO = 0, VBO = 0, EBO = 0;
+    unsigned int depthVAO = 0, positionVBO = 0; // position stream of the depth pre-pass
+    unsigned int indirectBuffer = 0;           // only when multi-draw indirect is available
+    GLenum indexType = GL_UNSIGNED_INT;
+    glm::mat4 dequantization = glm::mat4(1.0f);
+    vector<vector<unsigned int>> groups;       // mesh indices per material
+    vector<glm::vec3> groupCenters;
+    // per draw scratch, kept to avoid allocating every frame
+    vector<DrawElementsIndirectCommand> commands;
+    vector<GLsizei> counts;
+    vector<const void*> offsets;
+    vector<GLint> baseVertices;
+
+    // one multi-draw over the unculled meshes of a group, from the bound vertex array
+    void multiDraw(vector<Mesh> &meshes, const vector<int> &lods, size_t groupIndex)
+    {
+        const vector<unsigned int> &group = groups[groupIndex];
+        size_t indexSize = indexType == GL_UNSIGNED_SHORT ? sizeof(uint16_t) : sizeof(unsigned int);
+
+        if (indirectBuffer)
+        {
+            commands.clear();
+            for (unsigned int i : group)
+            {
+                if (lods[i] < 0)
+                    continue;
+                const MeshLod &range = meshes[i].lods[lods[i]];
+                DrawElementsIndirectCommand command = { range.indexCount, 1, (GLuint)(meshes[i].firstIndex + range.indexOffset),
+                                                        meshes[i].baseVertex, 0 };
+                commands.push_back(command);
+            }
+            // orphaned every call, draws still reading the previous commands keep their copy
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+            glBufferData(GL_DRAW_INDIRECT_BUFFER, commands.size() * sizeof(DrawElementsIndirectCommand), commands.data(), GL_STREAM_DRAW);
+            GLExt().MultiDrawElementsIndirect(GL_TRIANGLES, indexType, nullptr, (GLsizei)commands.size(), 0);
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+        }
+        else
+        {
+            counts.clear();
+            offsets.clear();
+            baseVertices.clear();
+            for (unsigned int i : group)
+            {
+                if (lods[i] < 0)
+                    continue;
+                const MeshLod &range = meshes[i].lods[lods[i]];
+                counts.push_back(range.indexCount);
+                offsets.push_back((const void*)((meshes[i].firstIndex + range.indexOffset) * indexSize));
+                baseVertices.push_back(meshes[i].baseVertex);
+            }
+            glMultiDrawElementsBaseVertex(GL_TRIANGLES, counts.data(), indexType, offsets.data(), (GLsizei)counts.size(),
+                                          baseVertices.data());
+        }
+        FrameDrawStats().drawCalls++;
+        FrameDrawStats().meshes += indirectBuffer ? commands.size() : counts.size();
+    }
+
+    static size_t sourceVertexCount(const Mesh &mesh)
+    {
+        return mesh.vertices.empty() ? mesh.numExternalVertices : mesh.vertices.size();
+    }
+};
+#endif
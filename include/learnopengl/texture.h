@@ -0,0 +1,212 @@
+#ifndef TEXTURE_H
+#define TEXTURE_H
+
+#include <glad/glad.h>
+#include <stb_image.h>
+
+#include <learnopengl/gl_ext.h>
+#include <learnopengl/ktx.h>
+
+#include <sys/stat.h>
+
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+using namespace std;
+
+// image decoded on the CPU, waiting to be uploaded on the GL thread
+struct TextureImage {
+    int width = 0, height = 0, nrComponents = 0;
+    unsigned char *data = nullptr;
+    // block compressed mip chain from a .ktx file next to the image (see tools/texture_transcoder.cpp), used instead of data
+    KtxTexture compressed;
+    double decodeTimeMs = 0.0;
+    // filled in by UploadTextureImage: bytes the texture occupies on the GPU and what the same image would take
+    // as an uncompressed 8 bit texture with mipmaps
+    size_t vramBytes = 0;
+    size_t uncompressedBytes = 0;
+};
+
+// the transcoder writes image.png -> image.png.ktx
+inline string PrecompressedTexturePath(const string &filename)
+{
+    return filename + ".ktx";
+}
+
+// a precompressed texture is only used if it is at least as new as its source image
+inline bool IsPrecompressedTextureFresh(const string &filename, const string &ktxFilename)
+{
+    struct stat source, ktx;
+    if (stat(ktxFilename.c_str(), &ktx) != 0)
+        return false;
+    return stat(filename.c_str(), &source) != 0 || ktx.st_mtime >= source.st_mtime;
+}
+
+inline int BaseFormatComponents(GLenum baseFormat)
+{
+    switch (baseFormat)
+    {
+        case GL_RED: return 1;
+        case GL_RG: return 2;
+        case GL_RGB: return 3;
+        default: return 4;
+    }
+}
+
+// pixel format and sized internal format of an 8 bit image with the given number of components
+inline void TextureFormats(int nrComponents, GLenum &format, GLenum &internalFormat)
+{
+    switch (nrComponents)
+    {
+        case 1: format = GL_RED; internalFormat = GL_R8; break;
+        case 2: format = GL_RG; internalFormat = GL_RG8; break;
+        case 3: format = GL_RGB; internalFormat = GL_RGB8; break;
+        default: format = GL_RGBA; internalFormat = GL_RGBA8; break;
+    }
+}
+
+inline int MipLevelCount(int width, int height)
+{
+    int levels = 1;
+    while (width > 1 || height > 1)
+    {
+        width = max(1, width / 2);
+        height = max(1, height / 2);
+        levels++;
+    }
+    return levels;
+}
+
+// uncompressed size of an 8 bit image including its mip chain (~4/3 of the base level)
+inline size_t UncompressedTextureBytes(int width, int height, int nrComponents)
+{
+    size_t bytes = 0;
+    for (;;)
+    {
+        bytes += (size_t)width * height * nrComponents;
+        if (width == 1 && height == 1)
+            return bytes;
+        width = max(1, width / 2);
+        height = max(1, height / 2);
+    }
+}
+
+inline bool ReadFileBytes(const string &filename, vector<unsigned char> &bytes)
+{
+    ifstream in(filename, ios::binary | ios::ate);
+    if (!in)
+        return false;
+    bytes.resize((size_t)in.tellg());
+    in.seekg(0);
+    return (bool)in.read((char *)bytes.data(), bytes.size());
+}
+
+// FNV-1a, identifies images by content
+inline uint64_t HashBytes(const unsigned char *bytes, size_t size)
+{
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < size; i++)
+        hash = (hash ^ bytes[i]) * 1099511628211ull;
+    return hash;
+}
+
+// Decodes an image whose file content has already been read (safe to call from loader threads once LoadGLExtensions()
+// ran). Prefers an up to date precompressed .ktx the driver can sample, otherwise decodes the image itself with stb_image.
+TextureImage DecodeTextureImage(const string &filename, const vector<unsigned char> &bytes)
+{
+    auto start = chrono::steady_clock::now();
+    TextureImage image;
+    string ktxFilename = PrecompressedTexturePath(filename);
+    if (IsPrecompressedTextureFresh(filename, ktxFilename) && ReadKtx(ktxFilename, image.compressed) &&
+        IsCompressedFormatSupported(image.compressed.internalFormat))
+    {
+        image.width = image.compressed.width;
+        image.height = image.compressed.height;
+        image.nrComponents = BaseFormatComponents(image.compressed.baseInternalFormat);
+    }
+    else
+    {
+        image.compressed = KtxTexture(); // missing, stale or unsupported: fall back to the source image
+        image.data = stbi_load_from_memory(bytes.data(), (int)bytes.size(), &image.width, &image.height, &image.nrComponents, 0);
+    }
+    image.decodeTimeMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    return image;
+}
+
+TextureImage DecodeTextureImage(const string &filename)
+{
+    vector<unsigned char> bytes;
+    ReadFileBytes(filename, bytes);
+    return DecodeTextureImage(filename, bytes);
+}
+
+// creates the GL texture for a decoded image and releases the CPU copy. Must run on the GL thread.
+unsigned int UploadTextureImage(TextureImage &image, const string &path, GLenum wrap = GL_REPEAT)
+{
+    unsigned int textureID;
+    glGenTextures(1, &textureID);
+
+    if (!image.compressed.empty())
+    {
+        glBindTexture(GL_TEXTURE_2D, textureID);
+        int width = image.width, height = image.height;
+        for (unsigned int level = 0; level < image.compressed.levels.size(); level++)
+        {
+            const KtxLevel &mip = image.compressed.levels[level];
+            glCompressedTexImage2D(GL_TEXTURE_2D, level, image.compressed.internalFormat, width, height, 0,
+                                   (GLsizei)mip.size, image.compressed.data.data() + mip.offset);
+            width = max(1, width / 2);
+            height = max(1, height / 2);
+        }
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)image.compressed.levels.size() - 1);
+
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrap);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, wrap);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+        image.vramBytes = image.compressed.byteSize();
+        image.uncompressedBytes = UncompressedTextureBytes(image.width, image.height, image.nrComponents);
+        image.compressed = KtxTexture();
+    }
+    else if (image.data)
+    {
+        GLenum format, internalFormat;
+        TextureFormats(image.nrComponents, format, internalFormat);
+
+        // rows of RGB images with odd widths are not 4 byte aligned
+        GLint unpackAlignment;
+        glGetIntegerv(GL_UNPACK_ALIGNMENT, &unpackAlignment);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glBindTexture(GL_TEXTURE_2D, textureID);
+        glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, image.width, image.height, 0, format, GL_UNSIGNED_BYTE, image.data);
+        glGenerateMipmap(GL_TEXTURE_2D);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, unpackAlignment);
+
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrap);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, wrap);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+        image.uncompressedBytes = UncompressedTextureBytes(image.width, image.height, image.nrComponents);
+        image.vramBytes = image.uncompressedBytes;
+        stbi_image_free(image.data);
+    }
+    else
+    {
+        std::cout << "Texture failed to load at path: " << path << std::endl;
+    }
+    image.data = nullptr;
+
+    return textureID;
+}
+
+unsigned int TextureFromFile(const char *path, const string &directory, bool gamma = false)
+{
+    TextureImage image = DecodeTextureImage(directory + '/' + string(path));
+    return UploadTextureImage(image, path);
+}
+#endif
@@ -0,0 +1,425 @@
+#ifndef TEXTURE_COMPRESSION_H
+#define TEXTURE_COMPRESSION_H
+
+#include <learnopengl/gl_ext.h>
+#include <learnopengl/ktx.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+using namespace std;
+
+// CPU block compression used by the offline texture transcoder (tools/texture_transcoder.cpp). The encoders favour
+// simplicity over the last dB of quality: endpoints come from the principal axis of each 4x4 block and every texel
+// then picks its best palette entry.
+//   BC1 (S3TC DXT1)  opaque RGB, 4 bpp
+//   BC3 (S3TC DXT5)  RGB + smooth alpha, 8 bpp
+//   BC4 (RGTC1)      single channel, 4 bpp
+//   BC5 (RGTC2)      two channels (normal map XY), 8 bpp
+//   BC7 (BPTC)       RGB(A) at higher quality, 8 bpp - mode 6 only
+enum class BlockFormat {
+    BC1,
+    BC3,
+    BC4,
+    BC5,
+    BC7
+};
+
+inline GLenum BlockFormatInternalFormat(BlockFormat format)
+{
+    switch (format)
+    {
+        case BlockFormat::BC1: return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+        case BlockFormat::BC3: return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+        case BlockFormat::BC4: return GL_COMPRESSED_RED_RGTC1;
+        case BlockFormat::BC5: return GL_COMPRESSED_RG_RGTC2;
+        case BlockFormat::BC7: return GL_COMPRESSED_RGBA_BPTC_UNORM;
+    }
+    return 0;
+}
+
+inline GLenum BlockFormatBaseFormat(BlockFormat format)
+{
+    switch (format)
+    {
+        case BlockFormat::BC1: return GL_RGB;
+        case BlockFormat::BC4: return GL_RED;
+        case BlockFormat::BC5: return GL_RG;
+        default: return GL_RGBA;
+    }
+}
+
+inline size_t BlockFormatBlockSize(BlockFormat format)
+{
+    return (format == BlockFormat::BC1 || format == BlockFormat::BC4) ? 8 : 16;
+}
+
+inline const char *BlockFormatName(BlockFormat format)
+{
+    switch (format)
+    {
+        case BlockFormat::BC1: return "BC1";
+        case BlockFormat::BC3: return "BC3";
+        case BlockFormat::BC4: return "BC4";
+        case BlockFormat::BC5: return "BC5";
+        case BlockFormat::BC7: return "BC7";
+    }
+    return "?";
+}
+
+// principal axis of the block's colors (first `channels` components of the RGBA texels) by power iteration
+inline void BlockPrincipalAxis(const uint8_t *rgba, int channels, float mean[4], float axis[4])
+{
+    for (int c = 0; c < 4; c++)
+    {
+        mean[c] = 0.0f;
+        axis[c] = 0.0f;
+    }
+    for (int i = 0; i < 16; i++)
+        for (int c = 0; c < channels; c++)
+            mean[c] += rgba[i * 4 + c] / 16.0f;
+
+    float covariance[4][4] = {};
+    for (int i = 0; i < 16; i++)
+        for (int a = 0; a < channels; a++)
+            for (int b = 0; b < channels; b++)
+                covariance[a][b] += (rgba[i * 4 + a] - mean[a]) * (rgba[i * 4 + b] - mean[b]);
+
+    for (int c = 0; c < channels; c++)
+        axis[c] = 1.0f;
+    for (int iteration = 0; iteration < 8; iteration++)
+    {
+        float next[4] = {};
+        float length = 0.0f;
+        for (int a = 0; a < channels; a++)
+        {
+            for (int b = 0; b < channels; b++)
+                next[a] += covariance[a][b] * axis[b];
+            length = max(length, fabs(next[a]));
+        }
+        if (length < 1e-6f)
+            break; // flat block, keep the current axis
+        for (int c = 0; c < channels; c++)
+            axis[c] = next[c] / length;
+    }
+}
+
+// the two extreme colors of the block along its principal axis
+inline void BlockEndpoints(const uint8_t *rgba, int channels, float e0[4], float e1[4])
+{
+    float mean[4], axis[4];
+    BlockPrincipalAxis(rgba, channels, mean, axis);
+    float minT = 1e30f, maxT = -1e30f;
+    for (int i = 0; i < 16; i++)
+    {
+        float t = 0.0f;
+        for (int c = 0; c < channels; c++)
+            t += (rgba[i * 4 + c] - mean[c]) * axis[c];
+        minT = min(minT, t);
+        maxT = max(maxT, t);
+    }
+    float axisLength2 = 0.0f;
+    for (int c = 0; c < channels; c++)
+        axisLength2 += axis[c] * axis[c];
+    if (axisLength2 > 0.0f)
+    {
+        minT /= axisLength2;
+        maxT /= axisLength2;
+    }
+    for (int c = 0; c < 4; c++)
+    {
+        e0[c] = c < channels ? min(255.0f, max(0.0f, mean[c] + axis[c] * maxT)) : 255.0f;
+        e1[c] = c < channels ? min(255.0f, max(0.0f, mean[c] + axis[c] * minT)) : 255.0f;
+    }
+}
+
+inline uint16_t PackRGB565(const float color[4])
+{
+    int r = (int)lround(color[0] * 31.0f / 255.0f);
+    int g = (int)lround(color[1] * 63.0f / 255.0f);
+    int b = (int)lround(color[2] * 31.0f / 255.0f);
+    return (uint16_t)((r << 11) | (g << 5) | b);
+}
+
+inline void UnpackRGB565(uint16_t packed, int color[3])
+{
+    int r = (packed >> 11) & 31, g = (packed >> 5) & 63, b = packed & 31;
+    color[0] = (r << 3) | (r >> 2);
+    color[1] = (g << 2) | (g >> 4);
+    color[2] = (b << 3) | (b >> 2);
+}
+
+// 4-color BC1 block: two RGB565 endpoints followed by 2 bit indices. Also the color half of BC3.
+inline void EncodeBC1Block(const uint8_t *rgba, uint8_t *out)
+{
+    float e0[4], e1[4];
+    BlockEndpoints(rgba, 3, e0, e1);
+    uint16_t c0 = PackRGB565(e0), c1 = PackRGB565(e1);
+    if (c0 < c1)
+        swap(c0, c1); // c0 > c1 selects the 4-color mode
+    int palette[4][3];
+    UnpackRGB565(c0, palette[0]);
+    UnpackRGB565(c1, palette[1]);
+    for (int c = 0; c < 3; c++)
+    {
+        palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+        palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+    }
+
+    uint32_t indices = 0;
+    if (c0 != c1)
+    {
+        for (int i = 0; i < 16; i++)
+        {
+            int best = 0, bestError = 1 << 30;
+            for (int p = 0; p < 4; p++)
+            {
+                int error = 0;
+                for (int c = 0; c < 3; c++)
+                {
+                    int d = rgba[i * 4 + c] - palette[p][c];
+                    error += d * d;
+                }
+                if (error < bestError)
+                {
+                    bestError = error;
+                    best = p;
+                }
+            }
+            indices |= (uint32_t)best << (2 * i);
+        }
+    }
+    memcpy(out, &c0, 2);
+    memcpy(out + 2, &c1, 2);
+    memcpy(out + 4, &indices, 4);
+}
+
+// 8-value BC4 block for one channel (`channel` selects the component of the RGBA texels). Alpha half of BC3, both halves of BC5.
+inline void EncodeBC4Block(const uint8_t *rgba, int channel, uint8_t *out)
+{
+    int lo = 255, hi = 0;
+    for (int i = 0; i < 16; i++)
+    {
+        lo = min(lo, (int)rgba[i * 4 + channel]);
+        hi = max(hi, (int)rgba[i * 4 + channel]);
+    }
+    int palette[8];
+    palette[0] = hi; // a0 > a1 selects the 8 value mode
+    palette[1] = lo;
+    for (int k = 1; k < 7; k++)
+        palette[k + 1] = ((7 - k) * hi + k * lo + 3) / 7;
+
+    uint64_t indices = 0;
+    for (int i = 0; i < 16; i++)
+    {
+        int value = rgba[i * 4 + channel];
+        int best = 0, bestError = 1 << 30;
+        for (int p = 0; p < 8; p++)
+        {
+            int error = abs(value - palette[p]);
+            if (error < bestError)
+            {
+                bestError = error;
+                best = p;
+            }
+        }
+        indices |= (uint64_t)best << (3 * i);
+    }
+    out[0] = (uint8_t)hi;
+    out[1] = (uint8_t)lo;
+    for (int b = 0; b < 6; b++)
+        out[2 + b] = (uint8_t)(indices >> (8 * b));
+}
+
+// LSB first bit writer for BC7 blocks
+struct BC7BitWriter {
+    uint8_t *bytes;
+    int position = 0;
+
+    void write(uint32_t value, int numBits)
+    {
+        for (int b = 0; b < numBits; b++, position++)
+            if (value & (1u << b))
+                bytes[position >> 3] |= (uint8_t)(1u << (position & 7));
+    }
+};
+
+// BC7 mode 6: one subset, RGBA endpoints with 7 bits + a unique p-bit each, 4 bit indices
+inline void EncodeBC7Block(const uint8_t *rgba, uint8_t *out)
+{
+    static const int weights[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+    float endpoints[2][4];
+    BlockEndpoints(rgba, 4, endpoints[0], endpoints[1]);
+
+    // quantize every endpoint to 7 bits + the p-bit that fits it best
+    int quantized[2][4], pbit[2], color[2][4];
+    for (int e = 0; e < 2; e++)
+    {
+        int bestError = 1 << 30;
+        for (int p = 0; p < 2; p++)
+        {
+            int q[4], error = 0;
+            for (int c = 0; c < 4; c++)
+            {
+                q[c] = min(127, max(0, (int)lround((endpoints[e][c] - p) / 2.0f)));
+                int d = (q[c] * 2 + p) - (int)lround(endpoints[e][c]);
+                error += d * d;
+            }
+            if (error < bestError)
+            {
+                bestError = error;
+                pbit[e] = p;
+                for (int c = 0; c < 4; c++)
+                    quantized[e][c] = q[c];
+            }
+        }
+        for (int c = 0; c < 4; c++)
+            color[e][c] = quantized[e][c] * 2 + pbit[e];
+    }
+
+    int indices[16];
+    for (int i = 0; i < 16; i++)
+    {
+        int bestError = 1 << 30;
+        for (int w = 0; w < 16; w++)
+        {
+            int error = 0;
+            for (int c = 0; c < 4; c++)
+            {
+                int value = ((64 - weights[w]) * color[0][c] + weights[w] * color[1][c] + 32) >> 6;
+                int d = rgba[i * 4 + c] - value;
+                error += d * d;
+            }
+            if (error < bestError)
+            {
+                bestError = error;
+                indices[i] = w;
+            }
+        }
+    }
+    // the anchor (first) index is stored with its top bit implied zero
+    if (indices[0] & 8)
+    {
+        for (int c = 0; c < 4; c++)
+            swap(quantized[0][c], quantized[1][c]);
+        swap(pbit[0], pbit[1]);
+        for (int i = 0; i < 16; i++)
+            indices[i] = 15 - indices[i];
+    }
+
+    memset(out, 0, 16);
+    BC7BitWriter writer = { out };
+    writer.write(1 << 6, 7); // mode 6
+    for (int c = 0; c < 4; c++)
+    {
+        writer.write(quantized[0][c], 7);
+        writer.write(quantized[1][c], 7);
+    }
+    writer.write(pbit[0], 1);
+    writer.write(pbit[1], 1);
+    writer.write(indices[0], 3);
+    for (int i = 1; i < 16; i++)
+        writer.write(indices[i], 4);
+}
+
+inline void EncodeBlock(BlockFormat format, const uint8_t *rgba, uint8_t *out)
+{
+    switch (format)
+    {
+        case BlockFormat::BC1:
+            EncodeBC1Block(rgba, out);
+            break;
+        case BlockFormat::BC3:
+            EncodeBC4Block(rgba, 3, out);
+            EncodeBC1Block(rgba, out + 8);
+            break;
+        case BlockFormat::BC4:
+            EncodeBC4Block(rgba, 0, out);
+            break;
+        case BlockFormat::BC5:
+            EncodeBC4Block(rgba, 0, out);
+            EncodeBC4Block(rgba, 1, out + 8);
+            break;
+        case BlockFormat::BC7:
+            EncodeBC7Block(rgba, out);
+            break;
+    }
+}
+
+// half resolution RGBA8 image with a 2x2 box filter (odd edges clamp)
+inline vector<uint8_t> DownsampleRGBA(const vector<uint8_t> &src, int width, int height, int &outWidth, int &outHeight)
+{
+    outWidth = max(1, width / 2);
+    outHeight = max(1, height / 2);
+    vector<uint8_t> dst((size_t)outWidth * outHeight * 4);
+    for (int y = 0; y < outHeight; y++)
+    {
+        int y0 = min(2 * y, height - 1), y1 = min(2 * y + 1, height - 1);
+        for (int x = 0; x < outWidth; x++)
+        {
+            int x0 = min(2 * x, width - 1), x1 = min(2 * x + 1, width - 1);
+            for (int c = 0; c < 4; c++)
+            {
+                int sum = src[((size_t)y0 * width + x0) * 4 + c] + src[((size_t)y0 * width + x1) * 4 + c] +
+                          src[((size_t)y1 * width + x0) * 4 + c] + src[((size_t)y1 * width + x1) * 4 + c];
+                dst[((size_t)y * outWidth + x) * 4 + c] = (uint8_t)((sum + 2) / 4);
+            }
+        }
+    }
+    return dst;
+}
+
+// compresses an 8 bit image with 1-4 components into `format`, including the whole mip chain down to 1x1
+inline KtxTexture CompressImage(const unsigned char *pixels, int width, int height, int nrComponents, BlockFormat format)
+{
+    KtxTexture texture;
+    texture.internalFormat = BlockFormatInternalFormat(format);
+    texture.baseInternalFormat = BlockFormatBaseFormat(format);
+    texture.width = width;
+    texture.height = height;
+
+    // expand to RGBA8, single channel images are treated as gray
+    vector<uint8_t> level((size_t)width * height * 4);
+    for (size_t i = 0; i < (size_t)width * height; i++)
+    {
+        const unsigned char *src = pixels + i * nrComponents;
+        level[i * 4 + 0] = src[0];
+        level[i * 4 + 1] = nrComponents >= 2 ? src[1] : src[0];
+        level[i * 4 + 2] = nrComponents >= 3 ? src[2] : src[0];
+        level[i * 4 + 3] = nrComponents == 4 ? src[3] : (nrComponents == 2 ? src[1] : 255);
+    }
+
+    size_t blockSize = BlockFormatBlockSize(format);
+    int levelWidth = width, levelHeight = height;
+    for (;;)
+    {
+        int blocksX = (levelWidth + 3) / 4, blocksY = (levelHeight + 3) / 4;
+        KtxLevel entry = { texture.data.size(), blocksX * blocksY * blockSize };
+        texture.data.resize(entry.offset + entry.size);
+        uint8_t *out = texture.data.data() + entry.offset;
+        for (int by = 0; by < blocksY; by++)
+        {
+            for (int bx = 0; bx < blocksX; bx++)
+            {
+                uint8_t block[16 * 4];
+                for (int y = 0; y < 4; y++)
+                    for (int x = 0; x < 4; x++)
+                    {
+                        int sx = min(bx * 4 + x, levelWidth - 1), sy = min(by * 4 + y, levelHeight - 1);
+                        memcpy(block + (y * 4 + x) * 4, &level[((size_t)sy * levelWidth + sx) * 4], 4);
+                    }
+                EncodeBlock(format, block, out);
+                out += blockSize;
+            }
+        }
+        texture.levels.push_back(entry);
+
+        if (levelWidth == 1 && levelHeight == 1)
+            break;
+        level = DownsampleRGBA(level, levelWidth, levelHeight, levelWidth, levelHeight);
+    }
+    return texture;
+}
+#endif
@@ -0,0 +1,282 @@
+#ifndef TEXTURE_REGISTRY_H
+#define TEXTURE_REGISTRY_H
+
+#include <glad/glad.h>
+
+#include <learnopengl/texture.h>
+#include <learnopengl/texture_streamer.h>
+#include <learnopengl/thread_pool.h>
+
+#include <stdlib.h>
+
+#include <atomic>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+using namespace std;
+
+// pass as wrap mode to clamp images with an alpha channel and repeat all others (what the old loadTexture did)
+const GLenum TEXTURE_WRAP_AUTO = 0;
+
+class TextureRegistry;
+
+// One image known to the registry. Entries are keyed by canonical path; two paths whose files have the same content
+// share the texture of whichever was decoded first (the other one becomes an alias).
+struct TextureEntry {
+    string path;               // canonical (realpath) filename
+    GLenum wrap = GL_REPEAT;
+    uint64_t contentHash = 0;
+    unsigned int id = 0;       // GL texture, valid once resident
+    bool resident = false;
+    atomic<int> refCount{ 0 };
+
+    future<TextureImage> pending;     // decode in flight, consumed by the upload
+    TextureEntry *aliasOf = nullptr;  // set when another entry already holds the same content
+
+    // statistics of the upload
+    size_t vramBytes = 0;
+    size_t uncompressedBytes = 0;
+    double decodeTimeMs = 0.0;
+};
+
+// Reference counted handle to a registry texture, cheap to copy and safe to copy on loader threads.
+// id() is only meaningful once TextureRegistry::FinishLoading() ran for the handle (or any other handle of the image).
+class TextureHandle
+{
+public:
+    TextureHandle() = default;
+
+    TextureHandle(const TextureHandle &other) : entry(other.entry)
+    {
+        if (entry)
+            entry->refCount++;
+    }
+
+    TextureHandle(TextureHandle &&other) noexcept : entry(other.entry)
+    {
+        other.entry = nullptr;
+    }
+
+    TextureHandle &operator=(TextureHandle other)
+    {
+        swap(entry, other.entry);
+        return *this;
+    }
+
+    ~TextureHandle();
+
+    unsigned int id() const
+    {
+        return entry ? entry->id : 0;
+    }
+
+    bool valid() const
+    {
+        return entry != nullptr;
+    }
+
+    const TextureEntry *get() const
+    {
+        return entry;
+    }
+
+private:
+    friend class TextureRegistry;
+    TextureEntry *entry = nullptr;
+
+    explicit TextureHandle(TextureEntry *entry) : entry(entry)
+    {
+        entry->refCount++;
+    }
+};
+
+// Process wide texture registry: every image is decoded and resident exactly once no matter how many models (or
+// main.cpp) reference it. Lookups are O(1) by canonical path and, after reading the file, by content hash.
+// Acquire() may be called from any thread; FinishLoading(), UploadPending() and CollectGarbage() need the GL thread.
+class TextureRegistry
+{
+public:
+    static TextureRegistry &Instance()
+    {
+        static TextureRegistry registry;
+        return registry;
+    }
+
+    // returns a handle to the image, scheduling its decode (on the pool if given, inline otherwise) the first time
+    TextureHandle Acquire(const string &filename, ThreadPool *pool = nullptr, GLenum wrap = GL_REPEAT)
+    {
+        string key = canonicalPath(filename);
+        lock_guard<mutex> lock(registryMutex);
+        auto found = byPath.find(key);
+        if (found != byPath.end())
+            return TextureHandle(found->second.get());
+
+        unique_ptr<TextureEntry> created(new TextureEntry);
+        TextureEntry *entry = created.get();
+        entry->path = key;
+        entry->wrap = wrap;
+        byPath.emplace(key, std::move(created));
+
+        auto decode = [this, entry]() { return decodeEntry(entry); };
+        if (pool)
+            entry->pending = pool->submit(decode);
+        else
+            entry->pending = async(launch::deferred, decode); // decoded by FinishLoading() on the caller's thread
+        return TextureHandle(entry);
+    }
+
+    // makes the texture behind the handle resident, waiting for its decode if necessary
+    void FinishLoading(const TextureHandle &handle)
+    {
+        if (handle.entry)
+            upload(handle.entry);
+    }
+
+    // uploads every image acquired so far
+    void UploadPending()
+    {
+        vector<TextureEntry *> entries;
+        {
+            lock_guard<mutex> lock(registryMutex);
+            for (auto &item : byPath)
+                entries.push_back(item.second.get());
+        }
+        for (TextureEntry *entry : entries)
+            upload(entry);
+    }
+
+    // deletes the textures no handle refers to anymore
+    void CollectGarbage()
+    {
+        if (!garbage.exchange(false))
+            return;
+        lock_guard<mutex> lock(registryMutex);
+        for (auto it = byPath.begin(); it != byPath.end();)
+        {
+            TextureEntry *entry = it->second.get();
+            // aliases keep their target referenced, entries still loading are left alone
+            if (entry->refCount > 0 || entry->pending.valid())
+            {
+                ++it;
+                continue;
+            }
+            if (entry->aliasOf)
+                entry->aliasOf->refCount--;
+            else if (entry->resident)
+            {
+                if (streamer)
+                    streamer->Cancel(entry->id);
+                glDeleteTextures(1, &entry->id);
+            }
+            auto hashed = byHash.find(entry->contentHash);
+            if (hashed != byHash.end() && hashed->second == entry)
+                byHash.erase(hashed);
+            it = byPath.erase(it);
+            garbage = true; // the alias target may have become garbage now, look again next time
+        }
+    }
+
+    // with a streamer, uploads only allocate the texture and its contents arrive over the following frames;
+    // pass nullptr to upload synchronously again (the default)
+    void SetStreamer(TextureStreamer *textureStreamer)
+    {
+        streamer = textureStreamer;
+    }
+
+    size_t size()
+    {
+        lock_guard<mutex> lock(registryMutex);
+        return byPath.size();
+    }
+
+    // GPU memory of all resident textures (aliases counted once)
+    size_t residentBytes()
+    {
+        lock_guard<mutex> lock(registryMutex);
+        size_t bytes = 0;
+        for (auto &item : byPath)
+            if (item.second->resident && !item.second->aliasOf)
+                bytes += item.second->vramBytes;
+        return bytes;
+    }
+
+private:
+    friend class TextureHandle;
+    mutex registryMutex;
+    unordered_map<string, unique_ptr<TextureEntry>> byPath;
+    unordered_map<uint64_t, TextureEntry *> byHash;
+    atomic<bool> garbage{ false };
+    TextureStreamer *streamer = nullptr;
+
+    TextureRegistry() = default;
+
+    static string canonicalPath(const string &filename)
+    {
+        char *resolved = realpath(filename.c_str(), nullptr);
+        if (!resolved)
+            return filename; // missing file, the decode reports the error
+        string path(resolved);
+        free(resolved);
+        return path;
+    }
+
+    // runs on a loader thread: reads and hashes the file, then decodes it unless the same content is already known
+    TextureImage decodeEntry(TextureEntry *entry)
+    {
+        vector<unsigned char> bytes;
+        ReadFileBytes(entry->path, bytes);
+        entry->contentHash = HashBytes(bytes.data(), bytes.size());
+        {
+            lock_guard<mutex> lock(registryMutex);
+            auto claimed = byHash.emplace(entry->contentHash, entry);
+            if (!claimed.second && !bytes.empty())
+            {
+                entry->aliasOf = claimed.first->second;
+                entry->aliasOf->refCount++;
+                return TextureImage();
+            }
+        }
+        return DecodeTextureImage(entry->path, bytes);
+    }
+
+    void upload(TextureEntry *entry)
+    {
+        if (entry->resident)
+            return;
+        TextureImage image = entry->pending.get();
+        if (entry->aliasOf)
+        {
+            upload(entry->aliasOf);
+            entry->id = entry->aliasOf->id;
+            entry->vramBytes = entry->aliasOf->vramBytes;
+            entry->uncompressedBytes = entry->aliasOf->uncompressedBytes;
+        }
+        else
+        {
+            GLenum wrap = entry->wrap;
+            if (wrap == TEXTURE_WRAP_AUTO)
+                wrap = image.nrComponents == 4 ? GL_CLAMP_TO_EDGE : GL_REPEAT;
+            entry->decodeTimeMs = image.decodeTimeMs;
+            entry->id = streamer ? streamer->Stream(image, entry->path, wrap) : UploadTextureImage(image, entry->path, wrap);
+            entry->vramBytes = image.vramBytes;
+            entry->uncompressedBytes = image.uncompressedBytes;
+        }
+        entry->resident = true;
+    }
+
+    void release(TextureEntry *entry)
+    {
+        if (--entry->refCount == 0)
+            garbage = true;
+    }
+};
+
+inline TextureHandle::~TextureHandle()
+{
+    if (entry)
+        TextureRegistry::Instance().release(entry);
+}
+#endif
@@ -0,0 +1,438 @@
+#ifndef TEXTURE_STREAMER_H
+#define TEXTURE_STREAMER_H
+
+#include <glad/glad.h>
+#include <stb_image.h>
+
+#include <learnopengl/gl_ext.h>
+#include <learnopengl/texture.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <string>
+#include <vector>
+using namespace std;
+
+// Uploads decoded images to the GPU a few rows at a time so that loading textures never stalls a frame.
+//
+// Stream() allocates the texture (immutable glTexStorage2D storage where available) and returns its id right away;
+// the pixels follow over the next frames, Update() copying at most frameBudget bytes per frame into a pixel unpack
+// buffer allocated once and used as a ring, each copy mapping its slice with glMapBufferRange. Every frame's share of
+// the ring is guarded by a fence and only reused once the GPU has consumed it, so the driver never has to wait for or
+// copy the application's memory.
+//
+// Only levels that have arrived are ever sampled: Stream() uploads a small level right away, box filtered on the CPU
+// to at most PREVIEW_SIZE texels a side for uncompressed images and the smallest stored level of precompressed ones,
+// and GL_TEXTURE_BASE_LEVEL points at it. Uncompressed images then stream their base level and switch to it, with the
+// generated mip chain, once it is complete. Precompressed images stream their other levels from the smallest to the
+// largest and lower the base level after each one, so they sharpen progressively instead of popping in.
+class TextureStreamer
+{
+public:
+    static const int PREVIEW_SIZE = 16;
+
+    TextureStreamer(size_t ringBytes = 8 * 1024 * 1024, size_t frameBudget = 2 * 1024 * 1024)
+        : ringBytes(ringBytes), frameBudget(min(frameBudget, ringBytes))
+    {
+        glGenBuffers(1, &ringBuffer);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, ringBuffer);
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, ringBytes, nullptr, GL_STREAM_DRAW);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    }
+
+    ~TextureStreamer()
+    {
+        for (InFlight &frame : inFlight)
+            glDeleteSync(frame.fence);
+        for (Job &job : jobs)
+            releaseImage(job.image);
+        glDeleteBuffers(1, &ringBuffer);
+    }
+
+    TextureStreamer(const TextureStreamer &) = delete;
+    TextureStreamer &operator=(const TextureStreamer &) = delete;
+
+    // Creates the texture for a decoded image and queues its contents. Takes over the CPU copy of the image and
+    // fills in image.vramBytes/uncompressedBytes like UploadTextureImage(). Must run on the GL thread.
+    unsigned int Stream(TextureImage &image, const string &path, GLenum wrap = GL_REPEAT)
+    {
+        unsigned int textureID;
+        glGenTextures(1, &textureID);
+        if (image.compressed.empty() && !image.data)
+        {
+            std::cout << "Texture failed to load at path: " << path << std::endl;
+            return textureID;
+        }
+
+        // the job takes over the pixels
+        Job job;
+        job.id = textureID;
+        job.image = std::move(image);
+        image.data = nullptr;
+        image.compressed = KtxTexture();
+        const TextureImage &source = job.image;
+        // the preview level is copied straight from client memory
+        GLint unpackAlignment;
+        glGetIntegerv(GL_UNPACK_ALIGNMENT, &unpackAlignment);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        glBindTexture(GL_TEXTURE_2D, textureID);
+        size_t queuedBytes = imageBytes(source);
+        if (!source.compressed.empty())
+        {
+            const KtxTexture &ktx = source.compressed;
+            job.levels = (int)ktx.levels.size();
+            if (GLCaps().textureStorage)
+                GLExt().TexStorage2D(GL_TEXTURE_2D, job.levels, ktx.internalFormat, source.width, source.height);
+            else
+                for (int level = 0; level < job.levels; level++)
+                    glCompressedTexImage2D(GL_TEXTURE_2D, level, ktx.internalFormat, levelExtent(source.width, level),
+                                           levelExtent(source.height, level), 0, (GLsizei)ktx.levels[level].size, nullptr);
+            // the smallest level now, each larger one streamed after it lowers the base level
+            int smallest = job.levels - 1;
+            glCompressedTexSubImage2D(GL_TEXTURE_2D, smallest, 0, 0, levelExtent(source.width, smallest),
+                                      levelExtent(source.height, smallest), ktx.internalFormat,
+                                      (GLsizei)ktx.levels[smallest].size, ktx.data.data() + ktx.levels[smallest].offset);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, smallest);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, job.levels - 1);
+            job.level = smallest - 1;
+            job.done = smallest == 0;
+            queuedBytes -= ktx.levels[smallest].size;
+            image.vramBytes = ktx.byteSize();
+        }
+        else
+        {
+            GLenum format, internalFormat;
+            TextureFormats(source.nrComponents, format, internalFormat);
+            job.levels = MipLevelCount(source.width, source.height);
+            if (GLCaps().textureStorage)
+                GLExt().TexStorage2D(GL_TEXTURE_2D, job.levels, internalFormat, source.width, source.height);
+            else
+                glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, source.width, source.height, 0, format, GL_UNSIGNED_BYTE, nullptr);
+            // the first level no larger than the preview, sampled alone until the base level has streamed in
+            int preview = 0;
+            while (max(levelExtent(source.width, preview), levelExtent(source.height, preview)) > PREVIEW_SIZE)
+                preview++;
+            if (preview == 0)
+            {
+                // small enough to upload whole
+                glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, source.width, source.height, format, GL_UNSIGNED_BYTE, source.data);
+                glGenerateMipmap(GL_TEXTURE_2D);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, job.levels - 1);
+                job.done = true;
+            }
+            else
+            {
+                int width = levelExtent(source.width, preview), height = levelExtent(source.height, preview);
+                vector<unsigned char> pixels = boxFilter(source, width, height);
+                if (GLCaps().textureStorage)
+                    glTexSubImage2D(GL_TEXTURE_2D, preview, 0, 0, width, height, format, GL_UNSIGNED_BYTE, pixels.data());
+                else
+                    glTexImage2D(GL_TEXTURE_2D, preview, internalFormat, width, height, 0, format, GL_UNSIGNED_BYTE, pixels.data());
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, preview);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, preview);
+            }
+            job.level = 0;
+            image.vramBytes = UncompressedTextureBytes(image.width, image.height, image.nrComponents);
+        }
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrap);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, wrap);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, unpackAlignment);
+
+        image.uncompressedBytes = UncompressedTextureBytes(image.width, image.height, image.nrComponents);
+        if (job.done)
+        {
+            releaseImage(job.image);
+            return textureID;
+        }
+        pendingBytes += queuedBytes;
+        jobs.push_back(std::move(job));
+        return textureID;
+    }
+
+    // drops the queued contents of a texture that is about to be deleted
+    void Cancel(unsigned int textureID)
+    {
+        for (auto it = jobs.begin(); it != jobs.end(); ++it)
+            if (it->id == textureID)
+            {
+                pendingBytes -= remainingBytes(*it);
+                releaseImage(it->image);
+                jobs.erase(it);
+                return;
+            }
+    }
+
+    // call once per frame on the GL thread
+    void Update()
+    {
+        retireFrames();
+        if (jobs.empty())
+            return;
+
+        auto start = chrono::steady_clock::now();
+        GLint unpackAlignment;
+        glGetIntegerv(GL_UNPACK_ALIGNMENT, &unpackAlignment);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1); // rows of RGB images with odd widths are not 4 byte aligned
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, ringBuffer);
+
+        size_t budget = frameBudget;
+        size_t frameBytes = 0;
+        while (!jobs.empty() && budget > 0)
+        {
+            Job &job = jobs.front();
+            size_t sliceBytes = uploadSlice(job, budget, frameBytes);
+            if (sliceBytes == 0)
+                break; // the ring is full, the GPU is still reading the previous frames
+            budget -= min(budget, sliceBytes);
+            bytesStreamed += sliceBytes;
+            pendingBytes -= sliceBytes;
+            if (job.done)
+            {
+                texturesStreamed++;
+                releaseImage(job.image);
+                jobs.pop_front();
+            }
+        }
+
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, unpackAlignment);
+        if (frameBytes > 0)
+            inFlight.push_back({ glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0), frameBytes });
+
+        double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+        framesStreaming++;
+        worstFrameMs = max(worstFrameMs, ms);
+        if (jobs.empty())
+        {
+            std::cout << "TEXTURE_STREAMER:: " << texturesStreamed << " textures, " << bytesStreamed / (1024.0 * 1024.0)
+                      << " MB streamed over " << framesStreaming << " frames, at most " << worstFrameMs
+                      << " ms per frame" << std::endl;
+            texturesStreamed = 0;
+            bytesStreamed = 0;
+            framesStreaming = 0;
+            worstFrameMs = 0.0;
+        }
+    }
+
+    bool Idle() const
+    {
+        return jobs.empty();
+    }
+
+    // bytes still waiting to be copied to the GPU
+    size_t PendingBytes() const
+    {
+        return pendingBytes;
+    }
+
+private:
+    struct Job {
+        unsigned int id = 0;
+        TextureImage image;
+        int levels = 1;
+        int level = 0;      // level being streamed
+        int row = 0;        // next pixel row (or block row for compressed levels) of that level
+        bool done = false;
+    };
+
+    struct InFlight {
+        GLsync fence;
+        size_t bytes;       // ring bytes the frame used, including space skipped at the end of the ring
+    };
+
+    unsigned int ringBuffer = 0;
+    size_t ringBytes;
+    size_t frameBudget;
+    size_t ringHead = 0;    // next free byte
+    size_t ringUsed = 0;    // bytes the GPU may still be reading
+    deque<InFlight> inFlight;
+    deque<Job> jobs;
+    size_t pendingBytes = 0;
+
+    // statistics of the current burst, reported when the queue runs empty
+    size_t texturesStreamed = 0;
+    size_t bytesStreamed = 0;
+    size_t framesStreaming = 0;
+    double worstFrameMs = 0.0;
+
+    static int levelExtent(int size, int level)
+    {
+        return max(1, size >> level);
+    }
+
+    static void releaseImage(TextureImage &image)
+    {
+        if (image.data)
+            stbi_image_free(image.data);
+        image.data = nullptr;
+        image.compressed = KtxTexture();
+    }
+
+    // the image scaled down to width x height, every texel the average of the source texels it covers
+    static vector<unsigned char> boxFilter(const TextureImage &image, int width, int height)
+    {
+        int channels = image.nrComponents;
+        vector<unsigned char> pixels((size_t)width * height * channels);
+        vector<uint32_t> sums(channels);
+        for (int y = 0; y < height; y++)
+        {
+            int y0 = (int)((int64_t)y * image.height / height), y1 = (int)((int64_t)(y + 1) * image.height / height);
+            for (int x = 0; x < width; x++)
+            {
+                int x0 = (int)((int64_t)x * image.width / width), x1 = (int)((int64_t)(x + 1) * image.width / width);
+                fill(sums.begin(), sums.end(), 0u);
+                for (int sy = y0; sy < y1; sy++)
+                {
+                    const unsigned char *row = image.data + ((size_t)sy * image.width + x0) * channels;
+                    for (int sx = x0; sx < x1; sx++, row += channels)
+                        for (int c = 0; c < channels; c++)
+                            sums[c] += row[c];
+                }
+                uint32_t count = (uint32_t)((y1 - y0) * (x1 - x0));
+                for (int c = 0; c < channels; c++)
+                    pixels[((size_t)y * width + x) * channels + c] = (unsigned char)((sums[c] + count / 2) / count);
+            }
+        }
+        return pixels;
+    }
+
+    static size_t imageBytes(const TextureImage &image)
+    {
+        if (!image.compressed.empty())
+            return image.compressed.byteSize();
+        return (size_t)image.width * image.height * image.nrComponents;
+    }
+
+    size_t remainingBytes(const Job &job) const
+    {
+        if (job.image.compressed.empty())
+            return (size_t)(job.image.height - job.row) * job.image.width * job.image.nrComponents;
+        const KtxTexture &ktx = job.image.compressed;
+        size_t bytes = 0;
+        for (int level = 0; level <= job.level; level++)
+            bytes += ktx.levels[level].size;
+        int blockRows = (levelExtent(job.image.height, job.level) + 3) / 4;
+        return bytes - ktx.levels[job.level].size / blockRows * job.row;
+    }
+
+    // frees the ring space of every frame the GPU has finished with, without waiting
+    void retireFrames()
+    {
+        while (!inFlight.empty())
+        {
+            GLenum status = glClientWaitSync(inFlight.front().fence, 0, 0);
+            if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+                return;
+            glDeleteSync(inFlight.front().fence);
+            ringUsed -= inFlight.front().bytes;
+            inFlight.pop_front();
+        }
+    }
+
+    // reserves size contiguous bytes of the ring, returns false if the GPU still uses them
+    bool allocate(size_t size, size_t &offset, size_t &frameBytes)
+    {
+        size_t skipped = ringHead + size > ringBytes ? ringBytes - ringHead : 0;
+        if (ringUsed + skipped + size > ringBytes)
+            return false;
+        if (skipped)
+            ringHead = 0;
+        offset = ringHead;
+        ringHead += size;
+        ringUsed += skipped + size;
+        frameBytes += skipped + size;
+        return true;
+    }
+
+    // copies as many rows of the job as fit into the budget through the ring, returns the bytes copied
+    size_t uploadSlice(Job &job, size_t budget, size_t &frameBytes)
+    {
+        const TextureImage &image = job.image;
+        bool compressed = !image.compressed.empty();
+        int width = levelExtent(image.width, job.level);
+        int height = levelExtent(image.height, job.level);
+        // compressed levels are copied in rows of 4x4 blocks
+        int totalRows = compressed ? (height + 3) / 4 : height;
+        size_t levelBytes = compressed ? image.compressed.levels[job.level].size : (size_t)width * height * image.nrComponents;
+        size_t rowBytes = levelBytes / totalRows;
+
+        // always make progress with at least one row, even if a single row exceeds the budget
+        int rows = (int)min<size_t>(totalRows - job.row, max<size_t>(1, budget / rowBytes));
+        rows = (int)min<size_t>(rows, max<size_t>(1, ringBytes / rowBytes));
+        size_t size = rows * rowBytes;
+        size_t offset;
+        if (size > ringBytes || !allocate(size, offset, frameBytes))
+        {
+            if (size <= ringBytes)
+                return 0;
+            // a row larger than the whole ring, upload it directly
+            offset = 0;
+        }
+
+        const unsigned char *source = compressed ? image.compressed.data.data() + image.compressed.levels[job.level].offset
+                                                 : image.data;
+        source += job.row * rowBytes;
+        const void *pixels = source;
+        if (size <= ringBytes)
+        {
+            void *mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, offset, size,
+                                            GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+            memcpy(mapped, source, size);
+            glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+            pixels = (const void *)offset; // offset into the bound unpack buffer
+        }
+        else
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+        glBindTexture(GL_TEXTURE_2D, job.id);
+        if (compressed)
+        {
+            int y = job.row * 4;
+            int sliceHeight = min(height - y, rows * 4);
+            glCompressedTexSubImage2D(GL_TEXTURE_2D, job.level, 0, y, width, sliceHeight, image.compressed.internalFormat,
+                                      (GLsizei)size, pixels);
+        }
+        else
+        {
+            GLenum format, internalFormat;
+            TextureFormats(image.nrComponents, format, internalFormat);
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, job.row, width, rows, format, GL_UNSIGNED_BYTE, pixels);
+        }
+        if (size > ringBytes)
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, ringBuffer);
+
+        job.row += rows;
+        if (job.row == totalRows)
+            finishLevel(job);
+        return size;
+    }
+
+    void finishLevel(Job &job)
+    {
+        job.row = 0;
+        if (!job.image.compressed.empty())
+        {
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, job.level);
+            if (job.level == 0)
+                job.done = true;
+            else
+                job.level--;
+            return;
+        }
+        // the base level replaces the preview, the levels between them are generated from it
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, job.levels - 1);
+        glGenerateMipmap(GL_TEXTURE_2D);
+        job.done = true;
+    }
+};
+#endif
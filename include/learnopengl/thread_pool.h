@@ -0,0 +1,86 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+using namespace std;
+
+// A fixed size pool of worker threads. Tasks are run in submission order by whichever worker is free and their
+// results are returned through std::future. Tasks must not block on futures of other tasks of the same pool,
+// the waiting should be done by the thread that owns the pool (the GL thread).
+class ThreadPool
+{
+public:
+    explicit ThreadPool(unsigned int numThreads = thread::hardware_concurrency())
+    {
+        if (numThreads == 0)
+            numThreads = 1;
+        for (unsigned int i = 0; i < numThreads; i++)
+            workers.emplace_back([this]() { workerLoop(); });
+    }
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    // finishes the queued tasks and joins the workers
+    ~ThreadPool()
+    {
+        {
+            lock_guard<mutex> lock(queueMutex);
+            stopping = true;
+        }
+        queueCondition.notify_all();
+        for (thread &worker : workers)
+            worker.join();
+    }
+
+    template<typename F>
+    auto submit(F task) -> future<decltype(task())>
+    {
+        using Result = decltype(task());
+        auto packaged = make_shared<packaged_task<Result()>>(std::move(task));
+        future<Result> result = packaged->get_future();
+        {
+            lock_guard<mutex> lock(queueMutex);
+            tasks.push([packaged]() { (*packaged)(); });
+        }
+        queueCondition.notify_one();
+        return result;
+    }
+
+    unsigned int size() const
+    {
+        return (unsigned int)workers.size();
+    }
+
+private:
+    vector<thread> workers;
+    queue<function<void()>> tasks;
+    mutex queueMutex;
+    condition_variable queueCondition;
+    bool stopping = false;
+
+    void workerLoop()
+    {
+        for (;;)
+        {
+            function<void()> task;
+            {
+                unique_lock<mutex> lock(queueMutex);
+                queueCondition.wait(lock, [this]() { return stopping || !tasks.empty(); });
+                if (tasks.empty())
+                    return; // stopping and nothing left to do
+                task = std::move(tasks.front());
+                tasks.pop();
+            }
+            task();
+        }
+    }
+};
+#endif
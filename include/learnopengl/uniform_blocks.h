@@ -0,0 +1,112 @@
+#ifndef UNIFORM_BLOCKS_H
+#define UNIFORM_BLOCKS_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// Uniform blocks shared by every shader program. Each block lives in one uniform buffer that is written once per frame
+// and stays bound to a fixed binding point; Shader connects the blocks of a program to these points when it links.
+// The structs mirror the std140 layout of the GLSL declarations:
+//
+//   layout (std140) uniform FrameData {
+//       mat4 view;
+//       mat4 projection;
+//       mat4 viewProjection;
+//       vec3 cameraPosition;
+//       float time;
+//   };
+//
+//   layout (std140) uniform LightData {
+//       ivec3 clusterCount;
+//       int pointLightCount;
+//       float sliceScale;
+//       float sliceBias;
+//   };
+//
+// The point lights themselves are in buffer textures, see clustered_lighting.h.
+
+struct FrameUniforms {
+    glm::mat4 view;
+    glm::mat4 projection;
+    glm::mat4 viewProjection;
+    glm::vec3 cameraPosition;
+    float time;
+};
+static_assert(offsetof(FrameUniforms, view) == 0, "FrameData.view must be at offset 0");
+static_assert(offsetof(FrameUniforms, projection) == 64, "FrameData.projection must be at offset 64");
+static_assert(offsetof(FrameUniforms, viewProjection) == 128, "FrameData.viewProjection must be at offset 128");
+static_assert(offsetof(FrameUniforms, cameraPosition) == 192, "FrameData.cameraPosition must be at offset 192");
+static_assert(offsetof(FrameUniforms, time) == 204, "FrameData.time shares the vec3's last 4 bytes");
+static_assert(sizeof(FrameUniforms) == 208, "FrameData is 208 bytes in std140");
+
+// light cluster grid: a fragment at view depth d is in slice max(floor(log(d) * sliceScale - sliceBias) + 1, 0)
+struct LightUniforms {
+    glm::ivec3 clusterCount;
+    int32_t pointLightCount;
+    float sliceScale;
+    float sliceBias;
+    float padding[2];
+};
+static_assert(offsetof(LightUniforms, pointLightCount) == 12, "LightData.pointLightCount shares the ivec3's last 4 bytes");
+static_assert(offsetof(LightUniforms, sliceScale) == 16, "LightData.sliceScale must be at offset 16");
+static_assert(sizeof(LightUniforms) == 32, "LightData is rounded up to a multiple of 16 bytes");
+
+// fixed binding point and expected size of every shared block, looked up by block name when a program links
+struct SharedUniformBlock {
+    const char *name;
+    GLuint binding;
+    size_t size;
+};
+
+inline const SharedUniformBlock *FindSharedUniformBlock(const char *name)
+{
+    static const SharedUniformBlock blocks[] = {
+        { "FrameData", 0, sizeof(FrameUniforms) },
+        { "LightData", 1, sizeof(LightUniforms) },
+    };
+    for (const SharedUniformBlock &block : blocks)
+        if (strcmp(block.name, name) == 0)
+            return &block;
+    return nullptr;
+}
+
+// the uniform buffer behind one shared block
+template <typename T>
+class UniformBlockBuffer
+{
+public:
+    explicit UniformBlockBuffer(const char *blockName)
+    {
+        binding = FindSharedUniformBlock(blockName)->binding;
+        glGenBuffers(1, &buffer);
+        glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+        glBufferData(GL_UNIFORM_BUFFER, sizeof(T), nullptr, GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        glBindBufferBase(GL_UNIFORM_BUFFER, binding, buffer);
+    }
+
+    ~UniformBlockBuffer()
+    {
+        glDeleteBuffers(1, &buffer);
+    }
+
+    UniformBlockBuffer(const UniformBlockBuffer &) = delete;
+    UniformBlockBuffer &operator=(const UniformBlockBuffer &) = delete;
+
+    // replaces the whole block; orphaning the storage keeps this from waiting on draws still reading last frame's data
+    void update(const T &data)
+    {
+        glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+        glBufferData(GL_UNIFORM_BUFFER, sizeof(T), &data, GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    }
+
+private:
+    unsigned int buffer = 0;
+    GLuint binding = 0;
+};
+#endif
@@ -1,20 +1,33 @@
 #version 330 core
+// Three programs in one (deferred_shading.h): forward shading by default, the G-buffer pass of the deferred path with
+// GBUFFER defined and its full screen lighting pass with DEFERRED_LIGHTING defined
+#ifdef GBUFFER
+layout (location = 0) out vec4 AlbedoSpecular;
+layout (location = 1) out vec4 NormalGloss;
+#else
 out vec4 FragColor;
+#endif
 
-// #define NUM_LIGHTS (3)
-
+// as the four texels of a light in pointLightData (PointLightData in clustered_lighting.h)
 struct PointLight {
     vec3 position;
-
-    vec3 specular;
-    vec3 diffuse;
+    float range;
     vec3 ambient;
-
     float constant;
+    vec3 diffuse;
     float linear;
+    vec3 specular;
     float quadratic;
 };
 
+#ifdef DEFERRED_LIGHTING
+in vec2 NdcPosition;
+
+uniform sampler2D gAlbedoSpecular;
+uniform sampler2D gNormalGloss;
+uniform sampler2D gDepth;
+uniform mat4 inverseViewProjection;
+#else
 struct Material {
     sampler2D texture_diffuse1;
     sampler2D texture_specular1;
@@ -25,19 +38,70 @@ in vec2 TexCoords;
 in vec3 Normal;
 in vec3 FragPos;
 
-// NOT WORKING
-// #define NUM_LIGHTS (4)
-//
-// uniform PointLight pointLight[NUM_LIGHTS];
-uniform PointLight pointLight;
 uniform Material material;
+#endif
+
+layout (std140) uniform FrameData {   // uniform_blocks.h
+    mat4 view;
+    mat4 projection;
+    mat4 viewProjection;
+    vec3 cameraPosition;
+    float time;
+};
+layout (std140) uniform LightData {
+    ivec3 clusterCount;
+    int pointLightCount;
+    float sliceScale;
+    float sliceBias;
+};
+// clustered lights, see clustered_lighting.h
+uniform samplerBuffer pointLightData;
+uniform usamplerBuffer lightClusters;
+uniform usamplerBuffer lightIndices;
 uniform bool blinn_flag;
 
-uniform vec3 viewPosition;
+// the G-buffer keeps shininess / MAX_SHININESS in 10 bits
+#define MAX_SHININESS 256.0
 
+// normals in the G-buffer, as in the packed vertices
+vec2 octahedralEncode(vec3 n)
+{
+    n /= abs(n.x) + abs(n.y) + abs(n.z);
+    if (n.z < 0.0)
+        n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    return n.xy;
+}
+
+vec3 octahedralDecode(vec2 e)
+{
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    if (n.z < 0.0)
+        n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    return normalize(n);
+}
+
+
+PointLight FetchPointLight(int index)
+{
+    vec4 texel0 = texelFetch(pointLightData, index * 4);
+    vec4 texel1 = texelFetch(pointLightData, index * 4 + 1);
+    vec4 texel2 = texelFetch(pointLightData, index * 4 + 2);
+    vec4 texel3 = texelFetch(pointLightData, index * 4 + 3);
+    return PointLight(texel0.xyz, texel0.w, texel1.xyz, texel1.w, texel2.xyz, texel2.w, texel3.xyz, texel3.w);
+}
+
+// first light index and light count of the cluster the fragment is in
+uvec2 FindCluster(vec3 fragPos)
+{
+    vec4 clip = viewProjection * vec4(fragPos, 1.0);
+    ivec2 tile = clamp(ivec2((clip.xy / clip.w * 0.5 + 0.5) * vec2(clusterCount.xy)), ivec2(0), clusterCount.xy - 1);
+    // clip.w is the view depth
+    int slice = clamp(int(floor(log(clip.w) * sliceScale - sliceBias)) + 1, 0, clusterCount.z - 1);
+    return texelFetch(lightClusters, tile.x + clusterCount.x * (tile.y + clusterCount.y * slice)).rg;
+}
 
 // calculates the color when using a point light.
-vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
+vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir, vec3 albedo, float specularMask, float shininess)
 {
     vec3 lightDir = normalize(light.position - fragPos);
     // diffuse shading
@@ -49,25 +113,28 @@ vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
     //Blinn-Phong
     if(blinn_flag){
         vec3 halfwayDir = normalize(lightDir + viewDir);
-        spec = pow(max(dot(normal, halfwayDir), 0.0), 4*material.shininess);
+        spec = pow(max(dot(normal, halfwayDir), 0.0), 4*shininess);
     }
     else{
-        spec = 0.2*pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
+        spec = 0.2*pow(max(dot(viewDir, reflectDir), 0.0), shininess);
     }
 
     // attenuation
     float d = length(light.position - fragPos);
     float attenuation = 1.0 / (light.constant + light.linear * d + light.quadratic * (d * d));
+    // fades out towards the range, past which the light isn't in the fragment's cluster
+    float window = clamp(1.0 - pow(d / light.range, 4.0), 0.0, 1.0);
+    attenuation *= window * window;
     // combine results
 //                                  izvlacimo boju teksture
-    vec3 ambient = light.ambient * vec3(texture(material.texture_diffuse1, TexCoords));
+    vec3 ambient = light.ambient * albedo;
 //     Blending
 //     vec4 diffSample = texture(material.texture_diffuse1, TexCords);
 //     if(diffSample.a < 0.1)
 //         discard;
-    vec3 diffuse = light.diffuse * diff * vec3(texture(material.texture_diffuse1, TexCoords)); // vec4
+    vec3 diffuse = light.diffuse * diff * albedo; // vec4
 //     vec3 diffuse = light.diffuse * diff * vec3(diffSample); // vec4
-    vec3 specular = light.specular * spec * vec3(texture(material.texture_specular1, TexCoords).xxx);
+    vec3 specular = light.specular * spec * vec3(specularMask);
     ambient *= attenuation;
     diffuse *= attenuation;
     specular *= attenuation;
@@ -76,15 +143,52 @@ vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
 }
 
 
-void main()
+// the lights of the fragment's cluster
+vec3 Shade(vec3 fragPos, vec3 normal, vec3 albedo, float specularMask, float shininess)
 {
-    vec3 normal = normalize(Normal);
-    vec3 viewDir = normalize(viewPosition - FragPos);
+    vec3 viewDir = normalize(cameraPosition - fragPos);
     vec3 result = vec3(0.0f);
 
-//    for(int i = 0; i < NUM_LIGHTS; i++)
-//      result += CalcPointLight(pointLight[i], normal, FragPos, viewDir);
-     result = CalcPointLight(pointLight, normal, FragPos, viewDir);
+    uvec2 cluster = FindCluster(fragPos);
+    for(uint i = 0u; i < cluster.y; i++)
+      result += CalcPointLight(FetchPointLight(int(texelFetch(lightIndices, int(cluster.x + i)).r)), normal, fragPos, viewDir,
+                               albedo, specularMask, shininess);
+    return result;
+}
+
+#if defined(GBUFFER)
+void main()
+{
+    // alpha of the normal target: 1 lit, 0 unlit (instancing.fs)
+    AlbedoSpecular = vec4(texture(material.texture_diffuse1, TexCoords).rgb, texture(material.texture_specular1, TexCoords).r);
+    NormalGloss = vec4(octahedralEncode(normalize(Normal)) * 0.5 + 0.5, material.shininess / MAX_SHININESS, 1.0);
+}
+#elif defined(DEFERRED_LIGHTING)
+void main()
+{
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    float depth = texelFetch(gDepth, pixel, 0).r;
+    if (depth == 1.0)
+        discard; // nothing drawn here, the clear color stays
+    vec4 albedoSpecular = texelFetch(gAlbedoSpecular, pixel, 0);
+    vec4 normalGloss = texelFetch(gNormalGloss, pixel, 0);
+    if (normalGloss.a < 0.5)
+    {
+        FragColor = vec4(albedoSpecular.rgb, 1.0);
+        return;
+    }
+    vec4 position = inverseViewProjection * vec4(NdcPosition, depth * 2.0 - 1.0, 1.0);
+    vec3 fragPos = position.xyz / position.w;
+    vec3 normal = octahedralDecode(normalGloss.xy * 2.0 - 1.0);
+    FragColor = vec4(Shade(fragPos, normal, albedoSpecular.rgb, albedoSpecular.a, normalGloss.b * MAX_SHININESS), 1.0);
+}
+#else
+void main()
+{
+    vec3 albedo = vec3(texture(material.texture_diffuse1, TexCoords));
+    float specularMask = texture(material.texture_specular1, TexCoords).r;
+    vec3 result = Shade(FragPos, normalize(Normal), albedo, specularMask, material.shininess);
 
     FragColor = vec4(result, 1.0); // umesto 1.0 da bude alpha komponenta difuzne teksture
-}
\ No newline at end of file
+}
+#endif
\ No newline at end of file
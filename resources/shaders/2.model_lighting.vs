@@ -1,22 +1,47 @@
 #version 330 core
+#ifdef PACKED_VERTICES
+layout (location = 0) in vec4 aPos;       // xyz quantized to the mesh bounds, w tangent handedness
+layout (location = 1) in vec2 aNormal;    // octahedral
+#else
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 aNormal;
+#endif
 layout (location = 2) in vec2 aTexCoords;
 
 out vec2 TexCoords;
 out vec3 Normal;
 out vec3 FragPos;
+// the depth pre-pass (depth_prepass.vs) computes the same position, the depth test against it is GL_EQUAL
+invariant gl_Position;
 
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
-
+uniform mat4 dequantization;
+layout (std140) uniform FrameData {   // uniform_blocks.h
+    mat4 view;
+    mat4 projection;
+    mat4 viewProjection;
+    vec3 cameraPosition;
+    float time;
+};
 
+vec3 octahedralDecode(vec2 e)
+{
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    if (n.z < 0.0)
+        n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    return normalize(n);
+}
 
 void main()
 {
-    FragPos = vec3(model * vec4(aPos, 1.0));
+#ifdef PACKED_VERTICES
+    vec3 position = vec3(dequantization * vec4(aPos.xyz, 1.0));
+    Normal = octahedralDecode(aNormal);
+#else
+    vec3 position = aPos;
     Normal = aNormal;
+#endif
+    FragPos = vec3(model * vec4(position, 1.0));
     TexCoords = aTexCoords;    
-    gl_Position = projection * view * vec4(FragPos, 1.0);
+    gl_Position = viewProjection * vec4(FragPos, 1.0);
 }
\ No newline at end of file
@@ -0,0 +1,10 @@
+#version 330 core
+// one triangle covering the target level of the bloom chain (bloom.h), no vertex buffer needed
+out vec2 TexCoords;
+
+void main()
+{
+    vec2 position = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+    TexCoords = position;
+    gl_Position = vec4(position * 2.0 - 1.0, 0.0, 1.0);
+}
@@ -0,0 +1,64 @@
+#version 330 core
+// one downsample of the bloom chain (bloom.h): 13 bilinear taps spanning 6x6 source texels, weighted as five
+// overlapping 2x2 boxes (the center one counting half) so the chain doesn't flicker as bright pixels move.
+// With prefilter set this is the first pass, from the scene: every box goes through the soft threshold and is
+// weighted down by its brightness so single very bright pixels can't turn into blinking squares.
+out vec4 FragColor;
+
+in vec2 TexCoords;
+
+uniform sampler2D source;
+uniform vec2 sourceTexelSize;
+uniform bool prefilter;
+// threshold, threshold - knee, 2 * knee, 0.25 / knee
+uniform vec4 prefilterCurve;
+
+float Brightness(vec3 c)
+{
+    return max(c.r, max(c.g, c.b));
+}
+
+// nothing below threshold - knee, a quadratic ramp up to threshold + knee, everything above the threshold past it
+vec3 Threshold(vec3 c)
+{
+    float brightness = Brightness(c);
+    float ramp = clamp(brightness - prefilterCurve.y, 0.0, prefilterCurve.z);
+    ramp = ramp * ramp * prefilterCurve.w;
+    return c * max(ramp, brightness - prefilterCurve.x) / max(brightness, 1e-4);
+}
+
+// adds a box of the filter; prefiltered boxes are thresholded and weighted by 1 / (1 + brightness)
+void AddBox(vec3 a, vec3 b, vec3 c, vec3 d, float weight, inout vec3 sum, inout float weights)
+{
+    vec3 box = (a + b + c + d) * 0.25;
+    if (prefilter)
+    {
+        box = Threshold(box);
+        weight /= 1.0 + Brightness(box);
+    }
+    sum += box * weight;
+    weights += weight;
+}
+
+vec3 Tap(float x, float y)
+{
+    return texture(source, TexCoords + vec2(x, y) * sourceTexelSize).rgb;
+}
+
+void main()
+{
+    vec3 a = Tap(-2.0,  2.0), b = Tap(0.0,  2.0), c = Tap(2.0,  2.0);
+    vec3 d = Tap(-2.0,  0.0), e = Tap(0.0,  0.0), f = Tap(2.0,  0.0);
+    vec3 g = Tap(-2.0, -2.0), h = Tap(0.0, -2.0), i = Tap(2.0, -2.0);
+    vec3 j = Tap(-1.0,  1.0), k = Tap(1.0,  1.0);
+    vec3 l = Tap(-1.0, -1.0), m = Tap(1.0, -1.0);
+
+    vec3 sum = vec3(0.0);
+    float weights = 0.0;
+    AddBox(j, k, l, m, 0.5, sum, weights);
+    AddBox(a, b, d, e, 0.125, sum, weights);
+    AddBox(b, c, e, f, 0.125, sum, weights);
+    AddBox(d, e, g, h, 0.125, sum, weights);
+    AddBox(e, f, h, i, 0.125, sum, weights);
+    FragColor = vec4(sum / weights, 1.0);
+}
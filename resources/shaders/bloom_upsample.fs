@@ -0,0 +1,22 @@
+#version 330 core
+// one upsample of the bloom chain (bloom.h): a 3x3 tent filter over the level below, added (blending) onto this one
+out vec4 FragColor;
+
+in vec2 TexCoords;
+
+uniform sampler2D source;
+uniform vec2 sourceTexelSize;
+uniform float filterRadius; // in source texels
+
+vec3 Tap(float x, float y)
+{
+    return texture(source, TexCoords + vec2(x, y) * sourceTexelSize * filterRadius).rgb;
+}
+
+void main()
+{
+    vec3 result = Tap(0.0, 0.0) * 4.0;
+    result += (Tap(-1.0, 0.0) + Tap(1.0, 0.0) + Tap(0.0, -1.0) + Tap(0.0, 1.0)) * 2.0;
+    result += Tap(-1.0, -1.0) + Tap(1.0, -1.0) + Tap(-1.0, 1.0) + Tap(1.0, 1.0);
+    FragColor = vec4(result / 16.0, 1.0);
+}
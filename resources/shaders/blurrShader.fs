@@ -8,27 +8,36 @@ in vec2 TexCoords;
 uniform sampler2D image;
 
 uniform bool horizontal;
-uniform float weight[5] = float[] (0.2270270270, 0.1945945946, 0.1216216216, 0.0540540541, 0.0162162162); // TODO: promeniti !!
+// the first pass reads the scene and thresholds it as bloom_downsample.fs does
+uniform bool prefilter;
+uniform vec4 prefilterCurve;
+// linear sampling taps of the Gaussian (BlurKernel in bloom.h): [0] the center, the rest taken on both sides,
+// each a bilinear fetch between two texels
+#define MAX_TAPS 9
+uniform int blurTaps;
+uniform float blurOffsets[MAX_TAPS];
+uniform float blurWeights[MAX_TAPS];
+
+vec3 Sample(vec2 uv)
+{
+    vec3 c = texture(image, uv).rgb;
+    if (!prefilter)
+        return c;
+    float brightness = max(c.r, max(c.g, c.b));
+    float ramp = clamp(brightness - prefilterCurve.y, 0.0, prefilterCurve.z);
+    ramp = ramp * ramp * prefilterCurve.w;
+    return c * max(ramp, brightness - prefilterCurve.x) / max(brightness, 1e-4);
+}
 
 void main()
 {
      vec2 tex_offset = 1.0 / textureSize(image, 0); // gets size of single texel
-     vec3 result = texture(image, TexCoords).rgb * weight[0];
-     if(horizontal)
-     {
-         for(int i = 1; i < 5; ++i)
-         {
-            result += texture(image, TexCoords + vec2(tex_offset.x * i, 0.0)).rgb * weight[i];
-            result += texture(image, TexCoords - vec2(tex_offset.x * i, 0.0)).rgb * weight[i];
-         }
-     }
-     else
+     vec2 direction = horizontal ? vec2(tex_offset.x, 0.0) : vec2(0.0, tex_offset.y);
+     vec3 result = Sample(TexCoords) * blurWeights[0];
+     for(int i = 1; i < blurTaps; ++i)
      {
-         for(int i = 1; i < 5; ++i)
-         {
-             result += texture(image, TexCoords + vec2(0.0, tex_offset.y * i)).rgb * weight[i];
-             result += texture(image, TexCoords - vec2(0.0, tex_offset.y * i)).rgb * weight[i];
-         }
+         result += Sample(TexCoords + direction * blurOffsets[i]) * blurWeights[i];
+         result += Sample(TexCoords - direction * blurOffsets[i]) * blurWeights[i];
      }
      FragColor = vec4(result, 1.0);
-}
\ No newline at end of file
+}
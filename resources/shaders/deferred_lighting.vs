@@ -0,0 +1,10 @@
+#version 330 core
+// the full screen triangle of the deferred lighting pass (2.model_lighting.fs with DEFERRED_LIGHTING)
+out vec2 NdcPosition;
+
+void main()
+{
+    vec2 position = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+    NdcPosition = position * 2.0 - 1.0;
+    gl_Position = vec4(NdcPosition, 0.0, 1.0);
+}
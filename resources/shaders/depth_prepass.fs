@@ -0,0 +1,6 @@
+#version 330 core
+// depth only, the color writes are masked off during the pre-pass
+
+void main()
+{
+}
@@ -0,0 +1,32 @@
+#version 330 core
+// Depth pre-pass (render_queue.h): the position stream only (SetupPositionStream in mesh.h). gl_Position is computed
+// exactly as in 2.model_lighting.vs and declared invariant in both, so the shading pass can test against this depth
+// with GL_EQUAL.
+#ifdef PACKED_VERTICES
+layout (location = 0) in vec4 aPos;       // xyz quantized to the mesh bounds
+#else
+layout (location = 0) in vec3 aPos;
+#endif
+
+invariant gl_Position;
+
+uniform mat4 model;
+uniform mat4 dequantization;
+layout (std140) uniform FrameData {   // uniform_blocks.h
+    mat4 view;
+    mat4 projection;
+    mat4 viewProjection;
+    vec3 cameraPosition;
+    float time;
+};
+
+void main()
+{
+#ifdef PACKED_VERTICES
+    vec3 position = vec3(dequantization * vec4(aPos.xyz, 1.0));
+#else
+    vec3 position = aPos;
+#endif
+    vec3 fragPos = vec3(model * vec4(position, 1.0));
+    gl_Position = viewProjection * vec4(fragPos, 1.0);
+}
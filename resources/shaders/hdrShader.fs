@@ -6,6 +6,7 @@ in vec2 TexCoords;
 uniform sampler2D scene;
 uniform sampler2D bloomBlur;
 uniform bool bloom;
+uniform float bloomIntensity;
 uniform float exposure;
 
 void main()
@@ -14,7 +15,7 @@ void main()
     vec3 hdrColor = texture(scene, TexCoords).rgb;
     vec3 bloomColor = texture(bloomBlur, TexCoords).rgb;
     if(bloom)
-        hdrColor += bloomColor; // additive blending
+        hdrColor += bloomColor * bloomIntensity; // additive blending
     // Reinhard tone mapping
     vec3 result = vec3(1.0) - exp(-hdrColor * exposure);
     // gamma correct
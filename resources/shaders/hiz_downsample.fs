@@ -0,0 +1,18 @@
+#version 330 core
+// one level of the depth pyramid: the farthest of the 2x2 source texels under this one. Levels are rounded down in
+// size (as mipmaps are), so along an odd source edge the last texel takes in the third row or column as well.
+out float FragDepth;
+
+uniform sampler2D source; // the depth buffer or the previous level (as its only accessible level)
+uniform ivec2 sourceSize;
+
+void main()
+{
+    ivec2 first = ivec2(gl_FragCoord.xy) * 2;
+    ivec2 last = min(first + 1 + ivec2(equal(first + 2, sourceSize - 1)), sourceSize - 1);
+    float farthest = 0.0;
+    for (int y = first.y; y <= last.y; y++)
+        for (int x = first.x; x <= last.x; x++)
+            farthest = max(farthest, texelFetch(source, ivec2(x, y), 0).r);
+    FragDepth = farthest;
+}
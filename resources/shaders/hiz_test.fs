@@ -0,0 +1,8 @@
+#version 330 core
+// never runs, the test is drawn with rasterization discarded
+out vec4 FragColor;
+
+void main()
+{
+    FragColor = vec4(0.0);
+}
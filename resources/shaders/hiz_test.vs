@@ -0,0 +1,53 @@
+#version 330 core
+// tests one box against the depth pyramid, the result is captured with transform feedback
+layout (location = 0) in vec3 boxMin;
+layout (location = 1) in vec3 boxMax;
+
+out float visible;
+
+uniform sampler2D hiZ;
+uniform vec2 depthSize; // of the depth buffer, level 0 of the pyramid is half of it
+uniform int levels;
+layout (std140) uniform FrameData {   // uniform_blocks.h
+    mat4 view;
+    mat4 projection;
+    mat4 viewProjection;
+    vec3 cameraPosition;
+    float time;
+};
+
+void main()
+{
+    gl_Position = vec4(0.0);
+    // screen rectangle and nearest depth of the box
+    vec3 ndcMin = vec3(1e30), ndcMax = vec3(-1e30);
+    for (int i = 0; i < 8; i++)
+    {
+        vec3 corner = vec3((i & 1) != 0 ? boxMax.x : boxMin.x, (i & 2) != 0 ? boxMax.y : boxMin.y,
+                           (i & 4) != 0 ? boxMax.z : boxMin.z);
+        vec4 clip = viewProjection * vec4(corner, 1.0);
+        if (clip.w <= 0.0)
+        {
+            // reaches behind the camera
+            visible = 1.0;
+            return;
+        }
+        vec3 ndc = clip.xyz / clip.w;
+        ndcMin = min(ndcMin, ndc);
+        ndcMax = max(ndcMax, ndc);
+    }
+    vec2 uvMin = clamp(ndcMin.xy * 0.5 + 0.5, 0.0, 1.0);
+    vec2 uvMax = clamp(ndcMax.xy * 0.5 + 0.5, 0.0, 1.0);
+    float nearest = ndcMin.z * 0.5 + 0.5;
+
+    // a texel of level L covers 2^(L+1) depth texels, pick the level where the rectangle spans at most 2x2 texels
+    vec2 extent = (uvMax - uvMin) * depthSize;
+    int level = clamp(int(ceil(log2(max(max(extent.x, extent.y), 1.0)))) - 1, 0, levels - 1);
+    ivec2 size = textureSize(hiZ, level);
+    float scale = 1.0 / exp2(float(level + 1));
+    ivec2 first = clamp(ivec2(uvMin * depthSize * scale), ivec2(0), size - 1);
+    ivec2 last = clamp(ivec2(uvMax * depthSize * scale), ivec2(0), size - 1);
+    float farthest = max(max(texelFetch(hiZ, first, level).r, texelFetch(hiZ, ivec2(last.x, first.y), level).r),
+                         max(texelFetch(hiZ, ivec2(first.x, last.y), level).r, texelFetch(hiZ, last, level).r));
+    visible = nearest <= farthest ? 1.0 : 0.0;
+}
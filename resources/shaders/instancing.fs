@@ -1,5 +1,11 @@
 #version 330 core
+#ifdef GBUFFER
+// the chips stay unlit in the deferred path too (alpha 0 of the normal target)
+layout (location = 0) out vec4 AlbedoSpecular;
+layout (location = 1) out vec4 NormalGloss;
+#else
 out vec4 FragColor;
+#endif
 
 in vec2 TexCoords;
 
@@ -7,5 +13,10 @@ uniform sampler2D texture_diffuse1;
 
 void main()
 {
+#ifdef GBUFFER
+    AlbedoSpecular = vec4(texture(texture_diffuse1, TexCoords).rgb, 0.0);
+    NormalGloss = vec4(0.5, 0.5, 0.0, 0.0);
+#else
     FragColor = texture(texture_diffuse1, TexCoords);
-}
\ No newline at end of file
+#endif
+}
@@ -1,15 +1,30 @@
 #version 330 core
+#ifdef PACKED_VERTICES
+layout (location = 0) in vec4 aPos;       // xyz quantized to the mesh bounds
+#else
 layout (location = 0) in vec3 aPos;
+#endif
 layout (location = 2) in vec2 aTexCoords;
-layout (location = 3) in mat4 aInstanceMatrix;
+layout (location = 8) in uint aInstance;  // slot of the instance's transform, InstancedModel::INSTANCE_LOCATION
 
 out vec2 TexCoords;
 
-uniform mat4 projection;
-uniform mat4 view;
+uniform mat4 dequantization;
+// four texels (the columns) per slot, see instanced_model.h
+uniform samplerBuffer instanceTransforms;
+layout (std140) uniform FrameData {   // uniform_blocks.h
+    mat4 view;
+    mat4 projection;
+    mat4 viewProjection;
+    vec3 cameraPosition;
+    float time;
+};
 
 void main()
 {
+    int texel = int(aInstance) * 4;
+    mat4 instanceMatrix = mat4(texelFetch(instanceTransforms, texel), texelFetch(instanceTransforms, texel + 1),
+                               texelFetch(instanceTransforms, texel + 2), texelFetch(instanceTransforms, texel + 3));
     TexCoords = aTexCoords;
-    gl_Position = projection * view * aInstanceMatrix * vec4(aPos, 1.0f);
+    gl_Position = viewProjection * instanceMatrix * dequantization * vec4(aPos.xyz, 1.0f);
 }
\ No newline at end of file
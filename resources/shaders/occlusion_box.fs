@@ -0,0 +1,8 @@
+#version 330 core
+// only the samples passing the depth test count, color writes are masked
+out vec4 FragColor;
+
+void main()
+{
+    FragColor = vec4(1.0);
+}
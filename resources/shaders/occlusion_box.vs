@@ -0,0 +1,17 @@
+#version 330 core
+layout (location = 0) in vec3 aPos; // corner of the unit cube
+
+uniform vec3 boxMin;
+uniform vec3 boxMax;
+layout (std140) uniform FrameData {   // uniform_blocks.h
+    mat4 view;
+    mat4 projection;
+    mat4 viewProjection;
+    vec3 cameraPosition;
+    float time;
+};
+
+void main()
+{
+    gl_Position = viewProjection * vec4(mix(boxMin, boxMax, aPos), 1.0);
+}
@@ -9,11 +9,28 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
+#include <learnopengl/bloom.h>
+#include <learnopengl/bvh.h>
+#include <learnopengl/clustered_lighting.h>
+#include <learnopengl/deferred_shading.h>
 #include <learnopengl/filesystem.h>
+#include <learnopengl/fragment_counter.h>
+#include <learnopengl/frame_graph.h>
+#include <learnopengl/frustum_culling.h>
+#include <learnopengl/gl_ext.h>
 #include <learnopengl/shader.h>
 #include <learnopengl/camera.h>
 #include <learnopengl/model.h>
-
+#include <learnopengl/occlusion_culling.h>
+#include <learnopengl/render_queue.h>
+#include <learnopengl/render_targets.h>
+#include <learnopengl/texture_registry.h>
+#include <learnopengl/gpu_timer.h>
+#include <learnopengl/hdr_formats.h>
+#include <learnopengl/instanced_model.h>
+#include <learnopengl/uniform_blocks.h>
+
+#include <chrono>
 #include <iostream>
 #include <vector>
 
@@ -30,7 +47,7 @@ void renderQuad();
 // End of new code
 
 // For Blending
-unsigned int loadTexture(char const * path);
+TextureHandle loadTexture(char const * path);
 // ---------------------------------------
 
 
@@ -78,6 +95,51 @@ struct ProgramState {
     bool ImGuiEnabled = false;
     Camera camera;
     bool CameraMouseMovementUpdateEnabled = true;
+    // GPU time of the opaque scene (models and instanced chips), shown in the settings window
+    double sceneGpuMs = 0.0;
+    // CPU time spent submitting it and the draw calls it took
+    double sceneCpuMs = 0.0;
+    DrawStats sceneDraws;
+    GLStateStats sceneStateChanges;
+    // level of detail selection
+    bool lodEnabled = true;
+    float lodPixelError = 1.0f;
+    // frustum culling of the scene objects (through the BVH) and of the meshes of the visible models, and what it
+    // left of the scene last frame
+    bool frustumCulling = true;
+    CullingStats sceneCulling;
+    unsigned int sceneObjects = 0;
+    unsigned int sceneObjectsVisible = 0;
+    unsigned int bvhNodesVisited = 0;
+    // occlusion culling of the opaque objects left by the frustum test
+    bool occlusionCulling = true;
+    bool occlusionHiZ = true; // depth pyramid test instead of occlusion queries
+    OcclusionStats sceneOcclusion;
+    // lights assigned to the view clusters last frame
+    ClusterStats lightClusters;
+    // opaque scene through the G-buffer and one lighting pass instead of lighting every fragment
+    bool deferredShading = false;
+    // opaque meshes lay down their depth first and are shaded with GL_EQUAL; the fragments the opaque scene shaded
+    // the last frames without [0] and with [1] the pre-pass
+    bool depthPrepass = false;
+    GLuint64 shadedFragments[2] = {};
+    bool shaderInvocations = false; // shadedFragments counts invocations, not samples passing the depth test
+    // bloom through the mip chain, or the full resolution Gaussian blur it replaced; GPU time of either
+    bool bloomMipChain = true;
+    BloomSettings bloomSettings;
+    double bloomGpuMs = 0.0;
+    // GPU time of a Gaussian blur pass, through the compute and the fragment shader
+    bool computeBlurAvailable = false;
+    double computeBlurPassMs = 0.0, fragmentBlurPassMs = 0.0;
+    // storage of the scene color and the bloom (HdrQuality), and its error against RGBA16F while validating
+    int hdrQuality = (int)HdrQuality::Balanced;
+    bool validateHdrFormats = false;
+    HdrFormatError hdrFormatError;
+    // HDR render targets allocated, as they would take at 3840x2160
+    size_t rgba16fBytesAt4K = 0, packedFloatBytesAt4K = 0;
+    // the frame graph's last frame
+    std::string framePasses;
+    unsigned int invalidatedAttachments = 0;
 
     // Cart object
     glm::vec3 cartPosition = glm::vec3(0.0f);
@@ -89,8 +151,11 @@ struct ProgramState {
     // Lays chips object
     glm::vec3 laysStartPosition = glm::vec3(cartPosition.x + cartXDiameter/2, cartPosition.y - cartYDiameter/2, cartPosition.z + cartZDiameter/2);
     float laysScale = 0.025f;
-    //instancing
+    //instancing: number of bags, added and removed at runtime (and kept in program_state.txt)
     int laysAmount = 4;
+    size_t laysInstances = 0;
+    size_t laysCapacity = 0;    // most bags the instance buffer texture holds
+    size_t laysUploadBytes = 0; // instance transforms sent last frame
     // ovo ce morati da bude niz za instancing
     float laysRotationDeg = 0.0f;
     // instancing
@@ -121,19 +186,13 @@ struct ProgramState {
             };
     float windowScale = 7.0f;
 
-//    std::vector<PointLight> pointLights;
     PointLight pointLight;
     ProgramState()
             : camera(glm::vec3(0.0f, 0.0f, 3.0f)) {}
 
 
 
-    // Multiple light sources -- NOT WORKING
-//    std::vector<glm::vec3> pointLightPositions();
-//    pointLightPositions.push_back(glm::vec3(cartPosition.x, 4.0f, cartPosition.z));
-//    pointLightPositions.push_back(glm::vec3(3.0f, 5.0f, 4.0f));
-//    pointLightPositions.push_back(glm::vec3(-7.0f, 4.0f, 3.8f));
-//    pointLightPositions.push_back(glm::vec3(-7.0f, 3.0f, camera.Position.z - 0.5f));
+    // Multiple light sources, all with the pointLight parameters
     glm::vec3 pointLightPositions[4] = {
             glm::vec3(cartPosition.x, 4.0f, cartPosition.z),
             glm::vec3(3.0f, 5.0f, 4.0f),
@@ -141,6 +200,13 @@ struct ProgramState {
             glm::vec3(-7.0f, 3.0f, camera.Position.z - 0.5f)
     };
 
+    // ceiling grid of store lights, centered above the scene
+    bool ceilingLights = true;
+    int ceilingLightRows = 16, ceilingLightColumns = 16;
+    float ceilingLightSpacing = 4.0f;
+    float ceilingHeight = 3.0f;
+    PointLight ceilingLight;
+
     void SaveToFile(std::string filename);
 
     void LoadFromFile(std::string filename);
@@ -157,7 +223,8 @@ void ProgramState::SaveToFile(std::string filename) {
         << camera.Position.z << '\n'
         << camera.Front.x << '\n'
         << camera.Front.y << '\n'
-        << camera.Front.z << '\n';
+        << camera.Front.z << '\n'
+        << laysAmount << '\n';
 }
 
 void ProgramState::LoadFromFile(std::string filename) {
@@ -172,16 +239,107 @@ void ProgramState::LoadFromFile(std::string filename) {
            >> camera.Position.z
            >> camera.Front.x
            >> camera.Front.y
-           >> camera.Front.z;
+           >> camera.Front.z
+           >> laysAmount;
     }
 }
 // ----------------------------------------------------------------------------
 
 
 ProgramState *programState;
+// every offscreen target, resized from framebuffer_size_callback
+RenderTargetPool *renderTargets = nullptr;
 
 void DrawImGui(ProgramState *programState);
-void renderModels(Shader &shader, vector<Model> &models);
+void computeModelTransforms(vector<glm::mat4> &transforms);
+void submitModel(RenderQueue &queue, Shader &shader, vector<Model> &models, unsigned int index, const glm::mat4 &transform,
+                 const LodView &lodView, const Frustum *frustum);
+void submitModels(RenderQueue &queue, Shader &shader, vector<Model> &models, const vector<glm::mat4> &transforms,
+                  const vector<uint8_t> &visible, const LodView &lodView, const Frustum *frustum);
+
+glm::mat4 laysInstanceTransform(unsigned int bag);
+
+// everything the scene BVH holds: a placed model, one of the instanced chips or a window; index is into models,
+// the chips' instance slots or programState->windows. REMOVED marks the entry of a chip that was taken away, it is
+// reused by the next one added.
+struct SceneObject {
+    enum Kind { MODEL, LAYS_INSTANCE, WINDOW, REMOVED } kind;
+    unsigned int index;
+    uint32_t handle;
+    Aabb bounds; // world space
+};
+
+// bags tested for occlusion one by one, with more they are only frustum culled
+const size_t MAX_OCCLUSION_TESTED_BAGS = 1024;
+// bags tossed into the cart, the others are lined up in rows next to it
+const unsigned int LAYS_IN_CART = 4;
+const unsigned int LAYS_PER_ROW = 256;
+
+// where bag i goes. The random offsets and rotation come from a hash of i, so a bag taken away and added again lands
+// on the same spot.
+glm::mat4 laysInstanceTransform(unsigned int bag) {
+    uint32_t hash = bag * 2654435761u + 1;
+    auto random = [&hash]() { // in [-0.5, 0.5]
+        hash ^= hash >> 15;
+        hash *= 2246822519u;
+        hash ^= hash >> 13;
+        return (float)(hash & 0xFFFF) / 65535.0f - 0.5f;
+    };
+    glm::vec3 position;
+    if (bag < LAYS_IN_CART) {
+        // 1. translation: displaced by up to half a unit around the cart, less in height
+        position.x = programState->laysStartPosition.x + random() - 0.2f;
+        position.y = random() * 0.6f - 0.2f;
+        position.z = programState->laysStartPosition.z + random();
+    } else {
+        unsigned int slot = bag - LAYS_IN_CART;
+        position = programState->laysStartPosition +
+                   glm::vec3(1.0f + (slot % LAYS_PER_ROW) * 0.25f, 0.0f, (slot / LAYS_PER_ROW) * 0.25f);
+    }
+    glm::mat4 model = glm::translate(glm::mat4(1.0f), position);
+    // 2. scale
+    model = glm::scale(model, glm::vec3(programState->laysScale));
+    // 3. rotation: around a (semi)randomly picked rotation axis vector
+    float rotAngle = (random() + 0.5f) * 360.0f;
+    return glm::rotate(model, rotAngle, glm::vec3(0.4f, 0.6f, 0.8f));
+}
+
+// the window quad (see transparentVertices) moved to its place
+Aabb windowBounds(const glm::vec3 &position) {
+    glm::mat4 model = glm::translate(glm::mat4(1.0f), position);
+    model = glm::scale(model, glm::vec3(programState->windowScale));
+    return Aabb::Transformed(glm::vec3(0.0f, -0.5f, 0.0f), glm::vec3(1.0f, 0.5f, 0.0f), model);
+}
+
+// one light of the given kind at position, as the clustered shading takes it
+PointLightData pointLightData(const PointLight &light, const glm::vec3 &position) {
+    PointLightData data;
+    data.position = position;
+    data.ambient = light.ambient;
+    data.diffuse = light.diffuse;
+    data.specular = light.specular;
+    data.constant = light.constant;
+    data.linear = light.linear;
+    data.quadratic = light.quadratic;
+    data.range = PointLightRange(data);
+    return data;
+}
+
+// what the queued draws of the instanced chips and the windows need (RenderQueue::DrawCallback contexts)
+struct InstancedLaysDraw {
+    Shader *shader;
+    InstancedModel *instances;
+    unsigned int texture;
+    const uint32_t *slots;
+    size_t count;
+    LodView lodView;
+};
+struct WindowDraw {
+    unsigned int vertexArray;
+    unsigned int texture;
+};
+void drawInstancedLays(void *context, GLStateCache &state);
+void drawWindow(void *context, GLStateCache &state);
 
 int main() {
     // glfw: initialize and configure
@@ -217,6 +375,7 @@ int main() {
         std::cout << "Failed to initialize GLAD" << std::endl;
         return -1;
     }
+    LoadGLExtensions((GLADloadproc) glfwGetProcAddress);
 
     // tell stb_image.h to flip loaded texture's on the y-axis (before loading model).
     stbi_set_flip_vertically_on_load(false);
@@ -258,7 +417,7 @@ int main() {
     };
 
 //    loading texture
-    unsigned int transparentTexture = loadTexture(FileSystem::getPath("resources/textures/blending_transparent_window.png").c_str());
+    TextureHandle transparentTexture = loadTexture(FileSystem::getPath("resources/textures/blending_transparent_window.png").c_str());
 
 //    Face-culling
     glEnable(GL_CULL_FACE);
@@ -267,389 +426,697 @@ int main() {
 
     // build and compile shaders
     // -------------------------
-    Shader ourShader(FileSystem::getPath("resources/shaders/2.model_lighting.vs").c_str(), FileSystem::getPath("resources/shaders/2.model_lighting.fs").c_str());
-    Shader instanceShader(FileSystem::getPath("resources/shaders/instancing.vs").c_str(), FileSystem::getPath("resources/shaders/instancing.fs").c_str());
+    // shaders drawing meshes have to match the vertex layout the meshes are uploaded with
+    Shader ourShader(FileSystem::getPath("resources/shaders/2.model_lighting.vs").c_str(), FileSystem::getPath("resources/shaders/2.model_lighting.fs").c_str(), nullptr, MeshShaderDefines());
+    Shader instanceShader(FileSystem::getPath("resources/shaders/instancing.vs").c_str(), FileSystem::getPath("resources/shaders/instancing.fs").c_str(), nullptr, MeshShaderDefines());
+    // the same programs writing the G-buffer of the deferred path, and its lighting pass
+    Shader gBufferShader(FileSystem::getPath("resources/shaders/2.model_lighting.vs").c_str(), FileSystem::getPath("resources/shaders/2.model_lighting.fs").c_str(), nullptr, std::string(MeshShaderDefines()) + GBufferDefines());
+    Shader instanceGBufferShader(FileSystem::getPath("resources/shaders/instancing.vs").c_str(), FileSystem::getPath("resources/shaders/instancing.fs").c_str(), nullptr, std::string(MeshShaderDefines()) + GBufferDefines());
+    Shader deferredLightingShader(FileSystem::getPath("resources/shaders/deferred_lighting.vs").c_str(), FileSystem::getPath("resources/shaders/2.model_lighting.fs").c_str(), nullptr, DeferredLightingDefines());
+    // depth only from the position streams, ahead of the shading of the opaque meshes
+    Shader depthPrepassShader(FileSystem::getPath("resources/shaders/depth_prepass.vs").c_str(), FileSystem::getPath("resources/shaders/depth_prepass.fs").c_str(), nullptr, MeshShaderDefines());
     Shader blendingShader(FileSystem::getPath("resources/shaders/blending.vs").c_str(), FileSystem::getPath("resources/shaders/blending.fs").c_str());
 // New code - Bloom & Blurr
     Shader blurrShader(FileSystem::getPath("resources/shaders/blurrShader.vs").c_str(), FileSystem::getPath("resources/shaders/blurrShader.fs").c_str());
+    Shader bloomDownsampleShader(FileSystem::getPath("resources/shaders/bloom.vs").c_str(), FileSystem::getPath("resources/shaders/bloom_downsample.fs").c_str());
+    Shader bloomUpsampleShader(FileSystem::getPath("resources/shaders/bloom.vs").c_str(), FileSystem::getPath("resources/shaders/bloom_upsample.fs").c_str());
     Shader hdrShader(FileSystem::getPath("resources/shaders/hdrShader.vs").c_str(), FileSystem::getPath("resources/shaders/hdrShader.fs").c_str());
 // End of new code
+    // occlusion culling: bounding box queries, depth pyramid downsampling and the pyramid test (transform feedback)
+    Shader occlusionBoxShader(FileSystem::getPath("resources/shaders/occlusion_box.vs").c_str(), FileSystem::getPath("resources/shaders/occlusion_box.fs").c_str());
+    Shader hiZDownsampleShader(FileSystem::getPath("resources/shaders/hiz_downsample.vs").c_str(), FileSystem::getPath("resources/shaders/hiz_downsample.fs").c_str());
+    Shader hiZTestShader(FileSystem::getPath("resources/shaders/hiz_test.vs").c_str(), FileSystem::getPath("resources/shaders/hiz_test.fs").c_str(),
+                         nullptr, "", { "visible" });
 
 
-    // load models
-    // -----------
-    vector<Model> models;
-    Model cartModel(FileSystem::getPath("resources/objects/simple_shopping_cart/scene.gltf"));
-    Model laysModel(FileSystem::getPath("resources/objects/lays_classic__hd_textures__free_download/scene.gltf"));
-    Model aisleModel(FileSystem::getPath("resources/objects/supermarket_potato_chips_shelf_asset/scene.gltf"));
-    Model floorModel(FileSystem::getPath("resources/objects/checkered_tile_floor/scene.gltf"));
-    Model bottleModel(FileSystem::getPath("resources/objects/water_bottle/scene.gltf"));
-    Model bottle2Model(FileSystem::getPath("resources/objects/low_poly_bottle/scene.gltf"));
-    models.push_back(cartModel);
-    models.push_back(laysModel);
-    models.push_back(aisleModel);
-    models.push_back(floorModel);
-    models.push_back(bottleModel);
-    models.push_back(bottle2Model);
-
-    cartModel.SetShaderTextureNamePrefix("material.");
-    laysModel.SetShaderTextureNamePrefix("material.");
-    aisleModel.SetShaderTextureNamePrefix("material.");
-//    -----------------------------------------------------------------------------------
-// Instancing
-// Code copied from: https://learnopengl.com/Advanced-OpenGL/Instancing -----------------
-
-    unsigned int amount = programState->laysAmount - 1;
-    glm::mat4 *modelMatrices = new glm::mat4[amount];
-    float radius = 1.0f;
-    float offset = 0.5f;
-
-    for (unsigned int i = 0; i < amount; i++)
-    {
-        glm::mat4 model = glm::mat4(1.0f);
-        // 1. translation: displace along circle with 'radius' in range [-offset, offset]
-        float angle = (float)i / (float)amount * 360.0f;
-        float displacement = (rand() % (int)(2 * offset * 100)) / 100.0f - offset;
-        float x = programState->laysStartPosition.x * radius + displacement - 0.2f;
-//        int sign = (i % 2) ? -1 : 1;
-//        float x = programState->laysStartPosition.x + sign*i*offset;
-        displacement = (rand() % (int)(2 * offset * 100)) / 100.0f - offset;
-        float y = displacement * 0.6f - 0.2f; // keep height of asteroid field smaller compared to width of x and z
-//        float y = programState->laysStartPosition.y;
-        displacement = (rand() % (int)(2 * offset * 100)) / 100.0f - offset;
-//        float z = programState->laysStartPosition.z;
-        float z = programState->laysStartPosition.z * radius + displacement;
-        model = glm::translate(model, glm::vec3(x, y, z));
-
-        // scale
-        model = glm::scale(model, glm::vec3(programState->laysScale));
-
-        // 3. rotation: add random rotation around a (semi)randomly picked rotation axis vector
-        float rotAngle = static_cast<float>((rand() % 360));
-        model = glm::rotate(model, rotAngle, glm::vec3(0.4f, 0.6f, 0.8f));
-
-        // 4. now add to list of matrices
-        modelMatrices[i] = model;
-    }
-
-    // configure instanced array
-    // -------------------------
-    unsigned int buffer;
-    glGenBuffers(1, &buffer);
-    glBindBuffer(GL_ARRAY_BUFFER, buffer);
-    glBufferData(GL_ARRAY_BUFFER, programState->laysAmount * sizeof(glm::mat4), &modelMatrices[0], GL_STATIC_DRAW);
-
-    for(unsigned int i = 0; i < laysModel.meshes.size(); i++)
-    {
-        unsigned int VAO = laysModel.meshes[i].VAO;
-        glBindVertexArray(VAO);
-        // vertex attributes
-        std::size_t vec4Size = sizeof(glm::vec4);
-        glEnableVertexAttribArray(3);
-        glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, 4 * vec4Size, (void*)0);
-        glEnableVertexAttribArray(4);
-        glVertexAttribPointer(4, 4, GL_FLOAT, GL_FALSE, 4 * vec4Size, (void*)(1 * vec4Size));
-        glEnableVertexAttribArray(5);
-        glVertexAttribPointer(5, 4, GL_FLOAT, GL_FALSE, 4 * vec4Size, (void*)(2 * vec4Size));
-        glEnableVertexAttribArray(6);
-        glVertexAttribPointer(6, 4, GL_FLOAT, GL_FALSE, 4 * vec4Size, (void*)(3 * vec4Size));
-
-        glVertexAttribDivisor(3, 1);
-        glVertexAttribDivisor(4, 1);
-        glVertexAttribDivisor(5, 1);
-        glVertexAttribDivisor(6, 1);
-
-        glBindVertexArray(0);
-    }
-// ----------------------------------------------------------
-
-// Blending
-// buffer objects for window
-    unsigned int transparentVAO, transparentVBO;
-    glGenVertexArrays(1, &transparentVAO);
-    glGenBuffers(1, &transparentVBO);
-    glBindVertexArray(transparentVAO);
-    glBindBuffer(GL_ARRAY_BUFFER, transparentVBO);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(transparentVertices), transparentVertices, GL_STATIC_DRAW);
-    glEnableVertexAttribArray(0); // positions
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)0);
-    glEnableVertexAttribArray(1); // texCoords
-    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(3 * sizeof(float)));
-    glBindVertexArray(0); // ? zasto ovo ?
-
-//---------------------------------------------------------------
-// New code - Blurr & Bloom --------------------------------------------------------------------------
-// configure (floating point) framebuffers
-// ---------------------------------------  code copied from learnOpenGL bloom page
-    unsigned int hdrFBO;
-    glGenFramebuffers(1, &hdrFBO);
-    glBindFramebuffer(GL_FRAMEBUFFER, hdrFBO);
-// create 2 floating point color buffers (1 for normal rendering, other for brightness threshold values)
-    unsigned int colorBuffers[2];
-    unsigned int pingpongColorbuffers[2];
-
-    glGenTextures(2, colorBuffers);
-    for (unsigned int i = 0; i < 2; i++)
-    {
-        glBindTexture(GL_TEXTURE_2D, colorBuffers[i]);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, SCR_WIDTH, SCR_HEIGHT, 0, GL_RGBA, GL_FLOAT, NULL);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);  // we clamp to the edge as the blur filter would otherwise sample repeated texture values!
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-// attach texture to framebuffer
-        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, GL_TEXTURE_2D, colorBuffers[i], 0);
-    }
-
-    // create and attach depth buffer (renderbuffer)
-    unsigned int rboDepth;
-    glGenRenderbuffers(1, &rboDepth);
-    glBindRenderbuffer(GL_RENDERBUFFER, rboDepth);
-    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT, SCR_WIDTH, SCR_HEIGHT);
-    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, rboDepth);
-    // tell OpenGL which color attachments we'll use (of this framebuffer) for rendering
-    unsigned int attachments[2] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
-    glDrawBuffers(2, attachments);
-    // finally check if framebuffer is complete
-    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
-        std::cout << "Framebuffer not complete!" << std::endl;
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
-
-//// Check if framebuffer is complete
-//    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
-//        std::cout << "Framebuffer not complete!" << std::endl;
-//
-//glBindFramebuffer(GL_FRAMEBUFFER, 0);  // Unbind the framebuffer -- without this it wouldn't work
-
-// ping-pong-framebuffer for blurring -- Bloom & Blurr
-    unsigned int pingpongFBO[2];
-    glGenFramebuffers(2, pingpongFBO);
-    glGenTextures(2, pingpongColorbuffers);
-    for (unsigned int i = 0; i < 2; i++)
+    // the GL objects from here down to the end of the render loop are destroyed when this block closes, while the
+    // context is still current (glfwTerminate() destroys it)
     {
-        glBindFramebuffer(GL_FRAMEBUFFER, pingpongFBO[i]);
-        glBindTexture(GL_TEXTURE_2D, pingpongColorbuffers[i]);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, SCR_WIDTH, SCR_HEIGHT, 0, GL_RGBA, GL_FLOAT, NULL);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE); // we clamp to the edge as the blur filter would otherwise sample repeated texture values!
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, pingpongColorbuffers[i], 0);
-// also check if framebuffers are complete (no need for depth buffer)
-        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
-            std::cout << "Framebuffer not complete!" << std::endl;
-    }
-
-    //    Lights; TODO -> vise pointLights
-// ----------------------------------------------------------
-
-    PointLight& pointLight = programState->pointLight;
-    pointLight.ambient = glm::vec3(1.0, 1.0, 1.0);
-    pointLight.diffuse = glm::vec3(1.0, 1.0, 1.0);
-    pointLight.specular = glm::vec3(5.0, 3.0, 2.0);
-
-    pointLight.constant = 1.3f;
-    pointLight.linear = 0.0f;
-    pointLight.quadratic = 0.0f;
-//--------------------------------------------------------------
-
-    blurrShader.use();
-    blurrShader.setInt("image", 0);
-    hdrShader.use();
-    hdrShader.setInt("scene", 0);
-    hdrShader.setInt("bloomBlur", 1);
-// End of new code - Blurr & Bloom --------------------------------------------------------------------------
-
-
-
-
-
-    // render loop
-    // -----------
-    while (!glfwWindowShouldClose(window)) {
-        // per-frame time logic
-        // --------------------
-        float currentFrame = glfwGetTime();
-        deltaTime = currentFrame - lastFrame;
-        lastFrame = currentFrame;
-
-        // input
-        // -----
-        processInput(window);
-
-        // sort the transparent windows before rendering
-        // ---------------------------------------------
-        std::map<float, glm::vec3> sorted;
-        for (unsigned int i = 0; i < programState->windows.size(); i++)
+        // load models
+        // -----------
+        // Assimp import and image decoding of all models run concurrently on the pool, only the GPU upload
+        // (finishLoading) happens here on the GL thread.
+        ThreadPool threadPool;
+        // texture contents are streamed in over the first frames instead of stalling here
+        unique_ptr<TextureStreamer> textureStreamer(new TextureStreamer());
+        TextureRegistry::Instance().SetStreamer(textureStreamer.get());
+        auto loadStart = std::chrono::steady_clock::now();
+        vector<Model> models;
+        models.emplace_back(FileSystem::getPath("resources/objects/simple_shopping_cart/scene.gltf"), threadPool);
+        models.emplace_back(FileSystem::getPath("resources/objects/lays_classic__hd_textures__free_download/scene.gltf"), threadPool);
+        models.emplace_back(FileSystem::getPath("resources/objects/supermarket_potato_chips_shelf_asset/scene.gltf"), threadPool);
+        models.emplace_back(FileSystem::getPath("resources/objects/checkered_tile_floor/scene.gltf"), threadPool);
+        models.emplace_back(FileSystem::getPath("resources/objects/water_bottle/scene.gltf"), threadPool);
+        models.emplace_back(FileSystem::getPath("resources/objects/low_poly_bottle/scene.gltf"), threadPool);
+        // everything but the chips, which are also drawn instanced through their per-mesh VAOs, goes into static batches
+        for (unsigned int i = 0; i < models.size(); i++)
         {
-            float distance = glm::length(programState->camera.Position - programState->windows[i]);
-            sorted[distance] = programState->windows[i];
+            models[i].staticBatching = i != 1;
+            models[i].finishLoading();
         }
-
-
-        // render
-        // ------
-        glClearColor(programState->clearColor.r, programState->clearColor.g, programState->clearColor.b, 1.0f);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-// New code - FP FB for Blurr
-        //render scene into floating point framebuffer -- Bloom
-        glBindFramebuffer(GL_FRAMEBUFFER, hdrFBO);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-// End of new code
-
-
-        // don't forget to enable shader before setting uniforms
-        ourShader.use();
-
-        // Lights
-        ourShader.setVec3("pointLight[0].position", programState->pointLightPositions[0]);
-        ourShader.setVec3("pointLight[1].position", programState->pointLightPositions[1]);
-        ourShader.setVec3("pointLight[2].position", programState->pointLightPositions[2]);
-        ourShader.setVec3("pointLight[3].position", programState->pointLightPositions[3]);
-        ourShader.setVec3("pointLight.ambient", programState->pointLight.ambient);
-        ourShader.setVec3("pointLight.diffuse", programState->pointLight.diffuse);
-        ourShader.setVec3("pointLight.specular", programState->pointLight.specular);
-        ourShader.setFloat("pointLight.constant", programState->pointLight.constant);
-        ourShader.setFloat("pointLight.linear", programState->pointLight.linear);
-        ourShader.setFloat("pointLight.quadratic", programState->pointLight.quadratic);
-        ourShader.setVec3("viewPosition", programState->camera.Position);
-        ourShader.setFloat("material.shininess", 32.0f);
-//        ourShader.setVec3("pointLight[1].ambient", glm::vec3(1.0f, 1.0f, 1.0f));
-//        ourShader.setVec3("pointLight[1].diffuse", glm::vec3(1.0f, 1.0f, 1.5f));
-//        ourShader.setVec3("pointLight[1].specular", glm::vec3(5.0, 3.0, 2.0));
-//        ourShader.setVec3("pointLight[2].ambient", glm::vec3(22.0f, -48.0f, 0.0f));
-//        ourShader.setVec3("pointLight[2].diffuse", glm::vec3(1.0f, 1.0f, 1.5f));
-//        ourShader.setVec3("pointLight[2].specular", glm::vec3(5.0, 3.0, 2.0));
-//        ourShader.setVec3("pointLight[3].ambient", glm::vec3(1.0f, 1.0f, 1.0f));
-//        ourShader.setVec3("pointLight[3].diffuse", glm::vec3(1.0f, 1.0f, 1.5f));
-//        ourShader.setVec3("pointLight[3].specular", glm::vec3(5.0, 3.0, 2.0));
-
-
-//        ourShader.setFloat("pointLight[1].constant", 1.3f);
-//        ourShader.setFloat("pointLight[1].linear", 0.0f);
-//        ourShader.setFloat("pointLight[1].quadratic", 0.0f);
-//        ourShader.setFloat("pointLight[2].constant", 1.3f);
-//        ourShader.setFloat("pointLight[2].linear", 0.0f);
-//        ourShader.setFloat("pointLight[2].quadratic", 0.0f);
-//        ourShader.setFloat("pointLight[3].constant", 1.3f);
-//        ourShader.setFloat("pointLight[3].linear", 0.0f);
-//        ourShader.setFloat("pointLight[3].quadratic", 0.0f);
-
-
-        ourShader.setInt("blinn_flag", blinn_flag);
-        std::cout << (blinn_flag ? "Blinn-Phong" : "Phong") << std::endl;
-
-        // view/projection transformations
-        glm::mat4 projection = glm::perspective(glm::radians(programState->camera.Zoom),
-                                                (float) SCR_WIDTH / (float) SCR_HEIGHT, 0.1f, 100.0f);
-        glm::mat4 view = programState->camera.GetViewMatrix();
-        ourShader.setMat4("projection", projection);
-        ourShader.setMat4("view", view);
-
-        // first render the opaque models
-        renderModels(ourShader, models);
-
-        // render aisle without face-cull
-        glDisable(GL_CULL_FACE);
-        glm::mat4 model = glm::mat4(1.0f);
-        model = glm::translate(model,
-                               programState->aislePosition); // translate it down so it's at the center of the scene
-        model = glm::scale(model, glm::vec3(
-                programState->aisleScale));    // it's a bit too big for our scene, so scale it dow
-        model = glm::rotate(model, glm::radians(programState->aisleRotationDeg), glm::vec3(1.0f, 0.0f, 0.0f));
-        ourShader.setMat4("model", model);
-        models[2].Draw(ourShader);
-
-        // Instancing
+        std::cout << "MODEL::LOAD:: all models ready in "
+                  << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - loadStart).count()
+                  << " ms using " << threadPool.size() << " loader threads" << std::endl;
+        size_t releasedGeometryBytes = 0;
+        for (const Model &model : models)
+            releasedGeometryBytes += model.releasedGeometryBytes;
+        std::cout << "MODEL::MEMORY:: " << releasedGeometryBytes / (1024.0 * 1024.0) << " MB of CPU geometry released after upload" << std::endl;
+        std::cout << "TEXTURES:: " << TextureRegistry::Instance().size() << " images, "
+                  << TextureRegistry::Instance().residentBytes() / (1024.0 * 1024.0) << " MB resident" << std::endl;
+        Model &cartModel = models[0];
+        Model &laysModel = models[1];
+        Model &aisleModel = models[2];
+
+    //    -----------------------------------------------------------------------------------
+    // Instancing
+    // Code copied from: https://learnopengl.com/Advanced-OpenGL/Instancing -----------------
+    // the bags are instances of one InstancedModel, added and removed in the render loop to match laysAmount
+        InstancedModel laysInstances(laysModel);
+        programState->laysCapacity = laysInstances.capacity();
         instanceShader.use();
-        instanceShader.setMat4("projection", projection);
-        instanceShader.setMat4("view", view);
-        instanceShader.setInt("texture_diffuse1", 0);
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, laysModel.textures_loaded[0].id);
-        for(unsigned int i = 0; i < laysModel.meshes.size(); i++)
-        {
-            glBindVertexArray(laysModel.meshes[i].VAO);
-            glDrawElementsInstanced(
-                    GL_TRIANGLES, laysModel.meshes[i].indices.size(), GL_UNSIGNED_INT, 0, programState->laysAmount
-            );
-            glBindVertexArray(0);
+        instanceShader.setInt("instanceTransforms", InstancedModel::TRANSFORM_UNIT);
+        instanceGBufferShader.use();
+        instanceGBufferShader.setInt("instanceTransforms", InstancedModel::TRANSFORM_UNIT);
+
+        // scene BVH: every placed model, chip instance and window
+        Bvh sceneBvh;
+        vector<SceneObject> sceneObjects;
+        vector<uint32_t> freeSceneObjects; // REMOVED entries
+        vector<uint32_t> laysBags;         // scene object of every bag, bag i placed by laysInstanceTransform(i)
+        vector<glm::mat4> modelTransforms(models.size());
+        vector<glm::vec3> modelMin(models.size()), modelMax(models.size());
+        computeModelTransforms(modelTransforms);
+        for (unsigned int i = 0; i < models.size(); i++) {
+            models[i].GetBounds(modelMin[i], modelMax[i]);
+            Aabb bounds = Aabb::Transformed(modelMin[i], modelMax[i], modelTransforms[i]);
+            sceneObjects.push_back({ SceneObject::MODEL, i, sceneBvh.insert(bounds, sceneObjects.size()), bounds });
         }
-
-        // Blending
-        blendingShader.use();
-        blendingShader.setMat4("projection", projection);
-        blendingShader.setMat4("view", view);
-
-        glBindVertexArray(transparentVAO);
-        glBindTexture(GL_TEXTURE_2D, transparentTexture);
-                                       // render from furthest to nearest
-        for (std::map<float, glm::vec3>::reverse_iterator it = sorted.rbegin(); it != sorted.rend(); ++it)
-        {
-            model = glm::mat4(1.0f);
-            model = glm::translate(model, it->second);
-            model = glm::scale(model, glm::vec3(programState->windowScale));
-            blendingShader.setMat4("model", model);
-            glDrawArrays(GL_TRIANGLES, 0, 6);
+        for (unsigned int i = 0; i < programState->windows.size(); i++) {
+            Aabb bounds = windowBounds(programState->windows[i]);
+            sceneObjects.push_back({ SceneObject::WINDOW, i, sceneBvh.insert(bounds, sceneObjects.size()), bounds });
         }
-
-        // Unbind the framebuffer
+        // the visible models and chips are split into those drawn first (visible last frame, or all without occlusion
+        // culling) and the occlusion candidates drawn after them
+        vector<uint8_t> modelVisible(models.size()), windowVisible(programState->windows.size());
+        vector<uint32_t> laysVisibleInstances;
+        vector<uint32_t> visibleObjects, occlusionCandidates, occlusionObjects;
+        vector<Aabb> occlusionBounds;
+        vector<InstancedLaysDraw> occludedLaysDraws;
+    // ----------------------------------------------------------
+
+    // Blending
+    // buffer objects for window
+        unsigned int transparentVAO, transparentVBO;
+        glGenVertexArrays(1, &transparentVAO);
+        glGenBuffers(1, &transparentVBO);
+        glBindVertexArray(transparentVAO);
+        glBindBuffer(GL_ARRAY_BUFFER, transparentVBO);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(transparentVertices), transparentVertices, GL_STATIC_DRAW);
+        glEnableVertexAttribArray(0); // positions
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)0);
+        glEnableVertexAttribArray(1); // texCoords
+        glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(3 * sizeof(float)));
+        glBindVertexArray(0); // ? zasto ovo ?
+
+    //---------------------------------------------------------------
+    // New code - Blurr & Bloom --------------------------------------------------------------------------
+    // configure (floating point) framebuffers
+    // ---------------------------------------  code copied from learnOpenGL bloom page
+        // every offscreen target follows the framebuffer's size (larger than the window's on retina displays)
+        int framebufferWidth, framebufferHeight;
+        glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+        RenderTargetPool renderTargetPool(framebufferWidth, framebufferHeight);
+        renderTargets = &renderTargetPool;
+
+        unsigned int hdrFBO;
+        glGenFramebuffers(1, &hdrFBO);
+        glBindFramebuffer(GL_FRAMEBUFFER, hdrFBO);
+    // create a floating point color buffer; the bright parts are taken out of it by the bloom's first pass (bloom.h)
+        // linear filtered and clamped to the edge, as the blur filters sample it
+        unsigned int colorBuffer = renderTargetPool.createPersistent(RenderTargetDesc{ GL_RGBA16F, 1.0f, GL_LINEAR });
+    // attach texture to framebuffer
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, colorBuffer, 0);
+
+        // create and attach depth buffer, as a texture: the occlusion culling builds its depth pyramid from it
+        unsigned int depthTexture = renderTargetPool.createPersistent(RenderTargetDesc{ GL_DEPTH_COMPONENT24, 1.0f, GL_NEAREST });
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthTexture, 0);
+        // finally check if framebuffer is complete
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cout << "Framebuffer not complete!" << std::endl;
         glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
-// New code - Bloom & Blurr ------------------------------
-        // Blurr
-        // bright fragments with two-pass Gaussian Blur
-        // --------------------------------------------------
-        bool horizontal = true, first_iteration = true;
-        unsigned int amount = 10;
-        blurrShader.use();
-        for (unsigned int i = 0; i < amount; i++)
-        {
-            glBindFramebuffer(GL_FRAMEBUFFER, pingpongFBO[horizontal]);
-            blurrShader.setInt("horizontal", horizontal);
-            glBindTexture(GL_TEXTURE_2D, first_iteration ? colorBuffers[1] : pingpongColorbuffers[!horizontal]);  // bind texture of other framebuffer (or scene if first iteration)
-            renderQuad();
-            horizontal = !horizontal;
-            if (first_iteration)
-                first_iteration = false;
+    //// Check if framebuffer is complete
+    //    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+    //        std::cout << "Framebuffer not complete!" << std::endl;
+    //
+    //glBindFramebuffer(GL_FRAMEBUFFER, 0);  // Unbind the framebuffer -- without this it wouldn't work
+
+    // blur of the bright parts: the mip chain, or the ping-pong Gaussian blur -- Bloom & Blurr
+        Bloom bloomChain(renderTargetPool, bloomDownsampleShader, bloomUpsampleShader, blurrShader);
+        // the Gaussian blur as a compute shader where there are compute shaders (GL 4.3), one per target format
+        unique_ptr<Shader> blurComputeShader, packedBlurComputeShader;
+        if (GLCaps().computeShader) {
+            blurComputeShader.reset(new Shader(FileSystem::getPath("resources/shaders/blur.comp").c_str()));
+            packedBlurComputeShader.reset(new Shader(FileSystem::getPath("resources/shaders/blur.comp").c_str(),
+                                                     std::string("#define PACKED_FLOAT_TARGET\n")));
         }
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        bloomChain.setComputeBlur(blurComputeShader.get(), packedBlurComputeShader.get());
+        // the targets are made RGBA16F, the preset's formats are set in the render loop
+        HdrFormats hdrFormats;
+        HdrFormatValidation hdrValidation;
+
+        OcclusionCuller occlusionCuller(occlusionBoxShader, hiZDownsampleShader, hiZTestShader, renderTargetPool, hdrFBO,
+                                        depthTexture);
+        programState->occlusionHiZ = programState->occlusionHiZ && occlusionCuller.hiZAvailable();
+
+        GBuffer gBuffer(renderTargetPool, depthTexture);
+        GBuffer::setupLightingShader(deferredLightingShader);
+        programState->deferredShading = programState->deferredShading && gBuffer.available();
+
+        //    Lights; TODO -> vise pointLights
+    // ----------------------------------------------------------
+
+        PointLight& pointLight = programState->pointLight;
+        pointLight.ambient = glm::vec3(1.0, 1.0, 1.0);
+        pointLight.diffuse = glm::vec3(1.0, 1.0, 1.0);
+        pointLight.specular = glm::vec3(5.0, 3.0, 2.0);
+
+        pointLight.constant = 1.3f;
+        pointLight.linear = 0.0f;
+        pointLight.quadratic = 0.0f;
+
+        // falls off within about 12 units, so each spot on the floor only sees the lights around it
+        PointLight& ceilingLight = programState->ceilingLight;
+        ceilingLight.ambient = glm::vec3(0.05f);
+        ceilingLight.diffuse = glm::vec3(1.0f, 0.95f, 0.85f);
+        ceilingLight.specular = glm::vec3(0.5f);
+        ceilingLight.constant = 1.0f;
+        ceilingLight.linear = 0.35f;
+        ceilingLight.quadratic = 0.44f;
+    //--------------------------------------------------------------
 
-        // now render floating point color buffer to 2D quad and tonemap HDR colors to default framebuffer's (clamped) color range
-        // --------------------------------------------------------------------------------------------------------------------------
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
         hdrShader.use();
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, colorBuffers[0]);
-        glActiveTexture(GL_TEXTURE1);
-        glBindTexture(GL_TEXTURE_2D, pingpongColorbuffers[!horizontal]);
-        hdrShader.setInt("bloom", bloom);
-        hdrShader.setFloat("exposure", exposure);
-        renderQuad();
-// End of new code--------------------------------
-
-
-    // -----------------------------------------
-
-        if (programState->ImGuiEnabled)
-            DrawImGui(programState);
+        hdrShader.setInt("scene", 0);
+        hdrShader.setInt("bloomBlur", 1);
+    // End of new code - Blurr & Bloom --------------------------------------------------------------------------
+
+
+
+
+
+        GpuTimer sceneTimer;
+        GpuTimer bloomTimer;
+        FrameGraph frameGraph(renderTargetPool);
+        // one per mode, so a result always belongs to the mode it was measured in
+        FragmentCounter shadedFragments[2];
+        RenderQueue renderQueue;
+        // uniform buffers behind the FrameData and LightData blocks, bound once for all programs
+        UniformBlockBuffer<FrameUniforms> frameBlock("FrameData");
+        UniformBlockBuffer<LightUniforms> lightBlock("LightData");
+        // point lights sorted into view clusters, their buffer textures stay bound to fixed units
+        LightClusters lightClusters(threadPool);
+        vector<PointLightData> sceneLights;
+        for (Shader *shader : { &ourShader, &deferredLightingShader }) {
+            shader->use();
+            shader->setInt("pointLightData", LightClusters::LIGHT_UNIT);
+            shader->setInt("lightClusters", LightClusters::CLUSTER_UNIT);
+            shader->setInt("lightIndices", LightClusters::INDEX_UNIT);
+        }
 
+        // render loop
+        // -----------
+        while (!glfwWindowShouldClose(window)) {
+            // per-frame time logic
+            // --------------------
+            float currentFrame = glfwGetTime();
+            deltaTime = currentFrame - lastFrame;
+            lastFrame = currentFrame;
+
+            // input
+            // -----
+            processInput(window);
+
+            textureStreamer->Update();
+            // a resize since the last frame reallocates the targets now
+            renderTargetPool.beginFrame();
+            float aspectRatio = (float) renderTargetPool.width() / (float) renderTargetPool.height();
+            // the quality preset's HDR formats, or RGBA16F for the reference frames of the validation
+            hdrValidation.enabled = programState->validateHdrFormats;
+            HdrFormats frameHdrFormats = hdrValidation.frameFormats(HdrFormatsFor((HdrQuality)programState->hdrQuality));
+            if (frameHdrFormats != hdrFormats) {
+                hdrFormats = frameHdrFormats;
+                renderTargetPool.setFormat(colorBuffer, hdrFormats.sceneColor);
+                bloomChain.setFormat(hdrFormats.bloom);
+            }
+            programState->computeBlurAvailable = bloomChain.computeBlurAvailable();
+
+            // render
+            // ------
+            // the scene is rendered into the floating point framebuffer (hdrFBO) cleared to this color -- Bloom
+            glClearColor(programState->clearColor.r, programState->clearColor.g, programState->clearColor.b, 1.0f);
+
+
+            // view/projection transformations
+            glm::mat4 projection = glm::perspective(glm::radians(programState->camera.Zoom),
+                                                    aspectRatio, 0.1f, 100.0f);
+            glm::mat4 view = programState->camera.GetViewMatrix();
+
+            // per frame data and lights, shared by every program through their uniform blocks
+            FrameUniforms frame;
+            frame.view = view;
+            frame.projection = projection;
+            frame.viewProjection = projection * view;
+            frame.cameraPosition = programState->camera.Position;
+            frame.time = (float) currentFrame;
+            frameBlock.update(frame);
+
+            // Lights, sorted into the clusters of this view
+            sceneLights.clear();
+            for (const glm::vec3 &position : programState->pointLightPositions)
+                sceneLights.push_back(pointLightData(programState->pointLight, position));
+            if (programState->ceilingLights) {
+                glm::vec2 gridOrigin = -0.5f * programState->ceilingLightSpacing *
+                                       glm::vec2(programState->ceilingLightColumns - 1, programState->ceilingLightRows - 1);
+                for (int row = 0; row < programState->ceilingLightRows; row++)
+                    for (int column = 0; column < programState->ceilingLightColumns; column++) {
+                        glm::vec2 offset = gridOrigin + programState->ceilingLightSpacing * glm::vec2(column, row);
+                        glm::vec3 position(offset.x, programState->ceilingHeight, offset.y);
+                        sceneLights.push_back(pointLightData(programState->ceilingLight, position));
+                    }
+            }
+            lightClusters.setProjection(glm::radians(programState->camera.Zoom), aspectRatio, 0.1f, 100.0f);
+            lightClusters.update(sceneLights, view);
+            lightBlock.update(lightClusters.uniforms());
+            programState->lightClusters = lightClusters.lastStats();
+
+            // don't forget to enable shader before setting uniforms
+            ourShader.use();
+            ourShader.setFloat("material.shininess", 32.0f);
+    //        ourShader.setVec3("pointLight[1].ambient", glm::vec3(1.0f, 1.0f, 1.0f));
+    //        ourShader.setVec3("pointLight[1].diffuse", glm::vec3(1.0f, 1.0f, 1.5f));
+    //        ourShader.setVec3("pointLight[1].specular", glm::vec3(5.0, 3.0, 2.0));
+    //        ourShader.setVec3("pointLight[2].ambient", glm::vec3(22.0f, -48.0f, 0.0f));
+    //        ourShader.setVec3("pointLight[2].diffuse", glm::vec3(1.0f, 1.0f, 1.5f));
+    //        ourShader.setVec3("pointLight[2].specular", glm::vec3(5.0, 3.0, 2.0));
+    //        ourShader.setVec3("pointLight[3].ambient", glm::vec3(1.0f, 1.0f, 1.0f));
+    //        ourShader.setVec3("pointLight[3].diffuse", glm::vec3(1.0f, 1.0f, 1.5f));
+    //        ourShader.setVec3("pointLight[3].specular", glm::vec3(5.0, 3.0, 2.0));
+
+
+    //        ourShader.setFloat("pointLight[1].constant", 1.3f);
+    //        ourShader.setFloat("pointLight[1].linear", 0.0f);
+    //        ourShader.setFloat("pointLight[1].quadratic", 0.0f);
+    //        ourShader.setFloat("pointLight[2].constant", 1.3f);
+    //        ourShader.setFloat("pointLight[2].linear", 0.0f);
+    //        ourShader.setFloat("pointLight[2].quadratic", 0.0f);
+    //        ourShader.setFloat("pointLight[3].constant", 1.3f);
+    //        ourShader.setFloat("pointLight[3].linear", 0.0f);
+    //        ourShader.setFloat("pointLight[3].quadratic", 0.0f);
+
+
+            ourShader.setInt("blinn_flag", blinn_flag);
+            std::cout << (blinn_flag ? "Blinn-Phong" : "Phong") << std::endl;
+            gBufferShader.use();
+            gBufferShader.setFloat("material.shininess", 32.0f);
+            deferredLightingShader.use();
+            deferredLightingShader.setInt("blinn_flag", blinn_flag);
+
+            // the opaque scene either lights every fragment as it's drawn or fills the G-buffer, lit once per pixel below
+            bool deferred = programState->deferredShading && gBuffer.available();
+            Shader &sceneShader = deferred ? gBufferShader : ourShader;
+            Shader &laysShader = deferred ? instanceGBufferShader : instanceShader;
+            bool depthPrepass = programState->depthPrepass;
+            FragmentCounter &fragmentCounter = shadedFragments[depthPrepass];
+
+
+            // level of detail: the coarsest mesh LOD whose error stays below lodPixelError pixels on screen
+            LodView lodView = LodView::Perspective(programState->camera.Position, glm::radians(programState->camera.Zoom),
+                                                   (float) renderTargetPool.height(), programState->lodPixelError);
+            lodView.enabled = programState->lodEnabled;
+            Frustum frustum = Frustum::FromViewProjection(frame.viewProjection);
+            const Frustum *cullingFrustum = programState->frustumCulling ? &frustum : nullptr;
+
+            // bags added or taken away with the slider, the last added go first
+            programState->laysAmount = std::max(std::min(programState->laysAmount, (int)laysInstances.capacity()), 0);
+            while (laysBags.size() < (size_t)programState->laysAmount) {
+                uint32_t instance = laysInstances.add(laysInstanceTransform(laysBags.size()));
+                if (instance == InstancedModel::INVALID_INSTANCE) {
+                    programState->laysAmount = (int)laysBags.size();
+                    break;
+                }
+                uint32_t slot = (uint32_t)sceneObjects.size();
+                if (!freeSceneObjects.empty()) {
+                    slot = freeSceneObjects.back();
+                    freeSceneObjects.pop_back();
+                } else {
+                    sceneObjects.emplace_back();
+                }
+                Aabb bounds = laysInstances.bounds(instance);
+                sceneObjects[slot] = { SceneObject::LAYS_INSTANCE, instance, sceneBvh.insert(bounds, slot), bounds };
+                laysBags.push_back(slot);
+            }
+            while (laysBags.size() > (size_t)programState->laysAmount) {
+                SceneObject &object = sceneObjects[laysBags.back()];
+                laysInstances.remove(object.index);
+                sceneBvh.remove(object.handle);
+                object.kind = SceneObject::REMOVED;
+                freeSceneObjects.push_back(laysBags.back());
+                laysBags.pop_back();
+            }
+            laysInstances.upload();
+            programState->laysInstances = laysInstances.size();
+            programState->laysUploadBytes = laysInstances.uploadedBytes();
+
+            // models that moved are refitted in the BVH, then it is asked which objects are in view
+            computeModelTransforms(modelTransforms);
+            for (SceneObject &object : sceneObjects) {
+                if (object.kind == SceneObject::MODEL)
+                    object.bounds = Aabb::Transformed(modelMin[object.index], modelMax[object.index], modelTransforms[object.index]);
+                else if (object.kind == SceneObject::WINDOW)
+                    object.bounds = windowBounds(programState->windows[object.index]);
+                else
+                    continue; // the chips stay where they were put, removed ones are out of the tree
+                sceneBvh.update(object.handle, object.bounds);
+            }
+            sceneBvh.maintain();
+            visibleObjects.clear();
+            if (cullingFrustum)
+                sceneBvh.queryFrustum(frustum, visibleObjects);
+            else
+                for (uint32_t i = 0; i < sceneObjects.size(); i++)
+                    visibleObjects.push_back(i);
+            programState->sceneObjects = sceneBvh.size();
+            programState->sceneObjectsVisible = visibleObjects.size();
+            programState->bvhNodesVisited = cullingFrustum ? sceneBvh.nodesVisited : 0;
+
+            // objects seen last frame are drawn first, the other opaque ones after them under occlusion queries
+            bool occlusionCulling = programState->occlusionCulling;
+            occlusionCuller.setMethod(programState->occlusionHiZ ? OcclusionCuller::Method::HiZ : OcclusionCuller::Method::Queries);
+            occlusionCuller.beginFrame(sceneObjects.size(), programState->camera.Position, 0.1f);
+            std::fill(modelVisible.begin(), modelVisible.end(), 0);
+            laysVisibleInstances.clear();
+            std::fill(windowVisible.begin(), windowVisible.end(), 0);
+            occlusionCandidates.clear();
+            occlusionObjects.clear();
+            occlusionBounds.clear();
+            // a query and a draw of its own per bag only pay off for a few bags, crowds of them are drawn in one go
+            bool occludeChips = laysBags.size() <= MAX_OCCLUSION_TESTED_BAGS;
+            for (uint32_t visible : visibleObjects) {
+                const SceneObject &object = sceneObjects[visible];
+                if (object.kind == SceneObject::WINDOW) {
+                    windowVisible[object.index] = 1;
+                    continue;
+                }
+                if (occlusionCulling && (object.kind == SceneObject::MODEL || occludeChips)) {
+                    occlusionObjects.push_back(visible);
+                    occlusionBounds.push_back(object.bounds);
+                    if (!occlusionCuller.visibleLastFrame(visible)) {
+                        occlusionCandidates.push_back(visible);
+                        continue;
+                    }
+                }
+                if (object.kind == SceneObject::MODEL)
+                    modelVisible[object.index] = 1;
+                else
+                    laysVisibleInstances.push_back(object.index);
+            }
+
+            // The frame as passes declaring what they read and write: the graph runs them in dependency order, culls those
+            // nothing reads (the bloom passes with bloom off), lends out the transient targets and invalidates what isn't
+            // needed anymore. The scene targets are the hdrFBO's; with deferred shading the opaque passes fill the
+            // G-buffer, lit into the scene color before the windows are blended over it.
+            frameGraph.reset();
+            FrameGraph::Resource sceneColor = frameGraph.import("scene color", colorBuffer);
+            frameGraph.attach(sceneColor, hdrFBO, GL_COLOR_ATTACHMENT0);
+            FrameGraph::Resource sceneDepth = frameGraph.import("scene depth", depthTexture);
+            frameGraph.attach(sceneDepth, hdrFBO, GL_DEPTH_ATTACHMENT);
+            FrameGraph::Resource gBufferTargets = frameGraph.import("G-buffer");
+            frameGraph.attach(gBufferTargets, gBuffer.framebufferObject(), GL_COLOR_ATTACHMENT0);
+            frameGraph.attach(gBufferTargets, gBuffer.framebufferObject(), GL_COLOR_ATTACHMENT1);
+            Bloom::Method bloomMethod = programState->bloomMipChain ? Bloom::Method::MipChain : Bloom::Method::Gaussian;
+            FrameGraph::Resource bright = frameGraph.create("bright", Bloom::BrightTarget(bloomMethod, hdrFormats.bloom));
+            FrameGraph::Resource backbuffer = frameGraph.import("backbuffer");
+            frameGraph.attach(backbuffer, 0, GL_COLOR);
+            frameGraph.attach(backbuffer, 0, GL_DEPTH);   // nothing uses it, the tone mapping discards it
+            frameGraph.markOutput(backbuffer);
+
+            auto submitStart = std::chrono::steady_clock::now();
+            // opaque models, those hidden last frame under occlusion queries
+            {
+                FrameGraph::PassBuilder pass = frameGraph.addPass("opaque", [&]() {
+                    // queue the whole scene: opaque draws are grouped by state and go front to back, the windows back
+                    // to front
+                    sceneTimer.begin();
+                    submitStart = std::chrono::steady_clock::now();
+                    FrameDrawStats() = DrawStats();
+                    GLState().stats = GLStateStats();
+                    FrameCullingStats() = CullingStats();
+                    glBindFramebuffer(GL_FRAMEBUFFER, hdrFBO);
+                    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+                    if (deferred)
+                        gBuffer.beginGeometry();
+                    renderQueue.begin(programState->camera.Position, 100.0f);
+                    renderQueue.setDepthPrepass(depthPrepass ? &depthPrepassShader : nullptr);
+                    submitModels(renderQueue, sceneShader, models, modelTransforms, modelVisible, lodView, cullingFrustum);
+                    // with the pre-pass only the depth is drawn here, everything is shaded together once the candidates
+                    // are in
+                    if (depthPrepass) {
+                        renderQueue.executeDepth();
+                    } else {
+                        fragmentCounter.begin();
+                        renderQueue.execute();
+                        fragmentCounter.end();
+                    }
+
+                    // Occlusion culling: every candidate's box is tested against the depth of what was drawn so far and
+                    // the object drawn under conditional rendering on the result
+                    if (occlusionCulling) {
+                        vector<GLuint> queries(occlusionCandidates.size());
+                        occlusionCuller.beginQueries();
+                        for (size_t i = 0; i < occlusionCandidates.size(); i++)
+                            queries[i] = occlusionCuller.queryBox(occlusionCandidates[i], sceneObjects[occlusionCandidates[i]].bounds);
+                        occlusionCuller.endQueries();
+
+                        // the pre-passed items stay queued for the shading below
+                        if (!depthPrepass)
+                            renderQueue.begin(programState->camera.Position, 100.0f);
+                        occludedLaysDraws.clear();
+                        occludedLaysDraws.reserve(occlusionCandidates.size()); // the queue keeps pointers to them
+                        for (size_t i = 0; i < occlusionCandidates.size(); i++) {
+                            const SceneObject &object = sceneObjects[occlusionCandidates[i]];
+                            renderQueue.setCondition(queries[i]);
+                            if (object.kind == SceneObject::MODEL) {
+                                submitModel(renderQueue, sceneShader, models, object.index, modelTransforms[object.index],
+                                            lodView, cullingFrustum);
+                            } else {
+                                // the instance on its own, its draw depends on its query only
+                                occludedLaysDraws.push_back({ &laysShader, &laysInstances, laysModel.textures_loaded[0].id,
+                                                              &object.index, 1, lodView });
+                                renderQueue.submitCallback(laysShader, RenderPass::Opaque, RenderQueue::NO_TRANSFORM,
+                                                           laysModel.textures_loaded[0].id, laysModel.meshes[0].VAO,
+                                                           object.bounds.center(), drawInstancedLays,
+                                                           &occludedLaysDraws.back());
+                            }
+                        }
+                        renderQueue.setCondition(0);
+                        if (depthPrepass) {
+                            renderQueue.executeDepth();
+                        } else {
+                            fragmentCounter.begin();
+                            renderQueue.execute();
+                            fragmentCounter.end();
+                        }
+                    }
+                    if (depthPrepass) {
+                        fragmentCounter.begin();
+                        renderQueue.execute();
+                        fragmentCounter.end();
+                    }
+                });
+                // the scene framebuffer is cleared, whatever the last frame left in it is dropped
+                sceneColor = pass.write(sceneColor, FrameGraph::Load::Discard);
+                sceneDepth = pass.write(sceneDepth, FrameGraph::Load::Discard);
+                if (deferred)
+                    gBufferTargets = pass.write(gBufferTargets, FrameGraph::Load::Discard);
+            }
+
+            // Instancing: the bags seen last frame in one instanced draw per mesh and LOD, after the models that hide them
+            {
+                FrameGraph::PassBuilder pass = frameGraph.addPass("instanced", [&]() {
+                    InstancedLaysDraw laysDraw = { &laysShader, &laysInstances, laysModel.textures_loaded[0].id,
+                                                   laysVisibleInstances.data(), laysVisibleInstances.size(), lodView };
+                    renderQueue.begin(programState->camera.Position, 100.0f);
+                    renderQueue.submitCallback(laysShader, RenderPass::Opaque, RenderQueue::NO_TRANSFORM,
+                                               laysModel.textures_loaded[0].id, laysModel.meshes[0].VAO,
+                                               programState->laysStartPosition, drawInstancedLays, &laysDraw);
+                    if (depthPrepass)
+                        renderQueue.executeDepth();
+                    fragmentCounter.begin();
+                    renderQueue.execute();
+                    fragmentCounter.end();
+                });
+                if (deferred)
+                    gBufferTargets = pass.write(gBufferTargets);
+                else
+                    sceneColor = pass.write(sceneColor);
+                sceneDepth = pass.write(sceneDepth);
+            }
+
+            // every candidate tested against the finished depth buffer, for the next frames
+            if (occlusionCulling) {
+                FrameGraph::PassBuilder pass = frameGraph.addPass("occlusion test", [&]() {
+                    occlusionCuller.endFrame(occlusionObjects, occlusionBounds);
+                });
+                pass.read(sceneDepth);
+                pass.sideEffects();
+            }
+
+            // Deferred lighting, into the scene framebuffer the windows are blended over
+            if (deferred) {
+                FrameGraph::PassBuilder pass = frameGraph.addPass("deferred lighting", [&]() {
+                    fragmentCounter.begin();
+                    gBuffer.light(deferredLightingShader, hdrFBO, frame.viewProjection);
+                    fragmentCounter.end();
+                });
+                pass.read(gBufferTargets);
+                pass.read(sceneDepth);
+                sceneColor = pass.write(sceneColor);
+            }
+
+            // Blending
+            {
+                FrameGraph::PassBuilder pass = frameGraph.addPass("transparent", [&]() {
+                    glBindFramebuffer(GL_FRAMEBUFFER, hdrFBO);
+                    renderQueue.begin(programState->camera.Position, 100.0f);
+                    WindowDraw windowDraw = { transparentVAO, transparentTexture.id() };
+                    for (unsigned int i = 0; i < programState->windows.size(); i++)
+                    {
+                        if (!windowVisible[i])
+                            continue;
+                        const glm::vec3 &position = programState->windows[i];
+                        glm::mat4 model = glm::mat4(1.0f);
+                        model = glm::translate(model, position);
+                        model = glm::scale(model, glm::vec3(programState->windowScale));
+                        renderQueue.submitCallback(blendingShader, RenderPass::Transparent, renderQueue.addTransform(model),
+                                                   transparentTexture.id(), transparentVAO, position, drawWindow, &windowDraw);
+                    }
+
+                    renderQueue.execute();
+                    double submitMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - submitStart).count();
+                    sceneTimer.end();
+                    programState->sceneGpuMs = sceneTimer.milliseconds();
+                    programState->sceneCpuMs = programState->sceneCpuMs * 0.95 + submitMs * 0.05;
+                    programState->sceneDraws = FrameDrawStats();
+                    programState->sceneStateChanges = GLState().stats;
+                    programState->sceneCulling = FrameCullingStats();
+                });
+                sceneColor = pass.write(sceneColor);
+                sceneDepth = pass.write(sceneDepth);
+            }
+
+    // New code - Bloom & Blurr ------------------------------
+            // Blurr
+            // bright fragments through the bloom mip chain (or the old two-pass Gaussian Blur); culled when the tone
+            // mapping doesn't add the bloom
+            // --------------------------------------------------
+            {
+                FrameGraph::PassBuilder pass = frameGraph.addPass("bright-pass", [&]() {
+                    bloomTimer.begin();
+                    bloomChain.brightPass(colorBuffer, frameGraph.texture(bright), programState->bloomSettings, bloomMethod);
+                });
+                pass.read(sceneColor);
+                bright = pass.write(bright, FrameGraph::Load::Discard);
+            }
+            {
+                FrameGraph::PassBuilder pass = frameGraph.addPass("blur", [&]() {
+                    bloomChain.blur(frameGraph.texture(bright), programState->bloomSettings, bloomMethod);
+                    bloomTimer.end();
+                    programState->bloomGpuMs = bloomTimer.milliseconds();
+                    programState->computeBlurPassMs = bloomChain.computeBlurPassMs();
+                    programState->fragmentBlurPassMs = bloomChain.fragmentBlurPassMs();
+                });
+                bright = pass.write(bright);
+            }
+
+            // now render floating point color buffer to 2D quad and tonemap HDR colors to default framebuffer's (clamped) color range
+            // the quad covers every pixel, so the default framebuffer is never cleared
+            // --------------------------------------------------------------------------------------------------------------------------
+            bool addBloom = bloom && bloomChain.available();
+            {
+                FrameGraph::PassBuilder pass = frameGraph.addPass("tonemap", [&]() {
+                    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+                    glDisable(GL_DEPTH_TEST);
+                    hdrShader.use();
+                    glActiveTexture(GL_TEXTURE0);
+                    glBindTexture(GL_TEXTURE_2D, colorBuffer);
+                    glActiveTexture(GL_TEXTURE1);
+                    glBindTexture(GL_TEXTURE_2D, addBloom ? frameGraph.texture(bright) : 0);
+                    hdrShader.setInt("bloom", addBloom);
+                    hdrShader.setFloat("bloomIntensity", programState->bloomSettings.intensity);
+                    hdrShader.setFloat("exposure", exposure);
+                    renderQuad();
+                    glEnable(GL_DEPTH_TEST);
+                    // bound directly, past the state cache
+                    GLState().invalidate();
+                });
+                pass.read(sceneColor);
+                if (addBloom)
+                    pass.read(bright);
+                backbuffer = pass.write(backbuffer, FrameGraph::Load::Discard);
+            }
+            // the scene color and the tone mapped frame of every frame while validating, before the UI is drawn over it
+            if (hdrValidation.enabled) {
+                FrameGraph::PassBuilder pass = frameGraph.addPass("HDR format validation", [&]() {
+                    hdrValidation.capture(colorBuffer, renderTargetPool.width(), renderTargetPool.height());
+                    programState->hdrFormatError = hdrValidation.error();
+                });
+                pass.read(sceneColor);
+                pass.read(backbuffer);
+                pass.sideEffects();
+            }
+    // End of new code--------------------------------
+
+
+        // -----------------------------------------
+
+            if (programState->ImGuiEnabled) {
+                FrameGraph::PassBuilder pass = frameGraph.addPass("UI", [&]() {
+                    DrawImGui(programState);
+                    GLState().invalidate();
+                });
+                backbuffer = pass.write(backbuffer);
+            }
+
+            fragmentCounter.beginFrame();
+            frameGraph.execute();
+            fragmentCounter.endFrame();
+            programState->shadedFragments[depthPrepass] = fragmentCounter.fragments();
+            programState->shaderInvocations = fragmentCounter.countsInvocations();
+            programState->sceneOcclusion = occlusionCuller.stats;
+            programState->rgba16fBytesAt4K = renderTargetPool.bytes(GL_RGBA16F, 3840, 2160);
+            programState->packedFloatBytesAt4K = renderTargetPool.bytes(GL_R11F_G11F_B10F, 3840, 2160);
+            programState->framePasses = frameGraph.summary();
+            programState->invalidatedAttachments = frameGraph.invalidatedAttachments();
+
+
+            // glfw: swap buffers and poll IO events (keys pressed/released, mouse moved etc.)
+            // -------------------------------------------------------------------------------
+            glfwSwapBuffers(window);
+            glfwPollEvents();
+            // free textures whose last user went away this frame
+            TextureRegistry::Instance().CollectGarbage();
+        }
 
-        // glfw: swap buffers and poll IO events (keys pressed/released, mouse moved etc.)
-        // -------------------------------------------------------------------------------
-        glfwSwapBuffers(window);
-        glfwPollEvents();
+// New code - Bloom & Blurr
+        // Bloom
+        glDeleteFramebuffers(1, &hdrFBO);
+        renderTargets = nullptr;
+// End of new code--------------------------------
+        TextureRegistry::Instance().SetStreamer(nullptr);
     }
 
     programState->SaveToFile("resources/program_state.txt");
     delete programState;
-// New code - Bloom & Blurr
-    // Bloom
-    glDeleteFramebuffers(1, &hdrFBO);
-    glDeleteTextures(2, colorBuffers);
-    glDeleteFramebuffers(2, pingpongFBO);
-    glDeleteTextures(2, pingpongColorbuffers);
-// End of new code--------------------------------
 
     //--------------------
     ImGui_ImplOpenGL3_Shutdown();
@@ -664,24 +1131,9 @@ int main() {
     return 0;
 }
 
-// New code - Bloom & HDR
-void hdr_resize(unsigned int *colorBuffers, unsigned int *pingpongColorbuffers) {
-    for (unsigned int i = 0; i < 2; i++) {
-        glBindTexture(GL_TEXTURE_2D, colorBuffers[i]);
-        glTexImage2D(
-                GL_TEXTURE_2D, 0, GL_RGBA16F, SCR_WIDTH, SCR_HEIGHT, 0, GL_RGBA, GL_FLOAT, NULL
-        );
-    }
-
-    for (unsigned int i = 0; i < 2; i++) {
-        glBindTexture(GL_TEXTURE_2D, pingpongColorbuffers[i]);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, SCR_WIDTH, SCR_HEIGHT, 0, GL_RGBA, GL_FLOAT, NULL);
-    }
-}
-// End of new code--------------------------------
 
-// renderModels implementation
-void renderModels(Shader &shader, vector<Model> &models) {
+// model matrices of models, by model index
+void computeModelTransforms(vector<glm::mat4> &transforms) {
 
     glm::mat4 model = glm::mat4(1.0f);
 
@@ -695,8 +1147,7 @@ void renderModels(Shader &shader, vector<Model> &models) {
                            programState->cartPosition);
     model = glm::rotate(model, glm::radians(programState->cartXRotationDeg), glm::vec3(1.0f, 0.0f, 0.0f));
     model = glm::rotate(model, glm::radians(programState->cartZRotationDeg), glm::vec3(0.0f, 0.0f, 1.0f));
-    shader.setMat4("model", model);
-    models[0].Draw(shader);
+    transforms[0] = model;
 
     // Lays chips model
     model = glm::mat4(1.0f);
@@ -707,8 +1158,7 @@ void renderModels(Shader &shader, vector<Model> &models) {
 //    model = glm::translate(model,
 //                           programState->laysStartPosition); nisam pratila dobar redosled transformacija jer sam samo gledala kako scena izgleda
     model = glm::rotate(model, glm::radians(programState->laysRotationDeg), glm::vec3(1.0f, 0.0f, 0.0f));
-    shader.setMat4("model", model);
-    models[1].Draw(shader);
+    transforms[1] = model;
 
 
     // Floor model
@@ -716,16 +1166,14 @@ void renderModels(Shader &shader, vector<Model> &models) {
     model = glm::translate(model,
                            programState->floorPosition); // translate it down so it's at the center of the scene
     model = glm::rotate(model, glm::radians(programState->floorXRotationDeg), glm::vec3(1.0f, 0.0f, 0.0f));
-    shader.setMat4("model", model);
-    models[3].Draw(shader);
+    transforms[3] = model;
 
     // Plastic bottle model
     model = glm::mat4(1.0f);
     model = glm::translate(model,
                            programState->bottlePosition);
     model = glm::rotate(model, glm::radians(programState->bottleXRotationDeg), glm::vec3(1.0f, 0.0f, 0.0f));
-    shader.setMat4("model", model);
-    models[4].Draw(shader);
+    transforms[4] = model;
 
     // Glass bottle model
     model = glm::mat4(1.0f);
@@ -734,10 +1182,46 @@ void renderModels(Shader &shader, vector<Model> &models) {
     model = glm::scale(model, glm::vec3(
             programState->bottle2Scale));
     model = glm::rotate(model, glm::radians(programState->bottleXRotationDeg), glm::vec3(1.0f, 0.0f, 0.0f));
-    shader.setMat4("model", model);
-    models[5].Draw(shader);
+    transforms[5] = model;
+
+    // Aisle model
+    model = glm::mat4(1.0f);
+    model = glm::translate(model,
+                           programState->aislePosition); // translate it down so it's at the center of the scene
+    model = glm::scale(model, glm::vec3(
+            programState->aisleScale));    // it's a bit too big for our scene, so scale it dow
+    model = glm::rotate(model, glm::radians(programState->aisleRotationDeg), glm::vec3(1.0f, 0.0f, 0.0f));
+    transforms[2] = model;
+}
+
+// queues a model, the aisle without face culling
+void submitModel(RenderQueue &queue, Shader &shader, vector<Model> &models, unsigned int index, const glm::mat4 &transform,
+                 const LodView &lodView, const Frustum *frustum) {
+    models[index].Submit(queue, shader, transform, lodView, frustum,
+                         index == 2 ? RenderPass::OpaqueDoubleSided : RenderPass::Opaque);
+}
+
+// queues the visible models
+void submitModels(RenderQueue &queue, Shader &shader, vector<Model> &models, const vector<glm::mat4> &transforms,
+                  const vector<uint8_t> &visible, const LodView &lodView, const Frustum *frustum) {
+    for (unsigned int i = 0; i < models.size(); i++)
+        if (visible[i])
+            submitModel(queue, shader, models, i, transforms[i], lodView, frustum);
 }
 
+void drawInstancedLays(void *context, GLStateCache &state) {
+    InstancedLaysDraw &draw = *(InstancedLaysDraw*)context;
+    state.bindTexture(0, draw.texture);
+    draw.instances->draw(*draw.shader, draw.slots, draw.count, draw.lodView);
+}
+
+void drawWindow(void *context, GLStateCache &state) {
+    WindowDraw &draw = *(WindowDraw*)context;
+    state.bindVertexArray(draw.vertexArray);
+    state.bindTexture(0, draw.texture);
+    glDrawArrays(GL_TRIANGLES, 0, 6);
+    FrameDrawStats().drawCalls++;
+}
 
 // process all input: query GLFW whether relevant keys are pressed/released this frame and react accordingly
 // ---------------------------------------------------------------------------------------------------------
@@ -767,15 +1251,15 @@ void processInput(GLFWwindow *window) {
 
 // glfw: whenever the window size changed (by OS or user resize) this callback function executes
 // ---------------------------------------------------------------------------------------------
-// void framebuffer_size_callback(GLFWwindow *window, int width, int height, unsigned int *colorBuffers, unsigned int *pingpongColorbuffers) -- DOESN'T WORK
 void framebuffer_size_callback(GLFWwindow *window, int width, int height) {
     // make sure the viewport matches the new window dimensions; note that width and
     // height will be significantly larger than specified on retina displays.
     glViewport(0, 0, width, height);
 
 // New code - Bloom & HDR
-//    Doesn't work
-//    hdr_resize(colorBuffers, pingpongColorbuffers); // Bloom & Blurr - for resizing hdr to fit window size
+    // the scene's targets follow at the start of the next frame
+    if (renderTargets)
+        renderTargets->resize(width, height);
 // End of new code--------------------------------
 
 }
@@ -817,6 +1301,61 @@ void DrawImGui(ProgramState *programState) {
         ImGui::Text("Choose your chips");
         ImGui::SliderFloat("Float slider", &f, 0.0, 1.0);
         ImGui::ColorEdit3("Background color", (float *) &programState->clearColor);
+        ImGui::Text("Scene draw (GPU): %.3f ms", programState->sceneGpuMs);
+        ImGui::Text("Scene submit (CPU): %.3f ms, %u draw calls for %u meshes", programState->sceneCpuMs,
+                    programState->sceneDraws.drawCalls, programState->sceneDraws.meshes);
+        ImGui::Text("State changes: %u programs, %u VAOs, %u textures, %u render states",
+                    programState->sceneStateChanges.programs, programState->sceneStateChanges.vertexArrays,
+                    programState->sceneStateChanges.textures, programState->sceneStateChanges.renderStates);
+        ImGui::Checkbox("Static batching", &StaticBatch::Enabled());
+        ImGui::Checkbox("Mesh LODs", &programState->lodEnabled);
+        ImGui::Checkbox("Frustum culling", &programState->frustumCulling);
+        ImGui::Text("Scene BVH: %u of %u objects visible, %u nodes visited", programState->sceneObjectsVisible,
+                    programState->sceneObjects, programState->bvhNodesVisited);
+        ImGui::Text("Mesh culling: %u of %u boxes visible, %u culled", programState->sceneCulling.visible,
+                    programState->sceneCulling.tested, programState->sceneCulling.tested - programState->sceneCulling.visible);
+        ImGui::Checkbox("Occlusion culling", &programState->occlusionCulling);
+        ImGui::Checkbox("Hi-Z pyramid (off: occlusion queries)", &programState->occlusionHiZ);
+        ImGui::Text("Occlusion: %u of %u objects hidden, %u drawn conditionally", programState->sceneOcclusion.occluded,
+                    programState->sceneOcclusion.tested, programState->sceneOcclusion.conditional);
+        ImGui::DragFloat("LOD pixel error", &programState->lodPixelError, 0.05, 0.1, 8.0);
+        ImGui::Checkbox("Deferred shading (off: forward)", &programState->deferredShading);
+        ImGui::Checkbox("Depth pre-pass", &programState->depthPrepass);
+        ImGui::Text("Shaded %s: %llu without the pre-pass, %llu with it",
+                    programState->shaderInvocations ? "fragments" : "fragments (depth test passes)",
+                    (unsigned long long)programState->shadedFragments[0], (unsigned long long)programState->shadedFragments[1]);
+        ImGui::Checkbox("Bloom", &bloom);
+        ImGui::Checkbox("Bloom mip chain (off: full resolution Gaussian)", &programState->bloomMipChain);
+        ImGui::DragFloat("Bloom threshold", &programState->bloomSettings.threshold, 0.05, 0.0, 10.0);
+        ImGui::DragFloat("Bloom knee", &programState->bloomSettings.knee, 0.05, 0.0, 1.0);
+        ImGui::DragFloat("Bloom radius", &programState->bloomSettings.radius, 0.05, 0.25, 4.0);
+        ImGui::DragFloat("Bloom intensity", &programState->bloomSettings.intensity, 0.01, 0.0, 4.0);
+        ImGui::DragFloat("Gaussian sigma", &programState->bloomSettings.blurSigma, 0.05, 0.5, 8.0);
+        ImGui::DragInt("Gaussian radius", &programState->bloomSettings.blurRadius, 0.2, 1, BlurKernel::MAX_RADIUS);
+        if (programState->computeBlurAvailable)
+            ImGui::Checkbox("Gaussian blur in a compute shader", &programState->bloomSettings.computeBlur);
+        ImGui::Text("Bloom (GPU): %.3f ms", programState->bloomGpuMs);
+        ImGui::Text("Gaussian pass (GPU): %.3f ms compute, %.3f ms fragment", programState->computeBlurPassMs,
+                    programState->fragmentBlurPassMs);
+        ImGui::Combo("HDR quality", &programState->hdrQuality,
+                     "High (RGBA16F)\0Balanced (R11F_G11F_B10F bloom)\0Performance (R11F_G11F_B10F scene and bloom)\0");
+        ImGui::Checkbox("Validate HDR formats against RGBA16F (keep the camera still)", &programState->validateHdrFormats);
+        if (programState->validateHdrFormats && programState->hdrFormatError.measured)
+            ImGui::Text("HDR format error: output max %.0f / 255, mean %.3f / 255; scene color max %.2f%%",
+                        programState->hdrFormatError.maxOutput, programState->hdrFormatError.meanOutput,
+                        programState->hdrFormatError.maxScene * 100.0f);
+        // before the pool: two scene color buffers and two ping-pong buffers, all full size RGBA16F
+        ImGui::Text("HDR targets at 4K: %.1f MB RGBA16F, %.1f MB R11F_G11F_B10F (fixed layout before: %.1f MB)",
+                    programState->rgba16fBytesAt4K / 1e6, programState->packedFloatBytesAt4K / 1e6,
+                    4 * RenderTargetPool::Bytes(RenderTargetDesc{ GL_RGBA16F, 1.0f }, glm::ivec2(3840, 2160)) / 1e6);
+        ImGui::TextWrapped("Frame: %s", programState->framePasses.c_str());
+        ImGui::Text("Attachments invalidated: %u", programState->invalidatedAttachments);
+        ImGui::Checkbox("Ceiling lights", &programState->ceilingLights);
+        ImGui::DragInt("Ceiling light rows", &programState->ceilingLightRows, 1, 1, 64);
+        ImGui::DragInt("Ceiling light columns", &programState->ceilingLightColumns, 1, 1, 64);
+        ImGui::Text("Light clusters: %u lights, %u references, at most %u per cluster, %.3f ms",
+                    programState->lightClusters.lights, programState->lightClusters.references,
+                    programState->lightClusters.maxPerCluster, programState->lightClusters.cpuMs);
 
         ImGui::DragFloat3("lightParams[1].position", (float*)&programState->pointLightPositions[2]);
         ImGui::DragFloat("constant", &programState->pointLight.constant, 0.05, 0.0, 1.0);
@@ -829,7 +1368,13 @@ void DrawImGui(ProgramState *programState) {
     {
         ImGui::Begin("Instancing");
         ImGui::Text("Stay healthy");
-        ImGui::SliderInt("Chips amount", &programState->laysAmount, 0, 4);
+        // no more than the instance buffer texture holds
+        int maxLays = (int)std::min(programState->laysCapacity, (size_t)1000000);
+        ImGui::DragInt("Chips amount", &programState->laysAmount, 25.0f, 0, maxLays);
+        ImGui::SameLine();
+        ImGui::Text("(at most %d)", maxLays);
+        ImGui::Text("Chips: %lu instances, %lu bytes of transforms uploaded", (unsigned long)programState->laysInstances,
+                    (unsigned long)programState->laysUploadBytes);
         ImGui::End();
     }
 
@@ -862,41 +1407,14 @@ void key_callback(GLFWwindow *window, int key, int scancode, int action, int mod
 
 // utility function for loading a 2D texture from file
 // ---------------------------------------------------
-unsigned int loadTexture(char const * path)
+// goes through the texture registry, so an image already used by a model is not loaded a second time
+TextureHandle loadTexture(char const * path)
 {
-    unsigned int textureID;
-    glGenTextures(1, &textureID);
-
-    int width, height, nrComponents;
-    unsigned char *data = stbi_load(path, &width, &height, &nrComponents, 0);
-    if (data)
-    {
-        GLenum format;
-        if (nrComponents == 1)
-            format = GL_RED;
-        else if (nrComponents == 3)
-            format = GL_RGB;
-        else if (nrComponents == 4)
-            format = GL_RGBA;
-
-        glBindTexture(GL_TEXTURE_2D, textureID);
-        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
-
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, format == GL_RGBA ? GL_CLAMP_TO_EDGE : GL_REPEAT); // for this tutorial: use GL_CLAMP_TO_EDGE to prevent semi-transparent borders. Due to interpolation it takes texels from next repeat
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, format == GL_RGBA ? GL_CLAMP_TO_EDGE : GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-        stbi_image_free(data);
-    }
-    else
-    {
-        std::cout << "Texture failed to load at path: " << path << std::endl;
-        stbi_image_free(data);
-    }
-
-    return textureID;
+    TextureRegistry &registry = TextureRegistry::Instance();
+    // for this tutorial: use GL_CLAMP_TO_EDGE for images with alpha to prevent semi-transparent borders. Due to interpolation it takes texels from next repeat
+    TextureHandle texture = registry.Acquire(path, nullptr, TEXTURE_WRAP_AUTO);
+    registry.FinishLoading(texture);
+    return texture;
 }
 // ----------------------------------------------------------------------
 
@@ -0,0 +1,153 @@
+// Offline texture transcoder: compresses the PNG/JPEG textures of the project into block compressed .ktx files
+// (image.png -> image.png.ktx) with a prebuilt mip chain. At runtime DecodeTextureImage() picks them up instead of the
+// source image whenever the driver supports the format, and falls back to the source image otherwise.
+//
+// usage: texture_transcoder [--bc7] [--force] <image or directory>...
+//   directories are searched recursively for .png/.jpg/.jpeg files
+//   --bc7    use BC7 for color images instead of BC1/BC3 (twice the size of BC1, noticeably better quality)
+//   --force  rewrite .ktx files that are already up to date
+//
+// Format selection per image:
+//   *normal*        BC5, only X and Y are kept - shaders sampling it have to reconstruct Z
+//   one channel     BC4
+//   alpha < 255     BC3 (BC7 with --bc7)
+//   otherwise       BC1 (BC7 with --bc7)
+
+#include <stb_image.h>
+
+#include <learnopengl/ktx.h>
+#include <learnopengl/texture_compression.h>
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+using namespace std;
+
+static bool hasImageExtension(const string &path)
+{
+    string lower = path;
+    transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+    for (const char *extension : { ".png", ".jpg", ".jpeg" })
+    {
+        size_t length = strlen(extension);
+        if (lower.size() > length && lower.compare(lower.size() - length, length, extension) == 0)
+            return true;
+    }
+    return false;
+}
+
+static void collectImages(const string &path, vector<string> &images)
+{
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0)
+    {
+        cout << "ERROR::TRANSCODER:: no such file or directory: " << path << endl;
+        return;
+    }
+    if (!S_ISDIR(st.st_mode))
+    {
+        if (hasImageExtension(path))
+            images.push_back(path);
+        return;
+    }
+    DIR *dir = opendir(path.c_str());
+    if (!dir)
+        return;
+    while (dirent *entry = readdir(dir))
+    {
+        if (entry->d_name[0] == '.')
+            continue;
+        collectImages(path + '/' + entry->d_name, images);
+    }
+    closedir(dir);
+}
+
+static BlockFormat chooseFormat(const string &path, const unsigned char *pixels, int width, int height, int nrComponents, bool bc7)
+{
+    string lower = path;
+    transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+    if (lower.find("normal") != string::npos && nrComponents >= 2)
+        return BlockFormat::BC5;
+    if (nrComponents == 1)
+        return BlockFormat::BC4;
+    bool translucent = false;
+    if (nrComponents == 4)
+        for (size_t i = 0; i < (size_t)width * height && !translucent; i++)
+            translucent = pixels[i * 4 + 3] != 255;
+    if (bc7)
+        return BlockFormat::BC7;
+    return translucent ? BlockFormat::BC3 : BlockFormat::BC1;
+}
+
+int main(int argc, char **argv)
+{
+    bool bc7 = false, force = false;
+    vector<string> images;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--bc7") == 0)
+            bc7 = true;
+        else if (strcmp(argv[i], "--force") == 0)
+            force = true;
+        else
+            collectImages(argv[i], images);
+    }
+    if (images.empty())
+    {
+        cout << "usage: texture_transcoder [--bc7] [--force] <image or directory>..." << endl;
+        return 1;
+    }
+
+    size_t totalSource = 0, totalCompressed = 0;
+    for (const string &image : images)
+    {
+        string ktxPath = image + ".ktx";
+        struct stat source, ktx;
+        if (!force && stat(ktxPath.c_str(), &ktx) == 0 && stat(image.c_str(), &source) == 0 && ktx.st_mtime >= source.st_mtime)
+        {
+            cout << "up to date: " << ktxPath << endl;
+            continue;
+        }
+
+        int width, height, nrComponents;
+        unsigned char *pixels = stbi_load(image.c_str(), &width, &height, &nrComponents, 0);
+        if (!pixels)
+        {
+            cout << "ERROR::TRANSCODER:: failed to load " << image << ": " << stbi_failure_reason() << endl;
+            continue;
+        }
+        auto start = chrono::steady_clock::now();
+        BlockFormat format = chooseFormat(image, pixels, width, height, nrComponents, bc7);
+        KtxTexture texture = CompressImage(pixels, width, height, nrComponents, format);
+        stbi_image_free(pixels);
+        double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+        if (!WriteKtx(ktxPath, texture))
+        {
+            cout << "ERROR::TRANSCODER:: failed to write " << ktxPath << endl;
+            continue;
+        }
+        // compare against what the runtime would upload uncompressed (8 bit per component + mip chain)
+        size_t uncompressed = 0;
+        for (int w = width, h = height;; w = max(1, w / 2), h = max(1, h / 2))
+        {
+            uncompressed += (size_t)w * h * nrComponents;
+            if (w == 1 && h == 1)
+                break;
+        }
+        totalSource += uncompressed;
+        totalCompressed += texture.byteSize();
+        cout << ktxPath << ": " << width << "x" << height << " " << BlockFormatName(format) << ", "
+             << texture.levels.size() << " levels, " << uncompressed / 1024 << " KB -> " << texture.byteSize() / 1024
+             << " KB (" << ms << " ms)" << endl;
+    }
+    if (totalSource)
+        cout << "total: " << totalSource / 1024 << " KB -> " << totalCompressed / 1024 << " KB of VRAM" << endl;
+    return 0;
+}